@@ -0,0 +1,192 @@
+/**
+ * @file w_compact.h
+ * @brief Компактный формат кадра сенсоров: битовые состояния, температура в int16, справочник термометров
+ *
+ * @details
+ * Вместо массивов StructMC_ValueRelay_t / StructMC_ValueIO_t / StructMC_ValueThermo_t в эфир
+ * уходит один кадр фиксированного размера:
+ *
+ *   w_compact_hdr_t | состояния реле | состояния входов | состояния термометров | температуры
+ *
+ *  - состояние - 2 бита на элемент (W_COMPACT_STATE_XXX), 4 элемента в байте;
+ *  - температура - int16 в сотых долях градуса (W_COMPACT_TEMP_NONE - нет значения);
+ *  - термометр в кадре задаётся индексом в справочнике (w_compact_dir_t), а не 64-битным адресом.
+ *
+ * Справочник передаётся отдельным сообщением W_MSG_TYPE_SENSORS_THERMO_DIR только при изменении
+ * состава термометров. Кадр несёт номер версии справочника (dir_epoch); при несовпадении
+ * приёмник запрашивает справочник (W_MSG_TYPE_SENSORS_THERMO_DIR_REQ).
+ *
+ * При W_COMPACT_MAX_ITEMS элементов каждого вида кадр занимает 5 + 8 + 8 + 8 + 64 = 93 байта
+ * и вместе с заголовками снимка помещается в один пакет данных RDT (192 байта полезной нагрузки).
+ *
+ * @author Pavel
+ * @date 2025-02-19
+ */
+
+#ifndef W_COMPACT_H
+#define W_COMPACT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Максимальное количество элементов каждого вида в кадре
+ */
+#define W_COMPACT_MAX_ITEMS     32
+
+/**
+ * @brief Версия формата кадра
+ */
+#define W_COMPACT_VERSION       1
+
+/**
+ * @brief Температура отсутствует (датчик не найден или значение невалидно)
+ */
+#define W_COMPACT_TEMP_NONE     INT16_MIN
+
+/**
+ * @brief Состояние элемента (2 бита)
+ */
+enum {
+    W_COMPACT_STATE_ABSENT  = 0,    ///< Элемент отсутствует
+    W_COMPACT_STATE_INVALID = 1,    ///< Присутствует, значение невалидно
+    W_COMPACT_STATE_OFF     = 2,    ///< Валидно, выключено (для термометра - валидно)
+    W_COMPACT_STATE_ON      = 3,    ///< Валидно, включено
+};
+
+/**
+ * @brief Группа элементов кадра
+ */
+enum {
+    W_COMPACT_RELAY  = 0,
+    W_COMPACT_IO     = 1,
+    W_COMPACT_THERMO = 2,
+    W_COMPACT_GROUPS
+};
+
+/**
+ * @brief Заголовок кадра
+ */
+#pragma pack(push, 1)
+typedef struct
+{
+    uint8_t version;                    ///< W_COMPACT_VERSION
+    uint8_t dir_epoch;                  ///< Версия справочника термометров (0 - справочника нет)
+    uint8_t count[W_COMPACT_GROUPS];    ///< Количество реле, входов, термометров
+    uint8_t data[];
+} w_compact_hdr_t;
+#pragma pack(pop)
+
+/**
+ * @brief Максимальный размер кадра (W_COMPACT_MAX_ITEMS элементов каждого вида)
+ */
+#define W_COMPACT_MAX_SIZE  (sizeof(w_compact_hdr_t) + W_COMPACT_GROUPS * (W_COMPACT_MAX_ITEMS / 4) + \
+                             W_COMPACT_MAX_ITEMS * sizeof(int16_t))
+
+/**
+ * @brief Справочник термометров: индекс в кадре -> onewire-адрес
+ */
+typedef struct
+{
+    uint8_t  epoch;                         ///< Версия (0 - не получен)
+    uint8_t  count;                         ///< Количество слотов
+    uint64_t addr[W_COMPACT_MAX_ITEMS];     ///< Адреса (0 - свободный слот)
+} w_compact_dir_t;
+
+/**
+ * @brief Размер кадра для заданного количества элементов
+ * @return Размер в байтах, 0 - превышено W_COMPACT_MAX_ITEMS
+ */
+size_t w_compact_size(uint8_t relays, uint8_t ios, uint8_t thermos);
+
+/**
+ * @brief Подготовить кадр: заголовок, все элементы отсутствуют
+ * @param[out] frame     Буфер размером w_compact_size()
+ * @param[in]  dir_epoch Версия справочника термометров
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_compact_init(uint8_t *frame, uint8_t dir_epoch, uint8_t relays, uint8_t ios, uint8_t thermos);
+
+/**
+ * @brief Проверить заголовок принятого кадра
+ * @return true, если версия и размер соответствуют
+ */
+bool w_compact_check(const uint8_t *frame, size_t len);
+
+/**
+ * @brief Записать / прочитать 2-битное состояние элемента
+ * @param[in] group W_COMPACT_RELAY, W_COMPACT_IO или W_COMPACT_THERMO
+ * @param[in] idx   Индекс элемента в группе
+ */
+void    w_compact_state_set(uint8_t *frame, uint8_t group, uint8_t idx, uint8_t state);
+uint8_t w_compact_state_get(const uint8_t *frame, uint8_t group, uint8_t idx);
+
+/**
+ * @brief Записать / прочитать температуру термометра с индексом idx
+ */
+void    w_compact_temp_set(uint8_t *frame, uint8_t idx, int16_t temp);
+int16_t w_compact_temp_get(const uint8_t *frame, uint8_t idx);
+
+/**
+ * @brief Квантование температуры: градусы <-> сотые доли градуса
+ */
+int16_t w_compact_temp_encode(float celsius);
+float   w_compact_temp_decode(int16_t temp);
+
+/**
+ * @brief Значимо ли отличие кадров
+ * @param[in] thermo_delta Порог изменения температуры, сотые доли градуса
+ * @return true, если изменилось любое состояние или температура на thermo_delta и более
+ */
+bool w_compact_significant(const uint8_t *old_frame, const uint8_t *new_frame, int16_t thermo_delta);
+
+/**
+ * @brief Обновить справочник по текущему набору адресов
+ *
+ * Известные адреса сохраняют индекс, новые занимают свободные слоты, пропавшие освобождаются.
+ * При любом изменении увеличивается epoch (0 пропускается).
+ *
+ * @param[in,out] dir   Справочник
+ * @param[in]     addrs Адреса (0 - пропускаются)
+ * @param[in]     count Количество адресов
+ * @return true, если справочник изменился и его нужно отправить
+ */
+bool w_compact_dir_update(w_compact_dir_t *dir, const uint64_t *addrs, uint8_t count);
+
+/**
+ * @brief Индекс адреса в справочнике
+ * @return Индекс или -1, если адреса нет
+ */
+int w_compact_dir_index(const w_compact_dir_t *dir, uint64_t addr);
+
+/**
+ * @brief Отправить справочник (W_MSG_TYPE_SENSORS_THERMO_DIR)
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_compact_dir_send(uint8_t channel, const w_compact_dir_t *dir);
+
+/**
+ * @brief Запросить справочник у передатчика (W_MSG_TYPE_SENSORS_THERMO_DIR_REQ)
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_compact_dir_request(uint8_t channel);
+
+/**
+ * @brief Применить принятый справочник
+ * @param[out] dir  Справочник
+ * @param[in]  data Полезная нагрузка после w_header_sensors_t
+ * @param[in]  len  Размер полезной нагрузки
+ * @return 0 - OK, 1 - ошибка формата
+ */
+int w_compact_dir_apply(w_compact_dir_t *dir, const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_COMPACT_H
@@ -0,0 +1,58 @@
+/**
+ * @file w_crc.h
+ * @brief CRC-32 (IEEE 802.3, отражённый, как esp_crc32_le) для кадров и хешей блоков RDT
+ *
+ * @details
+ * На ESP32 вызывает esp_crc32_le (ROM). На хосте (ESP-IDF, target linux) ROM нет, и побайтовая
+ * табличная CRC занимает заметную долю процессора шлюза и симуляции, поэтому ядро выбирается
+ * при первом вызове по возможностям процессора:
+ *  - x86-64 с PCLMULQDQ и SSE4.1: свёртка умножением без переносов по 64 байта;
+ *  - AArch64 с расширением CRC32: инструкции crc32x/crc32b;
+ *  - иначе slice-by-8 (8 таблиц, 8 байт за шаг).
+ * Все ядра дают результат, побитно совпадающий с esp_crc32_le.
+ *
+ * @author Pavel
+ * @date 2025-03-18
+ */
+
+#ifndef W_CRC_H
+#define W_CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief CRC-32 с той же семантикой, что esp_crc32_le
+ *
+ * Начальное значение инвертируется на входе, результат - на выходе:
+ * w_crc32_le(0, buf, len) - стандартная CRC-32 (как zlib crc32), продолжение - w_crc32_le(crc, ...).
+ * @param[in] crc Начальное значение
+ * @param[in] buf Данные
+ * @param[in] len Размер данных
+ * @return CRC-32
+ */
+uint32_t w_crc32_le(uint32_t crc, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Имя выбранного ядра ("esp_rom", "pclmul", "armv8", "slice8")
+ */
+const char *w_crc32_impl(void);
+
+/**
+ * @brief Принудительный выбор ядра по имени (для проверки и замеров, см. examples/wireless_crc_bench.c)
+ *
+ * Вызывать до начала обмена: переключение не синхронизировано с параллельными вызовами w_crc32_le().
+ * @param[in] name Имя ядра, как у w_crc32_impl()
+ * @return 0 - OK, 1 - ядро неизвестно или не поддерживается процессором
+ */
+int w_crc32_set_impl(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_CRC_H
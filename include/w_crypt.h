@@ -0,0 +1,148 @@
+/**
+ * @file w_crypt.h
+ * @brief Шифрование блоков RDT (AES-128-GCM, mbedTLS) с сеансовым ключом пира
+ *
+ * @details
+ * Вместо штатного шифрования ESP-NOW (ограниченное число зашифрованных пиров,
+ * шифрование каждого кадра) блок шифруется целиком одной операцией AEAD:
+ *  - к блоку добавляется хвост w_crypt_trailer_t (nonce + тег), W_CRYPT_OVERHEAD байт на блок,
+ *    а не на кадр; повторы пакетов RDT передают уже зашифрованные данные;
+ *  - AES выполняется аппаратным ускорителем ESP32 через mbedTLS, контекст ключа
+ *    создаётся один раз при смене ключа, а не на каждый блок;
+ *  - ключи выводятся HKDF-SHA256 из общего ключа объекта (PSK) и MAC-адресов
+ *    обоих узлов при привязке и при старте с сохранённым пиром, отдельно для каждого
+ *    направления (MAC отправителя входит в info): свой блок, отражённый обратно, не проходит.
+ *    Пиры ESP-NOW остаются незашифрованными, число пиров драйвером не ограничивается;
+ *  - номер канала входит в проверяемые данные (AAD): блок нельзя подменить блоком другого канала;
+ *  - префикс nonce - номер запуска отправителя, хранится в NVS и растёт с каждым запуском.
+ *    Приёмник хранит в NVS последний принятый номер запуска каждого пира (ключ на MAC, смена
+ *    пира его не сбрасывает): блоки прошлых запусков отбрасываются, внутри запуска повтор
+ *    старого nonce отбрасывается окном в W_CRYPT_REPLAY_WINDOW блоков.
+ *
+ * Восстановление после стирания NVS пира: его номер запуска начинается заново и оказывается
+ * меньше сохранённого у нас, все его блоки отбрасываются как повтор (счётчик replayed растёт).
+ * Повторная привязка (Wireless_Pairing_Begin) вызывает w_crypt_forget_peer(): сохранённый
+ * номер стирается, и первый подлинный блок пира задаёт его заново. Без привязки то же делает
+ * прямой вызов w_crypt_forget_peer() для MAC пира.
+ *
+ * Шифрование включается для канала Rdt_ChannelSetEncrypted() одинаково на обеих сторонах.
+ * Канал W_CHAN_SYSTEM (привязка) остаётся открытым: ключ пира появляется только после привязки.
+ * Возобновление прерванного блока RDT на зашифрованных каналах не срабатывает: повторная
+ * отправка шифруется с новым nonce, и хеш содержимого блока другой - блок передаётся заново.
+ *
+ * @author Pavel
+ * @date 2025-03-07
+ */
+
+#ifndef W_CRYPT_H
+#define W_CRYPT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define W_CRYPT_KEY_LEN         16  ///< AES-128
+#define W_CRYPT_NONCE_LEN       12
+#define W_CRYPT_TAG_LEN         16
+
+/**
+ * @brief Сколько байт добавляет шифрование к блоку
+ */
+#define W_CRYPT_OVERHEAD        (W_CRYPT_NONCE_LEN + W_CRYPT_TAG_LEN)
+
+/**
+ * @brief Окно защиты от повтора, блоков (блоки разных задач могут встать в очередь не по порядку)
+ */
+#define W_CRYPT_REPLAY_WINDOW   32
+
+#pragma pack(push, 1)
+/**
+ * @brief Хвост зашифрованного блока
+ *
+ * nonce: 4 байта номера запуска отправителя (big-endian) + 8 байт счётчика блоков
+ */
+typedef struct
+{
+    uint8_t nonce[W_CRYPT_NONCE_LEN];
+    uint8_t tag[W_CRYPT_TAG_LEN];
+} w_crypt_trailer_t;
+#pragma pack(pop)
+
+/**
+ * @brief Статистика шифрования
+ */
+typedef struct
+{
+    uint32_t sealed;        ///< Зашифровано блоков
+    uint32_t opened;        ///< Расшифровано блоков
+    uint32_t auth_failed;   ///< Отброшено: тег не сошёлся (чужой ключ или искажение)
+    uint32_t replayed;      ///< Отброшено: повтор
+    uint32_t no_key;        ///< Зашифрованный канал без ключа пира
+} w_crypt_stats_t;
+
+/**
+ * @brief Задать общий ключ объекта (PSK), из которого выводятся ключи пиров
+ *
+ * Вызывается до Wireless_Init(), чтобы ключ сохранённого пира был выведен при старте,
+ * и после nvs_flash_init(): здесь увеличивается номер запуска.
+ * @param[in] psk     Ключ (копируется)
+ * @param[in] psk_len Длина ключа, 16..64 байт
+ * @return 0 - OK, 1 - ошибка (в т.ч. NVS недоступно)
+ */
+int w_crypt_init(const uint8_t *psk, size_t psk_len);
+
+/**
+ * @brief Вывести сеансовый ключ для пира (вызывается из Rdt_AddPeer)
+ * @param[in] peer_mac MAC пира; широковещательный адрес сбрасывает ключ
+ * @return 0 - OK, 1 - PSK не задан или ошибка mbedTLS
+ */
+int w_crypt_set_peer(const uint8_t *peer_mac);
+
+/**
+ * @brief Забыть последний принятый номер запуска пира (NVS и окна защиты от повтора)
+ *
+ * Для пира, у которого стёрта NVS: иначе его новые запуски меньше сохранённого номера
+ * и отбрасываются навсегда. До первого подлинного блока пира принимаются и блоки его
+ * прошлых запусков, поэтому вызывается только при подтверждённой привязке.
+ * @param[in] peer_mac MAC пира
+ * @return 0 - OK, 1 - ошибка NVS или неверный MAC
+ */
+int w_crypt_forget_peer(const uint8_t *peer_mac);
+
+/**
+ * @brief Есть ли ключ пира
+ */
+bool w_crypt_ready(void);
+
+/**
+ * @brief Зашифровать блок на месте и дописать w_crypt_trailer_t
+ * @param[in]     channel Канал (AAD)
+ * @param[in,out] buf     Данные; размер буфера - не меньше len + W_CRYPT_OVERHEAD
+ * @param[in]     len     Размер открытых данных
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_crypt_seal(uint8_t channel, uint8_t *buf, size_t len);
+
+/**
+ * @brief Проверить и расшифровать блок на месте
+ * @param[in]     channel Канал (AAD)
+ * @param[in,out] buf     Зашифрованный блок с хвостом
+ * @param[in,out] len     Размер блока на входе, размер открытых данных на выходе
+ * @return 0 - OK, 1 - блок отброшен (тег, повтор, нет ключа)
+ */
+int w_crypt_open(uint8_t channel, uint8_t *buf, size_t *len);
+
+/**
+ * @brief Получить копию статистики
+ */
+void w_crypt_stats_get(w_crypt_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_CRYPT_H
@@ -6,6 +6,8 @@
 #include <stdbool.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "w_hedge.h"
+#include "w_sflight.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +33,7 @@ extern "C" {
  *  - offset: смещение файла (для READ/WRITE). Если == (uint32_t)-1 => "append"
  *  - data_length: кол-во байт данных, следующих за заголовком
  *  - path_length: длина пути (далее идут path_length байт пути)
+ *  - flags: флаги W_FILES_FLAG_XXX (копируются в ответ)
  *
  * Затем идут path_length байт с путём,
  * затем data_length байт с данными (если есть, напр. при WRITE).
@@ -44,7 +47,8 @@ typedef struct
 	uint32_t offset;
 	uint32_t data_length;
 	uint8_t path_length;
-	uint8_t reserved[3]; // на будущее, для выравнивания
+	uint8_t flags;       // W_FILES_FLAG_XXX
+	uint8_t reserved[2]; // на будущее, для выравнивания
 	// Дальше в памяти: path[], data[]
 } w_files_header_t;
 #pragma pack(pop)
@@ -66,6 +70,13 @@ enum {
     W_FILES_CMD_WRITE_RESP  = 6,  ///< Ответ о результате записи
 };
 
+/**
+ * @brief Флаги заголовка
+ */
+enum {
+    W_FILES_FLAG_HEDGE      = 0x01, ///< Запрос - дубликат (хедж); в ответе - ответ пришёл на дубликат
+};
+
 /**
  * @brief Коды возврата (return_code) в ответах
  */
@@ -89,6 +100,9 @@ void w_files_deinit(void);
 
 /**
  * @brief Получение списка файлов (и их размеров) в указанном каталоге (блокирующий вызов).
+ *
+ * Если LIST того же каталога уже выполняется другой задачей, новый запрос не отправляется:
+ * вызывающий получает копию ответа текущего запроса.
  * 
  * @param[in]  directory     Путь к каталогу (null-terminated)
  * @param[out] out_data      Буфер, куда будет записан список (текстом или иной схемой)
@@ -145,6 +159,22 @@ int w_files_write(const char *path,
                   TickType_t wait_ticks,
                   uint8_t *return_code);
 
+/**
+ * @brief Включить/выключить хеджирование идемпотентных запросов (LIST и READ)
+ *
+ * Если ответ не пришёл за адаптивный p95 задержки, отправляется дубликат запроса
+ * с тем же request_id, и принимается первый пришедший ответ.
+ *
+ * @param[in] enable true - включить, false - выключить (по умолчанию выключено)
+ */
+void w_files_hedge_enable(bool enable);
+
+/**
+ * @brief Получить статистику хеджирования (частота дубликатов, перцентили задержки, выигрыш)
+ * @param[out] out Структура для результата
+ */
+void w_files_hedge_stats_get(w_hedge_stats_t *out);
+
 #ifdef __cplusplus
 }
 #endif
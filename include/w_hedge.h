@@ -0,0 +1,182 @@
+/**
+ * @file w_hedge.h
+ * @brief Адаптивная оценка задержки ответов и хеджирование идемпотентных запросов
+ *
+ * @details
+ * Клиент замеряет время «запрос -> ответ» и по скользящему окну оценивает p95.
+ * Если ответ на идемпотентный запрос не пришёл за это время, отправляется дубликат
+ * с тем же request_id - но только после подтверждения доставки самого запроса (ASK):
+ * недоставленный запрос повторяет RDT, а дубликат встал бы в очередь канала за ним.
+ * Сервер запоминает request_id (см. w_dedup_t): дубликат чтения выполняется и отвечается
+ * заново (ответ на первый экземпляр мог потеряться), дубликат записи отбрасывается.
+ * Клиент принимает первый пришедший ответ.
+ *
+ * Запрос, оставшийся без ответа, при повторе с теми же данными в пределах RDT_RESUME_GRACE_MS
+ * получает прежний request_id (w_retry_t). Байты блока совпадают, и недоставленный длинный блок
+ * продолжается с пакетов, уже собранных приёмником (на шифрованном канале нонс у каждой отправки
+ * свой, блок передаётся заново). Сервер узнаёт повтор по w_dedup_t и не выполняет запись второй
+ * раз, а отвечает её прежним кодом.
+ *
+ * @author Pavel
+ * @date 2025-02-10
+ */
+
+#ifndef W_HEDGE_H
+#define W_HEDGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "w_main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Размер окна замеров задержки (количество последних ответов)
+ */
+#define W_HEDGE_WINDOW          32
+
+/**
+ * @brief Минимальное количество замеров, после которого разрешено хеджирование
+ */
+#define W_HEDGE_MIN_SAMPLES     8
+
+/**
+ * @brief Нижняя граница задержки перед отправкой дубликата, мс
+ *        (защита от лавины дубликатов на очень быстром канале)
+ */
+#define W_HEDGE_MIN_DELAY_MS    20
+
+/**
+ * @brief Глубина истории request_id на стороне сервера для подавления дубликатов
+ */
+#define W_DEDUP_DEPTH           8
+
+/**
+ * @brief Статистика хеджирования (для отчёта)
+ *
+ * Задержки запросов с дубликатом и без него считаются по отдельным окнам:
+ * дубликат уходит только после p95, и общее окно прятало бы его эффект.
+ */
+typedef struct
+{
+    uint32_t requests;              ///< Всего завершённых запросов (получен ответ)
+    uint32_t timeouts;              ///< Запросов, завершившихся таймаутом
+    uint32_t hedges_sent;           ///< Сколько раз отправлялся дубликат
+    uint32_t hedge_wins;            ///< Сколько раз первым пришёл ответ на дубликат
+    uint16_t hedge_rate_permille;   ///< Доля запросов с дубликатом, промилле от requests + timeouts
+    uint32_t plain_p50_us;          ///< Медиана задержки запросов без дубликата (окно), мкс
+    uint32_t plain_p95_us;          ///< p95 задержки запросов без дубликата (окно), мкс
+    uint32_t hedged_p50_us;         ///< Медиана задержки запросов с дубликатом до первого ответа (окно), мкс
+    uint32_t hedged_p95_us;         ///< p95 задержки запросов с дубликатом до первого ответа (окно), мкс
+    uint32_t coalesced;             ///< Запросов, обслуженных попутно с идентичным запросом (single-flight)
+} w_hedge_stats_t;
+
+/**
+ * @brief Окно последних замеров задержки
+ */
+typedef struct
+{
+    uint32_t samples[W_HEDGE_WINDOW];           ///< Кольцевой буфер задержек, мкс
+    uint8_t  head;                              ///< Индекс следующей записи
+    uint8_t  count;                             ///< Количество валидных замеров
+} w_hedge_window_t;
+
+/**
+ * @brief Состояние оценщика задержки и хеджирования одного модуля
+ */
+typedef struct
+{
+    bool             enabled;                   ///< Хеджирование включено
+    w_hedge_window_t all;                       ///< Все ответы: по нему выбирается задержка дубликата
+    w_hedge_window_t plain;                     ///< Ответы на запросы без дубликата
+    w_hedge_window_t hedged;                    ///< Ответы на запросы с дубликатом
+    w_hedge_stats_t  stats;                     ///< Накопленная статистика
+} w_hedge_t;
+
+/**
+ * @brief История обработанных request_id (серверная сторона)
+ */
+typedef struct
+{
+    uint16_t ids[W_DEDUP_DEPTH];    ///< Последние обработанные request_id (0 = пусто)
+    uint8_t  head;                  ///< Индекс следующей записи
+    uint32_t peer_gen;              ///< Смена пира, к которой относится история (w_dedup_peer_reset)
+} w_dedup_t;
+
+/**
+ * @brief Последний запрос клиента, оставшийся без ответа
+ */
+typedef struct
+{
+    bool     valid;                 ///< Запись занята
+    uint16_t request_id;            ///< request_id запроса
+    uint32_t hash;                  ///< CRC-32 запроса без request_id
+    size_t   size;                  ///< Размер блока запроса
+    int64_t  failed_us;             ///< Когда истёк срок ожидания ответа
+} w_retry_t;
+
+/**
+ * @brief Задержка перед отправкой дубликата
+ * @param[in] h          Состояние хеджирования
+ * @param[in] wait_ticks Общий таймаут запроса
+ * @return Через сколько тиков слать дубликат; wait_ticks, если хеджирование не нужно
+ */
+TickType_t w_hedge_delay_ticks(const w_hedge_t *h, TickType_t wait_ticks);
+
+/**
+ * @brief Учесть успешно завершённый запрос
+ * @param[in,out] h          Состояние хеджирования
+ * @param[in]     latency_us Задержка от первой отправки до ответа, мкс
+ * @param[in]     hedged     true, если по запросу отправлялся дубликат
+ * @param[in]     hedge_won  true, если ответ пришёл на дубликат
+ */
+void w_hedge_record(w_hedge_t *h, uint32_t latency_us, bool hedged, bool hedge_won);
+
+/**
+ * @brief Получить копию статистики с актуальными перцентилями
+ */
+void w_hedge_stats_get(const w_hedge_t *h, w_hedge_stats_t *out);
+
+/**
+ * @brief request_id для запроса: прежний, если такой же запрос недавно остался без ответа
+ * @param[in,out] r    Запрос без ответа (забирается при совпадении, другие запросы его не сбрасывают)
+ * @param[in]     hash CRC-32 запроса без request_id
+ * @param[in]     size Размер блока запроса
+ * @return Прежний request_id; 0 - нужен новый
+ */
+uint16_t w_retry_take(w_retry_t *r, uint32_t hash, size_t size);
+
+/**
+ * @brief Запомнить запрос, на который не дождались ответа
+ * @param[out] r          Запрос без ответа
+ * @param[in]  request_id request_id запроса
+ * @param[in]  hash       CRC-32 запроса без request_id
+ * @param[in]  size       Размер блока запроса
+ */
+void w_retry_failed(w_retry_t *r, uint16_t request_id, uint32_t hash, size_t size);
+
+/**
+ * @brief Проверить request_id и запомнить его
+ * @param[in,out] d  История request_id
+ * @param[in]     id request_id входящего запроса (0 - без подавления)
+ * @return true, если такой запрос уже обрабатывался (запись - отбросить, чтение - ответить заново)
+ */
+bool w_dedup_check_and_add(w_dedup_t *d, uint16_t id);
+
+/**
+ * @brief Забыть историю request_id всех серверов после смены пира (вызывается из Rdt_SwitchPeer)
+ *
+ * Номера запросов нового пира не связаны с номерами прежнего: совпадение приняло бы
+ * новый запрос за дубликат. История очищается при следующей проверке.
+ */
+void w_dedup_peer_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_HEDGE_H
@@ -0,0 +1,189 @@
+/**
+ * @file w_history.h
+ * @brief История сенсоров: кольцевой буфер отсчётов на шлюзе и догрузка пропуска после переподключения
+ *
+ * @details
+ * Шлюз складывает отсчёты (серия, время, значение) в кольцевой буфер в RAM. Каждый отсчёт
+ * получает сквозной номер seq. Дисплей после переподключения запрашивает пропуск
+ * (W_MSG_TYPE_HISTORY_REQ) начиная с последнего известного seq или с момента времени,
+ * а шлюз отдаёт его пачками по W_HISTORY_BATCH_SAMPLES отсчётов в отдельном канале
+ * W_CHAN_HISTORY: блоки ставятся в очередь RDT подряд, без ожидания периода рассылки,
+ * и не мешают живым кадрам канала сенсоров.
+ *
+ * Отдача выполняется отдельной задачей модуля: Rdt_SendBlock() ждёт места в очереди канала,
+ * и обработчик событий при этом не блокируется. Новый запрос прерывает текущую отдачу.
+ *
+ * Пачки сжимаются кодеком w_tsc.h (W_HISTORY_ENC_TSC); если сжатие не выгодно,
+ * пачка уходит массивом отсчётов (W_HISTORY_ENC_RAW).
+ *
+ * Живые пачки (w_history_push_live) несут новые отсчёты с последней живой пачки тем же
+ * форматом и флагом W_HISTORY_FLAG_LIVE. По seq дисплей видит разрыв и при необходимости
+ * запрашивает догрузку; повторно пришедшие seq он просто пропускает.
+ *
+ * Серии: W_HISTORY_SERIES_THERMO(индекс в справочнике w_compact_dir_t),
+ * W_HISTORY_SERIES_RELAY(n), W_HISTORY_SERIES_IO(n).
+ *
+ * @author Pavel
+ * @date 2025-02-21
+ */
+
+#ifndef W_HISTORY_H
+#define W_HISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Отсчётов в одном блоке догрузки
+ */
+#define W_HISTORY_BATCH_SAMPLES     500
+
+/**
+ * @brief seq не задан (запрос по времени)
+ */
+#define W_HISTORY_SEQ_NONE          0xFFFFFFFFu
+
+/**
+ * @brief Идентификаторы серий
+ */
+#define W_HISTORY_SERIES_THERMO(n)  ((uint8_t)(n))
+#define W_HISTORY_SERIES_RELAY(n)   ((uint8_t)(64 + (n)))
+#define W_HISTORY_SERIES_IO(n)      ((uint8_t)(128 + (n)))
+
+/**
+ * @brief Флаги блока догрузки
+ */
+enum {
+    W_HISTORY_FLAG_LAST = 0x01,     ///< Последний блок ответа на запрос
+    W_HISTORY_FLAG_GAP  = 0x02,     ///< Часть запрошенного диапазона уже вытеснена из буфера
+    W_HISTORY_FLAG_LIVE = 0x04,     ///< Живая пачка новых отсчётов (w_history_push_live), а не ответ на запрос
+};
+
+/**
+ * @brief Кодирование отсчётов в блоке
+ */
+enum {
+    W_HISTORY_ENC_RAW = 0,          ///< Массив w_history_sample_t
+    W_HISTORY_ENC_TSC = 1,          ///< Сжатый поток w_tsc.h
+};
+
+#pragma pack(push, 1)
+/**
+ * @brief Отсчёт
+ */
+typedef struct
+{
+    uint32_t ts;        ///< Время, с (time())
+    uint8_t  series;    ///< Серия W_HISTORY_SERIES_XXX
+    uint8_t  reserved;
+    int16_t  value;     ///< Значение: температура в сотых долях градуса или состояние W_COMPACT_STATE_XXX
+} w_history_sample_t;
+
+/**
+ * @brief Запрос догрузки (после w_header_sensors_t, W_MSG_TYPE_HISTORY_REQ)
+ */
+typedef struct
+{
+    uint32_t from_seq;      ///< Первый нужный seq (W_HISTORY_SEQ_NONE - искать по from_ts)
+    uint32_t from_ts;       ///< Первый нужный момент времени, с
+    uint32_t max_samples;   ///< Ограничение объёма ответа (0 - без ограничения)
+} w_history_req_t;
+
+/**
+ * @brief Заголовок блока догрузки (после w_header_sensors_t, W_MSG_TYPE_HISTORY_BATCH)
+ */
+typedef struct
+{
+    uint32_t first_seq;     ///< seq первого отсчёта блока
+    uint16_t count;         ///< Количество отсчётов
+    uint8_t  flags;         ///< W_HISTORY_FLAG_XXX
+    uint8_t  encoding;      ///< W_HISTORY_ENC_XXX
+    uint8_t  data[];
+} w_history_batch_hdr_t;
+#pragma pack(pop)
+
+/**
+ * @brief Статистика истории
+ */
+typedef struct
+{
+    uint32_t samples;           ///< Записано отсчётов
+    uint32_t overwritten;       ///< Вытеснено из буфера
+    uint32_t requests;          ///< Обработано запросов догрузки
+    uint32_t batches_sent;      ///< Отправлено блоков
+    uint32_t samples_sent;      ///< Отправлено отсчётов
+    uint32_t bytes_sent;        ///< Отправлено байт
+    uint32_t bytes_raw;         ///< Сколько байт заняли бы отсчёты без сжатия
+} w_history_stats_t;
+
+/**
+ * @brief Коллбек приёма блока догрузки на стороне дисплея (из обработчика событий канала)
+ * @param[in] samples   Отсчёты (в сжатой пачке - сгруппированы по сериям)
+ * @param[in] count     Количество
+ * @param[in] first_seq seq первого отсчёта (следующий запрос - с first_seq + count)
+ * @param[in] flags     W_HISTORY_FLAG_XXX
+ */
+typedef void (*w_history_batch_cb_t)(const w_history_sample_t *samples, size_t count,
+                                     uint32_t first_seq, uint8_t flags);
+
+/**
+ * @brief Инициализация шлюза: буфер истории, задача отдачи, приём запросов в W_CHAN_HISTORY
+ * @param[in] capacity Ёмкость буфера, отсчётов
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_history_server_init(uint32_t capacity);
+
+/**
+ * @brief Записать отсчёт с текущим временем
+ */
+void w_history_add(uint8_t series, int16_t value);
+
+/**
+ * @brief Записать отсчёт с заданным временем
+ */
+void w_history_add_ts(uint8_t series, uint32_t ts, int16_t value);
+
+/**
+ * @brief Отправить живую пачку: отсчёты, записанные после предыдущей живой пачки
+ *
+ * Вызывается периодически при наличии связи. После разрыва первая живая пачка
+ * отдаёт весь накопленный пропуск (в пределах буфера).
+ */
+void w_history_push_live(void);
+
+/**
+ * @brief seq следующего записываемого отсчёта (отсчёты с меньшими seq уже в буфере или вытеснены)
+ */
+uint32_t w_history_next_seq(void);
+
+/**
+ * @brief Получить копию статистики
+ */
+void w_history_stats_get(w_history_stats_t *out);
+
+/**
+ * @brief Инициализация дисплея: приём блоков в W_CHAN_HISTORY
+ * @param[in] cb Коллбек приёма блока
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_history_client_init(w_history_batch_cb_t cb);
+
+/**
+ * @brief Запросить пропуск истории
+ * @param[in] from_seq    Первый нужный seq (W_HISTORY_SEQ_NONE - по from_ts)
+ * @param[in] from_ts     Первый нужный момент времени, с
+ * @param[in] max_samples Ограничение объёма (0 - без ограничения)
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_history_request(uint32_t from_seq, uint32_t from_ts, uint32_t max_samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_HISTORY_H
@@ -8,15 +8,76 @@
 extern esp_event_base_t const WIRELESS_EVENT_BASE;
 extern esp_event_loop_handle_t W_event_loop;
 
+/*
+ * Протокол RDT: блок уходит кадрами BEGIN, DATA..., END; приёмник отвечает ASK, когда собрал всё,
+ * или NACK с недостающими кадрами, и отправитель досылает только их.
+ *  - Каждый кадр несёт ID, размер и хеш блока, размер DATA и CRC, поэтому сборка начинается с любого кадра.
+ *  - Прерванный длинный блок приёмник хранит RDT_RESUME_GRACE_MS. Содержимое недоставленного блока
+ *    отправитель повторяет с тем же ID и сначала запрашивает карту принятых кадров (RESUME);
+ *    новый блок отправляется сразу.
+ *  - Каждый кадр несёт случайный номер сеанса (epoch) этого запуска. Новый epoch пира (в первом кадре
+ *    или в HELLO при старте и привязке) сбрасывает сборку и сразу перезапускает передаваемый блок.
+ *  - Что делать с блоком, когда получатель не успевает, задаёт политика канала (rdt_rx_policy_t).
+ */
+
 // ========================= Константы и настройки ==========================
 
 /**
  * @brief Максимальное количество логических каналов
  */
-#define RDT_MAX_CHANNELS        4
+#define RDT_MAX_CHANNELS        6
+
+/**
+ * @brief Корзин гистограмм односторонней задержки: 0 - до 1 мс, k - [2^(k-1), 2^k) мс, последняя - 256 мс и больше
+ */
+#define RDT_OWD_BUCKETS         10
+
+/**
+ * @brief Наибольший размер кадра RDT (ограничение ESP-NOW), байт - под буферы транспорта
+ */
+#define RDT_FRAME_MAX_LEN       250
+
+/**
+ * @brief Сколько приёмник хранит прерванный длинный блок, а отправитель - его ID, мс
+ *
+ * Блок с тем же содержимым, отправленный за это время (например, повтор запроса с тем же
+ * request_id), продолжается с пакетов, которые приёмник уже собрал
+ */
+#define RDT_RESUME_GRACE_MS     30000
+
+/**
+ * @brief Границы настроек RDT (Rdt_TuningSet)
+ */
+#define RDT_TUNE_CHUNK_MIN      32                          ///< Полезная нагрузка кадра DATA, байт
+#define RDT_TUNE_CHUNK_MAX      192                         ///< = размер payload кадра
+#define RDT_TUNE_ACK_MIN_MS     20                          ///< Ожидание ASK, мс
+#define RDT_TUNE_ACK_MAX_MS     2000
+#define RDT_TUNE_RETRY_MIN      1                           ///< Повторов блока
+#define RDT_TUNE_RETRY_MAX      20
+#define RDT_TUNE_QUEUE_MIN      10                          ///< Глубина очереди событий задачи RDT
+#define RDT_TUNE_QUEUE_MAX      100
+#define RDT_TUNE_PRIO_MIN       1                           ///< Приоритет задачи RDT
+#define RDT_TUNE_PRIO_MAX       (configMAX_PRIORITIES - 4)  ///< Ниже задач Wi-Fi (ESP_TASK_PRIO_MAX - 2) и esp_timer (- 3)
 
 // ========================= Структуры данных ==========================
 
+/**
+ * @brief Транспорт кадров RDT (по умолчанию - ESP-NOW)
+ *
+ * Транспорт только доставляет кадры: повторы, сборка блоков и очереди остаются в RDT.
+ * Принятый кадр транспорт передаёт в Rdt_TransportInput(), итог отправки (если известен) -
+ * в Rdt_TransportSendDone(). Транспорт может копить кадры в send(): RDT вызывает flush()
+ * в конце каждого прохода задачи, так что пачка кадров окна уходит без добавочной задержки.
+ */
+typedef struct
+{
+    int  (*send)(void *ctx, const uint8_t *dst_mac, const uint8_t *frame, size_t len);  ///< Отправить кадр: 0 - OK, 1 - ошибка
+    int  (*add_peer)(void *ctx, const uint8_t *mac);                                    ///< Зарегистрировать пира (NULL - не нужно)
+    int  (*del_peer)(void *ctx, const uint8_t *mac);                                    ///< Удалить пира (NULL - не нужно)
+    void (*flush)(void *ctx);                                                           ///< Отправить накопленные кадры (NULL - send отправляет сразу)
+    void  *ctx;                                                                         ///< Контекст
+} rdt_transport_t;
+
 /**
  * @brief Элемент очереди для отправки/приёма целого блока
  */
@@ -27,6 +88,78 @@ typedef struct
     void    *user_ctx;            ///< Пользовательский контекст (необязательное поле)
 } rdt_block_item_t;
 
+/**
+ * @brief Коллбек завершения передачи блока
+ * @param[in] channel   Номер канала
+ * @param[in] user_ctx  Контекст, переданный в Rdt_SendBlock
+ * @param[in] delivered true - получено подтверждение (ASK), false - передача прервана после всех повторов
+ *
+ * Вызывается из задачи RDT под её мьютексом: обработчик должен быть коротким
+ * и не ждать других операций RDT.
+ */
+typedef void (*rdt_tx_done_cb_t)(uint8_t channel, void *user_ctx, bool delivered);
+
+#pragma pack(push, 1)
+/**
+ * @brief Настройки передачи одного канала
+ */
+typedef struct
+{
+    uint8_t  chunk_len;                         ///< Полезная нагрузка кадра DATA, байт (кадр в эфире - заголовок, chunk_len и CRC)
+    uint16_t ack_timeout_ms;                    ///< Ожидание ASK перед повтором блока (и верхняя граница RTO), мс
+    uint8_t  max_retry;                         ///< Повторов блока до отказа
+} rdt_channel_tuning_t;
+
+/**
+ * @brief Настройки RDT, изменяемые без перепрошивки (значение параметра W_MSG_TYPE_PARAM_RDT_TUNING)
+ */
+typedef struct
+{
+    rdt_channel_tuning_t channel[RDT_MAX_CHANNELS];
+    uint8_t  event_queue_len;                   ///< Глубина очереди событий задачи RDT (со следующего старта)
+    uint8_t  task_priority;                     ///< Приоритет задачи RDT
+} rdt_tuning_t;
+#pragma pack(pop)
+
+/**
+ * @brief Политика rx-очереди канала, когда получатель не успевает забирать блоки
+ */
+typedef enum
+{
+    RDT_RX_DROP_NEWEST = 0, ///< Новый блок отбрасывается (по умолчанию)
+    RDT_RX_DROP_OLDEST,     ///< Вытесняется самый старый блок очереди
+    RDT_RX_BACKPRESSURE,    ///< Блок удерживается приёмником без ASK, отправитель ждёт, не расходуя повторы
+    RDT_RX_CONFLATE,        ///< В очереди остаётся только новейший блок каждого ключа; при переполнении - как DROP_OLDEST
+} rdt_rx_policy_t;
+
+/**
+ * @brief Ключ сообщения для RDT_RX_CONFLATE (вызывается из задачи RDT)
+ * @param[in] data Данные блока
+ * @param[in] size Размер блока
+ */
+typedef uint32_t (*rdt_rx_key_fn_t)(const uint8_t *data, size_t size);
+
+/**
+ * @brief Оценки состояния линии для адаптации отправителей
+ */
+typedef struct
+{
+    uint32_t srtt_us;                           ///< Сглаженное время «начало блока -> ASK», мкс (0 - нет замеров)
+    uint32_t rttvar_us;                         ///< Разброс RTT, мкс
+    uint16_t loss_permille;                     ///< Сглаженная доля повторно отправленных пакетов, ‰ (недоставленный блок - 1000)
+    uint8_t  tx_queue_depth[RDT_MAX_CHANNELS];  ///< Блоков в очереди передачи канала, включая передаваемый
+    uint32_t blocks_ok;                         ///< Доставлено блоков
+    uint32_t blocks_failed;                     ///< Недоставлено блоков (исчерпаны повторы)
+    uint32_t resends_suppressed;                ///< Повторов по NACK, пропущенных: пакет уже переотправлен после END, на который ответил NACK
+    uint32_t peer_restarts;                     ///< Обнаружено перезапусков пира (смена номера сеанса)
+    uint32_t rx_overflow[RDT_MAX_CHANNELS];     ///< Принятых блоков канала, отброшенных или вытесненных политикой rx-очереди
+    bool     clock_synced;                      ///< Смещение часов пира известно (Rdt_TimeSyncEnable)
+    int64_t  clock_offset_us;                   ///< Часы пира минус свои часы, мкс
+    uint32_t clock_delay_us;                    ///< Задержка обмена, по которому выбрано смещение, мкс
+    uint32_t owd_tx_hist[RDT_OWD_BUCKETS];      ///< Задержка в сторону пира (по обменам времени)
+    uint32_t owd_rx_hist[RDT_OWD_BUCKETS];      ///< Задержка от пира (по обменам времени и метке отправки каждого кадра)
+} rdt_link_stats_t;
+
 // ========================= Публичные функции ==========================
 
 /**
@@ -35,6 +168,47 @@ typedef struct
  */
 int Wireless_Init(void);
 
+/**
+ * @brief Заменить транспорт кадров (вызывается до Wireless_Init)
+ *
+ * С внешним транспортом Wireless_Init не поднимает Wi-Fi и ESP-NOW.
+ * @param[in] transport Транспорт, хранится по указателю (NULL - ESP-NOW)
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_SetTransport(const rdt_transport_t *transport);
+
+/**
+ * @brief Передать в RDT принятый транспортом кадр (из задачи или коллбека транспорта в задаче,
+ *        например коллбека приёма ESP-NOW; из прерывания - Rdt_TransportInputFromISR)
+ * @param[in] src_mac MAC отправителя (кадры не от текущего пира отбрасываются)
+ * @param[in] frame   Кадр
+ * @param[in] len     Размер кадра
+ * @param[in] rssi_dbm Уровень сигнала, дБм (0 - неизвестен)
+ */
+void Rdt_TransportInput(const uint8_t *src_mac, const uint8_t *frame, size_t len, int rssi_dbm);
+
+/**
+ * @brief То же, что Rdt_TransportInput, из обработчика прерывания
+ */
+void Rdt_TransportInputFromISR(const uint8_t *src_mac, const uint8_t *frame, size_t len, int rssi_dbm);
+
+/**
+ * @brief Сколько кадров ещё поместится в очередь событий RDT (для приёма пачками)
+ * @return Свободное место; 0 - RDT не запущен или очередь заполнена
+ */
+size_t Rdt_TransportRxSpace(void);
+
+/**
+ * @brief Сообщить итог отправки кадра (если транспорт его знает; из задачи или коллбека в задаче)
+ * @param[in] ok true - кадр доставлен
+ */
+void Rdt_TransportSendDone(bool ok);
+
+/**
+ * @brief То же, что Rdt_TransportSendDone, из обработчика прерывания
+ */
+void Rdt_TransportSendDoneFromISR(bool ok);
+
 /**
  * @brief Регистрация/создание очередей для одного логического канала
  * @param[in] channel Номер канала (0..RDT_MAX_CHANNELS-1)
@@ -55,6 +229,67 @@ int Rdt_ChannelInit(uint8_t channel, uint8_t rx_queue_len, uint8_t tx_queue_len,
  */
 int Rdt_SendBlock(uint8_t channel, const uint8_t *data_ptr, size_t size, void *user_ctx);
 
+/**
+ * @brief Установить коллбек завершения передачи блоков канала
+ * @param[in] channel Номер канала
+ * @param[in] cb      Коллбек (NULL - отключить)
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_ChannelSetTxDoneCallback(uint8_t channel, rdt_tx_done_cb_t cb);
+
+/**
+ * @brief Включить/выключить шифрование блоков канала (w_crypt.h), одинаково на обеих сторонах
+ *
+ * Прерванный блок зашифрованного канала не возобновляется (новый nonce - другой хеш блока).
+ * @param[in] channel Номер канала
+ * @param[in] enable  true - блоки шифруются AES-GCM ключом пира
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_ChannelSetEncrypted(uint8_t channel, bool enable);
+
+/**
+ * @brief Включить обмен времени с пиром и измерение односторонних задержек
+ *
+ * Раз в period_ms отправляется запрос времени (служебный кадр в канале W_CHAN_SYSTEM), пир
+ * отвечает всегда. Смещение часов пира оценивается по четырём меткам обмена (как в NTP),
+ * задержки в обе стороны копятся в гистограммах rdt_link_stats_t; задержка от пира
+ * дополнительно считается по метке отправки каждого принятого кадра.
+ * @param[in] period_ms Период обмена, мс (0 - выключить)
+ */
+void Rdt_TimeSyncEnable(uint32_t period_ms);
+
+/**
+ * @brief Установить политику переполнения rx-очереди канала
+ *
+ * Ключ RDT_RX_CONFLATE вычисляется по открытым данным: для зашифрованного канала
+ * политика работает как RDT_RX_DROP_OLDEST.
+ * @param[in] channel Номер канала
+ * @param[in] policy  Политика
+ * @param[in] key_fn  Ключ сообщения для RDT_RX_CONFLATE (NULL - первый байт блока, тип сообщения)
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_ChannelSetRxPolicy(uint8_t channel, rdt_rx_policy_t policy, rdt_rx_key_fn_t key_fn);
+
+/**
+ * @brief Умеренность уведомлений получателя канала (для потоковых каналов из множества блоков)
+ *
+ * По умолчанию получатель уведомляется (событие канала в W_event_loop) о каждом блоке.
+ * С умеренностью одно событие приходит на max_blocks блоков, но не позже max_delay_us
+ * после первого из них и сразу при заполнении rx-очереди; обработчик такого канала
+ * забирает все блоки очереди (Rdt_ReceiveBlock в цикле до false).
+ * @param[in] channel      Номер канала
+ * @param[in] max_blocks   Уведомлять раз на столько блоков (0, 1 - на каждый блок)
+ * @param[in] max_delay_us Наибольшая задержка уведомления, мкс (точность - тик FreeRTOS)
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_ChannelSetNotify(uint8_t channel, uint8_t max_blocks, uint32_t max_delay_us);
+
+/**
+ * @brief Получить оценки состояния линии (RTT, потери, глубина очередей)
+ * @param[out] out Оценки
+ */
+void Rdt_LinkStatsGet(rdt_link_stats_t *out);
+
 /**
  * @brief Получить готовый принятый блок из rx-очереди (если есть)
  * @param[in]  channel Номер канала
@@ -65,17 +300,90 @@ int Rdt_SendBlock(uint8_t channel, const uint8_t *data_ptr, size_t size, void *u
 bool Rdt_ReceiveBlock(uint8_t channel, rdt_block_item_t *block_item, TickType_t wait_ticks);
 
 /**
- * @brief Освободить принятый блок, если библиотека выделяла память
- * @param[in] block_item Блок, полученный через Rdt_ReceiveBlock
+ * @brief Освободить принятый блок (снять одну ссылку; память освобождается последней)
+ *
+ * Данные принятого блока освобождаются только этой функцией, не free().
+ * @param[in] block_item Блок, полученный через Rdt_ReceiveBlock, или его копия после Rdt_RetainBlock
  */
 void Rdt_FreeReceivedBlock(rdt_block_item_t *block_item);
 
+/**
+ * @brief Добавить владельца принятого блока
+ *
+ * Один собранный буфер раздаётся нескольким получателям без копирования: каждый получатель
+ * хранит свою копию rdt_block_item_t (только структура) и освобождает её Rdt_FreeReceivedBlock.
+ * Данные общие и не должны изменяться.
+ * @param[in] block_item Блок, полученный через Rdt_ReceiveBlock
+ */
+void Rdt_RetainBlock(const rdt_block_item_t *block_item);
+
 /**
  * @brief Зарегистрировать peer по MAC (если не использовать широковещание)
  * @param[in] peer_mac Указатель на MAC (6 байт)
  */
 void Rdt_AddPeer(const uint8_t *peer_mac);
 
+/**
+ * @brief Текущий peer
+ * @param[out] peer_mac Буфер под MAC (6 байт)
+ */
+void Rdt_GetPeer(uint8_t *peer_mac);
+
+/**
+ * @brief Сменить пира с отдельным сеансом (из задачи, не из коллбеков RDT)
+ *
+ * Rdt_AddPeer только перенацеливает кадры: состояние каналов прежнего пира (недособранные
+ * и прерванные блоки, ID последнего собранного блока, блоки в очередях передачи) досталось бы
+ * новому. Здесь:
+ *  - ждёт до timeout_ms, пока очереди передачи опустеют и текущие блоки будут подтверждены;
+ *    оставшиеся блоки завершаются коллбеком с delivered = false;
+ *  - сбрасывает приём и передачу всех каналов, обмен времени, снимки (w_snapshot_peer_reset)
+ *    и историю request_id серверов (w_dedup_peer_reset);
+ *  - начинает новый сеанс RDT (новый epoch): пир сбросит своё состояние прошлой связи с нами;
+ *  - удаляет прежнего пира из транспорта (del_peer; у ESP-NOW число пиров ограничено)
+ *    и регистрирует нового (Rdt_AddPeer, ключи w_crypt).
+ * @param[in] peer_mac   MAC нового пира
+ * @param[in] timeout_ms Сколько ждать завершения передачи прежнему пиру, мс
+ * @return 0 - OK, 1 - передача не завершилась за timeout_ms (пир всё равно сменён), 2 - ошибка
+ */
+int Rdt_SwitchPeer(const uint8_t *peer_mac, uint32_t timeout_ms);
+
+/**
+ * @brief Получить текущие настройки RDT
+ *
+ * До Wireless_Init - заданные Rdt_TuningSet или значения по умолчанию (NVS не читается)
+ * @param[out] out Настройки
+ */
+void Rdt_TuningGet(rdt_tuning_t *out);
+
+/**
+ * @brief Изменить настройки RDT
+ *
+ * Значения проверяются целиком: при любом выходе за границы RDT_TUNE_XXX ничего не меняется.
+ * Настройки канала применяются со следующего блока (передаваемый блок заканчивается со старыми),
+ * приоритет задачи - сразу, глубина очереди событий - со следующего старта.
+ * Размер кадра передаётся в каждом кадре блока, приёмнику настраивать его не нужно.
+ * @param[in] tuning Настройки
+ * @return 0 - OK, 1 - значение вне границ
+ */
+int Rdt_TuningSet(const rdt_tuning_t *tuning);
+
+/**
+ * @brief Сохранить текущие настройки в NVS (загружаются в Wireless_Init)
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_TuningSave(void);
+
+/**
+ * @brief Чтение настроек для дескриптора w_param (W_PARAM_DESCRIPTOR(RDT_TUNING, ...))
+ */
+int Rdt_TuningParamRead(uint8_t *out_data, size_t *out_size);
+
+/**
+ * @brief Запись настроек через w_param: Rdt_TuningSet и сохранение в NVS
+ */
+int Rdt_TuningParamWrite(const uint8_t *in_data, size_t in_size);
+
 void Wireless_Channel_Clear_Queue(int channel);
 
 /**
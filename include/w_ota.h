@@ -0,0 +1,208 @@
+/**
+ * @file w_ota.h
+ * @brief Обновление прошивки по линии RDT (канал W_CHAN_OTA, поверх w_rpc)
+ *
+ * @details
+ * Отправитель (шлюз) читает образ частями через w_ota_source_t и передаёт их вызовами RPC;
+ * приёмник (дисплей) пишет каждую часть сразу в неактивный раздел OTA, образ целиком в RAM
+ * не хранится ни на одной стороне.
+ *  - BEGIN: размер и SHA-256 образа. Если у приёмника есть незавершённая загрузка того же
+ *    образа (в RAM или сохранённая w_ota_flash_ops_t::progress_save после перезагрузки),
+ *    он отвечает подтверждённым смещением, и передача продолжается с него;
+ *  - WRITE: смещение + данные. Часть пишется только по подтверждённому смещению; повтор уже
+ *    записанной части (потерян ответ) подтверждается без записи;
+ *  - FINISH: приёмник читает записанный образ из раздела, сверяет SHA-256 и только
+ *    при совпадении делает раздел загрузочным (activate). Новая прошивка запускается
+ *    при следующей перезагрузке; когда перезагружаться, решает приложение.
+ *
+ * Раздел скрыт за w_ota_flash_ops_t: на ESP32 - w_ota_flash_esp_ops (esp_partition + NVS),
+ * для проверки на хосте - файл (w_ota_flash_file_init).
+ *
+ * Рассылка нескольким узлам (w_ota_push_nodes) выполняется по очереди: RDT работает с одним
+ * пиром, узел выбирается Rdt_SwitchPeer - с новым сеансом RDT, сбросом состояния каналов
+ * и удалением прежнего пира ESP-NOW (таблица пиров драйвера не переполняется на длинном
+ * списке узлов). После рассылки тем же способом восстанавливается прежний пир.
+ *
+ * @author Pavel
+ * @date 2025-03-12
+ */
+
+#ifndef W_OTA_H
+#define W_OTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Размер части образа в одном вызове WRITE, байт
+ */
+#define W_OTA_CHUNK             2048
+
+/**
+ * @brief Сохранять прогресс приёмника не реже, чем раз в столько байт (износ NVS)
+ */
+#define W_OTA_SAVE_EVERY        (32 * 1024)
+
+/**
+ * @brief Повторов одного вызова при истечении срока
+ */
+#define W_OTA_RETRIES           5
+
+#define W_OTA_HASH_LEN          32  ///< SHA-256
+
+/**
+ * @brief Методы RPC канала W_CHAN_OTA
+ */
+enum {
+    W_OTA_M_BEGIN  = 1,
+    W_OTA_M_WRITE  = 2,
+    W_OTA_M_FINISH = 3,
+};
+
+/**
+ * @brief Коды завершения методов (коды обработчика w_rpc, < 0xF0)
+ */
+enum {
+    W_OTA_OK         = 0,
+    W_OTA_ERR_STATE  = 1,   ///< Нет загрузки (WRITE/FINISH без BEGIN)
+    W_OTA_ERR_OFFSET = 2,   ///< Смещение не совпало с подтверждённым (в ответе - подтверждённое)
+    W_OTA_ERR_FLASH  = 3,   ///< Ошибка раздела (в том числе образ не помещается)
+    W_OTA_ERR_HASH   = 4,   ///< SHA-256 записанного образа не совпал, загрузка сброшена
+    W_OTA_ERR_NO_RX  = 5,   ///< Узел не принимает обновления (w_ota_init без flash)
+};
+
+/**
+ * @brief Прогресс загрузки приёмника
+ */
+typedef struct
+{
+    uint32_t image_size;                ///< Размер образа
+    uint8_t  sha256[W_OTA_HASH_LEN];    ///< SHA-256 образа
+    uint32_t offset;                    ///< Подтверждённое смещение (записано всё до него)
+} w_ota_progress_t;
+
+#pragma pack(push, 1)
+/**
+ * @brief Аргументы BEGIN
+ */
+typedef struct
+{
+    uint32_t image_size;
+    uint8_t  sha256[W_OTA_HASH_LEN];
+} w_ota_begin_req_t;
+
+/**
+ * @brief Аргументы WRITE
+ */
+typedef struct
+{
+    uint32_t offset;
+    uint8_t  data[];
+} w_ota_write_req_t;
+
+/**
+ * @brief Ответ BEGIN и WRITE
+ */
+typedef struct
+{
+    uint32_t offset;                    ///< Подтверждённое смещение
+} w_ota_resp_t;
+#pragma pack(pop)
+
+/**
+ * @brief Доступ к неактивному разделу прошивки (вызывается из задачи w_rpc)
+ *
+ * Функции возвращают 0 - OK, 1 - ошибка.
+ */
+typedef struct
+{
+    int  (*begin)(void *ctx, size_t image_size);                                ///< Подготовить (стереть) раздел под образ
+    int  (*write)(void *ctx, size_t offset, const uint8_t *data, size_t len);   ///< Записать часть
+    int  (*read)(void *ctx, size_t offset, uint8_t *data, size_t len);          ///< Прочитать записанное
+    int  (*activate)(void *ctx, size_t image_size);                             ///< Сделать раздел загрузочным
+    int  (*progress_save)(void *ctx, const w_ota_progress_t *p);                ///< Сохранить прогресс (NULL - не сохраняется)
+    int  (*progress_load)(void *ctx, w_ota_progress_t *p);                      ///< Прочитать прогресс (NULL - нет)
+    void  *ctx;                                                                 ///< Контекст
+} w_ota_flash_ops_t;
+
+/**
+ * @brief Источник образа отправителя
+ */
+typedef struct
+{
+    int  (*read)(void *ctx, size_t offset, uint8_t *data, size_t len);          ///< Прочитать часть образа: 0 - OK, 1 - ошибка
+    void  *ctx;
+} w_ota_source_t;
+
+/**
+ * @brief Коллбек хода передачи (из задачи, вызвавшей w_ota_push)
+ * @param[in] offset     Подтверждённое приёмником смещение
+ * @param[in] image_size Размер образа
+ * @param[in] ctx        Контекст
+ */
+typedef void (*w_ota_progress_cb_t)(uint32_t offset, uint32_t image_size, void *ctx);
+
+/**
+ * @brief Файл вместо раздела (проверка на хосте)
+ */
+typedef struct
+{
+    char path[128];                     ///< Файл образа; прогресс - в "<path>.progress"
+    bool activated;                     ///< activate() вызван
+} w_ota_flash_file_t;
+
+/**
+ * @brief Инициализация: RPC канала W_CHAN_OTA
+ * @param[in] flash Раздел приёмника (NULL - узел только отправляет обновления); хранится по указателю
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_ota_init(const w_ota_flash_ops_t *flash);
+
+/**
+ * @brief Передать образ текущему пиру (блокирующий вызов, из задачи)
+ * @param[in] src        Источник образа
+ * @param[in] image_size Размер образа
+ * @param[in] sha256     SHA-256 образа (NULL - вычислить, прочитав источник)
+ * @param[in] cb         Коллбек хода передачи (может быть NULL)
+ * @param[in] ctx        Контекст коллбека
+ * @return W_OTA_OK, код W_OTA_ERR_XXX приёмника или код w_rpc (W_RPC_ERR_XXX)
+ */
+int w_ota_push(const w_ota_source_t *src, uint32_t image_size, const uint8_t *sha256,
+               w_ota_progress_cb_t cb, void *ctx);
+
+/**
+ * @brief Передать образ нескольким узлам по очереди
+ * @param[in]  macs    MAC узлов
+ * @param[in]  count   Количество узлов
+ * @param[out] results Результат w_ota_push по каждому узлу (может быть NULL)
+ * @return Количество узлов, принявших образ
+ */
+size_t w_ota_push_nodes(const uint8_t (*macs)[6], size_t count,
+                        const w_ota_source_t *src, uint32_t image_size, const uint8_t *sha256,
+                        w_ota_progress_cb_t cb, void *ctx, int *results);
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+/**
+ * @brief Раздел OTA на ESP32: следующий раздел обновления, прогресс - в NVS
+ */
+extern const w_ota_flash_ops_t w_ota_flash_esp_ops;
+#endif
+
+/**
+ * @brief Заполнить ops для файла вместо раздела
+ * @param[out] f    Состояние (хранится вызывающим)
+ * @param[in]  path Путь к файлу образа
+ * @param[out] ops  Операции
+ */
+void w_ota_flash_file_init(w_ota_flash_file_t *f, const char *path, w_ota_flash_ops_t *ops);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_OTA_H
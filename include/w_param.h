@@ -5,12 +5,14 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "freertos/FreeRTOS.h"
+#include "w_hedge.h"
+#include "w_sflight.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define MAX_PARAM_LENGTH (1024*8) ///< Максимальная длина параметра
+#define MAX_PARAM_LENGTH (1024*8) ///< Максимальная длина параметра (если в дескрипторе не задан max_size)
 
 /**
  * @brief Типы операций с параметрами и ответов
@@ -28,18 +30,29 @@ enum {
  *  - message_type: тип параметра (например, W_MSG_TYPE_PARAM_XXX)
  *  - set_or_get: тип операции (W_PARAM_GET, W_PARAM_SET или W_PARAM_RESP)
  *  - return_code: код возврата (0 = успех, !=0 = ошибка)
+ *  - request_id: ID запроса, копируется в ответ; по нему сервер отбрасывает дубликаты
+ *  - flags: флаги W_PARAM_FLAG_XXX, копируются в ответ
  *  - data: полезная нагрузка (данные параметра)
  */
 #pragma pack(push, 1)
 typedef struct
 {
-    uint8_t message_type;  ///< Тип параметра
-    uint8_t set_or_get;    ///< Тип операции (GET, SET или RESP)
-    uint8_t return_code;   ///< Код возврата
-    uint8_t data[0];       ///< Полезная нагрузка (данные)
+    uint8_t  message_type;  ///< Тип параметра
+    uint8_t  set_or_get;    ///< Тип операции (GET, SET или RESP)
+    uint8_t  return_code;   ///< Код возврата
+    uint16_t request_id;    ///< ID запроса (0 = без подавления дубликатов)
+    uint8_t  flags;         ///< Флаги W_PARAM_FLAG_XXX
+    uint8_t  data[0];       ///< Полезная нагрузка (данные)
 } w_header_param_t;
 #pragma pack(pop)
 
+/**
+ * @brief Флаги заголовка параметров
+ */
+enum {
+    W_PARAM_FLAG_HEDGE = 0x01  ///< Запрос является дубликатом (хеджем); в ответе - ответ пришёл на дубликат
+};
+
 /**
  * @brief Тип функции чтения параметра
  * @param[out] out_data  Буфер для записи значения параметра
@@ -63,12 +76,15 @@ typedef int (*w_param_write_fn)(const uint8_t *in_data, size_t in_size);
  * @details
  *  - message_type: соответствует W_MSG_TYPE_PARAM_XXX.
  *  - read_fn и write_fn: функции чтения и записи (могут быть NULL, если операция не поддерживается).
+ *  - max_size: подсказка размера ответа GET; буфер ответа выделяется ровно такого размера
+ *    (0 - MAX_PARAM_LENGTH). Удобно заполнять через W_PARAM_DESCRIPTOR() из w_param_registry.h.
  */
 typedef struct
 {
     uint8_t             message_type; ///< Тип параметра (например, W_MSG_TYPE_PARAM_TIME)
     w_param_read_fn     read_fn;      ///< Функция чтения параметра (NULL, если не поддерживается)
     w_param_write_fn    write_fn;     ///< Функция записи параметра (NULL, если не поддерживается)
+    size_t              max_size;     ///< Максимальный размер значения (0 - MAX_PARAM_LENGTH)
 } w_param_descriptor_t;
 
 /**
@@ -77,6 +93,7 @@ typedef struct
  * @param[in] table_count  Количество элементов в таблице
  *
  * Эта функция должна быть вызвана перед началом работы модуля.
+ * По таблице строится индекс по message_type, поиск дескриптора при обработке запроса - O(1).
  */
 void w_param_init(const w_param_descriptor_t *table, size_t table_count);
 
@@ -96,6 +113,10 @@ void w_param_start(void);
 
 /**
  * @brief Блокирующий запрос GET или SET с ожиданием ответа
+ *
+ * Если такой же GET (тот же message_type) уже выполняется другой задачей,
+ * новый запрос не отправляется: вызывающий получает копию ответа текущего запроса.
+ *
  * @param[in]  message_type  Тип параметра (W_MSG_TYPE_PARAM_XXX)
  * @param[in]  set_or_get    W_PARAM_GET или W_PARAM_SET
  * @param[in]  value         Данные для SET (NULL для GET)
@@ -162,6 +183,22 @@ int w_param_set(uint8_t message_type,
                 size_t value_len,
                 uint8_t *return_code);
 
+/**
+ * @brief Включить/выключить хеджирование GET-запросов
+ *
+ * Если ответ не пришёл за адаптивный p95 задержки, отправляется дубликат запроса
+ * с тем же request_id, и принимается первый пришедший ответ. SET не хеджируется.
+ *
+ * @param[in] enable true - включить, false - выключить (по умолчанию выключено)
+ */
+void w_param_hedge_enable(bool enable);
+
+/**
+ * @brief Получить статистику хеджирования (частота дубликатов, перцентили задержки, выигрыш)
+ * @param[out] out Структура для результата
+ */
+void w_param_hedge_stats_get(w_hedge_stats_t *out);
+
 #ifdef __cplusplus
 }
 #endif
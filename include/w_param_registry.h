@@ -0,0 +1,84 @@
+/**
+ * @file w_param_registry.h
+ * @brief Генерация размеров, дескрипторов и типизированных обёрток клиента из реестра W_PARAM_LIST
+ *
+ * @details
+ * Реестр параметров описывается один раз в w_user.h (W_PARAM_LIST). Из него получаются:
+ *  - W_MSG_TYPE_PARAM_<имя>     - тип сообщения (w_user.h);
+ *  - W_PARAM_SIZE_<имя>         - размер значения (подсказка размера ответа);
+ *  - W_PARAM_DESCRIPTOR()       - инициализатор дескриптора для таблицы сервера;
+ *  - w_param_get_<имя>(), w_param_set_<имя>() - типизированные обёртки клиента,
+ *    размер буфера проверяется при компиляции по типу указателя.
+ *
+ * Заголовок подключается в проектной части ПОСЛЕ заголовков с типами, указанными в реестре
+ * (например, AT32_structs_MC.h).
+ *
+ * @author Pavel
+ * @date 2025-02-14
+ */
+
+#ifndef W_PARAM_REGISTRY_H
+#define W_PARAM_REGISTRY_H
+
+#include "w_param.h"
+#include "w_user.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Размеры значений параметров: W_PARAM_SIZE_<имя>
+ */
+#define W_PARAM_SIZE_ITEM(name, id, type) W_PARAM_SIZE_##name = sizeof(type),
+enum
+{
+    W_PARAM_LIST(W_PARAM_SIZE_ITEM)
+};
+#undef W_PARAM_SIZE_ITEM
+
+/**
+ * @brief Инициализатор дескриптора параметра с подсказкой размера из реестра
+ * @param name  Имя параметра из W_PARAM_LIST
+ * @param read  Функция чтения (или NULL)
+ * @param write Функция записи (или NULL)
+ */
+#define W_PARAM_DESCRIPTOR(name, read, write)       \
+    {                                               \
+        .message_type = W_MSG_TYPE_PARAM_##name,    \
+        .read_fn      = (read),                     \
+        .write_fn     = (write),                    \
+        .max_size     = W_PARAM_SIZE_##name,        \
+    }
+
+/**
+ * @brief Типизированные обёртки клиента
+ *
+ *  - w_param_get_<имя>(тип *out, size_t *out_size, uint8_t *return_code)
+ *  - w_param_set_<имя>(const тип *value, uint8_t *return_code)
+ */
+#define W_PARAM_STUB_ITEM(name, id, type)                                                   \
+    static inline int w_param_get_##name(__typeof__(type) *out,                             \
+                                         size_t *out_size,                                  \
+                                         uint8_t *return_code)                              \
+    {                                                                                       \
+        size_t size = sizeof(*out);                                                         \
+        int ret = w_param_get(W_MSG_TYPE_PARAM_##name, (uint8_t *)out, &size, return_code); \
+        if (out_size) *out_size = size;                                                     \
+        return ret;                                                                         \
+    }                                                                                       \
+    static inline int w_param_set_##name(const __typeof__(type) *value,                     \
+                                         uint8_t *return_code)                              \
+    {                                                                                       \
+        return w_param_set(W_MSG_TYPE_PARAM_##name, (const uint8_t *)value,                 \
+                           sizeof(*value), return_code);                                    \
+    }
+
+W_PARAM_LIST(W_PARAM_STUB_ITEM)
+#undef W_PARAM_STUB_ITEM
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_PARAM_REGISTRY_H
@@ -0,0 +1,141 @@
+/**
+ * @file w_pubsub.h
+ * @brief Публикация/подписка по числовым темам поверх канала RDT
+ *
+ * @details
+ * Тема - первый байт сообщения канала (message_type из w_header_sensors_t), поэтому
+ * существующие сообщения сенсоров (W_MSG_TYPE_SENSORS_XXX) являются темами без изменения формата.
+ *
+ *  - Модуль единолично принимает блоки канала и раздаёт их подписчикам темы прямым
+ *    обращением к таблице s_topics[тема]; подписчик получает указатель в принятый блок,
+ *    без копирования и выделения памяти. Подписчик, которому данные нужны после коллбека
+ *    (очередь логгера и т.п.), берёт ссылку на тот же блок w_pubsub_retain().
+ *  - Подписка локальная (w_pubsub_subscribe) и одновременно удалённая: набор тем с локальными
+ *    подписчиками отправляется пиру служебным сообщением W_PUBSUB_TOPIC_CONTROL.
+ *  - w_pubsub_publish() отдаёт сообщение локальным подписчикам и отправляет в эфир
+ *    только если пир подписан на тему. Пока от пира не пришло ни одного набора тем
+ *    (например, старая прошивка), считается, что он подписан на всё.
+ *
+ * Подписаться и отписаться можно в любой момент, в том числе из коллбека подписчика: раздача
+ * идёт под мьютексом модуля по копии списка подписчиков темы. После возврата
+ * w_pubsub_unsubscribe() из другой задачи отписанный коллбек больше не вызывается.
+ * Коллбек не должен долго блокироваться: на это время ждут (от)писка и публикации других задач.
+ *
+ * @author Pavel
+ * @date 2025-03-03
+ */
+
+#ifndef W_PUBSUB_H
+#define W_PUBSUB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "w_main.h" // rdt_block_item_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Количество тем (0..W_PUBSUB_MAX_TOPICS-1)
+ */
+#define W_PUBSUB_MAX_TOPICS     64
+
+/**
+ * @brief Максимум локальных подписчиков одной темы
+ */
+#define W_PUBSUB_MAX_SUBS       4
+
+/**
+ * @brief Служебная тема: обмен наборами подписок
+ */
+#define W_PUBSUB_TOPIC_CONTROL  (W_PUBSUB_MAX_TOPICS - 1)
+
+/**
+ * @brief Операции служебной темы
+ */
+enum {
+    W_PUBSUB_OP_SET   = 1,  ///< Полный набор тем отправителя (битовая маска W_PUBSUB_MAX_TOPICS бит)
+    W_PUBSUB_OP_QUERY = 2,  ///< Просьба прислать свой набор тем
+};
+
+/**
+ * @brief Коллбек подписчика (из обработчика событий канала)
+ * @param[in] topic Тема
+ * @param[in] data  Данные после байта темы (действительны только на время вызова)
+ * @param[in] len   Размер данных
+ * @param[in] ctx   Контекст подписчика
+ */
+typedef void (*w_pubsub_cb_t)(uint8_t topic, const uint8_t *data, size_t len, void *ctx);
+
+/**
+ * @brief Статистика темы
+ */
+typedef struct
+{
+    uint32_t published;     ///< Вызовов w_pubsub_publish
+    uint32_t sent;          ///< Отправлено в эфир
+    uint32_t suppressed;    ///< Не отправлено: пир не подписан
+    uint32_t received;      ///< Принято из эфира
+} w_pubsub_topic_stats_t;
+
+/**
+ * @brief Инициализация: модуль становится единственным получателем блоков канала
+ * @param[in] channel Канал RDT
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_pubsub_init(uint8_t channel);
+
+/**
+ * @brief Подписаться на тему (локально и у пира)
+ * @return 0 - OK, 1 - ошибка (тема вне диапазона, нет места)
+ */
+int w_pubsub_subscribe(uint8_t topic, w_pubsub_cb_t cb, void *ctx);
+
+/**
+ * @brief Отписаться от темы
+ * @return 0 - OK, 1 - подписчик не найден
+ */
+int w_pubsub_unsubscribe(uint8_t topic, w_pubsub_cb_t cb, void *ctx);
+
+/**
+ * @brief Опубликовать сообщение: локальным подписчикам и пиру, если он подписан
+ * @param[in] topic Тема
+ * @param[in] data  Данные (копируются)
+ * @param[in] len   Размер данных
+ * @return 0 - OK (в том числе если отправка не требовалась), 1 - ошибка отправки
+ */
+int w_pubsub_publish(uint8_t topic, const uint8_t *data, size_t len);
+
+/**
+ * @brief Взять ссылку на принятый блок, который сейчас раздаётся подписчикам
+ *
+ * Вызывается только из коллбека подписчика. Блок общий для всех получателей и не изменяется;
+ * data_ptr[0] - байт темы. Освобождается получателем через Rdt_FreeReceivedBlock().
+ * @param[out] out Ссылка на блок
+ * @return 0 - OK, 1 - вне коллбека или сообщение локальное (w_pubsub_publish)
+ */
+int w_pubsub_retain(rdt_block_item_t *out);
+
+/**
+ * @brief Подписан ли пир на тему (для издателей, формирующих блок сами, как w_snapshot)
+ */
+bool w_pubsub_remote_subscribed(uint8_t topic);
+
+/**
+ * @brief Отправить пиру свой набор тем и запросить его набор (после привязки/переподключения)
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_pubsub_resync(void);
+
+/**
+ * @brief Статистика темы
+ */
+void w_pubsub_topic_stats_get(uint8_t topic, w_pubsub_topic_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_PUBSUB_H
@@ -0,0 +1,303 @@
+/**
+ * @file w_rpc.h
+ * @brief Универсальный запрос/ответ (RPC) поверх канала RDT
+ *
+ * @details
+ * Общий механизм для пользовательских каналов вместо ручного сопоставления ответов:
+ *  - метод - номер 0..255, запрос и ответ несут request_id;
+ *  - клиент: до W_RPC_MAX_PENDING одновременных вызовов из разных задач, у каждого
+ *    свой срок (deadline). Блокирующий вызов w_rpc_call() и асинхронный w_rpc_call_async()
+ *    с коллбеком завершения;
+ *  - сервер: таблица методов, прямой индекс по номеру метода. Короткие обработчики
+ *    выполняются сразу в обработчике событий канала, остальные - в задаче модуля
+ *    (W_RPC_METHOD_WORKER), принятый блок передаётся в задачу без копирования;
+ *  - оставшийся срок вызова передаётся в запросе: сервер не выполняет запрос,
+ *    который клиент уже перестал ждать;
+ *  - идемпотентные методы можно хеджировать (w_hedge.h): дубликат уходит после доставки запроса,
+ *    сервер не выполняет его повторно, а отвечает сохранённым ответом (последние W_RPC_REPLAY_DEPTH
+ *    ответов до W_RPC_REPLAY_MAX_LEN байт), если первый ответ потерялся;
+ *  - повтор w_rpc_call() с теми же аргументами после таймаута идёт с прежним request_id (w_retry_t):
+ *    RDT продолжает недоставленный блок, а сервер отвечает сохранённым ответом.
+ *
+ * Пример (канал W_CHAN_USER добавлен в w_user.h и инициализирован Rdt_ChannelInit):
+ * @code
+ *  static uint8_t rpc_echo(const uint8_t *req, size_t req_len, uint8_t *resp, size_t *resp_len, void *ctx)
+ *  {
+ *      memcpy(resp, req, req_len);
+ *      *resp_len = req_len;
+ *      return W_RPC_OK;
+ *  }
+ *  static const w_rpc_method_t s_methods[] = {
+ *      { .method = 1, .handler = rpc_echo, .max_resp = 64, .flags = 0 },
+ *  };
+ *  static w_rpc_t s_rpc;
+ *  w_rpc_init(&s_rpc, W_CHAN_USER, s_methods, 1);
+ *  ...
+ *  uint8_t out[64]; size_t out_len = sizeof(out); uint8_t status;
+ *  w_rpc_call(&s_rpc, 1, (const uint8_t *)"ping", 4, out, &out_len, W_RPC_DEFAULT_TIMEOUT, &status);
+ * @endcode
+ *
+ * @author Pavel
+ * @date 2025-03-05
+ */
+
+#ifndef W_RPC_H
+#define W_RPC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "w_hedge.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Максимальное количество одновременных вызовов клиента
+ */
+#define W_RPC_MAX_PENDING       8
+
+/**
+ * @brief Глубина очереди запросов к задаче сервера
+ */
+#define W_RPC_WORKER_QUEUE      4
+
+/**
+ * @brief Сколько последних ответов сервер хранит для повтора на дубликат запроса
+ */
+#define W_RPC_REPLAY_DEPTH      W_DEDUP_DEPTH
+
+/**
+ * @brief Наибольший размер ответа, который сохраняется для повтора, байт
+ */
+#define W_RPC_REPLAY_MAX_LEN    256
+
+/**
+ * @brief Период проверки сроков асинхронных вызовов, мс
+ */
+#define W_RPC_SWEEP_MS          50
+
+/**
+ * @brief Таймаут вызова по умолчанию
+ */
+#define W_RPC_DEFAULT_TIMEOUT   pdMS_TO_TICKS(2000)
+
+/**
+ * @brief Вид пакета
+ */
+enum {
+    W_RPC_KIND_REQ  = 1,    ///< Запрос
+    W_RPC_KIND_RESP = 2,    ///< Ответ
+};
+
+/**
+ * @brief Флаги пакета (копируются в ответ)
+ */
+enum {
+    W_RPC_FLAG_HEDGE    = 0x01, ///< Повторный экземпляр запроса (хедж)
+    W_RPC_FLAG_NO_REPLY = 0x02, ///< Ответ не нужен
+};
+
+/**
+ * @brief Коды завершения вызова. Значения < 0xF0 - коды обработчика метода
+ */
+enum {
+    W_RPC_OK              = 0,
+    W_RPC_ERR_NO_METHOD   = 0xF0,   ///< Метод не зарегистрирован на сервере
+    W_RPC_ERR_NO_MEM      = 0xF1,   ///< Сервер: нет памяти под ответ
+    W_RPC_ERR_SERVER_BUSY = 0xF2,   ///< Сервер: очередь задачи заполнена
+    W_RPC_ERR_TIMEOUT     = 0xFC,   ///< Срок вызова истёк
+    W_RPC_ERR_SEND        = 0xFD,   ///< Ошибка отправки запроса
+    W_RPC_ERR_BUSY        = 0xFE,   ///< Клиент: нет свободного слота вызова
+    W_RPC_ERR_ARG         = 0xFF,   ///< Неверные аргументы / модуль не инициализирован
+};
+
+/**
+ * @brief Флаги метода сервера
+ */
+enum {
+    W_RPC_METHOD_WORKER = 0x01,     ///< Выполнять в задаче модуля (долгий обработчик)
+};
+
+#pragma pack(push, 1)
+/**
+ * @brief Заголовок пакета RPC
+ */
+typedef struct
+{
+    uint8_t  kind;          ///< W_RPC_KIND_XXX
+    uint8_t  method;        ///< Номер метода
+    uint16_t request_id;    ///< ID вызова (не 0)
+    uint8_t  status;        ///< Код завершения (в ответе)
+    uint8_t  flags;         ///< W_RPC_FLAG_XXX
+    uint16_t budget_ms;     ///< Оставшийся срок вызова на момент отправки, мс (0 - не ограничен)
+    uint8_t  data[];        ///< Аргументы запроса или данные ответа
+} w_header_rpc_t;
+#pragma pack(pop)
+
+/**
+ * @brief Обработчик метода сервера
+ * @param[in]  req      Аргументы запроса
+ * @param[in]  req_len  Размер аргументов
+ * @param[out] resp     Буфер ответа (max_resp байт)
+ * @param[in,out] resp_len Размер буфера на входе, размер ответа на выходе
+ * @param[in]  ctx      Контекст метода
+ * @return Код завершения (W_RPC_OK или свой код < 0xF0)
+ */
+typedef uint8_t (*w_rpc_handler_t)(const uint8_t *req, size_t req_len,
+                                   uint8_t *resp, size_t *resp_len, void *ctx);
+
+/**
+ * @brief Описание метода сервера
+ */
+typedef struct
+{
+    uint8_t         method;     ///< Номер метода
+    w_rpc_handler_t handler;    ///< Обработчик
+    size_t          max_resp;   ///< Максимальный размер ответа, байт
+    uint8_t         flags;      ///< W_RPC_METHOD_XXX
+    void           *ctx;        ///< Контекст обработчика
+} w_rpc_method_t;
+
+/**
+ * @brief Коллбек завершения асинхронного вызова
+ *
+ * Вызывается из обработчика событий канала (ответ) или из задачи модуля (истечение срока).
+ *
+ * @param[in] status Код завершения
+ * @param[in] data   Данные ответа (действительны только на время вызова)
+ * @param[in] len    Размер данных
+ * @param[in] ctx    Контекст вызова
+ */
+typedef void (*w_rpc_done_cb_t)(uint8_t status, const uint8_t *data, size_t len, void *ctx);
+
+/**
+ * @brief Слот незавершённого вызова клиента
+ */
+typedef struct
+{
+    bool              used;         ///< Слот занят
+    bool              done;         ///< Ответ получен (блокирующий вызов)
+    uint8_t           method;       ///< Номер метода
+    uint16_t          request_id;   ///< ID вызова
+    TickType_t        deadline;     ///< Тик истечения срока
+    w_rpc_done_cb_t   cb;           ///< Коллбек (NULL - блокирующий вызов)
+    void             *ctx;          ///< Контекст коллбека
+    uint8_t          *buf;          ///< Буфер ответа блокирующего вызова
+    size_t           *size;         ///< Размер буфера / ответа
+    uint8_t           status;       ///< Код завершения
+    uint8_t           flags;        ///< Флаги из ответа
+    bool              delivered;    ///< Запрос доставлен (ASK): дубликат не встанет в очередь за ним
+    SemaphoreHandle_t sem;          ///< Пробуждение блокирующего вызова
+} w_rpc_pending_t;
+
+/**
+ * @brief Сохранённый ответ сервера (повтор на дубликат запроса)
+ */
+typedef struct
+{
+    uint16_t request_id;            ///< ID вызова (0 - пусто)
+    uint8_t  method;                ///< Номер метода
+    uint8_t  status;                ///< Код завершения
+    uint16_t len;                   ///< Размер данных ответа
+    uint8_t *data;                  ///< Копия данных ответа (NULL при len == 0)
+    uint32_t peer_gen;              ///< Смена пира, при которой сохранён ответ (w_dedup_t::peer_gen)
+} w_rpc_replay_t;
+
+/**
+ * @brief Статистика RPC
+ */
+typedef struct
+{
+    uint32_t calls;             ///< Отправлено вызовов
+    uint32_t completed;         ///< Получено ответов
+    uint32_t timeouts;          ///< Вызовов с истёкшим сроком
+    uint32_t late;              ///< Ответов без ожидающего вызова (опоздавших)
+    uint32_t served;            ///< Выполнено запросов сервером
+    uint32_t expired;           ///< Запросов, отброшенных сервером по сроку
+    uint32_t duplicates;        ///< Дубликатов запросов, подавленных сервером (ответ ещё не готов или не сохранён)
+    uint32_t replayed;          ///< Дубликатов, на которые повторён сохранённый ответ
+} w_rpc_stats_t;
+
+/**
+ * @brief Состояние RPC одного канала (выделяется пользователем, обычно статически)
+ *
+ * Таблица вызовов, сохранённые ответы, хеджирование и статистика - под lock.
+ */
+typedef struct
+{
+    uint8_t               channel;                          ///< Канал RDT
+    const w_rpc_method_t *methods;                          ///< Таблица методов сервера (может быть NULL)
+    size_t                method_count;                     ///< Размер таблицы
+    uint8_t               index[256];                       ///< Номер метода -> позиция в таблице
+    SemaphoreHandle_t     lock;                             ///< Защита таблицы вызовов
+    w_rpc_pending_t       pending[W_RPC_MAX_PENDING];       ///< Незавершённые вызовы
+    uint16_t              next_request_id;                  ///< Следующий ID вызова
+    uint8_t               idempotent[256 / 8];              ///< Методы, которые можно хеджировать
+    w_hedge_t             hedge;                            ///< Хеджирование идемпотентных вызовов
+    w_dedup_t             dedup;                            ///< Подавление дубликатов на сервере
+    w_retry_t             retry;                            ///< Последний вызов без ответа
+    w_rpc_replay_t        replay[W_RPC_REPLAY_DEPTH];       ///< Последние ответы сервера
+    uint8_t               replay_head;                      ///< Индекс следующей записи
+    QueueHandle_t         jobs;                             ///< Очередь запросов к задаче модуля
+    w_rpc_stats_t         stats;                            ///< Статистика
+} w_rpc_t;
+
+/**
+ * @brief Инициализация RPC в канале: таблица методов, задача модуля, приём блоков канала
+ * @param[out] rpc          Состояние
+ * @param[in]  channel      Канал RDT (модуль становится единственным получателем его блоков
+ *                          и занимает коллбек завершения передачи канала)
+ * @param[in]  methods      Таблица методов сервера (NULL - только клиент); хранится по указателю
+ * @param[in]  method_count Размер таблицы
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_rpc_init(w_rpc_t *rpc, uint8_t channel, const w_rpc_method_t *methods, size_t method_count);
+
+/**
+ * @brief Блокирующий вызов
+ * @param[in]     rpc         Состояние
+ * @param[in]     method      Номер метода
+ * @param[in]     req         Аргументы (копируются)
+ * @param[in]     req_len     Размер аргументов
+ * @param[out]    resp        Буфер ответа (может быть NULL)
+ * @param[in,out] resp_size   Размер буфера на входе, размер ответа на выходе (может быть NULL)
+ * @param[in]     timeout     Срок вызова
+ * @param[out]    status      Код завершения (может быть NULL)
+ * @return 0 - ответ получен (код метода в *status), -2 - нет слота, -1 - ошибка отправки, -3 - срок истёк
+ */
+int w_rpc_call(w_rpc_t *rpc, uint8_t method, const uint8_t *req, size_t req_len,
+               uint8_t *resp, size_t *resp_size, TickType_t timeout, uint8_t *status);
+
+/**
+ * @brief Асинхронный вызов: коллбек вызывается ровно один раз - с ответом или с W_RPC_ERR_TIMEOUT
+ * @param[in] cb  Коллбек завершения (NULL - ответ не нужен, запрос уходит с W_RPC_FLAG_NO_REPLY)
+ * @return 0 - запрос отправлен, 1 - ошибка (коллбек не вызывается)
+ */
+int w_rpc_call_async(w_rpc_t *rpc, uint8_t method, const uint8_t *req, size_t req_len,
+                     TickType_t timeout, w_rpc_done_cb_t cb, void *ctx);
+
+/**
+ * @brief Отметить метод как идемпотентный: блокирующий вызов хеджируется, если хеджирование включено
+ */
+void w_rpc_set_idempotent(w_rpc_t *rpc, uint8_t method, bool idempotent);
+
+/**
+ * @brief Включить/выключить хеджирование идемпотентных вызовов
+ */
+void w_rpc_hedge_enable(w_rpc_t *rpc, bool enable);
+
+/**
+ * @brief Получить копию статистики
+ */
+void w_rpc_stats_get(w_rpc_t *rpc, w_rpc_stats_t *out, w_hedge_stats_t *hedge_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_RPC_H
@@ -0,0 +1,129 @@
+/**
+ * @file w_sflight.h
+ * @brief Объединение одинаковых одновременных запросов (single-flight)
+ *
+ * @details
+ * Если задача делает идемпотентный запрос, идентичный уже выполняющемуся
+ * (тот же ключ: message_type параметра, путь LIST и т.п.), она не отправляет
+ * свой запрос, а присоединяется к текущему как «попутчик» и получает копию его ответа.
+ * Запрос становится лидером в том же вызове w_sflight_join(), ещё до ожидания мьютекса
+ * запросов модуля: задачи, пришедшие, пока лидер ждёт своей очереди, присоединяются к нему.
+ * До W_SFLIGHT_MAX_FLIGHTS лидеров с разными ключами открыты одновременно.
+ * Все структуры статические, выделения памяти на запрос нет.
+ *
+ * @author Pavel
+ * @date 2025-02-12
+ */
+
+#ifndef W_SFLIGHT_H
+#define W_SFLIGHT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Максимальное количество попутчиков одного запроса
+ */
+#define W_SFLIGHT_MAX_WAITERS   4
+
+/**
+ * @brief Максимальное количество одновременно открытых запросов-лидеров
+ */
+#define W_SFLIGHT_MAX_FLIGHTS   4
+
+/**
+ * @brief Максимальная длина ключа запроса, байт (путь LIST + завершающий ноль)
+ */
+#define W_SFLIGHT_KEY_MAX       132
+
+/**
+ * @brief Слот ожидающего попутчика
+ */
+typedef struct
+{
+    bool              used;         ///< Слот занят
+    bool              done;         ///< Результат записан
+    uint32_t          flight;       ///< Запрос-лидер, к которому присоединился
+    int               result;       ///< Результат запроса (как у блокирующей функции)
+    uint8_t           return_code;  ///< Код возврата из ответа
+    uint8_t          *buf;          ///< Буфер попутчика для данных ответа (может быть NULL)
+    size_t           *size;         ///< Размер буфера / фактический размер (может быть NULL)
+    SemaphoreHandle_t sem;          ///< Семафор пробуждения попутчика
+} w_sflight_waiter_t;
+
+/**
+ * @brief Открытый запрос-лидер
+ */
+typedef struct
+{
+    uint32_t id;                                        ///< Номер запроса (0 - слот свободен)
+    uint8_t  key[W_SFLIGHT_KEY_MAX];                    ///< Ключ запроса
+    size_t   key_len;                                   ///< Длина ключа
+} w_sflight_flight_t;
+
+/**
+ * @brief Состояние single-flight одного модуля
+ */
+typedef struct
+{
+    SemaphoreHandle_t  lock;                            ///< Защита структуры
+    w_sflight_flight_t flights[W_SFLIGHT_MAX_FLIGHTS];  ///< Лидеры, принимающие попутчиков
+    uint32_t           next_id;                         ///< Номер следующего лидера
+    w_sflight_waiter_t waiters[W_SFLIGHT_MAX_WAITERS];  ///< Попутчики
+    uint32_t           coalesced;                       ///< Сколько запросов обслужено без отправки
+} w_sflight_t;
+
+/**
+ * @brief Инициализация (создание мьютекса и семафоров)
+ */
+void w_sflight_init(w_sflight_t *sf);
+
+/**
+ * @brief Присоединиться к идентичному запросу в полёте или стать лидером
+ *
+ * @param[in,out] sf          Состояние single-flight
+ * @param[in]     key         Ключ запроса
+ * @param[in]     key_len     Длина ключа
+ * @param[out]    buf         Буфер для данных ответа (может быть NULL)
+ * @param[in,out] size        Размер буфера на входе, фактический размер на выходе (может быть NULL)
+ * @param[in]     wait_ticks  Таймаут ожидания
+ * @param[out]    return_code Код возврата из ответа (может быть NULL)
+ * @param[out]    result      Результат запроса (0 - ответ получен)
+ * @param[out]    flight      Номер открытого лидера, если запрос выполняется свой
+ *                            (0 - все слоты лидеров заняты, попутчиков не будет)
+ *
+ * @return true, если запрос обслужен попутно (результат в *result);
+ *         false, если идентичного запроса нет: нужно выполнить свой и на любом
+ *         выходе вызвать w_sflight_complete() с *flight
+ */
+bool w_sflight_join(w_sflight_t *sf, const void *key, size_t key_len,
+                    uint8_t *buf, size_t *size, TickType_t wait_ticks,
+                    uint8_t *return_code, int *result, uint32_t *flight);
+
+/**
+ * @brief Завершить запрос-лидер: закрыть приём попутчиков и раздать им результат
+ *
+ * Повторный вызов после завершения и flight == 0 ничего не делают.
+ *
+ * @param[in,out] sf          Состояние single-flight
+ * @param[in]     flight      Номер лидера из w_sflight_join()
+ * @param[in]     result      Результат запроса (0 - ответ получен)
+ * @param[in]     return_code Код возврата из ответа
+ * @param[in]     data        Данные ответа (может быть NULL)
+ * @param[in]     data_len    Размер данных ответа
+ */
+void w_sflight_complete(w_sflight_t *sf, uint32_t flight, int result, uint8_t return_code,
+                        const uint8_t *data, size_t data_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_SFLIGHT_H
@@ -0,0 +1,248 @@
+/**
+ * @file w_snapshot.h
+ * @brief Передача снимков сенсоров разностью относительно последнего подтверждённого снимка
+ *
+ * @details
+ * Снимок - массив записей одинакового размера (например, StructMC_ValueThermo_t[THERMO_UNITS_MAX]).
+ * Передатчик хранит последний снимок, доставку которого подтвердил RDT (ASK), и отправляет
+ * только изменившиеся записи (индекс + запись). В полёте не более одного снимка потока,
+ * поэтому базовый снимок передатчика всегда совпадает с состоянием приёмника.
+ *
+ * Ключевой кадр (полный снимок) отправляется:
+ *  - первым сообщением потока;
+ *  - не реже keyframe_interval_ms;
+ *  - после неудачной доставки (RDT исчерпал повторы);
+ *  - по запросу приёмника (W_MSG_TYPE_SENSORS_KEYFRAME_REQ), если его снимок не совпал с базовым.
+ *
+ * Политика отправки (w_snapshot_tx_set_policy) делает поток событийным: вызывающая задача
+ * опрашивает источник часто, а w_snapshot_tx_send() сам решает, есть ли что отправлять:
+ *  - изменение записи, признанное значимым (significant), уходит сразу;
+ *  - незначимые изменения (например, дрейф температуры ниже порога) копятся и уходят
+ *    не реже heartbeat_ms;
+ *  - между отправками выдерживается min_interval_ms (ограничение всплесков).
+ * Значимость оценивается относительно подтверждённого снимка, поэтому медленный дрейф
+ * тоже будет отправлен, как только накопится до порога.
+ *
+ * Сообщение: w_header_sensors_t (message_type = W_MSG_TYPE_SENSORS_DELTA) + w_snapshot_hdr_t + данные.
+ *
+ * @author Pavel
+ * @date 2025-02-17
+ */
+
+#ifndef W_SNAPSHOT_H
+#define W_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Максимальное количество потоков снимков на передающей стороне
+ */
+#define W_SNAPSHOT_MAX_STREAMS  4
+
+/**
+ * @brief Флаги заголовка снимка
+ */
+enum {
+    W_SNAPSHOT_FLAG_KEYFRAME = 0x01,    ///< Полный снимок (base_seq не используется)
+};
+
+/**
+ * @brief Результаты w_snapshot_tx_send() и w_snapshot_rx_apply()
+ */
+enum {
+    W_SNAPSHOT_OK            = 0,   ///< Снимок отправлен / применён
+    W_SNAPSHOT_ERROR         = 1,   ///< Ошибка (память, очередь, формат)
+    W_SNAPSHOT_BUSY          = 2,   ///< Предыдущий снимок ещё не подтверждён, отправка пропущена
+    W_SNAPSHOT_UNCHANGED     = 3,   ///< Изменений относительно базового снимка нет, отправлять нечего
+    W_SNAPSHOT_NEED_KEYFRAME = 4,   ///< Разница не к нашему снимку - отброшена, запрошен ключевой кадр
+    W_SNAPSHOT_DEFERRED      = 5,   ///< Изменения есть, но отложены политикой (ниже порога или лимит частоты)
+};
+
+/**
+ * @brief Значимо ли изменение записи
+ * @param[in] old_rec Запись из подтверждённого снимка
+ * @param[in] new_rec Текущая запись
+ * @return true - отправить без ожидания heartbeat
+ */
+typedef bool (*w_snapshot_significant_fn_t)(const void *old_rec, const void *new_rec);
+
+/**
+ * @brief Политика отправки потока
+ */
+typedef struct
+{
+    w_snapshot_significant_fn_t significant;   ///< Оценка значимости (NULL - любое изменение значимо)
+    uint32_t     heartbeat_ms;      ///< Незначимые изменения отправляются не реже (0 - только вместе со значимыми)
+    uint32_t     min_interval_ms;   ///< Минимальный интервал между отправками (0 - без ограничения)
+    TaskHandle_t notify_task;       ///< Задача, которую будить по завершении доставки (NULL - не будить)
+} w_snapshot_policy_t;
+
+/**
+ * @brief Заголовок снимка (после w_header_sensors_t)
+ */
+#pragma pack(push, 1)
+typedef struct
+{
+    uint8_t  stream;        ///< Поток (исходный тип, например W_MSG_TYPE_SENSORS_THERMO)
+    uint8_t  flags;         ///< W_SNAPSHOT_FLAG_XXX
+    uint16_t seq;           ///< Номер этого снимка
+    uint16_t base_seq;      ///< Номер базового снимка, к которому применяется разница
+    uint16_t record_size;   ///< Размер одной записи, байт
+    uint8_t  record_count;  ///< Количество записей в полном снимке
+    uint8_t  entries;       ///< Количество записей в этом сообщении
+    uint8_t  data[];        ///< Ключевой кадр: record_count записей; разница: entries x (индекс u8 + запись)
+} w_snapshot_hdr_t;
+#pragma pack(pop)
+
+/**
+ * @brief Статистика передатчика
+ */
+typedef struct
+{
+    uint32_t keyframes;     ///< Отправлено ключевых кадров
+    uint32_t diffs;         ///< Отправлено разностей
+    uint32_t unchanged;     ///< Вызовов без изменений (ничего не отправлено)
+    uint32_t busy;          ///< Пропусков из-за неподтверждённого снимка
+    uint32_t deferred;      ///< Отложенных изменений (ниже порога или лимит частоты)
+    uint32_t failed;        ///< Недоставленных снимков (RDT исчерпал повторы)
+    uint32_t bytes_sent;    ///< Отправлено байт (блоки целиком)
+    uint32_t bytes_full;    ///< Сколько байт заняли бы отправленные снимки, будь каждый полным (bytes_sent / bytes_full - сжатие разностями)
+} w_snapshot_tx_stats_t;
+
+/**
+ * @brief Состояние передатчика одного потока
+ */
+typedef struct
+{
+    uint8_t   channel;              ///< Канал RDT
+    uint8_t   stream;               ///< Идентификатор потока
+    uint16_t  record_size;          ///< Размер записи
+    uint8_t   record_count;         ///< Количество записей
+    uint32_t  keyframe_interval_ms; ///< Период ключевых кадров, мс (0 - только по необходимости)
+    w_snapshot_policy_t policy;     ///< Политика отправки
+    int64_t   last_send_us;         ///< Время последней отправки (esp_timer), мкс
+    int64_t   last_keyframe_us;     ///< Время последнего ключевого кадра, мкс
+    uint8_t  *baseline;             ///< Последний подтверждённый снимок
+    uint8_t  *pending;              ///< Снимок в полёте
+    uint16_t  baseline_seq;         ///< Номер подтверждённого снимка
+    uint16_t  pending_seq;          ///< Номер снимка в полёте
+    uint16_t  next_seq;             ///< Номер следующего снимка
+    bool      has_baseline;         ///< Есть подтверждённый снимок
+    volatile bool in_flight;        ///< Снимок отправлен и ждёт подтверждения
+    volatile bool force_keyframe;   ///< Следующим отправить ключевой кадр
+    w_snapshot_tx_stats_t stats;    ///< Статистика
+} w_snapshot_tx_t;
+
+/**
+ * @brief Состояние приёмника одного потока
+ */
+typedef struct
+{
+    uint8_t   channel;      ///< Канал RDT (для запроса ключевого кадра)
+    uint8_t   stream;       ///< Идентификатор потока
+    uint16_t  record_size;  ///< Размер записи
+    uint8_t   record_count; ///< Количество записей
+    uint8_t  *snapshot;     ///< Восстановленный полный снимок
+    uint16_t  seq;          ///< Номер восстановленного снимка
+    bool      valid;        ///< Снимок восстановлен хотя бы раз
+    uint32_t  gaps;         ///< Сколько разностей отброшено из-за несовпадения базы
+    uint32_t  peer_gen;     ///< Смена пира, к которой относится снимок (w_snapshot_peer_reset)
+} w_snapshot_rx_t;
+
+/**
+ * @brief Инициализация передатчика потока
+ *
+ * Регистрирует коллбек завершения передачи канала (Rdt_ChannelSetTxDoneCallback),
+ * поэтому на этом канале не должно быть других пользователей коллбека.
+ *
+ * @param[out] tx                Состояние передатчика
+ * @param[in]  channel           Канал RDT
+ * @param[in]  stream            Идентификатор потока
+ * @param[in]  record_size       Размер записи
+ * @param[in]  record_count      Количество записей
+ * @param[in]  keyframe_interval_ms Период ключевых кадров, мс (0 - только по необходимости)
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_snapshot_tx_init(w_snapshot_tx_t *tx, uint8_t channel, uint8_t stream,
+                       size_t record_size, uint8_t record_count, uint32_t keyframe_interval_ms);
+
+/**
+ * @brief Задать политику отправки потока
+ *
+ * По умолчанию (после w_snapshot_tx_init) любое изменение отправляется сразу, без ограничения частоты.
+ *
+ * @param[in,out] tx     Состояние передатчика
+ * @param[in]     policy Политика (копируется)
+ */
+void w_snapshot_tx_set_policy(w_snapshot_tx_t *tx, const w_snapshot_policy_t *policy);
+
+/**
+ * @brief Изменить период ключевых кадров (например, отключить их на перегруженной линии)
+ * @param[in,out] tx                   Состояние передатчика
+ * @param[in]     keyframe_interval_ms Период, мс (0 - только по необходимости)
+ */
+void w_snapshot_tx_set_keyframe_interval(w_snapshot_tx_t *tx, uint32_t keyframe_interval_ms);
+
+/**
+ * @brief Отправить текущий снимок (ключевым кадром или разницей)
+ * @param[in,out] tx      Состояние передатчика
+ * @param[in]     records Текущий полный снимок (record_count записей)
+ * @return W_SNAPSHOT_OK, W_SNAPSHOT_BUSY, W_SNAPSHOT_UNCHANGED, W_SNAPSHOT_DEFERRED или W_SNAPSHOT_ERROR
+ */
+int w_snapshot_tx_send(w_snapshot_tx_t *tx, const void *records);
+
+/**
+ * @brief Обработать запрос ключевого кадра (W_MSG_TYPE_SENSORS_KEYFRAME_REQ) на передающей стороне
+ * @param[in] data Полезная нагрузка после w_header_sensors_t
+ * @param[in] len  Размер полезной нагрузки
+ */
+void w_snapshot_tx_handle_keyframe_req(const uint8_t *data, size_t len);
+
+/**
+ * @brief Забыть подтверждённые снимки после смены пира (вызывается из Rdt_SwitchPeer)
+ *
+ * Передатчики начинают с ключевого кадра, приёмники отбрасывают разницы до ключевого кадра
+ * нового пира: база прежнего пира к нему не относится.
+ */
+void w_snapshot_peer_reset(void);
+
+/**
+ * @brief Инициализация приёмника потока
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_snapshot_rx_init(w_snapshot_rx_t *rx, uint8_t channel, uint8_t stream,
+                       size_t record_size, uint8_t record_count);
+
+/**
+ * @brief Идентификатор потока сообщения W_MSG_TYPE_SENSORS_DELTA (для выбора приёмника)
+ * @param[in] data Полезная нагрузка после w_header_sensors_t
+ * @param[in] len  Размер полезной нагрузки
+ * @return stream или 0, если сообщение короче заголовка
+ */
+uint8_t w_snapshot_stream_get(const uint8_t *data, size_t len);
+
+/**
+ * @brief Применить принятое сообщение W_MSG_TYPE_SENSORS_DELTA
+ *
+ * При несовпадении базы разница отбрасывается и передатчику отправляется запрос ключевого кадра.
+ *
+ * @param[in,out] rx   Состояние приёмника; полный снимок - в rx->snapshot
+ * @param[in]     data Полезная нагрузка после w_header_sensors_t
+ * @param[in]     len  Размер полезной нагрузки
+ * @return W_SNAPSHOT_OK, W_SNAPSHOT_NEED_KEYFRAME или W_SNAPSHOT_ERROR
+ */
+int w_snapshot_rx_apply(w_snapshot_rx_t *rx, const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_SNAPSHOT_H
@@ -0,0 +1,108 @@
+/**
+ * @file w_tsc.h
+ * @brief Потоковое сжатие временных рядов сенсоров (в духе Gorilla)
+ *
+ * @details
+ * Пачка отсчётов w_history_sample_t кодируется по сериям: для каждой серии - заголовок
+ * (серия 8 бит, количество 16 бит), затем отсчёты в исходном порядке:
+ *  - первый отсчёт: время 32 бита, значение 16 бит;
+ *  - далее время - разность разностей (delta-of-delta):
+ *        0                     '0'
+ *        [-64, 63]             '10'   + 7 бит
+ *        [-256, 255]           '110'  + 9 бит
+ *        [-2048, 2047]         '1110' + 12 бит
+ *        иначе                 '1111' + 32 бита
+ *  - значение - зигзаг-код разности с предыдущим значением серии:
+ *        0                     '0'
+ *        < 16                  '10'   + 4 бита
+ *        < 256                 '110'  + 8 бит
+ *        иначе                 '111'  + 17 бит
+ *
+ * Температура с постоянным периодом записи и медленным дрейфом занимает 2..7 бит на отсчёт
+ * вместо 8 байт. Декодер потоковый и хранит только состояние текущей серии
+ * (w_tsc_decoder_t), выход - по одному отсчёту.
+ *
+ * Порядок отсчётов внутри пачки после декодирования - по сериям, а не по seq.
+ *
+ * @author Pavel
+ * @date 2025-02-24
+ */
+
+#ifndef W_TSC_H
+#define W_TSC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "w_history.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Чтение битового потока
+ */
+typedef struct
+{
+    const uint8_t *buf;     ///< Данные
+    size_t         len;     ///< Размер, байт
+    size_t         pos;     ///< Позиция, бит
+    bool           error;   ///< Попытка чтения за концом
+} w_bitreader_t;
+
+/**
+ * @brief Состояние серии (общее для кодера и декодера)
+ */
+typedef struct
+{
+    uint32_t ts;            ///< Время предыдущего отсчёта
+    int32_t  delta;         ///< Предыдущая разность времени
+    int16_t  value;         ///< Предыдущее значение
+} w_tsc_series_t;
+
+/**
+ * @brief Потоковый декодер
+ */
+typedef struct
+{
+    w_bitreader_t  br;          ///< Битовый поток
+    w_tsc_series_t st;          ///< Состояние текущей серии
+    uint8_t        series;      ///< Текущая серия
+    uint16_t       group_left;  ///< Осталось отсчётов текущей серии
+    uint16_t       group_pos;   ///< Номер отсчёта в серии
+    size_t         left;        ///< Осталось отсчётов всего
+} w_tsc_decoder_t;
+
+/**
+ * @brief Сжать пачку отсчётов
+ * @param[in]  in      Отсчёты (в порядке seq)
+ * @param[in]  count   Количество (не более 65535)
+ * @param[out] out     Буфер результата
+ * @param[in]  out_cap Размер буфера
+ * @return Размер результата, байт; 0 - не поместилось (использовать W_HISTORY_ENC_RAW)
+ */
+size_t w_tsc_encode(const w_history_sample_t *in, size_t count, uint8_t *out, size_t out_cap);
+
+/**
+ * @brief Инициализация декодера
+ * @param[out] dec   Декодер
+ * @param[in]  data  Сжатые данные
+ * @param[in]  len   Размер данных
+ * @param[in]  count Количество отсчётов в пачке
+ */
+void w_tsc_decoder_init(w_tsc_decoder_t *dec, const uint8_t *data, size_t len, size_t count);
+
+/**
+ * @brief Следующий отсчёт
+ * @param[in,out] dec Декодер
+ * @param[out]    out Отсчёт
+ * @return true - отсчёт получен; false - конец пачки или ошибка (dec->br.error)
+ */
+bool w_tsc_decoder_next(w_tsc_decoder_t *dec, w_history_sample_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_TSC_H
@@ -0,0 +1,136 @@
+/**
+ * @file w_udp.h
+ * @brief Транспорт кадров RDT по UDP для хоста (ESP-IDF, target linux) с пакетными системными вызовами
+ *
+ * @details
+ * Датаграмма: MAC отправителя (6 байт) + кадр RDT. Узлы задаются w_udp_add_node();
+ * датаграммы от незнакомого MAC или с чужого адреса отбрасываются. С w_udp_learn_enable()
+ * незнакомый MAC запоминается по первой датаграмме (только в доверенной сети), но и тогда
+ * адрес известного узла датаграммами не меняется.
+ *  - Приём: w_udp_poll() забирает одним recvmmsg() до W_UDP_BATCH датаграмм, но не больше
+ *    свободного места в очереди событий RDT, в заранее выделенные буферы и передаёт кадры
+ *    в Rdt_TransportInput(). Сокет неблокирующий, w_udp_fd() регистрируется в цикле epoll
+ *    приложения (см. examples/wireless_gateway.c).
+ *  - Передача: send() только копирует кадр в пачку; пачка уходит одним sendmmsg()
+ *    в flush(), который RDT вызывает в конце прохода задачи, или при заполнении пачки.
+ *    Кадры RDT одного размера, поэтому подряд идущие кадры одному узлу склеиваются
+ *    в одну датаграмму с UDP_SEGMENT (GSO), если ядро его поддерживает.
+ *
+ * Подключение: w_udp_init(), затем Rdt_SetTransport(w_udp_transport()) до Wireless_Init().
+ * Без RDT в процессе (ретранслятор кадров, см. examples/wireless_gateway.c) принятые кадры
+ * забирает функция w_udp_set_input(), а send()/flush() транспорта вызываются напрямую.
+ *
+ * @author Pavel
+ * @date 2025-03-17
+ */
+
+#ifndef W_UDP_H
+#define W_UDP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "w_main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Датаграмм за один recvmmsg()/sendmmsg()
+ */
+#define W_UDP_BATCH             64
+
+/**
+ * @brief Наибольшее число узлов в таблице адресов
+ */
+#define W_UDP_MAX_NODES         64
+
+/**
+ * @brief Наибольшее число сегментов одной датаграммы GSO
+ */
+#define W_UDP_GSO_SEGMENTS      32
+
+/**
+ * @brief Получатель принятых кадров (сигнатура Rdt_TransportInput)
+ */
+typedef void (*w_udp_input_fn_t)(const uint8_t *src_mac, const uint8_t *frame, size_t len, int rssi_dbm);
+
+/**
+ * @brief Статистика транспорта
+ */
+typedef struct
+{
+    uint32_t rx_frames;     ///< Принято кадров
+    uint32_t rx_calls;      ///< Вызовов recvmmsg(), вернувших данные
+    uint32_t tx_frames;     ///< Отправлено кадров
+    uint32_t tx_calls;      ///< Вызовов sendmmsg()
+    uint32_t tx_dropped;    ///< Кадров, не принятых сокетом или без адреса узла
+    uint32_t rx_dropped;    ///< Датаграмм от незнакомого узла или с чужого адреса
+    bool     gso;           ///< UDP_SEGMENT используется
+} w_udp_stats_t;
+
+/**
+ * @brief Открыть сокет
+ * @param[in] bind_addr Адрес IPv4 для bind (NULL - все интерфейсы)
+ * @param[in] port      Порт UDP
+ * @param[in] self_mac  MAC шлюза в датаграммах (6 байт)
+ * @return 0 - OK, 1 - ошибка
+ */
+int w_udp_init(const char *bind_addr, uint16_t port, const uint8_t *self_mac);
+
+/**
+ * @brief Задать адрес узла
+ * @param[in] mac  MAC узла
+ * @param[in] ip   Адрес IPv4
+ * @param[in] port Порт UDP
+ * @return 0 - OK, 1 - ошибка (неверный адрес или таблица заполнена)
+ */
+int w_udp_add_node(const uint8_t *mac, const char *ip, uint16_t port);
+
+/**
+ * @brief Запоминать незнакомые узлы по первой датаграмме (по умолчанию выключено)
+ *
+ * Первая датаграмма с новым MAC закрепляет за ним адрес отправителя; дальше адрес
+ * не меняется. Включать только в сети, где MAC в датаграммах нельзя подделать.
+ */
+void w_udp_learn_enable(bool enable);
+
+/**
+ * @brief Заменить получателя принятых кадров (по умолчанию Rdt_TransportInput)
+ *
+ * Со своим получателем пачка приёма не ограничивается местом в очереди RDT:
+ * переполнение своей очереди получатель обрабатывает сам.
+ * @param[in] input Получатель (NULL - Rdt_TransportInput)
+ */
+void w_udp_set_input(w_udp_input_fn_t input);
+
+/**
+ * @brief Транспорт для Rdt_SetTransport()
+ */
+const rdt_transport_t *w_udp_transport(void);
+
+/**
+ * @brief Дескриптор сокета для epoll (EPOLLIN)
+ */
+int w_udp_fd(void);
+
+/**
+ * @brief Принять всё, что накопилось в сокете (из цикла событий приложения)
+ *
+ * Если очередь событий RDT заполнена, датаграммы остаются в сокете (EPOLLIN не снимается):
+ * при 0 и готовом сокете циклу стоит уступить процессор задаче RDT.
+ * @return Количество принятых датаграмм
+ */
+size_t w_udp_poll(void);
+
+/**
+ * @brief Получить копию статистики
+ */
+void w_udp_stats_get(w_udp_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // W_UDP_H
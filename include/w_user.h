@@ -22,8 +22,29 @@ enum
     W_CHAN_SENSORS,     // Контакты и реле МС
     W_CHAN_PARAMS,      // Чтение-запись параметров
     W_CHAN_FILES,       // Чтение-запись файлов
+    W_CHAN_HISTORY,     // Догрузка истории сенсоров (w_history.h)
+    W_CHAN_OTA,         // Обновление прошивки (w_ota.h)
 };
 
+/**
+ * Реестр параметров - единственное место, где описываются параметры.
+ * X(имя, message_type, тип значения)
+ *  - имя: из него получаются W_MSG_TYPE_PARAM_<имя>, W_PARAM_SIZE_<имя>,
+ *    w_param_get_<имя>() и w_param_set_<имя>() (см. w_param_registry.h)
+ *  - тип значения: тип ответа на GET, sizeof(тип) - подсказка размера ответа.
+ *    Типы раскрываются только в w_param_registry.h, поэтому здесь заголовки проекта не нужны.
+ */
+#define W_PARAM_LIST(X) \
+    X(TIME,             20, uint8_t[64])                                /* Время (структура даты и часового пояса) */ \
+    X(MC_CONFIG,        21, StructMC_Config_t)                          /* Конфигурация МС */ \
+    X(MC_TITLES_IO,     22, StructMC_UnitParam_t[IO_MAX])               /* Названия контактов */ \
+    X(MC_TITLES_RELAY,  23, StructMC_UnitParam_t[RELAYS_MAX])           /* Названия реле */ \
+    X(MC_TITLES_THERMO, 24, StructMC_UnitParam_t[THERMO_UNITS_MAX])     /* Названия термометров */ \
+    X(DISP_FWVER,       25, char[32])                                   /* Версия прошивки дисплея */ \
+    X(RULES,            26, uint8_t[MAX_PARAM_LENGTH])                  /* Правила MC */ \
+    X(DIRECT_RELAY,     27, uint8_t[MAX_PARAM_LENGTH])                  /* Параметры прямого управления реле */ \
+    X(RDT_TUNING,       28, rdt_tuning_t)                               /* Настройки RDT (w_main.h) */
+
 enum
 {
     /* Системные сообщения */
@@ -34,17 +55,21 @@ enum
     W_MSG_TYPE_SENSORS_IO       = 10,       // Рассылка данных сухих контактов
     W_MSG_TYPE_SENSORS_RELAY    = 11,       // Рассылка данных реле
     W_MSG_TYPE_SENSORS_THERMO   = 12,       // Рассылка данных термометров
-
-    /* Чтение-запись параметров */
-    W_MSG_TYPE_PARAM_TIME               = 20,    // Время (time_t)
-    W_MSG_TYPE_PARAM_MC_CONFIG          = 21,    // Конфигурация МС (StructMC_Config_t)
-    W_MSG_TYPE_PARAM_MC_TITLES_IO       = 22,    // Названия контактов
-    W_MSG_TYPE_PARAM_MC_TITLES_RELAY    = 23,    // Названия реле
-    W_MSG_TYPE_PARAM_MC_TITLES_THERMO   = 24,    // Названия термометров
-    W_MSG_TYPE_PARAM_DISP_FWVER         = 25,    // Версия прошивки дисплея
-    W_MSG_TYPE_PARAM_RULES              = 26,    // Правила MC
-    W_MSG_TYPE_PARAM_DIRECT_RELAY       = 27,    // Параметры прямого управления реле
-    
+    W_MSG_TYPE_SENSORS_DELTA    = 13,       // Снимок сенсоров: ключевой кадр или разница с базовым (w_snapshot.h)
+    W_MSG_TYPE_SENSORS_KEYFRAME_REQ = 14,   // Запрос ключевого кадра от приёмника (w_snapshot.h)
+    W_MSG_TYPE_SENSORS_COMPACT  = 15,       // Компактный кадр всех сенсоров (поток снимков, w_compact.h)
+    W_MSG_TYPE_SENSORS_THERMO_DIR = 16,     // Справочник термометров: индекс -> onewire-адрес (w_compact.h)
+    W_MSG_TYPE_SENSORS_THERMO_DIR_REQ = 17, // Запрос справочника термометров от приёмника (w_compact.h)
+    W_MSG_TYPE_SENSORS_PUBSUB   = 63,       // Обмен наборами подписок (W_PUBSUB_TOPIC_CONTROL, w_pubsub.h)
+
+    /* История сенсоров (канал W_CHAN_HISTORY) */
+    W_MSG_TYPE_HISTORY_REQ      = 18,       // Запрос догрузки пропуска (w_history.h)
+    W_MSG_TYPE_HISTORY_BATCH    = 19,       // Блок отсчётов истории (w_history.h)
+
+    /* Чтение-запись параметров: W_MSG_TYPE_PARAM_XXX генерируются из W_PARAM_LIST */
+#define W_PARAM_ENUM_ITEM(name, id, type) W_MSG_TYPE_PARAM_##name = id,
+    W_PARAM_LIST(W_PARAM_ENUM_ITEM)
+#undef W_PARAM_ENUM_ITEM
 };
 
 
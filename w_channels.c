@@ -25,6 +25,10 @@ void Wireless_Channels_Init(void)
     {
         logE("Rdt_ChannelInit failed");
     }
+    // Разности снимков (w_snapshot.h) опираются на подтверждённый ASK снимок: принятый блок
+    // не выбрасывается, а задерживает отправителя, который тем временем копит изменения
+    // и отправляет свежее состояние, как только интерфейс заберёт предыдущее
+    Rdt_ChannelSetRxPolicy(W_CHAN_SENSORS, RDT_RX_BACKPRESSURE, NULL);
     ret = Rdt_ChannelInit(W_CHAN_SYSTEM, 5, 5, 512);
     if(ret != 0)
     {
@@ -40,6 +44,18 @@ void Wireless_Channels_Init(void)
     {
         logE("Rdt_ChannelInit failed");
     }
+    ret = Rdt_ChannelInit(W_CHAN_HISTORY, 2, 2, 4096);
+    if(ret != 0)
+    {
+        logE("Rdt_ChannelInit failed");
+    }
+    // Пакеты истории идут потоком: одно уведомление на очередь, не позже 20 мс
+    Rdt_ChannelSetNotify(W_CHAN_HISTORY, 2, 20000);
+    ret = Rdt_ChannelInit(W_CHAN_OTA, 2, 2, 4096);
+    if(ret != 0)
+    {
+        logE("Rdt_ChannelInit failed");
+    }
 }
 
 void Wireless_Channel_Receive_Callback_Register(esp_event_handler_t cb, int channel)
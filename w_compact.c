@@ -0,0 +1,287 @@
+/**
+ * @file w_compact.c
+ * @brief Компактный формат кадра сенсоров: битовые состояния, температура в int16, справочник термометров
+ *
+ * @author Pavel
+ * @date 2025-02-19
+ */
+
+#include "w_compact.h"
+#include "w_main.h"
+#include "w_user.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define TAG "w_compact"
+#include "log.h"
+
+/* ----------------------------------------------------------------
+ * Локальные функции
+ * ---------------------------------------------------------------- */
+
+// Байт на 2-битные состояния n элементов
+static inline size_t w_compact_state_bytes(uint8_t n)
+{
+    return ((size_t)n * 2 + 7) / 8;
+}
+
+// Смещение области состояний группы от начала data
+static size_t w_compact_state_offset(const w_compact_hdr_t *hdr, uint8_t group)
+{
+    size_t off = 0;
+    for (uint8_t g = 0; g < group; g++)
+    {
+        off += w_compact_state_bytes(hdr->count[g]);
+    }
+    return off;
+}
+
+// Смещение температур от начала data
+static inline size_t w_compact_temp_offset(const w_compact_hdr_t *hdr)
+{
+    return w_compact_state_offset(hdr, W_COMPACT_GROUPS);
+}
+
+/* ----------------------------------------------------------------
+ * Кадр
+ * ---------------------------------------------------------------- */
+
+size_t w_compact_size(uint8_t relays, uint8_t ios, uint8_t thermos)
+{
+    if (relays > W_COMPACT_MAX_ITEMS || ios > W_COMPACT_MAX_ITEMS || thermos > W_COMPACT_MAX_ITEMS) return 0;
+
+    return sizeof(w_compact_hdr_t) + w_compact_state_bytes(relays) + w_compact_state_bytes(ios) +
+           w_compact_state_bytes(thermos) + (size_t)thermos * sizeof(int16_t);
+}
+
+int w_compact_init(uint8_t *frame, uint8_t dir_epoch, uint8_t relays, uint8_t ios, uint8_t thermos)
+{
+    size_t size = w_compact_size(relays, ios, thermos);
+    if (!frame || size == 0) return 1;
+
+    memset(frame, 0, size);
+    w_compact_hdr_t *hdr            = (w_compact_hdr_t *)frame;
+    hdr->version                    = W_COMPACT_VERSION;
+    hdr->dir_epoch                  = dir_epoch;
+    hdr->count[W_COMPACT_RELAY]     = relays;
+    hdr->count[W_COMPACT_IO]        = ios;
+    hdr->count[W_COMPACT_THERMO]    = thermos;
+
+    for (uint8_t i = 0; i < thermos; i++)
+    {
+        w_compact_temp_set(frame, i, W_COMPACT_TEMP_NONE);
+    }
+    return 0;
+}
+
+bool w_compact_check(const uint8_t *frame, size_t len)
+{
+    if (!frame || len < sizeof(w_compact_hdr_t)) return false;
+
+    const w_compact_hdr_t *hdr = (const w_compact_hdr_t *)frame;
+    if (hdr->version != W_COMPACT_VERSION) return false;
+
+    size_t size = w_compact_size(hdr->count[W_COMPACT_RELAY], hdr->count[W_COMPACT_IO], hdr->count[W_COMPACT_THERMO]);
+    return size != 0 && len >= size;
+}
+
+void w_compact_state_set(uint8_t *frame, uint8_t group, uint8_t idx, uint8_t state)
+{
+    w_compact_hdr_t *hdr = (w_compact_hdr_t *)frame;
+    if (group >= W_COMPACT_GROUPS || idx >= hdr->count[group]) return;
+
+    uint8_t *p     = hdr->data + w_compact_state_offset(hdr, group) + idx / 4;
+    uint8_t  shift = (idx % 4) * 2;
+    *p = (uint8_t)((*p & ~(0x03 << shift)) | ((state & 0x03) << shift));
+}
+
+uint8_t w_compact_state_get(const uint8_t *frame, uint8_t group, uint8_t idx)
+{
+    const w_compact_hdr_t *hdr = (const w_compact_hdr_t *)frame;
+    if (group >= W_COMPACT_GROUPS || idx >= hdr->count[group]) return W_COMPACT_STATE_ABSENT;
+
+    const uint8_t *p = hdr->data + w_compact_state_offset(hdr, group) + idx / 4;
+    return (*p >> ((idx % 4) * 2)) & 0x03;
+}
+
+void w_compact_temp_set(uint8_t *frame, uint8_t idx, int16_t temp)
+{
+    w_compact_hdr_t *hdr = (w_compact_hdr_t *)frame;
+    if (idx >= hdr->count[W_COMPACT_THERMO]) return;
+
+    // Little-endian независимо от платформы приёмника
+    uint8_t *p = hdr->data + w_compact_temp_offset(hdr) + idx * sizeof(int16_t);
+    p[0] = (uint8_t)((uint16_t)temp & 0xFF);
+    p[1] = (uint8_t)((uint16_t)temp >> 8);
+}
+
+int16_t w_compact_temp_get(const uint8_t *frame, uint8_t idx)
+{
+    const w_compact_hdr_t *hdr = (const w_compact_hdr_t *)frame;
+    if (idx >= hdr->count[W_COMPACT_THERMO]) return W_COMPACT_TEMP_NONE;
+
+    const uint8_t *p = hdr->data + w_compact_temp_offset(hdr) + idx * sizeof(int16_t);
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+int16_t w_compact_temp_encode(float celsius)
+{
+    float v = celsius * 100.0f;
+    if (v != v) return W_COMPACT_TEMP_NONE;     // NaN
+    if (v >= (float)INT16_MAX) return INT16_MAX;
+    if (v <= (float)(INT16_MIN + 1)) return INT16_MIN + 1;
+    return (int16_t)(v < 0 ? v - 0.5f : v + 0.5f);
+}
+
+float w_compact_temp_decode(int16_t temp)
+{
+    return (float)temp / 100.0f;
+}
+
+bool w_compact_significant(const uint8_t *old_frame, const uint8_t *new_frame, int16_t thermo_delta)
+{
+    const w_compact_hdr_t *o = (const w_compact_hdr_t *)old_frame;
+    const w_compact_hdr_t *n = (const w_compact_hdr_t *)new_frame;
+
+    if (o->dir_epoch != n->dir_epoch || memcmp(o->count, n->count, sizeof(o->count)) != 0) return true;
+
+    // Состояния сравниваются целиком: любое переключение значимо
+    size_t states = w_compact_temp_offset(n);
+    if (memcmp(o->data, n->data, states) != 0) return true;
+
+    for (uint8_t i = 0; i < n->count[W_COMPACT_THERMO]; i++)
+    {
+        int16_t a = w_compact_temp_get(old_frame, i);
+        int16_t b = w_compact_temp_get(new_frame, i);
+        if (a == b) continue;
+        if (a == W_COMPACT_TEMP_NONE || b == W_COMPACT_TEMP_NONE) return true;
+        if (abs((int)b - (int)a) >= thermo_delta) return true;
+    }
+    return false;
+}
+
+/* ----------------------------------------------------------------
+ * Справочник термометров
+ * ---------------------------------------------------------------- */
+
+bool w_compact_dir_update(w_compact_dir_t *dir, const uint64_t *addrs, uint8_t count)
+{
+    if (!dir || (!addrs && count)) return false;
+    if (count > W_COMPACT_MAX_ITEMS) count = W_COMPACT_MAX_ITEMS;
+
+    bool changed = false;
+
+    // Освобождаем слоты пропавших адресов
+    for (uint8_t s = 0; s < W_COMPACT_MAX_ITEMS; s++)
+    {
+        if (dir->addr[s] == 0) continue;
+
+        bool found = false;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            if (addrs[i] == dir->addr[s]) { found = true; break; }
+        }
+        if (!found)
+        {
+            dir->addr[s] = 0;
+            changed = true;
+        }
+    }
+
+    // Новые адреса - в свободные слоты
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (addrs[i] == 0 || w_compact_dir_index(dir, addrs[i]) >= 0) continue;
+
+        for (uint8_t s = 0; s < W_COMPACT_MAX_ITEMS; s++)
+        {
+            if (dir->addr[s] == 0)
+            {
+                dir->addr[s] = addrs[i];
+                changed = true;
+                break;
+            }
+        }
+    }
+
+    uint8_t used = 0;
+    for (uint8_t s = 0; s < W_COMPACT_MAX_ITEMS; s++)
+    {
+        if (dir->addr[s]) used = s + 1;
+    }
+    dir->count = used;
+
+    if (changed || dir->epoch == 0)
+    {
+        dir->epoch++;
+        if (dir->epoch == 0) dir->epoch = 1;
+        return true;
+    }
+    return false;
+}
+
+int w_compact_dir_index(const w_compact_dir_t *dir, uint64_t addr)
+{
+    if (!dir || addr == 0) return -1;
+
+    for (uint8_t s = 0; s < W_COMPACT_MAX_ITEMS; s++)
+    {
+        if (dir->addr[s] == addr) return s;
+    }
+    return -1;
+}
+
+int w_compact_dir_send(uint8_t channel, const w_compact_dir_t *dir)
+{
+    if (!dir) return 1;
+
+    // epoch, count, count x u64
+    size_t msg_size = sizeof(w_header_sensors_t) + 2 + (size_t)dir->count * sizeof(uint64_t);
+    w_header_sensors_t *msg = (w_header_sensors_t *)malloc(msg_size);
+    if (!msg) return 1;
+
+    msg->message_type = W_MSG_TYPE_SENSORS_THERMO_DIR;
+    msg->data[0]      = dir->epoch;
+    msg->data[1]      = dir->count;
+    memcpy(&msg->data[2], dir->addr, (size_t)dir->count * sizeof(uint64_t));
+
+    if (Rdt_SendBlock(channel, (uint8_t *)msg, msg_size, NULL) != 0)
+    {
+        free(msg);
+        return 1;
+    }
+    logI("отправлен справочник термометров v%d (%d)", dir->epoch, dir->count);
+    return 0;
+}
+
+int w_compact_dir_request(uint8_t channel)
+{
+    w_header_sensors_t *req = (w_header_sensors_t *)malloc(sizeof(w_header_sensors_t));
+    if (!req) return 1;
+
+    req->message_type = W_MSG_TYPE_SENSORS_THERMO_DIR_REQ;
+    if (Rdt_SendBlock(channel, (uint8_t *)req, sizeof(w_header_sensors_t), NULL) != 0)
+    {
+        free(req);
+        return 1;
+    }
+    return 0;
+}
+
+int w_compact_dir_apply(w_compact_dir_t *dir, const uint8_t *data, size_t len)
+{
+    if (!dir || !data || len < 2) return 1;
+
+    uint8_t count = data[1];
+    if (count > W_COMPACT_MAX_ITEMS || len < 2 + (size_t)count * sizeof(uint64_t))
+    {
+        logE("неверный справочник термометров");
+        return 1;
+    }
+
+    memset(dir->addr, 0, sizeof(dir->addr));
+    memcpy(dir->addr, &data[2], (size_t)count * sizeof(uint64_t));
+    dir->count = count;
+    dir->epoch = data[0];
+    return 0;
+}
@@ -11,6 +11,7 @@
  */
 
 #include "w_main.h"
+#include "w_crypt.h"
 #include "w_user.h"
 #include "wireless_port.h"
 #include "esp_event.h"
@@ -359,6 +360,9 @@ static void finalize_pairing(void)
     S_MC_Set_Paired_Display_id(temp_peer_mac);
     S_Commit_All();
 
+    // Пир мог стереть NVS: его номер запуска начинается заново, прежний сохранённый забываем
+    w_crypt_forget_peer(temp_peer_mac);
+
     // Добавляем peer в ESP-NOW (если это требуется)
     Rdt_AddPeer(temp_peer_mac);
 
@@ -0,0 +1,310 @@
+/**
+ * @file w_crc.c
+ * @brief CRC-32 для кадров и хешей блоков RDT: ROM на ESP32, ускоренные ядра на хосте
+ *
+ * @author Pavel
+ * @date 2025-03-18
+ */
+
+#include "sdkconfig.h"
+#include "w_crc.h"
+#include <string.h>
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+
+#include "esp_crc.h"
+
+uint32_t w_crc32_le(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    return esp_crc32_le(crc, buf, (uint32_t)len);
+}
+
+const char *w_crc32_impl(void)
+{
+    return "esp_rom";
+}
+
+int w_crc32_set_impl(const char *name)
+{
+    return (name && strcmp(name, "esp_rom") == 0) ? 0 : 1;
+}
+
+#else // CONFIG_IDF_TARGET_LINUX
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define W_CRC_HAVE_PCLMUL   1
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define W_CRC_HAVE_ARMV8    1
+#endif
+
+#define W_CRC_POLY          0xEDB88320u     ///< Отражённый полином 0x04C11DB7
+
+/**
+ * @brief Ядро: состояние без инверсий на входе и выходе
+ */
+typedef uint32_t (*w_crc_kernel_t)(uint32_t crc, const uint8_t *buf, size_t len);
+
+static uint32_t       s_table[8][256];
+static w_crc_kernel_t s_kernel = NULL;
+static const char    *s_kernel_name = "slice8";
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+
+/* ----------------------------------------------------------------
+ * slice-by-8
+ * ---------------------------------------------------------------- */
+
+static uint32_t w_crc_bytes(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (len--)
+    {
+        crc = (crc >> 8) ^ s_table[0][(crc ^ *buf++) & 0xFF];
+    }
+    return crc;
+}
+
+static uint32_t w_crc_slice8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, buf, 4);
+        memcpy(&hi, buf + 4, 4);
+        lo ^= crc;
+        crc = s_table[7][lo & 0xFF] ^ s_table[6][(lo >> 8) & 0xFF] ^
+              s_table[5][(lo >> 16) & 0xFF] ^ s_table[4][lo >> 24] ^
+              s_table[3][hi & 0xFF] ^ s_table[2][(hi >> 8) & 0xFF] ^
+              s_table[1][(hi >> 16) & 0xFF] ^ s_table[0][hi >> 24];
+        buf += 8;
+        len -= 8;
+    }
+#endif
+    return w_crc_bytes(crc, buf, len);
+}
+
+/* ----------------------------------------------------------------
+ * x86: PCLMULQDQ
+ * ---------------------------------------------------------------- */
+
+#ifdef W_CRC_HAVE_PCLMUL
+
+static bool s_have_pclmul = false;   ///< Процессор поддерживает ядро pclmul
+
+/**
+ * @brief Свёртка по 64 байта умножением без переносов и редукция Барретта
+ *
+ * Константы - для отражённого полинома (Intel, "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction"). Длина - не меньше 64 и кратна 16.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t w_crc_pclmul_fold(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    buf += 64;
+    len -= 64;
+
+    // Четыре независимые цепочки по 16 байт
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+        buf += 64;
+        len -= 64;
+    }
+
+    // Четыре цепочки - в одну
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (len >= 16)
+    {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)buf)), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    // 128 -> 64 бит
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Редукция Барретта до 32 бит
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t w_crc_pclmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    if (len >= 64)
+    {
+        size_t n = len & ~(size_t)15;
+        crc = w_crc_pclmul_fold(crc, buf, n);
+        buf += n;
+        len -= n;
+    }
+    return w_crc_slice8(crc, buf, len);
+}
+
+#endif // W_CRC_HAVE_PCLMUL
+
+/* ----------------------------------------------------------------
+ * AArch64: инструкции CRC32
+ * ---------------------------------------------------------------- */
+
+#ifdef W_CRC_HAVE_ARMV8
+
+static bool s_have_armv8 = false;    ///< Процессор поддерживает ядро armv8
+
+__attribute__((target("+crc")))
+static uint32_t w_crc_armv8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, buf, 8);
+        crc = __crc32d(crc, v);
+        buf += 8;
+        len -= 8;
+    }
+    while (len--)
+    {
+        crc = __crc32b(crc, *buf++);
+    }
+    return crc;
+}
+
+#endif // W_CRC_HAVE_ARMV8
+
+/* ----------------------------------------------------------------
+ * Выбор ядра
+ * ---------------------------------------------------------------- */
+
+static void w_crc_select(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c >> 1) ^ ((c & 1) ? W_CRC_POLY : 0);
+        }
+        s_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        for (int t = 1; t < 8; t++)
+        {
+            s_table[t][i] = (s_table[t - 1][i] >> 8) ^ s_table[0][s_table[t - 1][i] & 0xFF];
+        }
+    }
+
+    s_kernel = w_crc_slice8;
+#ifdef W_CRC_HAVE_PCLMUL
+    __builtin_cpu_init();
+    s_have_pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    if (s_have_pclmul)
+    {
+        s_kernel      = w_crc_pclmul;
+        s_kernel_name = "pclmul";
+    }
+#endif
+#ifdef W_CRC_HAVE_ARMV8
+    s_have_armv8 = (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+    if (s_have_armv8)
+    {
+        s_kernel      = w_crc_armv8;
+        s_kernel_name = "armv8";
+    }
+#endif
+}
+
+/* ----------------------------------------------------------------
+ * Публичные функции
+ * ---------------------------------------------------------------- */
+
+uint32_t w_crc32_le(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    pthread_once(&s_once, w_crc_select);
+    return ~s_kernel(~crc, buf, len);
+}
+
+const char *w_crc32_impl(void)
+{
+    pthread_once(&s_once, w_crc_select);
+    return s_kernel_name;
+}
+
+int w_crc32_set_impl(const char *name)
+{
+    pthread_once(&s_once, w_crc_select);
+    if (!name) return 1;
+    if (strcmp(name, "slice8") == 0)
+    {
+        s_kernel      = w_crc_slice8;
+        s_kernel_name = "slice8";
+        return 0;
+    }
+#ifdef W_CRC_HAVE_PCLMUL
+    if (strcmp(name, "pclmul") == 0 && s_have_pclmul)
+    {
+        s_kernel      = w_crc_pclmul;
+        s_kernel_name = "pclmul";
+        return 0;
+    }
+#endif
+#ifdef W_CRC_HAVE_ARMV8
+    if (strcmp(name, "armv8") == 0 && s_have_armv8)
+    {
+        s_kernel      = w_crc_armv8;
+        s_kernel_name = "armv8";
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+#endif // CONFIG_IDF_TARGET_LINUX
@@ -0,0 +1,431 @@
+/**
+ * @file w_crypt.c
+ * @brief Шифрование блоков RDT (AES-128-GCM, mbedTLS) с сеансовым ключом пира
+ *
+ * @author Pavel
+ * @date 2025-03-07
+ */
+
+#include "w_crypt.h"
+#include "w_main.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_mac.h"
+#include "nvs.h"
+#include "mbedtls/gcm.h"
+#include "mbedtls/hkdf.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TAG "w_crypt"
+#include "log.h"
+
+#define W_CRYPT_PSK_MAX     64
+#define W_CRYPT_PREFIX_LEN  4
+
+#define W_CRYPT_NVS_NAMESPACE   "w_crypt"
+#define W_CRYPT_NVS_BOOT        "boot"      ///< Свой номер запуска (префикс nonce)
+#define W_CRYPT_NVS_PEER        "p%02x%02x%02x%02x%02x%02x"   ///< Последний принятый номер запуска пира (ключ на MAC)
+
+/**
+ * @brief Окно защиты от повтора одного канала (в пределах текущего запуска пира)
+ */
+typedef struct
+{
+    bool     valid;                         ///< Принят хотя бы один блок
+    uint64_t top;                           ///< Наибольший принятый счётчик
+    uint32_t bitmap;                        ///< Бит i - принят счётчик top - i
+} w_crypt_window_t;
+
+static uint8_t  s_psk[W_CRYPT_PSK_MAX];
+static size_t   s_psk_len = 0;
+static bool     s_ready   = false;
+
+// Отдельные контексты передачи и приёма: шифрование в задачах-отправителях
+// не ждёт расшифровки в обработчике событий
+static mbedtls_gcm_context s_tx_ctx;
+static mbedtls_gcm_context s_rx_ctx;
+static SemaphoreHandle_t   s_tx_lock = NULL;
+static SemaphoreHandle_t   s_rx_lock = NULL;
+
+static uint8_t  s_prefix[W_CRYPT_PREFIX_LEN];
+static uint64_t s_counter = 0;
+static uint8_t  s_peer_mac[6] = {0};
+static bool     s_have_peer = false;
+
+// Блоки запусков пира ниже s_rx_boot отбрасываются, внутри s_rx_boot - окном
+static uint32_t         s_rx_boot = 0;
+static w_crypt_window_t s_windows[RDT_MAX_CHANNELS];
+
+// Счётчики меняют задачи-отправители и обработчик событий
+static w_crypt_stats_t  s_stats = {0};
+static portMUX_TYPE     s_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+#define W_CRYPT_STAT_INC(field)                 \
+    do                                          \
+    {                                           \
+        portENTER_CRITICAL(&s_stats_mux);       \
+        s_stats.field++;                        \
+        portEXIT_CRITICAL(&s_stats_mux);        \
+    } while (0)
+
+/* ----------------------------------------------------------------
+ * Локальные функции
+ * ---------------------------------------------------------------- */
+
+static bool w_crypt_is_broadcast(const uint8_t *mac)
+{
+    static const uint8_t bcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    static const uint8_t zero[6]  = {0};
+    return memcmp(mac, bcast, 6) == 0 || memcmp(mac, zero, 6) == 0;
+}
+
+/**
+ * @brief Ключ направления: HKDF-SHA256(salt = MAC в порядке возрастания, ikm = PSK,
+ *        info = метка + MAC отправителя)
+ *
+ * Salt одинаков на обеих сторонах, MAC отправителя в info разделяет направления:
+ * свой блок, отражённый обратно, не проходит проверку ключом приёма.
+ * @param[in]  peer_mac   MAC пира
+ * @param[in]  sender_mac MAC стороны, которая шифрует этим ключом
+ * @param[out] key        Ключ
+ */
+static int w_crypt_derive(const uint8_t *peer_mac, const uint8_t *sender_mac, uint8_t *key)
+{
+    uint8_t my_mac[6];
+    esp_read_mac(my_mac, ESP_MAC_WIFI_STA);
+
+    uint8_t salt[12];
+    bool mine_first = memcmp(my_mac, peer_mac, 6) < 0;
+    memcpy(&salt[0], mine_first ? my_mac : peer_mac, 6);
+    memcpy(&salt[6], mine_first ? peer_mac : my_mac, 6);
+
+    static const char label[] = "w_rdt block key v2";
+    uint8_t info[sizeof(label) - 1 + 6];
+    memcpy(info, label, sizeof(label) - 1);
+    memcpy(info + sizeof(label) - 1, sender_mac, 6);
+
+    return mbedtls_hkdf(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                        salt, sizeof(salt), s_psk, s_psk_len,
+                        info, sizeof(info), key, W_CRYPT_KEY_LEN) != 0;
+}
+
+static uint32_t w_crypt_nonce_boot(const uint8_t *nonce)
+{
+    return ((uint32_t)nonce[0] << 24) | ((uint32_t)nonce[1] << 16) | ((uint32_t)nonce[2] << 8) | nonce[3];
+}
+
+static uint64_t w_crypt_nonce_counter(const uint8_t *nonce)
+{
+    uint64_t v = 0;
+    for (int i = W_CRYPT_PREFIX_LEN; i < W_CRYPT_NONCE_LEN; i++)
+    {
+        v = (v << 8) | nonce[i];
+    }
+    return v;
+}
+
+/**
+ * @brief Свой номер запуска: читается из NVS, увеличивается и сохраняется до первого блока
+ *
+ * Префикс nonce растёт от запуска к запуску, поэтому приёмник отличает новый сеанс
+ * от повтора блока прошлого запуска. Без NVS шифрование не включается.
+ */
+static int w_crypt_boot_next(void)
+{
+    nvs_handle_t h;
+    if (nvs_open(W_CRYPT_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK)
+    {
+        logE("NVS недоступно: номер запуска не сохранить");
+        return 1;
+    }
+    uint32_t boot = 0;
+    nvs_get_u32(h, W_CRYPT_NVS_BOOT, &boot);
+    if (boot == UINT32_MAX)
+    {
+        nvs_close(h);
+        logE("номера запусков исчерпаны, нужен новый PSK");
+        return 1;
+    }
+    boot++;
+    esp_err_t err = nvs_set_u32(h, W_CRYPT_NVS_BOOT, boot);
+    if (err == ESP_OK) err = nvs_commit(h);
+    nvs_close(h);
+    if (err != ESP_OK) return 1;
+
+    s_prefix[0] = (uint8_t)(boot >> 24);
+    s_prefix[1] = (uint8_t)(boot >> 16);
+    s_prefix[2] = (uint8_t)(boot >> 8);
+    s_prefix[3] = (uint8_t)boot;
+    return 0;
+}
+
+// Ключ NVS номера запуска пира: свой на каждый MAC, смена пира не теряет номер прежнего
+static void w_crypt_peer_key(const uint8_t *peer_mac, char *key)
+{
+    snprintf(key, NVS_KEY_NAME_MAX_SIZE, W_CRYPT_NVS_PEER, peer_mac[0], peer_mac[1], peer_mac[2],
+             peer_mac[3], peer_mac[4], peer_mac[5]);
+}
+
+// Последний принятый номер запуска пира (0 - пир ещё не известен)
+static uint32_t w_crypt_peer_boot_load(const uint8_t *peer_mac)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    w_crypt_peer_key(peer_mac, key);
+
+    nvs_handle_t h;
+    if (nvs_open(W_CRYPT_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK) return 0;
+    uint32_t boot = 0;
+    if (nvs_get_u32(h, key, &boot) != ESP_OK) boot = 0;
+    nvs_close(h);
+    return boot;
+}
+
+static void w_crypt_peer_boot_save(const uint8_t *peer_mac, uint32_t boot)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    w_crypt_peer_key(peer_mac, key);
+
+    nvs_handle_t h;
+    if (nvs_open(W_CRYPT_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) return;
+    if (nvs_set_u32(h, key, boot) == ESP_OK) nvs_commit(h);
+    nvs_close(h);
+}
+
+// Блок с таким счётчиком в текущем запуске пира ещё не принимался
+static bool w_crypt_window_check(const w_crypt_window_t *w, uint64_t ctr)
+{
+    if (!w->valid) return true;
+    if (ctr > w->top) return true;
+    uint64_t back = w->top - ctr;
+    if (back >= W_CRYPT_REPLAY_WINDOW) return false;
+    return !((w->bitmap >> back) & 1);
+}
+
+static void w_crypt_window_update(w_crypt_window_t *w, uint64_t ctr)
+{
+    if (!w->valid)
+    {
+        w->valid  = true;
+        w->top    = ctr;
+        w->bitmap = 1;
+        return;
+    }
+    if (ctr > w->top)
+    {
+        uint64_t shift = ctr - w->top;
+        w->bitmap = (shift >= W_CRYPT_REPLAY_WINDOW) ? 0 : (w->bitmap << shift);
+        w->bitmap |= 1;
+        w->top = ctr;
+    }
+    else
+    {
+        w->bitmap |= 1u << (w->top - ctr);
+    }
+}
+
+/* ----------------------------------------------------------------
+ * Публичные функции
+ * ---------------------------------------------------------------- */
+
+int w_crypt_init(const uint8_t *psk, size_t psk_len)
+{
+    if (!psk || psk_len < W_CRYPT_KEY_LEN || psk_len > W_CRYPT_PSK_MAX) return 1;
+
+    if (!s_tx_lock)
+    {
+        // Номер запуска - до создания контекстов: без него init можно повторить
+        if (w_crypt_boot_next() != 0) return 1;
+        s_tx_lock = xSemaphoreCreateMutex();
+        s_rx_lock = xSemaphoreCreateMutex();
+        if (!s_tx_lock || !s_rx_lock) return 1;
+        mbedtls_gcm_init(&s_tx_ctx);
+        mbedtls_gcm_init(&s_rx_ctx);
+    }
+
+    memcpy(s_psk, psk, psk_len);
+    s_psk_len = psk_len;
+
+    // Пир уже известен (Rdt_AddPeer вызван раньше) - выводим его ключ сейчас
+    if (s_have_peer)
+    {
+        return w_crypt_set_peer(s_peer_mac);
+    }
+    return 0;
+}
+
+int w_crypt_set_peer(const uint8_t *peer_mac)
+{
+    if (!peer_mac) return 1;
+
+    if (w_crypt_is_broadcast(peer_mac))
+    {
+        s_have_peer = false;
+        s_ready     = false;
+        return 0;
+    }
+    memcpy(s_peer_mac, peer_mac, 6);
+    s_have_peer = true;
+    if (!s_psk_len) return 1;
+
+    uint8_t my_mac[6];
+    esp_read_mac(my_mac, ESP_MAC_WIFI_STA);
+    uint8_t tx_key[W_CRYPT_KEY_LEN];
+    uint8_t rx_key[W_CRYPT_KEY_LEN];
+    if (w_crypt_derive(peer_mac, my_mac, tx_key) != 0 || w_crypt_derive(peer_mac, peer_mac, rx_key) != 0)
+    {
+        logE("ошибка вывода ключа пира");
+        return 1;
+    }
+    uint32_t peer_boot = w_crypt_peer_boot_load(peer_mac);
+
+    xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+    xSemaphoreTake(s_rx_lock, portMAX_DELAY);
+    int err = mbedtls_gcm_setkey(&s_tx_ctx, MBEDTLS_CIPHER_ID_AES, tx_key, W_CRYPT_KEY_LEN * 8);
+    err |= mbedtls_gcm_setkey(&s_rx_ctx, MBEDTLS_CIPHER_ID_AES, rx_key, W_CRYPT_KEY_LEN * 8);
+    memset(s_windows, 0, sizeof(s_windows));
+    s_rx_boot = peer_boot;
+    s_ready = (err == 0);
+    xSemaphoreGive(s_rx_lock);
+    xSemaphoreGive(s_tx_lock);
+    memset(tx_key, 0, sizeof(tx_key));
+    memset(rx_key, 0, sizeof(rx_key));
+
+    if (!s_ready)
+    {
+        logE("mbedtls_gcm_setkey: %d", err);
+        return 1;
+    }
+    logI("ключ пира %02x:%02x:%02x:%02x:%02x:%02x установлен",
+         peer_mac[0], peer_mac[1], peer_mac[2], peer_mac[3], peer_mac[4], peer_mac[5]);
+    return 0;
+}
+
+bool w_crypt_ready(void)
+{
+    return s_ready;
+}
+
+int w_crypt_seal(uint8_t channel, uint8_t *buf, size_t len)
+{
+    if (!buf) return 1;
+    if (!s_ready)
+    {
+        W_CRYPT_STAT_INC(no_key);
+        return 1;
+    }
+
+    w_crypt_trailer_t *tr = (w_crypt_trailer_t *)(buf + len);
+
+    xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+    uint64_t ctr = ++s_counter;
+    memcpy(tr->nonce, s_prefix, W_CRYPT_PREFIX_LEN);
+    for (int i = W_CRYPT_NONCE_LEN - 1; i >= W_CRYPT_PREFIX_LEN; i--)
+    {
+        tr->nonce[i] = (uint8_t)ctr;
+        ctr >>= 8;
+    }
+    int err = mbedtls_gcm_crypt_and_tag(&s_tx_ctx, MBEDTLS_GCM_ENCRYPT, len,
+                                        tr->nonce, W_CRYPT_NONCE_LEN, &channel, 1,
+                                        buf, buf, W_CRYPT_TAG_LEN, tr->tag);
+    xSemaphoreGive(s_tx_lock);
+
+    if (err)
+    {
+        logE("mbedtls_gcm_crypt_and_tag: %d", err);
+        return 1;
+    }
+    W_CRYPT_STAT_INC(sealed);
+    return 0;
+}
+
+int w_crypt_forget_peer(const uint8_t *peer_mac)
+{
+    if (!peer_mac || w_crypt_is_broadcast(peer_mac)) return 1;
+
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    w_crypt_peer_key(peer_mac, key);
+
+    nvs_handle_t h;
+    if (nvs_open(W_CRYPT_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) return 1;
+    esp_err_t err = nvs_erase_key(h, key);
+    if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;   // номер пира ещё не сохранялся
+    if (err == ESP_OK) err = nvs_commit(h);
+    nvs_close(h);
+    if (err != ESP_OK)
+    {
+        logE("nvs_erase_key: %d", err);
+        return 1;
+    }
+
+    // Текущий пир: окна и номер запуска начинаются заново с первого подлинного блока
+    if (s_rx_lock && s_have_peer && memcmp(s_peer_mac, peer_mac, 6) == 0)
+    {
+        xSemaphoreTake(s_rx_lock, portMAX_DELAY);
+        s_rx_boot = 0;
+        memset(s_windows, 0, sizeof(s_windows));
+        xSemaphoreGive(s_rx_lock);
+    }
+    logI("номер запуска пира %02x:%02x:%02x:%02x:%02x:%02x забыт",
+         peer_mac[0], peer_mac[1], peer_mac[2], peer_mac[3], peer_mac[4], peer_mac[5]);
+    return 0;
+}
+
+int w_crypt_open(uint8_t channel, uint8_t *buf, size_t *len)
+{
+    if (!buf || !len || *len < W_CRYPT_OVERHEAD || channel >= RDT_MAX_CHANNELS) return 1;
+    if (!s_ready)
+    {
+        W_CRYPT_STAT_INC(no_key);
+        return 1;
+    }
+
+    size_t plain_len = *len - W_CRYPT_OVERHEAD;
+    const w_crypt_trailer_t *tr = (const w_crypt_trailer_t *)(buf + plain_len);
+    uint32_t boot = w_crypt_nonce_boot(tr->nonce);
+    uint64_t ctr  = w_crypt_nonce_counter(tr->nonce);
+    w_crypt_window_t *w = &s_windows[channel];
+
+    xSemaphoreTake(s_rx_lock, portMAX_DELAY);
+    // Прошлый запуск пира или повтор в текущем
+    if (boot < s_rx_boot || (boot == s_rx_boot && !w_crypt_window_check(w, ctr)))
+    {
+        xSemaphoreGive(s_rx_lock);
+        W_CRYPT_STAT_INC(replayed);
+        logW("канал %d: повтор блока отброшен", channel);
+        return 1;
+    }
+    int err = mbedtls_gcm_auth_decrypt(&s_rx_ctx, plain_len, tr->nonce, W_CRYPT_NONCE_LEN,
+                                       &channel, 1, tr->tag, W_CRYPT_TAG_LEN, buf, buf);
+    if (!err)
+    {
+        // Номер запуска и окно сдвигаются только подлинным блоком (nonce входит в проверку тега)
+        if (boot > s_rx_boot)
+        {
+            s_rx_boot = boot;
+            memset(s_windows, 0, sizeof(s_windows));
+            w_crypt_peer_boot_save(s_peer_mac, boot);
+            logI("новый запуск пира %u", (unsigned)boot);
+        }
+        w_crypt_window_update(w, ctr);
+    }
+    xSemaphoreGive(s_rx_lock);
+
+    if (err)
+    {
+        W_CRYPT_STAT_INC(auth_failed);
+        logW("канал %d: блок не прошёл проверку подлинности", channel);
+        return 1;
+    }
+    *len = plain_len;
+    W_CRYPT_STAT_INC(opened);
+    return 0;
+}
+
+void w_crypt_stats_get(w_crypt_stats_t *out)
+{
+    if (!out) return;
+    portENTER_CRITICAL(&s_stats_mux);
+    *out = s_stats;
+    portEXIT_CRITICAL(&s_stats_mux);
+}
@@ -2,6 +2,8 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,6 +13,7 @@
 #include <dirent.h> // Для чтения каталога (POSIX); адаптируйте под нужную среду
 
 // Подключаем API Rdt и Wireless_*:
+#include "w_crc.h"
 #include "w_main.h" // Rdt_SendBlock, Rdt_ReceiveBlock, Rdt_FreeReceivedBlock
 #include "w_user.h"
 #include "wireless_port.h" // Wireless_Channel_Receive_Callback_Register
@@ -30,6 +33,22 @@ static uint16_t g_current_request_id	= 0; // ID активного запрос
 static uint8_t g_resp_return_code = 0xFF;
 static uint8_t *g_resp_buffer	  = NULL; // сюда копируем данные из ответа
 static size_t g_resp_data_len	  = 0;	  // фактический объём в g_resp_buffer
+static uint8_t g_resp_flags		  = 0;	  // флаги из ответа
+
+// Хеджирование LIST/READ (клиент) и подавление дубликатов (сервер)
+static w_hedge_t g_hedge = {0};
+static w_dedup_t g_dedup = {0};
+
+// Запрос без ответа (клиент) и последний выполненный WRITE с его кодом (сервер)
+static w_retry_t g_retry = {0};
+static uint16_t g_write_done_id  = 0;
+static uint8_t g_write_done_code = W_FILES_OK;
+
+// Активный запрос доставлен (ASK от сервера): дубликат не встанет в очередь за ним
+static volatile bool g_req_delivered = false;
+
+// Объединение одновременных LIST одного каталога (ключ - путь)
+static w_sflight_t g_sflight = {0};
 
 // Вспомогательные forward-декларации
 static void w_files_receive_cb(void *handler_arg,
@@ -37,6 +56,7 @@ static void w_files_receive_cb(void *handler_arg,
 							   int32_t id,
 							   void *event_data);
 
+static void w_files_tx_done(uint8_t channel, void *user_ctx, bool delivered);
 static void w_files_handle_incoming_packet(const uint8_t *packet_data, size_t packet_size);
 static void w_files_process_request(const w_files_header_t *hdr_in, size_t packet_size);
 static void w_files_process_response(const w_files_header_t *hdr_in, size_t packet_size);
@@ -76,11 +96,21 @@ void Wireless_Files_Init(void)
 
 	g_mutex				  = xSemaphoreCreateMutex();
 	g_response_sem		  = xSemaphoreCreateBinary();
+	w_sflight_init(&g_sflight);
 	g_request_in_progress = false;
 	g_initialized		  = true;
 
+	// Случайное начало нумерации, чтобы после перезагрузки сервер не принял
+	// новые запросы за дубликаты старых
+	g_next_request_id = (uint16_t)esp_random();
+	if (g_next_request_id == 0)
+	{
+		g_next_request_id = 1;
+	}
+
 	// Регистрируем колбэк приёма в канале W_CHAN_FILES
 	Wireless_Channel_Receive_Callback_Register(w_files_receive_cb, W_CHAN_FILES);
+	Rdt_ChannelSetTxDoneCallback(W_CHAN_FILES, w_files_tx_done);
 }
 
 void w_files_deinit(void)
@@ -93,6 +123,7 @@ void w_files_deinit(void)
 
 	// Отписываемся от колбэка (если нужно)
 	Wireless_Channel_Receive_Callback_Unregister(w_files_receive_cb, W_CHAN_FILES);
+	Rdt_ChannelSetTxDoneCallback(W_CHAN_FILES, NULL);
 
 	// Освобождаем ресурсы
 	if (g_mutex)
@@ -107,6 +138,17 @@ void w_files_deinit(void)
 	}
 }
 
+void w_files_hedge_enable(bool enable)
+{
+	g_hedge.enabled = enable;
+}
+
+void w_files_hedge_stats_get(w_hedge_stats_t *out)
+{
+	w_hedge_stats_get(&g_hedge, out);
+	if (out) out->coalesced = g_sflight.coalesced;
+}
+
 // ----------------------------------------------------------------
 // Публичные функции API (блокирующие)
 // ----------------------------------------------------------------
@@ -221,9 +263,23 @@ static int w_files_send_request_blocking(uint8_t command,
         return -1;
     }
 
+    // LIST того же каталога уже в полёте - ждём его ответ вместо отправки своего.
+    // Иначе этот LIST сразу становится лидером: попутчики присоединяются и пока он ждёт мьютекс
+    uint32_t sf_flight = 0;
+    if (command == W_FILES_CMD_LIST)
+    {
+        int sf_result;
+        if (w_sflight_join(&g_sflight, path, strlen(path) + 1,
+                           out_data, inout_size, wait_ticks, return_code, &sf_result, &sf_flight))
+        {
+            return sf_result;
+        }
+    }
+
     // Блокируем мьютекс
     if (xSemaphoreTake(g_mutex, pdMS_TO_TICKS(2000)) != pdTRUE)
     {
+        w_sflight_complete(&g_sflight, sf_flight, -2, W_FILES_ERR_INTERNAL, NULL, 0);
         if (return_code)            *return_code = W_FILES_ERR_INTERNAL;
         return -2;
     }
@@ -231,6 +287,7 @@ static int w_files_send_request_blocking(uint8_t command,
     if (g_request_in_progress)
     {
         xSemaphoreGive(g_mutex);
+        w_sflight_complete(&g_sflight, sf_flight, -3, W_FILES_ERR_INTERNAL, NULL, 0);
         if (return_code)            *return_code = W_FILES_ERR_INTERNAL;
         return -3;
     }
@@ -242,6 +299,7 @@ static int w_files_send_request_blocking(uint8_t command,
     {
         g_request_in_progress = false;
         xSemaphoreGive(g_mutex);
+        w_sflight_complete(&g_sflight, sf_flight, -4, W_FILES_ERR_TOOLARGE, NULL, 0);
         if (return_code)            *return_code = W_FILES_ERR_TOOLARGE;
         return -4;
     }
@@ -254,17 +312,11 @@ static int w_files_send_request_blocking(uint8_t command,
     {
         g_request_in_progress = false;
         xSemaphoreGive(g_mutex);
+        w_sflight_complete(&g_sflight, sf_flight, -5, W_FILES_ERR_TOOLARGE, NULL, 0);
         if (return_code)            *return_code = W_FILES_ERR_TOOLARGE;
         return -5;
     }
 
-    // Увеличиваем счётчик request_id
-    g_current_request_id = g_next_request_id++;
-    if (g_next_request_id == 0)
-    {
-        g_next_request_id = 1;
-    }
-
     // Подготовим пакет: заголовок + путь + (если есть) данные
     size_t packet_size = sizeof(w_files_header_t) + path_len + data_len;
     uint8_t *packet = (uint8_t *)malloc(packet_size);
@@ -272,6 +324,7 @@ static int w_files_send_request_blocking(uint8_t command,
     {
         g_request_in_progress = false;
         xSemaphoreGive(g_mutex);
+        w_sflight_complete(&g_sflight, sf_flight, -6, W_FILES_ERR_INTERNAL, NULL, 0);
         if (return_code)            *return_code = W_FILES_ERR_INTERNAL;
         return -6;
     }
@@ -280,7 +333,6 @@ static int w_files_send_request_blocking(uint8_t command,
     w_files_header_t *hdr = (w_files_header_t *)packet;
     hdr->command = command;
     hdr->return_code = 0;
-    hdr->request_id = g_current_request_id;
     hdr->offset = offset;
     hdr->data_length = data_len;
     hdr->path_length = (uint8_t)path_len;
@@ -293,36 +345,101 @@ static int w_files_send_request_blocking(uint8_t command,
         memcpy(packet + sizeof(w_files_header_t) + path_len, data, data_len);
     }
 
+    // Повтор запроса, на который не дождались ответа, идёт с прежним request_id: RDT продолжит
+    // недоставленный блок, а сервер узнает дубликат (WRITE не выполнится второй раз)
+    uint32_t retry_hash = w_crc32_le(0, packet, packet_size);
+    g_current_request_id = w_retry_take(&g_retry, retry_hash, packet_size);
+    if (g_current_request_id == 0)
+    {
+        g_current_request_id = g_next_request_id++;
+        if (g_next_request_id == 0)
+        {
+            g_next_request_id = 1;
+        }
+    }
+    hdr->request_id = g_current_request_id;
+
     // Сброс семафора перед отправкой
     xSemaphoreTake(g_response_sem, 0);
 
+    // Подготавливаем переменные для получения ответа
+    g_resp_return_code = 0xFF;
+    g_resp_data_len = 0;
+    g_resp_flags = 0;
+    g_req_delivered = false;
+    if (g_resp_buffer)
+    {
+        free(g_resp_buffer);
+        g_resp_buffer = NULL;
+    }
+
+    // LIST и READ идемпотентны - для них возможен дубликат запроса (хедж)
+    bool idempotent = (command == W_FILES_CMD_LIST || command == W_FILES_CMD_READ);
+    uint8_t *hedge_packet = NULL;
+    TickType_t first_wait = idempotent ? w_hedge_delay_ticks(&g_hedge, wait_ticks) : wait_ticks;
+    if (first_wait < wait_ticks)
+    {
+        // Копию делаем заранее: после отправки владение packet переходит к Rdt
+        hedge_packet = (uint8_t *)malloc(packet_size);
+        if (hedge_packet)
+        {
+            memcpy(hedge_packet, packet, packet_size);
+            ((w_files_header_t *)hedge_packet)->flags |= W_FILES_FLAG_HEDGE;
+        }
+    }
+
     // Отправляем пакет; Rdt_SendBlock сам возьмёт на себя владение памятью, если ret_send == 0
-    int ret_send = Rdt_SendBlock(W_CHAN_FILES, packet, packet_size, NULL);
+    int64_t t_start = esp_timer_get_time();
+    int ret_send = Rdt_SendBlock(W_CHAN_FILES, packet, packet_size, (void *)(uintptr_t)g_current_request_id);
     if (ret_send != 0)
     {
         free(packet);
+        free(hedge_packet);
+        w_sflight_complete(&g_sflight, sf_flight, -7, W_FILES_ERR_INTERNAL, NULL, 0);
         g_request_in_progress = false;
         xSemaphoreGive(g_mutex);
         if (return_code)            *return_code = W_FILES_ERR_INTERNAL;
         return -7;
     }
 
-    // Подготавливаем переменные для получения ответа
-    g_resp_return_code = 0xFF;
-    g_resp_data_len = 0;
-    if (g_resp_buffer)
+    // Ожидаем ответа или таймаут
+    TickType_t waited = first_wait;
+    bool hedged = false;
+    bool got_response = (xSemaphoreTake(g_response_sem, first_wait) == pdTRUE);
+    while (!got_response && hedge_packet && waited < wait_ticks)
     {
-        free(g_resp_buffer);
-        g_resp_buffer = NULL;
+        // Ответа нет дольше p95. Дубликат с тем же request_id - только после ASK запроса:
+        // недоставленный запрос повторяет RDT, и дубликат встал бы в очередь канала за ним
+        if (g_req_delivered)
+        {
+            if (Rdt_SendBlock(W_CHAN_FILES, hedge_packet, packet_size, NULL) == 0)
+            {
+                hedge_packet = NULL;
+                hedged = true;
+                g_hedge.stats.hedges_sent++;
+                logD("hedge cmd=%d after %d ticks", command, (int)waited);
+            }
+            break;
+        }
+        TickType_t step = (wait_ticks - waited < first_wait) ? wait_ticks - waited : first_wait;
+        got_response = (xSemaphoreTake(g_response_sem, step) == pdTRUE);
+        waited += step;
+    }
+    if (!got_response && waited < wait_ticks)
+    {
+        got_response = (xSemaphoreTake(g_response_sem, wait_ticks - waited) == pdTRUE);
     }
+    free(hedge_packet);
 
-    // Ожидаем ответа или таймаут
-    if (xSemaphoreTake(g_response_sem, wait_ticks) == pdTRUE)
+    if (got_response)
     {
         if (return_code)
         {
             *return_code = g_resp_return_code;
         }
+        w_hedge_record(&g_hedge, (uint32_t)(esp_timer_get_time() - t_start),
+                       hedged, (g_resp_flags & W_FILES_FLAG_HEDGE) != 0);
+        w_sflight_complete(&g_sflight, sf_flight, 0, g_resp_return_code, g_resp_buffer, g_resp_data_len);
         if (out_data && inout_size)
         {
             size_t to_copy = (g_resp_data_len <= *inout_size) ? g_resp_data_len : *inout_size;
@@ -339,6 +456,9 @@ static int w_files_send_request_blocking(uint8_t command,
         {
             *return_code = W_FILES_ERR_INTERNAL;
         }
+        g_hedge.stats.timeouts++;
+        w_retry_failed(&g_retry, g_current_request_id, retry_hash, packet_size);
+        w_sflight_complete(&g_sflight, sf_flight, -8, W_FILES_ERR_INTERNAL, NULL, 0);
         g_request_in_progress = false;
         xSemaphoreGive(g_mutex);
         return -8;
@@ -350,6 +470,16 @@ static int w_files_send_request_blocking(uint8_t command,
 // Колбэк приёма на канале W_CHAN_FILES
 // ----------------------------------------------------------------
 
+// Завершение передачи блока (задача RDT): user_ctx - request_id активного запроса, у ответов NULL
+static void w_files_tx_done(uint8_t channel, void *user_ctx, bool delivered)
+{
+	(void)channel;
+	if (delivered && user_ctx && (uint16_t)(uintptr_t)user_ctx == g_current_request_id)
+	{
+		g_req_delivered = true;
+	}
+}
+
 static void w_files_receive_cb(void *handler_arg,
 							   esp_event_base_t base,
 							   int32_t id,
@@ -425,8 +555,23 @@ static void w_files_process_request(const w_files_header_t *hdr_in, size_t packe
 	const uint8_t *p_path = (const uint8_t *)(hdr_in + 1);
 	const uint8_t *p_data = p_path + path_len; // указатель на начало данных
 
+	// Дубликат уже обработанного запроса (хедж или повтор клиента). Ответ на первый экземпляр
+	// мог потеряться, поэтому LIST и READ выполняются и отвечаются заново; WRITE не повторяется,
+	// на повтор последнего WRITE отвечаем его прежним кодом
+	bool duplicate = w_dedup_check_and_add(&g_dedup, request_id);
+	bool replay	   = duplicate && command == W_FILES_CMD_WRITE && request_id == g_write_done_id;
+	if (duplicate && !replay && command != W_FILES_CMD_LIST && command != W_FILES_CMD_READ)
+	{
+		logD("дубликат запроса id=%d подавлен", (int)request_id);
+		return;
+	}
+
 	// Безопасная проверка
-	if (sizeof(*hdr_in) + path_len + data_len > packet_size)
+	if (replay)
+	{
+		return_code = g_write_done_code;
+	}
+	else if (sizeof(*hdr_in) + path_len + data_len > packet_size)
 	{
 		// Пакет "битый" или неполный
 		return_code = W_FILES_ERR_INTERNAL;
@@ -450,12 +595,13 @@ static void w_files_process_request(const w_files_header_t *hdr_in, size_t packe
 	hdr_out->command		  = command + 1; // например, LIST -> LIST_RESP (договорённость)
 	hdr_out->return_code	  = return_code;
 	hdr_out->request_id		  = request_id; // чтобы клиент сопоставил ответ
+	hdr_out->flags			  = hdr_in->flags;
 	hdr_out->offset			  = hdr_in->offset;
 	hdr_out->data_length	  = 0;
 	hdr_out->path_length	  = 0;
 
-	// Если уже ошибка - просто отсылаем ответ с return_code
-	if (return_code != W_FILES_OK)
+	// Если уже ошибка или повтор WRITE - просто отсылаем ответ с return_code
+	if (return_code != W_FILES_OK || replay)
 	{
 		size_t resp_size = sizeof(w_files_header_t);
 		int ret			 = Rdt_SendBlock(W_CHAN_FILES, resp_buf, resp_size, NULL);
@@ -579,6 +725,8 @@ static void w_files_process_request(const w_files_header_t *hdr_in, size_t packe
 			}
 			w_port_fclose(f);
 		}
+		g_write_done_id	  = request_id;
+		g_write_done_code = return_code;
 	}
 	else
 	{
@@ -612,8 +760,9 @@ static void w_files_process_response(const w_files_header_t *hdr_in, size_t pack
 		return;
 	}
 
-	// Копируем return_code
+	// Копируем return_code и флаги
 	g_resp_return_code = hdr_in->return_code;
+	g_resp_flags	   = hdr_in->flags;
 
 	// Извлекаем данные ответа, если есть
 	size_t data_len		  = hdr_in->data_length;
@@ -0,0 +1,147 @@
+/**
+ * @file w_hedge.c
+ * @brief Адаптивная оценка задержки ответов и хеджирование идемпотентных запросов
+ *
+ * @author Pavel
+ * @date 2025-02-10
+ */
+
+#include "w_hedge.h"
+#include "esp_timer.h"
+#include <string.h>
+
+static volatile uint32_t s_dedup_gen = 0;   ///< Номер смены пира
+
+/**
+ * @brief Перцентиль по окну замеров
+ * @param[in] w       Окно замеров
+ * @param[in] percent Перцентиль (0..100)
+ * @return Значение в мкс, 0 если замеров нет
+ */
+static uint32_t w_hedge_percentile(const w_hedge_window_t *w, uint8_t percent)
+{
+    if (w->count == 0) return 0;
+
+    // Окно маленькое, поэтому сортируем копию вставками
+    uint32_t sorted[W_HEDGE_WINDOW];
+    memcpy(sorted, w->samples, w->count * sizeof(uint32_t));
+    for (uint8_t i = 1; i < w->count; i++)
+    {
+        uint32_t v = sorted[i];
+        int j = i - 1;
+        while (j >= 0 && sorted[j] > v)
+        {
+            sorted[j + 1] = sorted[j];
+            j--;
+        }
+        sorted[j + 1] = v;
+    }
+
+    // Ранг по методу «ближайшего сверху»
+    uint32_t rank = ((uint32_t)w->count * percent + 99) / 100;
+    if (rank == 0) rank = 1;
+    return sorted[rank - 1];
+}
+
+static void w_hedge_window_add(w_hedge_window_t *w, uint32_t latency_us)
+{
+    w->samples[w->head] = latency_us;
+    w->head = (w->head + 1) % W_HEDGE_WINDOW;
+    if (w->count < W_HEDGE_WINDOW) w->count++;
+}
+
+TickType_t w_hedge_delay_ticks(const w_hedge_t *h, TickType_t wait_ticks)
+{
+    if (!h || !h->enabled || h->all.count < W_HEDGE_MIN_SAMPLES)
+    {
+        return wait_ticks;
+    }
+
+    // Задержка дубликата - по всем ответам: ответ с дубликатом приходит не раньше p95
+    // и держит хвост окна, окно только без дубликатов сжималось бы с каждым хеджем
+    uint32_t p95_ms = w_hedge_percentile(&h->all, 95) / 1000;
+    if (p95_ms < W_HEDGE_MIN_DELAY_MS)
+    {
+        p95_ms = W_HEDGE_MIN_DELAY_MS;
+    }
+
+    TickType_t delay = pdMS_TO_TICKS(p95_ms);
+    if (delay == 0) delay = 1;
+    return (delay < wait_ticks) ? delay : wait_ticks;
+}
+
+void w_hedge_record(w_hedge_t *h, uint32_t latency_us, bool hedged, bool hedge_won)
+{
+    if (!h) return;
+
+    w_hedge_window_add(&h->all, latency_us);
+    w_hedge_window_add(hedged ? &h->hedged : &h->plain, latency_us);
+
+    h->stats.requests++;
+    if (hedge_won)
+    {
+        h->stats.hedge_wins++;
+    }
+}
+
+void w_hedge_stats_get(const w_hedge_t *h, w_hedge_stats_t *out)
+{
+    if (!h || !out) return;
+    *out = h->stats;
+    uint32_t total = out->requests + out->timeouts;
+    out->hedge_rate_permille = total ? (uint16_t)((uint64_t)out->hedges_sent * 1000 / total) : 0;
+    out->plain_p50_us  = w_hedge_percentile(&h->plain, 50);
+    out->plain_p95_us  = w_hedge_percentile(&h->plain, 95);
+    out->hedged_p50_us = w_hedge_percentile(&h->hedged, 50);
+    out->hedged_p95_us = w_hedge_percentile(&h->hedged, 95);
+}
+
+bool w_dedup_check_and_add(w_dedup_t *d, uint16_t id)
+{
+    if (!d || id == 0) return false;
+
+    uint32_t gen = s_dedup_gen;
+    if (d->peer_gen != gen)
+    {
+        memset(d->ids, 0, sizeof(d->ids));
+        d->head     = 0;
+        d->peer_gen = gen;
+    }
+    for (uint8_t i = 0; i < W_DEDUP_DEPTH; i++)
+    {
+        if (d->ids[i] == id) return true;
+    }
+    d->ids[d->head] = id;
+    d->head = (d->head + 1) % W_DEDUP_DEPTH;
+    return false;
+}
+
+void w_dedup_peer_reset(void)
+{
+    s_dedup_gen++;
+}
+
+uint16_t w_retry_take(w_retry_t *r, uint32_t hash, size_t size)
+{
+    if (!r || !r->valid) return 0;
+    // Позже приёмник отложенный блок уже выбросил, а сервер мог забыть request_id
+    if (esp_timer_get_time() - r->failed_us > (int64_t)RDT_RESUME_GRACE_MS * 1000)
+    {
+        r->valid = false;
+        return 0;
+    }
+    // Другие запросы между попытками запись не сбрасывают
+    if (r->hash != hash || r->size != size) return 0;
+    r->valid = false;
+    return r->request_id;
+}
+
+void w_retry_failed(w_retry_t *r, uint16_t request_id, uint32_t hash, size_t size)
+{
+    if (!r || request_id == 0) return;
+    r->valid      = true;
+    r->request_id = request_id;
+    r->hash       = hash;
+    r->size       = size;
+    r->failed_us  = esp_timer_get_time();
+}
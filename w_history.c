@@ -0,0 +1,433 @@
+/**
+ * @file w_history.c
+ * @brief История сенсоров: кольцевой буфер отсчётов на шлюзе и догрузка пропуска после переподключения
+ *
+ * @author Pavel
+ * @date 2025-02-21
+ */
+
+#include "w_history.h"
+#include "w_tsc.h"
+#include "w_main.h"
+#include "w_user.h"
+#include "wireless_port.h" // Wireless_Channel_Receive_Callback_Register
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TAG "w_history"
+#include "log.h"
+
+/**
+ * @brief Глубина очереди запросов догрузки
+ */
+#define W_HISTORY_REQ_QUEUE_LEN     2
+
+/**
+ * @brief Задание для задачи отдачи
+ */
+typedef struct
+{
+    w_history_req_t req;
+    uint8_t         flags;  ///< W_HISTORY_FLAG_LIVE для живой пачки
+} w_history_job_t;
+
+static bool g_server            = false;
+static bool g_cb_registered     = false;
+static SemaphoreHandle_t g_mutex = NULL;
+static QueueHandle_t g_req_queue = NULL;
+
+// Кольцевой буфер: отсчёт с номером seq лежит в g_ring[seq % g_capacity]
+static w_history_sample_t *g_ring = NULL;
+static uint32_t g_capacity      = 0;
+static uint32_t g_next_seq      = 0;
+static uint32_t g_live_seq      = 0;    // Первый seq следующей живой пачки
+
+static w_history_stats_t g_stats = {0};
+static w_history_batch_cb_t g_batch_cb = NULL;
+
+static void w_history_receive_cb(void *handler_arg, esp_event_base_t base, int32_t id, void *event_data);
+static void w_history_task(void *arg);
+
+/* ----------------------------------------------------------------
+ * Локальные функции
+ * ---------------------------------------------------------------- */
+
+// Самый старый seq, ещё лежащий в буфере (под g_mutex)
+static inline uint32_t w_history_oldest_seq(void)
+{
+    return g_next_seq > g_capacity ? g_next_seq - g_capacity : 0;
+}
+
+static void w_history_register_cb(void)
+{
+    if (!g_cb_registered)
+    {
+        Wireless_Channel_Receive_Callback_Register(w_history_receive_cb, W_CHAN_HISTORY);
+        g_cb_registered = true;
+    }
+}
+
+/**
+ * @brief Отдать диапазон истории пачками
+ */
+static void w_history_serve(const w_history_req_t *req, uint8_t job_flags)
+{
+    uint8_t flags = job_flags;
+
+    xSemaphoreTake(g_mutex, portMAX_DELAY);
+    uint32_t end    = g_next_seq;
+    uint32_t oldest = w_history_oldest_seq();
+    uint32_t seq;
+    if (req->from_seq != W_HISTORY_SEQ_NONE)
+    {
+        // Живая пачка идёт от текущего g_live_seq: задания в очереди могли устареть
+        seq = (job_flags & W_HISTORY_FLAG_LIVE) ? g_live_seq : req->from_seq;
+        if (seq < oldest)
+        {
+            seq    = oldest;
+            flags |= W_HISTORY_FLAG_GAP;
+        }
+        if (seq > end) seq = end;
+    }
+    else
+    {
+        // Идём от новых к старым, пока отсчёты не раньше from_ts
+        seq = end;
+        while (seq > oldest && g_ring[(seq - 1) % g_capacity].ts >= req->from_ts)
+        {
+            seq--;
+        }
+        if (seq == oldest && oldest > 0 && end > oldest && g_ring[oldest % g_capacity].ts > req->from_ts)
+        {
+            flags |= W_HISTORY_FLAG_GAP;
+        }
+    }
+    if (req->max_samples && end - seq > req->max_samples)
+    {
+        end = seq + req->max_samples;
+    }
+    if (job_flags & W_HISTORY_FLAG_LIVE)
+    {
+        g_live_seq = end;
+    }
+    xSemaphoreGive(g_mutex);
+
+    if (job_flags & W_HISTORY_FLAG_LIVE)
+    {
+        // Живой пачке без новых отсчётов отправлять нечего
+        if (seq == end) return;
+    }
+    else
+    {
+        g_stats.requests++;
+        logI("догрузка истории: seq %lu..%lu", (unsigned long)seq, (unsigned long)end);
+    }
+
+    // Пустой ответ тоже отправляется (с W_HISTORY_FLAG_LAST), чтобы дисплей знал, что догружать нечего
+    do
+    {
+        uint32_t n = end - seq;
+        if (n > W_HISTORY_BATCH_SAMPLES) n = W_HISTORY_BATCH_SAMPLES;
+
+        size_t raw_size = n * sizeof(w_history_sample_t);
+        size_t msg_size = sizeof(w_header_sensors_t) + sizeof(w_history_batch_hdr_t) + raw_size;
+        w_header_sensors_t *msg = (w_header_sensors_t *)malloc(msg_size);
+        w_history_sample_t *out = (w_history_sample_t *)malloc(raw_size ? raw_size : 1);
+        if (!msg || !out)
+        {
+            free(msg);
+            free(out);
+            logE("нет памяти для блока истории");
+            return;
+        }
+        msg->message_type          = W_MSG_TYPE_HISTORY_BATCH;
+        w_history_batch_hdr_t *hdr = (w_history_batch_hdr_t *)msg->data;
+
+        xSemaphoreTake(g_mutex, portMAX_DELAY);
+        // Пока блоки стояли в очереди, начало диапазона могло быть вытеснено
+        oldest = w_history_oldest_seq();
+        if (seq < oldest)
+        {
+            uint32_t skip = oldest - seq;
+            seq   = oldest;
+            n     = skip >= n ? 0 : n - skip;
+            flags |= W_HISTORY_FLAG_GAP;
+            if (seq > end) seq = end;
+        }
+        for (uint32_t i = 0; i < n; i++)
+        {
+            out[i] = g_ring[(seq + i) % g_capacity];
+        }
+        xSemaphoreGive(g_mutex);
+
+        // Сжатый поток не длиннее массива отсчётов, иначе отправляем как есть
+        size_t data_len = w_tsc_encode(out, n, hdr->data, n * sizeof(w_history_sample_t));
+        if (data_len)
+        {
+            hdr->encoding = W_HISTORY_ENC_TSC;
+        }
+        else
+        {
+            hdr->encoding = W_HISTORY_ENC_RAW;
+            data_len      = n * sizeof(w_history_sample_t);
+            memcpy(hdr->data, out, data_len);
+        }
+        free(out);
+
+        hdr->first_seq = seq;
+        hdr->count     = (uint16_t)n;
+        hdr->flags     = flags | ((seq + n >= end) ? W_HISTORY_FLAG_LAST : 0);
+        msg_size       = sizeof(w_header_sensors_t) + sizeof(w_history_batch_hdr_t) + data_len;
+
+        // Ждёт места в очереди канала - темп задаёт RDT
+        if (Rdt_SendBlock(W_CHAN_HISTORY, (uint8_t *)msg, msg_size, NULL) != 0)
+        {
+            free(msg);
+            logE("догрузка истории прервана на seq %lu", (unsigned long)seq);
+            return;
+        }
+        g_stats.batches_sent++;
+        g_stats.samples_sent += n;
+        g_stats.bytes_sent   += msg_size;
+        g_stats.bytes_raw    += sizeof(w_header_sensors_t) + sizeof(w_history_batch_hdr_t) + n * sizeof(w_history_sample_t);
+        seq += n;
+
+        // Новый запрос дисплея важнее недоотданного старого (живые пачки ждут своей очереди)
+        w_history_job_t next;
+        if (xQueuePeek(g_req_queue, &next, 0) == pdTRUE && !(next.flags & W_HISTORY_FLAG_LIVE))
+        {
+            logW("догрузка истории прервана новым запросом");
+            return;
+        }
+    } while (seq < end);
+}
+
+static void w_history_task(void *arg)
+{
+    w_history_job_t job;
+    while (1)
+    {
+        if (xQueueReceive(g_req_queue, &job, portMAX_DELAY) == pdTRUE)
+        {
+            w_history_serve(&job.req, job.flags);
+        }
+    }
+}
+
+/**
+ * @brief Разобрать блок догрузки и передать отсчёты коллбеку
+ */
+static void w_history_handle_batch(const uint8_t *data, size_t len)
+{
+    const w_history_batch_hdr_t *hdr = (const w_history_batch_hdr_t *)data;
+    if (len < sizeof(w_history_batch_hdr_t))
+    {
+        logE("неверный блок истории");
+        return;
+    }
+    size_t data_len = len - sizeof(w_history_batch_hdr_t);
+
+    if (hdr->encoding == W_HISTORY_ENC_RAW)
+    {
+        if (data_len < (size_t)hdr->count * sizeof(w_history_sample_t))
+        {
+            logE("неверный блок истории");
+            return;
+        }
+        g_batch_cb((const w_history_sample_t *)hdr->data, hdr->count, hdr->first_seq, hdr->flags);
+        return;
+    }
+
+    if (hdr->encoding != W_HISTORY_ENC_TSC)
+    {
+        logE("неизвестное кодирование истории %d", hdr->encoding);
+        return;
+    }
+
+    w_history_sample_t *samples = (w_history_sample_t *)malloc(hdr->count ? hdr->count * sizeof(w_history_sample_t) : 1);
+    if (!samples)
+    {
+        logE("нет памяти для блока истории");
+        return;
+    }
+
+    w_tsc_decoder_t dec;
+    size_t n = 0;
+    w_tsc_decoder_init(&dec, hdr->data, data_len, hdr->count);
+    while (n < hdr->count && w_tsc_decoder_next(&dec, &samples[n]))
+    {
+        n++;
+    }
+    if (n == hdr->count)
+    {
+        g_batch_cb(samples, n, hdr->first_seq, hdr->flags);
+    }
+    else
+    {
+        logE("ошибка декодирования истории (%u из %u)", (unsigned)n, (unsigned)hdr->count);
+    }
+    free(samples);
+}
+
+static void w_history_process_block(const rdt_block_item_t *block_item)
+{
+    const w_header_sensors_t *msg = (const w_header_sensors_t *)block_item->data_ptr;
+    size_t len = block_item->data_size >= sizeof(w_header_sensors_t) ? block_item->data_size - sizeof(w_header_sensors_t) : 0;
+
+    if (block_item->data_size < sizeof(w_header_sensors_t))
+    {
+        logE("короткий блок истории");
+    }
+    else if (msg->message_type == W_MSG_TYPE_HISTORY_REQ && g_server)
+    {
+        if (len >= sizeof(w_history_req_t))
+        {
+            w_history_job_t job = { .flags = 0 };
+            memcpy(&job.req, msg->data, sizeof(job.req));
+            if (xQueueSend(g_req_queue, &job, 0) != pdTRUE)
+            {
+                logW("очередь запросов истории заполнена");
+            }
+        }
+    }
+    else if (msg->message_type == W_MSG_TYPE_HISTORY_BATCH && g_batch_cb)
+    {
+        w_history_handle_batch(msg->data, len);
+    }
+}
+
+static void w_history_receive_cb(void *handler_arg, esp_event_base_t base, int32_t id, void *event_data)
+{
+    // Уведомления канала умеренные (Rdt_ChannelSetNotify): забираем всю очередь
+    rdt_block_item_t block_item;
+    while (Rdt_ReceiveBlock(W_CHAN_HISTORY, &block_item, 0))
+    {
+        w_history_process_block(&block_item);
+        Rdt_FreeReceivedBlock(&block_item);
+    }
+}
+
+/* ----------------------------------------------------------------
+ * Шлюз
+ * ---------------------------------------------------------------- */
+
+int w_history_server_init(uint32_t capacity)
+{
+    if (g_server) return 0;
+    if (capacity == 0) return 1;
+
+    g_ring = (w_history_sample_t *)calloc(capacity, sizeof(w_history_sample_t));
+    if (!g_ring)
+    {
+        logE("нет памяти для истории (%lu)", (unsigned long)capacity);
+        return 1;
+    }
+    g_capacity  = capacity;
+    g_next_seq  = 0;
+    if (!g_mutex) g_mutex = xSemaphoreCreateMutex();
+    g_req_queue = xQueueCreate(W_HISTORY_REQ_QUEUE_LEN, sizeof(w_history_job_t));
+    if (!g_mutex || !g_req_queue)
+    {
+        logE("нет памяти для истории");
+        return 1;
+    }
+
+    g_server = true;
+    xTaskCreate(w_history_task, "w_history_task", 4096, NULL, 4, NULL);
+    w_history_register_cb();
+    return 0;
+}
+
+void w_history_add(uint8_t series, int16_t value)
+{
+    w_history_add_ts(series, (uint32_t)time(NULL), value);
+}
+
+void w_history_add_ts(uint8_t series, uint32_t ts, int16_t value)
+{
+    if (!g_server) return;
+
+    xSemaphoreTake(g_mutex, portMAX_DELAY);
+    w_history_sample_t *s = &g_ring[g_next_seq % g_capacity];
+    s->ts       = ts;
+    s->series   = series;
+    s->reserved = 0;
+    s->value    = value;
+    if (g_next_seq >= g_capacity) g_stats.overwritten++;
+    g_next_seq++;
+    g_stats.samples++;
+    xSemaphoreGive(g_mutex);
+}
+
+void w_history_push_live(void)
+{
+    if (!g_server) return;
+
+    // g_live_seq пишет задача отдачи
+    xSemaphoreTake(g_mutex, portMAX_DELAY);
+    uint32_t live = g_live_seq;
+    uint32_t next = g_next_seq;
+    xSemaphoreGive(g_mutex);
+    if (live == next) return;
+
+    w_history_job_t job = {
+        .req   = { .from_seq = live, .from_ts = 0, .max_samples = 0 },
+        .flags = W_HISTORY_FLAG_LIVE,
+    };
+    // Если очередь занята догрузкой, новые отсчёты уйдут следующей живой пачкой
+    xQueueSend(g_req_queue, &job, 0);
+}
+
+uint32_t w_history_next_seq(void)
+{
+    if (!g_mutex) return 0;
+    xSemaphoreTake(g_mutex, portMAX_DELAY);
+    uint32_t next = g_next_seq;
+    xSemaphoreGive(g_mutex);
+    return next;
+}
+
+void w_history_stats_get(w_history_stats_t *out)
+{
+    if (!out) return;
+    *out = g_stats;
+}
+
+/* ----------------------------------------------------------------
+ * Дисплей
+ * ---------------------------------------------------------------- */
+
+int w_history_client_init(w_history_batch_cb_t cb)
+{
+    if (!cb) return 1;
+    g_batch_cb = cb;
+    w_history_register_cb();
+    return 0;
+}
+
+int w_history_request(uint32_t from_seq, uint32_t from_ts, uint32_t max_samples)
+{
+    size_t msg_size = sizeof(w_header_sensors_t) + sizeof(w_history_req_t);
+    w_header_sensors_t *msg = (w_header_sensors_t *)malloc(msg_size);
+    if (!msg) return 1;
+
+    msg->message_type = W_MSG_TYPE_HISTORY_REQ;
+    w_history_req_t req = {
+        .from_seq    = from_seq,
+        .from_ts     = from_ts,
+        .max_samples = max_samples,
+    };
+    memcpy(msg->data, &req, sizeof(req));
+
+    if (Rdt_SendBlock(W_CHAN_HISTORY, (uint8_t *)msg, msg_size, NULL) != 0)
+    {
+        free(msg);
+        return 1;
+    }
+    return 0;
+}
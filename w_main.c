@@ -8,22 +8,32 @@
 
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "esp_wifi.h"
 #include "esp_now.h"
-#include "esp_crc.h"
 #include "esp_system.h"
 #include "esp_event.h"
 #include "esp_timer.h"
 #include "esp_heap_caps.h"
+#include "esp_random.h"
+#include "nvs.h"
 #include "w_main.h"
+#include "w_crypt.h"
+#include "w_crc.h"
+#include "w_snapshot.h"
+#include "w_hedge.h"
 #include "wireless_port.h"
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include "w_udp.h"
+#endif
 
 
 //ESP_EVENT_DEFINE_BASE(WIRELESS_EVENT_BASE);
@@ -55,6 +65,78 @@ esp_event_base_t const WIRELESS_EVENT_BASE = "WIRELESS_EVENT_BASE";
  */
 #define RDT_MAX_RETRY_COUNT     5
 
+/**
+ * @brief Глубина очереди событий и приоритет задачи RDT по умолчанию
+ *
+ * RDT_PACKET_PAYLOAD_LEN, RDT_ACK_TIMEOUT_MS, RDT_MAX_RETRY_COUNT и эти значения - только
+ * начальные настройки, меняются на ходу Rdt_TuningSet
+ */
+#ifdef CONFIG_IDF_TARGET_LINUX
+#define RDT_EVENT_QUEUE_LEN     W_UDP_BATCH     ///< Пачка recvmmsg транспорта w_udp помещается целиком
+#else
+#define RDT_EVENT_QUEUE_LEN     30
+#endif
+#define RDT_TASK_PRIORITY       5
+
+_Static_assert(RDT_EVENT_QUEUE_LEN >= RDT_TUNE_QUEUE_MIN && RDT_EVENT_QUEUE_LEN <= RDT_TUNE_QUEUE_MAX,
+               "RDT_EVENT_QUEUE_LEN out of tuning range");
+_Static_assert(RDT_TASK_PRIORITY >= RDT_TUNE_PRIO_MIN && RDT_TASK_PRIORITY <= RDT_TUNE_PRIO_MAX,
+               "RDT_TASK_PRIORITY out of tuning range");
+
+#define RDT_TUNING_NVS_NAMESPACE    "w_rdt"
+#define RDT_TUNING_NVS_KEY          "tuning"
+
+/**
+ * @brief Блоки длиннее этого числа пакетов возобновляются: на BEGIN с флагом RDT_BEGIN_RESUME_ASK
+ *        приёмник отвечает картой уже принятых пакетов (RDT_MSG_RESUME), отправитель досылает
+ *        только недостающие
+ */
+#define RDT_RESUME_MIN_PACKETS  8
+
+/**
+ * @brief Сколько отправитель ждёт RDT_MSG_RESUME после BEGIN с RDT_BEGIN_RESUME_ASK, мс
+ *
+ * Карту запрашивают только повтор всего блока и повторная отправка содержимого неудавшегося
+ * блока; новый блок отправляется сразу. Приёмник отвечает и без принятых пакетов (пустой
+ * картой), так что ожидание обычно короче RTT
+ */
+#define RDT_RESUME_WAIT_MS      30
+
+/**
+ * @brief Наибольшее ожидание событий задачи RDT без сроков в каналах, мс
+ */
+#define RDT_TASK_IDLE_MS        50
+
+/**
+ * @brief Флаг в payload[0] кадра BEGIN: ответить картой принятых пакетов (RDT_MSG_RESUME)
+ */
+#define RDT_BEGIN_RESUME_ASK    0x01
+
+/**
+ * @brief Сколько недоставленных длинных блоков канала помнит отправитель для повторной отправки с тем же ID
+ */
+#define RDT_RESUME_FAILED       4
+
+/**
+ * @brief Границы RTO для подавления повторных отправок, если NACK не указывает свой END, мс
+ */
+#define RDT_RTO_MIN_MS          10
+
+/**
+ * @brief Сколько последних отправок END помнит отправитель (для сопоставления с NACK)
+ */
+#define RDT_END_HISTORY         8
+
+/**
+ * @brief Окно обменов времени: смещение часов берётся по обмену с наименьшей задержкой
+ */
+#define RDT_TIME_SAMPLES        8
+
+/**
+ * @brief Пакетов в одной карте RDT_MSG_RESUME (2 байта - номер первого пакета, далее биты)
+ */
+#define RDT_RESUME_BITS         ((RDT_PACKET_PAYLOAD_LEN - 2) * 8)
+
 /**
  * @brief Коды служебных сообщений
  */
@@ -64,24 +146,68 @@ typedef enum
     RDT_MSG_DATA,       // Обычный пакет данных
     RDT_MSG_END,        // Конец передачи
     RDT_MSG_ASK,        // Все пакеты получены
-    RDT_MSG_NACK        // Запрос на переотправку
+    RDT_MSG_NACK,       // Запрос на переотправку
+    RDT_MSG_RESUME,     // Карта уже принятых пакетов блока (ответ на BEGIN)
+    RDT_MSG_HELLO,      // Объявление сеанса (после старта и привязки)
+    RDT_MSG_WAIT,       // Блок собран, но rx-очередь полна: ASK позже (RDT_RX_BACKPRESSURE)
+    RDT_MSG_TIME_REQ,   // Запрос времени (t1)
+    RDT_MSG_TIME_RESP   // Ответ времени (t1, t2, t3)
 } rdt_service_code_t;
 
 // ========================= Структуры данных ==========================
 
 /**
  * @brief Структура пакета, передаваемого по ESP-NOW
+ *
+ * В эфир уходят заголовок, только занятая часть payload и CRC сразу за ней:
+ * кадр DATA - chunk_len байт данных, служебные кадры - свои несколько байт.
+ * CRC считается по заголовку и отправленной части payload.
  */
 typedef struct
 {
     uint8_t  channel;                         ///< Номер логического канала
     uint16_t seq_num;                         ///< Порядковый номер пакета
     uint8_t  service_code;                    ///< Служебный код
+    uint16_t block_id;                        ///< ID блока (в ASK/NACK - ID подтверждаемого блока)
+    uint32_t block_size;                      ///< Размер всего блока: приём можно начать с любого кадра
+    uint32_t block_hash;                      ///< CRC32 содержимого блока: повторная отправка того же блока возобновляется
+    uint8_t  chunk_len;                       ///< Полезная нагрузка кадра DATA блока, байт (настройка отправителя)
+    uint32_t epoch;                           ///< Номер сеанса отправителя (случайный, новый при каждом старте)
+    uint32_t tx_time;                         ///< Время отправки по часам отправителя, мкс (младшие 32 бита)
     uint8_t  payload[RDT_PACKET_PAYLOAD_LEN]; ///< Полезная нагрузка
     uint32_t crc;                             ///< CRC (не входит в расчёт самого CRC)
 } __attribute__((packed)) rdt_packet_t;
 
+_Static_assert(sizeof(rdt_packet_t) <= RDT_PACKET_TOTAL_SIZE, "rdt_packet_t exceeds ESP-NOW frame");
+
+/** @brief Заголовок кадра (до payload), байт */
+#define RDT_PACKET_HDR_LEN      offsetof(rdt_packet_t, payload)
+
+/** @brief Кадр без payload: заголовок и CRC, байт */
+#define RDT_PACKET_MIN_LEN      (RDT_PACKET_HDR_LEN + sizeof(uint32_t))
+
+/** @brief Payload кадра END: номер отправки END */
+#define RDT_END_PAYLOAD_LEN     2
+_Static_assert(RDT_TUNE_CHUNK_MAX == RDT_PACKET_PAYLOAD_LEN, "RDT_TUNE_CHUNK_MAX must match the frame payload");
+
+
 
+/**
+ * @brief Прерванный блок, ожидающий повторной отправки того же содержимого
+ */
+typedef struct
+{
+    bool     valid;               ///< Слот занят
+    uint16_t block_id;            ///< ID блока: повторная отправка содержимого идёт с тем же ID
+    uint32_t block_hash;          ///< CRC32 содержимого
+    size_t   total_size;          ///< Размер блока
+    uint16_t total_packets;       ///< Кол-во пакетов в блоке
+    uint16_t packets_received;    ///< Сколько пакетов принято
+    uint8_t  chunk_len;           ///< Полезная нагрузка кадра DATA
+    uint8_t *rx_buffer;           ///< Собранные данные
+    bool    *packet_received_map; ///< Флаги приёма пакетов
+    int64_t  parked_time;         ///< Когда блок был прерван
+} rdt_rx_parked_t;
 
 /**
  * @brief Внутреннее состояние канала для приёма
@@ -95,8 +221,29 @@ typedef struct
     uint8_t *rx_buffer;           ///< Указатель на буфер для сборки всего блока
     bool    *packet_received_map; ///< Флаги приёма отдельных пакетов
     int64_t  last_packet_time;    ///< Метка времени последнего принятого пакета
+    uint16_t block_id;            ///< ID собираемого (или последнего собранного) блока
+    bool     done_valid;          ///< done_block_id задан
+    uint16_t done_block_id;       ///< ID последнего собранного блока (повтор не собирается заново)
+    uint32_t block_hash;          ///< CRC32 содержимого собираемого блока
+    rdt_rx_parked_t parked;       ///< Прерванный блок для возобновления
+    uint16_t end_round;           ///< Номер последнего принятого END (возвращается в NACK)
+    bool     held;                ///< Собранный блок ждёт места в rx-очереди (ASK не отправлен)
+    uint8_t  chunk_len;           ///< Полезная нагрузка кадра DATA собираемого блока
 } rdt_channel_rx_t;
 
+/**
+ * @brief Недоставленный длинный блок: то же содержимое снова отправляется с его ID
+ */
+typedef struct
+{
+    bool     valid;               ///< Запись занята
+    uint16_t block_id;            ///< ID недоставленного блока
+    uint32_t block_hash;          ///< CRC32 содержимого
+    size_t   size;                ///< Размер блока
+    uint8_t  chunk_len;           ///< Полезная нагрузка кадра DATA
+    int64_t  failed_time;         ///< Когда блок не доставлен
+} rdt_tx_failed_t;
+
 /**
  * @brief Внутреннее состояние канала для передачи
  */
@@ -110,6 +257,22 @@ typedef struct
     uint16_t next_seq_to_send;    ///< Какой seq отправлять следующим (в общей последовательности)
     bool    *packet_sent_map;     ///< Флаги того, какие пакеты уже отправлялись
     int64_t  last_send_time;      ///< Метка времени последнего события отправки
+    void    *user_ctx;            ///< Контекст блока из Rdt_SendBlock (для коллбека завершения)
+    int64_t  start_time;          ///< Метка времени начала передачи блока (для оценки RTT)
+    uint16_t packets_resent;      ///< Повторно отправленных пакетов блока (для оценки потерь)
+    uint16_t block_id;            ///< ID передаваемого блока
+    uint16_t next_block_id;       ///< ID следующего блока
+    uint32_t block_hash;          ///< CRC32 содержимого блока
+    int64_t  resume_wait_until;   ///< До какого момента ждать RDT_MSG_RESUME после BEGIN (0 - не ждать)
+    rdt_tx_failed_t failed[RDT_RESUME_FAILED]; ///< Недоставленные длинные блоки (приёмник мог их отложить)
+    uint16_t acked_max;           ///< Наибольшее число пакетов, подтверждённых картой приёмника
+    int64_t *packet_tx_time;      ///< Время последней отправки каждого пакета
+    uint16_t end_round;           ///< Номер последней отправки END (приёмник возвращает его в NACK)
+    int64_t  end_time[RDT_END_HISTORY]; ///< Время отправки END по номеру (end_round % RDT_END_HISTORY)
+    uint16_t resends_suppressed;  ///< Подавлено повторных отправок по NACK
+    bool     peer_holding;        ///< Приёмник ответил WAIT: ждём без расхода повторов
+    bool     peer_held;           ///< Блок удерживался приёмником (RTT блока не учитывается)
+    rdt_channel_tuning_t tune;    ///< Настройки канала на время блока (снимок при начале передачи)
 } rdt_channel_tx_t;
 
 /**
@@ -130,9 +293,34 @@ typedef struct
     uint8_t tx_queue_length;
     // Максимальный размер одного блока данных в байтах (должен делиться на 192, если хочется ровно)
     size_t  max_block_size;
+    // Коллбек завершения передачи блока (может быть NULL)
+    rdt_tx_done_cb_t tx_done_cb;
+    // Блоки канала шифруются (w_crypt.h)
+    bool encrypted;
+    // Политика переполнения rx-очереди и ключ сообщения для RDT_RX_CONFLATE
+    rdt_rx_policy_t rx_policy;
+    rdt_rx_key_fn_t rx_key_fn;
+    // Умеренность уведомлений получателя: не чаще раза на notify_blocks блоков или notify_us мкс
+    uint8_t  notify_blocks;
+    uint32_t notify_us;
+    uint8_t  notify_pending;      // Блоков в очереди без уведомления
+    int64_t  notify_first;        // Когда поставлен первый из них
 } rdt_channel_t;
 
 
+/**
+ * @brief Заголовок перед данными принятого блока (счётчик ссылок)
+ *
+ * 8 байт: данные блока остаются выровненными на 8.
+ */
+typedef struct
+{
+    uint32_t refs;                ///< Число владельцев блока
+    uint32_t reserved;
+} rdt_block_ref_t;
+
+#define RDT_BLOCK_REF(data)     ((rdt_block_ref_t *)((uint8_t *)(data) - sizeof(rdt_block_ref_t)))
+
 typedef struct {
     int8_t  rssi;                   // Текущий уровень RSSI
     int64_t last_rssi_update;    // Время последнего обновления RSSI
@@ -145,6 +333,17 @@ typedef struct {
 #define RSSI_TIMEOUT 3000
 static rssi_t rssi = {0};
 
+/**
+ * @brief Сглаженные оценки состояния линии (не сбрасываются Wireless_Error_Rate_Get)
+ */
+static rdt_link_stats_t s_link = {0};
+static portMUX_TYPE s_link_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Защита счётчиков ссылок принятых блоков
+ */
+static portMUX_TYPE s_block_ref_mux = portMUX_INITIALIZER_UNLOCKED;
+
 // ========================= Глобальные/статические переменные ==========================
 
 static const char *TAG = "rdt";
@@ -155,6 +354,66 @@ static const char *TAG = "rdt";
  */
 static rdt_channel_t s_channels[RDT_MAX_CHANNELS] = {0};
 
+/**
+ * @brief Настройки RDT (Rdt_TuningSet); каналы берут их снимок в начале каждого блока
+ */
+static rdt_tuning_t s_tuning;
+static bool         s_tuning_ready = false;
+
+static void rdt_tuning_defaults(rdt_tuning_t *t)
+{
+    for (uint8_t i = 0; i < RDT_MAX_CHANNELS; i++)
+    {
+        t->channel[i].chunk_len      = RDT_PACKET_PAYLOAD_LEN;
+        t->channel[i].ack_timeout_ms = RDT_ACK_TIMEOUT_MS;
+        t->channel[i].max_retry      = RDT_MAX_RETRY_COUNT;
+    }
+    t->event_queue_len = RDT_EVENT_QUEUE_LEN;
+    t->task_priority   = RDT_TASK_PRIORITY;
+}
+
+static bool rdt_tuning_valid(const rdt_tuning_t *t)
+{
+    for (uint8_t i = 0; i < RDT_MAX_CHANNELS; i++)
+    {
+        const rdt_channel_tuning_t *c = &t->channel[i];
+        if (c->chunk_len < RDT_TUNE_CHUNK_MIN || c->chunk_len > RDT_TUNE_CHUNK_MAX) return false;
+        if (c->ack_timeout_ms < RDT_TUNE_ACK_MIN_MS || c->ack_timeout_ms > RDT_TUNE_ACK_MAX_MS) return false;
+        if (c->max_retry < RDT_TUNE_RETRY_MIN || c->max_retry > RDT_TUNE_RETRY_MAX) return false;
+    }
+    if (t->event_queue_len < RDT_TUNE_QUEUE_MIN || t->event_queue_len > RDT_TUNE_QUEUE_MAX) return false;
+    if (t->task_priority < RDT_TUNE_PRIO_MIN || t->task_priority > RDT_TUNE_PRIO_MAX) return false;
+    return true;
+}
+
+/**
+ * @brief Настройки по умолчанию, поверх - сохранённые в NVS (если они в границах)
+ *
+ * Вызывается из Wireless_Init: к этому моменту приложение инициализировало NVS (нужно Wi-Fi).
+ * Если NVS всё же не готово, загрузка повторится при следующем вызове
+ */
+static void rdt_tuning_load(void)
+{
+    if (s_tuning_ready) return;
+    rdt_tuning_defaults(&s_tuning);
+
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(RDT_TUNING_NVS_NAMESPACE, NVS_READONLY, &h);
+    s_tuning_ready = err != ESP_ERR_NVS_NOT_INITIALIZED;
+    if (err != ESP_OK) return;
+    rdt_tuning_t saved;
+    size_t len = sizeof(saved);
+    err = nvs_get_blob(h, RDT_TUNING_NVS_KEY, &saved, &len);
+    nvs_close(h);
+    if (err != ESP_OK || len != sizeof(saved)) return;
+    if (!rdt_tuning_valid(&saved))
+    {
+        logW("Saved RDT tuning out of range, defaults used");
+        return;
+    }
+    s_tuning = saved;
+}
+
 /**
  * @brief Мьютекс для защиты общих структур
  */
@@ -173,19 +432,45 @@ typedef enum
 {
     RDT_EVENT_SEND_OK,
     RDT_EVENT_SEND_FAIL, // Для ESP-NOW при неуспехе (но в LR может не отрабатывать)
-    RDT_EVENT_RECV_PKT
+    RDT_EVENT_RECV_PKT,
+    RDT_EVENT_RX_SPACE,  // Получатель забрал блок из rx-очереди (для RDT_RX_BACKPRESSURE)
+    RDT_EVENT_TX_READY   // В tx-очередь свободного канала поставлен блок
 } rdt_internal_event_type_t;
 
 typedef struct
 {
     rdt_internal_event_type_t event_type; ///< Тип события
-    rdt_packet_t packet;                  ///< Копия принятого пакета (для RDT_EVENT_RECV_PKT)
+    rdt_packet_t packet;                  ///< Копия принятого пакета (для RDT_EVENT_RECV_PKT), CRC - в поле crc
+    uint8_t payload_len;                  ///< Принятая часть payload, байт
     uint8_t src_mac[6];                  ///< MAC отправителя
+    int64_t rx_time;                     ///< Время приёма пакета, мкс
 } rdt_event_msg_t;
 
 static QueueHandle_t s_rdt_event_queue = NULL;
 static TaskHandle_t  s_rdt_task_handle = NULL;
 static u8            s_peer_macaddr[6] = {0};
+
+/**
+ * @brief Состояние обмена времени (NTP: t1 - запрос, t2 - приём у пира, t3 - ответ пира, t4 - приём ответа)
+ */
+typedef struct
+{
+    uint32_t period_ms;                         ///< Период обмена (0 - выключен)
+    int64_t  next_req;                          ///< Когда отправить следующий запрос
+    int64_t  pending_t1;                        ///< t1 запроса без ответа (0 - нет)
+    int64_t  offset_us[RDT_TIME_SAMPLES];       ///< Смещение часов пира по обменам окна
+    uint32_t delay_us[RDT_TIME_SAMPLES];        ///< Задержка обмена без времени обработки у пира
+    uint8_t  count;                             ///< Заполнено в окне
+    uint8_t  pos;                               ///< Следующая позиция окна
+} rdt_time_sync_t;
+
+static rdt_time_sync_t s_time = {0};
+
+/**
+ * @brief Номер своего сеанса и последний известный номер сеанса пира (0 - неизвестен)
+ */
+static uint32_t      s_epoch      = 0;
+static uint32_t      s_peer_epoch = 0;
 esp_event_loop_handle_t W_event_loop = NULL;
 
 // ========================= Прототипы статических функций ==========================
@@ -196,6 +481,11 @@ static void rdt_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status);
 /** @brief Коллбек ESP-NOW для приёма */
 static void rdt_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len);
 
+/** @brief Транспорт ESP-NOW */
+static int rdt_espnow_send(void *ctx, const uint8_t *dst_mac, const uint8_t *frame, size_t len);
+static int rdt_espnow_add_peer(void *ctx, const uint8_t *mac);
+static int rdt_espnow_del_peer(void *ctx, const uint8_t *mac);
+
 /** @brief Основная задача RDT для обработки событий */
 static void rdt_task(void *arg);
 
@@ -204,10 +494,37 @@ static esp_err_t rdt_send_one_packet(uint8_t channel_idx, uint16_t seq, rdt_serv
                                      const uint8_t *payload, size_t payload_len);
 
 /** @brief Формирование CRC пакета */
-static uint32_t rdt_calc_crc(const rdt_packet_t *pkt);
+static uint32_t rdt_calc_crc(const rdt_packet_t *pkt, size_t payload_len);
 
 /** @brief Обработчик принятого пакета */
-static void rdt_process_received_packet(uint8_t channel_idx, const rdt_packet_t *pkt, const uint8_t *src_mac);
+static void rdt_process_received_packet(uint8_t channel_idx, const rdt_packet_t *pkt, size_t payload_len,
+                                        const uint8_t *src_mac, int64_t rx_time);
+
+// Начать сборку блока по заголовку любого его кадра
+static bool rdt_rx_start(rdt_channel_t *ch, const rdt_packet_t *pkt);
+static void rdt_send_resume(uint8_t channel_idx);
+static void rdt_send_begin(uint8_t channel_idx, bool ask_resume);
+static void rdt_tx_failed_add(rdt_channel_tx_t *tx);
+static bool rdt_tx_failed_take(rdt_channel_tx_t *tx, uint16_t *block_id);
+static void rdt_rx_expire_parked(uint8_t channel_idx);
+
+/** @brief Отдать собранный блок в rx-очередь по политике канала, ASK */
+static bool rdt_rx_deliver(uint8_t channel_idx);
+static void rdt_rx_flush_held(uint8_t channel_idx);
+
+/** @brief Уведомление получателя канала с учётом умеренности */
+static void rdt_rx_notify(uint8_t channel_idx);
+static void rdt_rx_notify_due(uint8_t channel_idx);
+static TickType_t rdt_task_wait_ticks(void);
+
+/** @brief Проверка номера сеанса пира: сброс состояния каналов после его перезапуска */
+static void rdt_check_peer_epoch(const rdt_packet_t *pkt);
+static void rdt_send_hello(void);
+
+/** @brief Обмен времени с пиром и односторонние задержки */
+static void rdt_time_poll(void);
+static void rdt_time_reset(void);
+static void rdt_owd_rx_sample(const rdt_packet_t *pkt, int64_t rx_time);
 
 /** @brief Обработка логики передачи (текущего блока) */
 static void rdt_process_tx_channel(uint8_t channel_idx);
@@ -218,6 +535,10 @@ static void rdt_restart_tx_block(uint8_t channel_idx);
 /** @brief Поиск пропущенных пакетов и формирование nack */
 static void rdt_send_nack_for_missing(uint8_t channel_idx, const uint8_t *dst_mac);
 
+/** @brief Завершение передачи текущего блока: освобождение буферов и вызов коллбека */
+static void rdt_finish_tx_block(uint8_t channel_idx, bool delivered);
+static int64_t rdt_rto_us(const rdt_channel_tx_t *tx);
+
 static void check_connection_status(void);
 static void update_link_quality_score(void);
 
@@ -226,9 +547,7 @@ static void update_link_quality_score(void);
 static void rdt_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status)
 {
     if (!mac_addr) return;
-    rdt_event_msg_t msg = {0};
-    msg.event_type = (status == ESP_NOW_SEND_SUCCESS) ? RDT_EVENT_SEND_OK : RDT_EVENT_SEND_FAIL;
-    xQueueSendFromISR(s_rdt_event_queue, &msg, NULL);
+    Rdt_TransportSendDone(status == ESP_NOW_SEND_SUCCESS);
 }
 
 /**
@@ -239,41 +558,49 @@ static void rdt_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status)
  */
 static void rdt_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len)
 {
-    if (!recv_info || !data || len < (int)sizeof(rdt_packet_t))
+    if (!recv_info || !data || len < 0)
     {
         // Если данные некорректны, выходим
         return;
     }
-    
-    // проверка мака пира
-    if (memcmp(recv_info->src_addr, s_peer_macaddr, ESP_NOW_ETH_ALEN) != 0)
-    {
-        return;
-    }
-
-    rssi.last_rssi_update = xTaskGetTickCount();
-    rssi.rssi = recv_info->rx_ctrl->rssi;
+    Rdt_TransportInput(recv_info->src_addr, data, (size_t)len, recv_info->rx_ctrl->rssi);
+}
 
-    // Считаем, что данные не превышают 250 байт, а структура rdt_packet_t соответствует этим данным.
-    // Создаём сообщение для обработки в основной задаче.
-    rdt_event_msg_t msg = {0};
-    msg.event_type = RDT_EVENT_RECV_PKT;
+static int rdt_espnow_send(void *ctx, const uint8_t *dst_mac, const uint8_t *frame, size_t len)
+{
+    return esp_now_send(dst_mac, frame, len) != ESP_OK;
+}
 
-    // Копируем MAC-адрес отправителя
-    memcpy(msg.src_mac, recv_info->src_addr, ESP_NOW_ETH_ALEN);
+static int rdt_espnow_add_peer(void *ctx, const uint8_t *mac)
+{
+    esp_now_peer_info_t peer = {0};
+    peer.channel = 1; // или другой канал
+    peer.ifidx   = ESP_IF_WIFI_STA;
+    peer.encrypt = false;
+    memcpy(peer.peer_addr, mac, ESP_NOW_ETH_ALEN);
+    esp_err_t err = esp_now_add_peer(&peer);
+    return err != ESP_OK && err != ESP_ERR_ESPNOW_EXIST;
+}
 
-    // Копируем данные пакета (если длина подходит для структуры)
-    if (len >= (int)sizeof(rdt_packet_t))
-    {
-        memcpy(&msg.packet, data, sizeof(rdt_packet_t));
-    }
+static int rdt_espnow_del_peer(void *ctx, const uint8_t *mac)
+{
+    esp_err_t err = esp_now_del_peer(mac);
+    return err != ESP_OK && err != ESP_ERR_ESPNOW_NOT_FOUND;
+}
 
-    // Отправляем сообщение в очередь событий, чтобы обработка происходила в задаче rdt_task
-    if (xQueueSendFromISR(s_rdt_event_queue, &msg, NULL) != pdTRUE)
-    {
-        // Если очередь переполнена, обработка будет пропущена
-        logW("Event queue full, packet dropped");
-    }
+static const rdt_transport_t s_espnow_transport = {
+    .send     = rdt_espnow_send,
+    .add_peer = rdt_espnow_add_peer,
+    .del_peer = rdt_espnow_del_peer,
+    .flush    = NULL,
+    .ctx      = NULL,
+};
+static const rdt_transport_t *s_transport = &s_espnow_transport;
+
+// Транспорт с пакетной отправкой отдаёт накопленные за проход кадры разом
+static void rdt_transport_flush(void)
+{
+    if (s_transport->flush) s_transport->flush(s_transport->ctx);
 }
 
 static void rdt_task(void *arg)
@@ -283,7 +610,7 @@ static void rdt_task(void *arg)
 
     while (true)
     {
-        if (xQueueReceive(s_rdt_event_queue, &event, pdMS_TO_TICKS(50)) == pdTRUE)
+        if (xQueueReceive(s_rdt_event_queue, &event, rdt_task_wait_ticks()) == pdTRUE)
         {
             xSemaphoreTake(s_rdt_mutex, portMAX_DELAY);
 
@@ -299,7 +626,8 @@ static void rdt_task(void *arg)
                 // Обработка принятого пакета
                 if (event.packet.channel < RDT_MAX_CHANNELS)
                 {
-                    rdt_process_received_packet(event.packet.channel, &event.packet, event.src_mac);
+                    rdt_process_received_packet(event.packet.channel, &event.packet, event.payload_len,
+                                                event.src_mac, event.rx_time);
                 }
                 break;
             default:
@@ -310,7 +638,12 @@ static void rdt_task(void *arg)
             for (uint8_t i = 0; i < RDT_MAX_CHANNELS; i++)
             {
                 rdt_process_tx_channel(i);
+                rdt_rx_expire_parked(i);
+                rdt_rx_flush_held(i);
+                rdt_rx_notify_due(i);
             }
+            rdt_time_poll();
+            rdt_transport_flush();
 
             xSemaphoreGive(s_rdt_mutex);
         }
@@ -321,7 +654,12 @@ static void rdt_task(void *arg)
             for (uint8_t i = 0; i < RDT_MAX_CHANNELS; i++)
             {
                 rdt_process_tx_channel(i);
+                rdt_rx_expire_parked(i);
+                rdt_rx_flush_held(i);
+                rdt_rx_notify_due(i);
             }
+            rdt_time_poll();
+            rdt_transport_flush();
             xSemaphoreGive(s_rdt_mutex);
         }
     }
@@ -337,192 +675,712 @@ static esp_err_t rdt_send_one_packet(uint8_t channel_idx, uint16_t seq, rdt_serv
     pkt.channel      = channel_idx;
     pkt.seq_num      = seq;
     pkt.service_code = (uint8_t)code;
+    pkt.epoch        = s_epoch;
+    pkt.tx_time      = (uint32_t)esp_timer_get_time();
+
+    // Кадры блока несут его ID, размер и хеш; ASK/NACK/RESUME/WAIT - принимаемого блока
+    if (code == RDT_MSG_ASK || code == RDT_MSG_NACK || code == RDT_MSG_RESUME || code == RDT_MSG_WAIT)
+    {
+        pkt.block_id   = s_channels[channel_idx].rx_ctrl.block_id;
+        pkt.block_size = (uint32_t)s_channels[channel_idx].rx_ctrl.total_size;
+        pkt.block_hash = s_channels[channel_idx].rx_ctrl.block_hash;
+        pkt.chunk_len  = s_channels[channel_idx].rx_ctrl.chunk_len;
+    }
+    else if (code != RDT_MSG_HELLO && code != RDT_MSG_TIME_REQ && code != RDT_MSG_TIME_RESP)
+    {
+        pkt.block_id   = s_channels[channel_idx].tx_ctrl.block_id;
+        pkt.block_size = (uint32_t)s_channels[channel_idx].tx_ctrl.current_size;
+        pkt.block_hash = s_channels[channel_idx].tx_ctrl.block_hash;
+        pkt.chunk_len  = s_channels[channel_idx].tx_ctrl.tune.chunk_len;
+    }
 
     if (payload && payload_len > 0)
     {
         memcpy(pkt.payload, payload, payload_len);
     }
 
-    pkt.crc = rdt_calc_crc(&pkt);
+    // Время отправки каждого пакета блока и номер отправки END - для отсева устаревших NACK
+    rdt_channel_tx_t *tx = &s_channels[channel_idx].tx_ctrl;
+    if ((code == RDT_MSG_BEGIN || code == RDT_MSG_DATA || code == RDT_MSG_END) && tx->packet_tx_time && seq < tx->total_packets)
+    {
+        int64_t now = esp_timer_get_time();
+        tx->packet_tx_time[seq] = now;
+        if (code == RDT_MSG_END)
+        {
+            if (++tx->end_round == 0) tx->end_round = 1;
+            tx->end_time[tx->end_round % RDT_END_HISTORY] = now;
+            pkt.payload[0] = (uint8_t)(tx->end_round & 0xFF);
+            pkt.payload[1] = (uint8_t)((tx->end_round >> 8) & 0xFF);
+        }
+    }
+
+    // Кадр обрезается по занятой части payload, CRC идёт сразу за ней
+    if (code == RDT_MSG_END && payload_len < RDT_END_PAYLOAD_LEN) payload_len = RDT_END_PAYLOAD_LEN;
+    uint32_t crc = rdt_calc_crc(&pkt, payload_len);
+    size_t frame_len = RDT_PACKET_HDR_LEN + payload_len;
+    memcpy((uint8_t *)&pkt + frame_len, &crc, sizeof(crc));
+    frame_len += sizeof(crc);
 
-    // Отправка по ESP-NOW
-    return esp_now_send(s_peer_macaddr, (uint8_t*)&pkt, sizeof(rdt_packet_t));
+    return s_transport->send(s_transport->ctx, s_peer_macaddr, (const uint8_t *)&pkt, frame_len) ? ESP_FAIL : ESP_OK;
 }
 
-static uint32_t rdt_calc_crc(const rdt_packet_t *pkt)
+static uint32_t rdt_calc_crc(const rdt_packet_t *pkt, size_t payload_len)
 {
-    // Поле CRC не должно входить в расчёт, поэтому используем размер без последнего поля
-    // Считаем: sizeof(rdt_packet_t) - sizeof(pkt->crc) = ...
-    uint32_t crc_len = sizeof(rdt_packet_t) - sizeof(pkt->crc);
-    return esp_crc32_le(UINT32_MAX, (const uint8_t*)pkt, crc_len);
+    // Заголовок и отправленная часть payload; полный кадр (payload_len == RDT_PACKET_PAYLOAD_LEN)
+    // даёт тот же CRC, что и прежний кадр постоянной длины
+    return w_crc32_le(UINT32_MAX, (const uint8_t*)pkt, RDT_PACKET_HDR_LEN + payload_len);
 }
 
-static void rdt_process_received_packet(uint8_t channel_idx, const rdt_packet_t *pkt, const uint8_t *src_mac)
+/**
+ * @brief Буфер сборки блока: данные со счётчиком ссылок перед ними (одна ссылка)
+ */
+static uint8_t *rdt_rx_buf_alloc(size_t size)
 {
-    if (channel_idx >= RDT_MAX_CHANNELS) return;
-    if (s_channels[channel_idx].tx_queue == NULL || s_channels[channel_idx].tx_queue_length == 0 || s_channels[channel_idx].rx_queue == NULL) return;
-    
-    // Проверяем CRC
-    uint32_t calc_crc = rdt_calc_crc(pkt);
-    if (calc_crc != pkt->crc)
+    rdt_block_ref_t *ref = (rdt_block_ref_t *)calloc(1, sizeof(rdt_block_ref_t) + size);
+    if (!ref) return NULL;
+    ref->refs = 1;
+    return (uint8_t *)(ref + 1);
+}
+
+static void rdt_rx_buf_free(uint8_t *data)
+{
+    if (data) free(RDT_BLOCK_REF(data));
+}
+
+static void rdt_rx_parked_free(rdt_rx_parked_t *p)
+{
+    rdt_rx_buf_free(p->rx_buffer);
+    free(p->packet_received_map);
+    memset(p, 0, sizeof(*p));
+}
+
+// Отложить недособранный блок: его могут отправить заново с новым ID
+static void rdt_rx_park(rdt_channel_rx_t *rx)
+{
+    rdt_rx_parked_free(&rx->parked);
+    rx->parked.valid               = true;
+    rx->parked.block_id            = rx->block_id;
+    rx->parked.block_hash          = rx->block_hash;
+    rx->parked.total_size          = rx->total_size;
+    rx->parked.total_packets       = rx->total_packets;
+    rx->parked.packets_received    = rx->packets_received;
+    rx->parked.chunk_len           = rx->chunk_len;
+    rx->parked.rx_buffer           = rx->rx_buffer;
+    rx->parked.packet_received_map = rx->packet_received_map;
+    rx->parked.parked_time         = esp_timer_get_time();
+    rx->rx_buffer           = NULL;
+    rx->packet_received_map = NULL;
+    logD("block %u parked: %u/%u packets", (unsigned)rx->block_id,
+         (unsigned)rx->packets_received, (unsigned)rx->total_packets);
+}
+
+static bool rdt_rx_start(rdt_channel_t *ch, const rdt_packet_t *pkt)
+{
+    rdt_channel_rx_t *rx = &ch->rx_ctrl;
+
+    // Размер приходит в каждом кадре: не больше блока канала (с хвостом шифрования),
+    // число пакетов - в пределах uint16_t. Иначе кадр отбрасывается, текущий приём не трогаем
+    size_t limit = ch->max_block_size + (ch->encrypted ? W_CRYPT_OVERHEAD : 0);
+    size_t size  = pkt->block_size ? pkt->block_size : ch->max_block_size;
+    if (size > limit || (size + pkt->chunk_len - 1) / pkt->chunk_len + 2 > UINT16_MAX)
     {
-        // CRC не совпал — игнорируем
-        return;
+        logD("block %u rejected: size %u", (unsigned)pkt->block_id, (unsigned)pkt->block_size);
+        return false;
     }
 
-    rdt_channel_t    *ch  = &s_channels[channel_idx];
-    rdt_channel_rx_t *rx  = &ch->rx_ctrl;
-    rdt_channel_tx_t *tx  = &ch->tx_ctrl; // Для некоторых типов пакетов (nack, ask) нужна передача
-    
-    switch (pkt->service_code)
+    // Прерванный новым блоком приём не выбрасываем, а откладываем
+    if (rx->receiving && rx->rx_buffer && rx->packet_received_map &&
+        rx->packets_received > 0 && rx->packets_received < rx->total_packets)
     {
-    case RDT_MSG_BEGIN:
+        rdt_rx_park(rx);
+    }
+
+    rx->receiving        = false;
+    rx->held             = false;
+    rx->packets_received = 0;
+    rx->block_id         = pkt->block_id;
+    rx->block_hash       = pkt->block_hash;
+    rx->chunk_len        = pkt->chunk_len;
+    // Размер неизвестен (0) - выставим максимум
+    rx->total_size    = size;
+    rx->total_packets = (rx->total_size + rx->chunk_len - 1) / rx->chunk_len + 2; // +2 c учётом begin/end
+    rssi.total_packets_sent += rx->total_packets;
+    // Освобождаем старые буферы, если что
+    if (rx->rx_buffer)
     {
-        // Начало приёма на этом канале
-        rx->receiving       = true;
-        rx->packets_received = 0;
-        // Предположим, что размер блока передаётся в первых байтах payload (если нужно),
-        // либо в любом другом формате. Для примера — пусть там лежит 4 байта размера.
-        if (pkt->payload[0] || pkt->payload[1] || pkt->payload[2] || pkt->payload[3])
-        {
-            rx->total_size = 
-                ((size_t)pkt->payload[0])       |
-                ((size_t)pkt->payload[1] << 8)  |
-                ((size_t)pkt->payload[2] << 16) |
-                ((size_t)pkt->payload[3] << 24);
-        }
-        else
-        {
-            // Если нет ясен размер, выставим максимум
-            rx->total_size = ch->max_block_size;
-        }
-        rx->total_packets    = (rx->total_size + RDT_PACKET_PAYLOAD_LEN - 1) / RDT_PACKET_PAYLOAD_LEN + 2; // +2 c учётом begin/end
-        rssi.total_packets_sent += rx->total_packets;
-        // Освобождаем старые буферы, если что
-        if (rx->rx_buffer)
-        {
-            free(rx->rx_buffer);
-            rx->rx_buffer = NULL;
-        }
-        if (rx->packet_received_map)
-        {
-            free(rx->packet_received_map);
-            rx->packet_received_map = NULL;
-        }
-        // Выделяем новые буферы
-        rx->rx_buffer          = (uint8_t*)calloc(1, rx->total_size);
-        rx->packet_received_map = (bool*)calloc(rx->total_packets, sizeof(bool));
-        // Сразу фиксируем приём пакета BEGIN
-        rx->packet_received_map[pkt->seq_num] = true;
-        rx->packets_received                  = 1;
-        rx->last_packet_time                  = esp_timer_get_time(); // microseconds
-        break;
+        rdt_rx_buf_free(rx->rx_buffer);
+        rx->rx_buffer = NULL;
+    }
+    if (rx->packet_received_map)
+    {
+        free(rx->packet_received_map);
+        rx->packet_received_map = NULL;
     }
 
-    case RDT_MSG_DATA:
+    // Тот же блок уже частично принят - продолжаем с его карты. Отправитель повторяет недоставленный
+    // блок с прежним ID, поэтому совпадать должны ID, размер и хеш: чужие данные с тем же CRC-32
+    // и размером не подмешаются
+    rdt_rx_parked_t *p = &rx->parked;
+    if (p->valid && pkt->block_size && p->block_id == pkt->block_id && p->block_hash == pkt->block_hash &&
+        p->total_size == rx->total_size && p->chunk_len == rx->chunk_len)
     {
-        if (!rx->receiving) return; // Не в режиме приёма
-        if (pkt->seq_num >= rx->total_packets) 
-        {
-            // seq_num выходит за рамки
-            return;
-        }
-        if (!rx->packet_received_map[pkt->seq_num])
+        rx->rx_buffer           = p->rx_buffer;
+        rx->packet_received_map = p->packet_received_map;
+        rx->packets_received    = p->packets_received;
+        p->rx_buffer            = NULL;
+        p->packet_received_map  = NULL;
+        rdt_rx_parked_free(p);
+        // BEGIN/END относятся к новой попытке
+        rx->packets_received -= rx->packet_received_map[0] + rx->packet_received_map[rx->total_packets - 1];
+        rx->packet_received_map[0] = false;
+        rx->packet_received_map[rx->total_packets - 1] = false;
+        rx->receiving = true;
+        logD("block %u resumed: %u/%u packets", (unsigned)rx->block_id,
+             (unsigned)rx->packets_received, (unsigned)rx->total_packets);
+        return true;
+    }
+
+    // Выделяем новые буферы
+    rx->rx_buffer           = rdt_rx_buf_alloc(rx->total_size);
+    rx->packet_received_map = (bool*)calloc(rx->total_packets, sizeof(bool));
+    if (!rx->rx_buffer || !rx->packet_received_map)
+    {
+        logE("no memory for block of %u bytes", (unsigned)rx->total_size);
+        rdt_rx_buf_free(rx->rx_buffer);
+        free(rx->packet_received_map);
+        rx->rx_buffer           = NULL;
+        rx->packet_received_map = NULL;
+        return false;
+    }
+    rx->receiving = true;
+    return true;
+}
+
+/**
+ * @brief Отправить карту принятых пакетов блока (ответ на BEGIN длинного блока)
+ */
+static void rdt_send_resume(uint8_t channel_idx)
+{
+    rdt_channel_rx_t *rx = &s_channels[channel_idx].rx_ctrl;
+
+    for (uint16_t base = 0; base < rx->total_packets; base += RDT_RESUME_BITS)
+    {
+        uint8_t buffer[RDT_PACKET_PAYLOAD_LEN] = {0};
+        buffer[0] = (uint8_t)(base & 0xFF);
+        buffer[1] = (uint8_t)((base >> 8) & 0xFF);
+        for (uint16_t i = 0; i < RDT_RESUME_BITS && base + i < rx->total_packets; i++)
         {
-            rx->packet_received_map[pkt->seq_num] = true;
-            rx->packets_received++;
-            // Копируем payload
-            size_t offset = (pkt->seq_num - 1) * RDT_PACKET_PAYLOAD_LEN; 
-            // seq_num - 1, т.к. 0 — это BEGIN, а начиная с 1 идут data
-            size_t copy_len = RDT_PACKET_PAYLOAD_LEN;
-            if (offset + copy_len > rx->total_size)
-            {
-                copy_len = rx->total_size - offset;
-            }
-            if (offset < rx->total_size)
+            // END не сообщается: отправитель должен прислать его, чтобы получить ASK или NACK
+            if (rx->packet_received_map[base + i] && base + i != rx->total_packets - 1)
             {
-                memcpy(rx->rx_buffer + offset, pkt->payload, copy_len);
+                buffer[2 + i / 8] |= (uint8_t)(1 << (i % 8));
             }
         }
-        rx->last_packet_time = esp_timer_get_time();
-        // Проверим, не надо ли отправить NACK. Если не пришли какие-то пакеты до seq_num?
-        // Для упрощения отправим NACK только по таймеру или при получении "end".
-        break;
+        rdt_send_one_packet(channel_idx, base, RDT_MSG_RESUME, buffer, RDT_PACKET_PAYLOAD_LEN);
     }
+}
 
-    case RDT_MSG_END:
+static uint32_t rdt_rx_key(const rdt_channel_t *ch, const rdt_block_item_t *item)
+{
+    if (ch->rx_key_fn) return ch->rx_key_fn(item->data_ptr, item->data_size);
+    return item->data_size ? item->data_ptr[0] : 0;
+}
+
+// Убрать из rx-очереди блоки с тем же ключом (порядок остальных сохраняется)
+static void rdt_rx_drop_key(uint8_t channel_idx, const rdt_block_item_t *item)
+{
+    rdt_channel_t *ch = &s_channels[channel_idx];
+    uint32_t key = rdt_rx_key(ch, item);
+    UBaseType_t n = uxQueueMessagesWaiting(ch->rx_queue);
+    for (UBaseType_t i = 0; i < n; i++)
     {
-        if (!rx->receiving) return;
-        if (pkt->seq_num != rx->total_packets - 1)
-        {
-            // seq не совпадает с последним
-            return;
-        }
-        // Помечаем, что получили последний
-        if (!rx->packet_received_map[pkt->seq_num])
-        {
-            rx->packet_received_map[pkt->seq_num] = true;
-            rx->packets_received++;
-        }
-        // Проверяем, все ли пакеты
-        bool all_ok = (rx->packets_received == rx->total_packets);
-        if (!all_ok)
-        {
-            // Отправляем NACK
-            rdt_send_nack_for_missing(channel_idx, src_mac);
-        }
-        else
+        rdt_block_item_t old;
+        if (xQueueReceive(ch->rx_queue, &old, 0) != pdTRUE) break;
+        if (rdt_rx_key(ch, &old) == key)
         {
-            // Всё собрано, отправляем ASK
-            rdt_send_one_packet(channel_idx, 0, RDT_MSG_ASK, NULL, 0);
-            // Складываем блок в rx-очередь
-            rdt_block_item_t completed_block;
-            memset(&completed_block, 0, sizeof(completed_block));
-            completed_block.data_ptr  = rx->rx_buffer;
-            completed_block.data_size = rx->total_size;
-            //logI("Recv block %d bytes from channel %d", completed_block.data_size, channel_idx);
-            if(pdTRUE != xQueueSend(ch->rx_queue, &completed_block, 0))
-            {
-                logE("rx_queue full on channel %d!", channel_idx);
-                free(rx->rx_buffer);
-            }
-            esp_event_post_to(W_event_loop, WIRELESS_EVENT_BASE, channel_idx, NULL, 0, 0);
-            // Обнуляем
-            rx->rx_buffer          = NULL;
-            if (rx->packet_received_map)
-            {
-                free(rx->packet_received_map);
-                rx->packet_received_map = NULL;
-            }
-            rx->receiving          = false;
+            Rdt_FreeReceivedBlock(&old);
+            portENTER_CRITICAL(&s_link_mux);
+            s_link.rx_overflow[channel_idx]++;
+            portEXIT_CRITICAL(&s_link_mux);
+            continue;
         }
-        rx->last_packet_time = esp_timer_get_time();
-        break;
+        xQueueSend(ch->rx_queue, &old, 0);
     }
+}
 
-    case RDT_MSG_ASK:
+/**
+ * @brief Положить блок в rx-очередь по политике переполнения канала
+ * @return true - блок в очереди или отброшен политикой, false - очередь полна, блок удерживается
+ */
+static bool rdt_rx_enqueue(uint8_t channel_idx, rdt_block_item_t *item)
+{
+    rdt_channel_t  *ch     = &s_channels[channel_idx];
+    rdt_rx_policy_t policy = ch->rx_policy;
+    // Ключ зашифрованного блока до расшифровки неизвестен
+    if (policy == RDT_RX_CONFLATE && ch->encrypted) policy = RDT_RX_DROP_OLDEST;
+
+    if (policy == RDT_RX_CONFLATE)
     {
-        // Приёмник подтверждает, что все пакеты получены
-        if (tx->sending)
+        rdt_rx_drop_key(channel_idx, item);
+    }
+    if (xQueueSend(ch->rx_queue, item, 0) == pdTRUE) return true;
+
+    if (policy == RDT_RX_BACKPRESSURE) return false;
+
+    portENTER_CRITICAL(&s_link_mux);
+    s_link.rx_overflow[channel_idx]++;
+    portEXIT_CRITICAL(&s_link_mux);
+
+    if (policy == RDT_RX_DROP_OLDEST || policy == RDT_RX_CONFLATE)
+    {
+        rdt_block_item_t old;
+        if (xQueueReceive(ch->rx_queue, &old, 0) == pdTRUE)
         {
-            // Завершаем передачу блока, освобождаем буферы
-           // logI("Freeing block %p", tx->tx_buffer);
-            free(tx->packet_sent_map);
-            tx->packet_sent_map = NULL;
-            free(tx->tx_buffer);
-            tx->tx_buffer       = NULL;
-            tx->sending         = false;
-            //logI("Channel %d: block transmitted successfully", channel_idx);
-            logD("ask wait for %" PRId64" ms", (esp_timer_get_time() - tx->last_send_time) / 1000);
+            Rdt_FreeReceivedBlock(&old);
         }
-        break;
+        if (xQueueSend(ch->rx_queue, item, 0) == pdTRUE) return true;
     }
+    logE("rx_queue full on channel %d!", channel_idx);
+    rdt_rx_buf_free(item->data_ptr);
+    return true;
+}
 
-    case RDT_MSG_NACK:
+static bool rdt_rx_deliver(uint8_t channel_idx)
+{
+    rdt_channel_t    *ch = &s_channels[channel_idx];
+    rdt_channel_rx_t *rx = &ch->rx_ctrl;
+
+    rdt_block_item_t completed_block;
+    memset(&completed_block, 0, sizeof(completed_block));
+    completed_block.data_ptr  = rx->rx_buffer;
+    completed_block.data_size = rx->total_size;
+    //logI("Recv block %d bytes from channel %d", completed_block.data_size, channel_idx);
+    if (!rdt_rx_enqueue(channel_idx, &completed_block))
     {
-        // В payload могут быть номера seq для повторной отправки
+        // Блок остаётся собранным в rx_ctrl; ASK - когда получатель освободит место
+        if (!rx->held) logD("Channel %d: block %u held, rx queue full", channel_idx, (unsigned)rx->block_id);
+        rx->held = true;
+        rdt_send_one_packet(channel_idx, 0, RDT_MSG_WAIT, NULL, 0);
+        return false;
+    }
+    if (rx->held) logD("Channel %d: held block %u delivered, ASK", channel_idx, (unsigned)rx->block_id);
+    rdt_send_one_packet(channel_idx, 0, RDT_MSG_ASK, NULL, 0);
+    rdt_rx_notify(channel_idx);
+    // Обнуляем
+    rx->rx_buffer          = NULL;
+    if (rx->packet_received_map)
+    {
+        free(rx->packet_received_map);
+        rx->packet_received_map = NULL;
+    }
+    rx->held               = false;
+    rx->receiving          = false;
+    rx->done_valid         = true;
+    rx->done_block_id      = rx->block_id;
+    return true;
+}
+
+/**
+ * @brief Отдать удерживаемый блок, если в rx-очереди появилось место
+ */
+static void rdt_rx_flush_held(uint8_t channel_idx)
+{
+    rdt_channel_t *ch = &s_channels[channel_idx];
+    if (ch->rx_ctrl.held && ch->rx_queue && uxQueueSpacesAvailable(ch->rx_queue) > 0)
+    {
+        rdt_rx_deliver(channel_idx);
+    }
+}
+
+static void rdt_rx_notify_post(uint8_t channel_idx)
+{
+    s_channels[channel_idx].notify_pending = 0;
+    esp_event_post_to(W_event_loop, WIRELESS_EVENT_BASE, channel_idx, NULL, 0, 0);
+}
+
+static void rdt_rx_notify(uint8_t channel_idx)
+{
+    rdt_channel_t *ch = &s_channels[channel_idx];
+    if (ch->notify_pending == 0) ch->notify_first = esp_timer_get_time();
+    ch->notify_pending++;
+    // Полная очередь уведомляется сразу: иначе новые блоки упрутся в политику переполнения
+    if (ch->notify_pending >= ch->notify_blocks || uxQueueSpacesAvailable(ch->rx_queue) == 0)
+    {
+        rdt_rx_notify_post(channel_idx);
+    }
+}
+
+/**
+ * @brief Уведомить получателя о блоках, ждущих дольше notify_us
+ */
+static void rdt_rx_notify_due(uint8_t channel_idx)
+{
+    rdt_channel_t *ch = &s_channels[channel_idx];
+    if (ch->notify_pending && esp_timer_get_time() - ch->notify_first >= (int64_t)ch->notify_us)
+    {
+        rdt_rx_notify_post(channel_idx);
+    }
+}
+
+// Ожидание событий задачи RDT: не дольше ближайшего срока - отложенного уведомления,
+// таймаута ASK (повтор блока или END), конца ожидания карты RESUME, запроса времени;
+// без ожидания, если у канала есть неотправленные кадры блока
+static TickType_t rdt_task_wait_ticks(void)
+{
+    int64_t wait_us = RDT_TASK_IDLE_MS * 1000;
+    int64_t now     = esp_timer_get_time();
+    for (uint8_t i = 0; i < RDT_MAX_CHANNELS; i++)
+    {
+        rdt_channel_t *ch = &s_channels[i];
+        if (ch->notify_pending)
+        {
+            int64_t left = ch->notify_first + (int64_t)ch->notify_us - now;
+            if (left < wait_us) wait_us = left;
+        }
+        const rdt_channel_tx_t *tx = &ch->tx_ctrl;
+        if (tx->sending)
+        {
+            // После BEGIN кадры блока уходят следующим проходом: без событий отправки
+            // (транспорт без Rdt_TransportSendDone) он не должен ждать RDT_TASK_IDLE_MS
+            if (!tx->resume_wait_until && tx->next_seq_to_send < tx->total_packets) return 0;
+            // Таймаут срабатывает строго после ack_timeout
+            int64_t left = tx->last_send_time + (int64_t)tx->tune.ack_timeout_ms * 1000 + 1 - now;
+            if (left < wait_us) wait_us = left;
+            if (tx->resume_wait_until && tx->resume_wait_until - now < wait_us) wait_us = tx->resume_wait_until - now;
+        }
+    }
+    if (s_time.period_ms && s_time.next_req - now < wait_us) wait_us = s_time.next_req - now;
+    if (wait_us <= 0) return 0;
+    TickType_t ticks = pdMS_TO_TICKS((wait_us + 999) / 1000);
+    return ticks ? ticks : 1;
+}
+
+/**
+ * @brief Выбросить прерванный блок, который так и не отправили повторно
+ */
+static void rdt_rx_expire_parked(uint8_t channel_idx)
+{
+    rdt_rx_parked_t *p = &s_channels[channel_idx].rx_ctrl.parked;
+    if (p->valid && esp_timer_get_time() - p->parked_time > (int64_t)RDT_RESUME_GRACE_MS * 1000)
+    {
+        logD("Channel %d: parked block expired", channel_idx);
+        rdt_rx_parked_free(p);
+    }
+}
+
+/**
+ * @brief Объявить свой сеанс пиру (в payload - известный нам сеанс пира)
+ */
+static void rdt_send_hello(void)
+{
+    if (memcmp(s_peer_macaddr, s_broadcast_mac, ESP_NOW_ETH_ALEN) == 0) return;
+    uint8_t buffer[4];
+    buffer[0] = (uint8_t)(s_peer_epoch & 0xFF);
+    buffer[1] = (uint8_t)((s_peer_epoch >> 8) & 0xFF);
+    buffer[2] = (uint8_t)((s_peer_epoch >> 16) & 0xFF);
+    buffer[3] = (uint8_t)((s_peer_epoch >> 24) & 0xFF);
+    rdt_send_one_packet(0, 0, RDT_MSG_HELLO, buffer, sizeof(buffer));
+}
+
+// Корзина гистограммы: 0 - до 1 мс, k - [2^(k-1), 2^k) мс, последняя - всё больше
+static uint8_t rdt_owd_bucket(int64_t owd_us)
+{
+    uint32_t ms = owd_us > 0 ? (uint32_t)(owd_us / 1000) : 0;
+    uint8_t  b  = 0;
+    while (ms && b < RDT_OWD_BUCKETS - 1)
+    {
+        ms >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static void rdt_time_reset(void)
+{
+    s_time.pending_t1 = 0;
+    s_time.count      = 0;
+    s_time.pos        = 0;
+    portENTER_CRITICAL(&s_link_mux);
+    s_link.clock_synced = false;
+    portEXIT_CRITICAL(&s_link_mux);
+}
+
+/**
+ * @brief Учесть обмен времени
+ *
+ * Смещение ((t2 - t1) + (t3 - t4)) / 2 верно при равных задержках в обе стороны; очередь
+ * в одной из сторон искажает его на половину разницы. Поэтому смещение берётся по обмену
+ * окна с наименьшей задержкой (NTP clock filter), а задержки этого обмена по направлениям
+ * идут в гистограммы: рост одной из них показывает, с какой стороны копится очередь.
+ */
+static void rdt_time_sample(int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+    int64_t delay = (t4 - t1) - (t3 - t2);
+    if (delay < 0) delay = 0;
+    s_time.offset_us[s_time.pos] = ((t2 - t1) + (t3 - t4)) / 2;
+    s_time.delay_us[s_time.pos]  = (uint32_t)delay;
+    s_time.pos = (s_time.pos + 1) % RDT_TIME_SAMPLES;
+    if (s_time.count < RDT_TIME_SAMPLES) s_time.count++;
+
+    uint8_t best = 0;
+    for (uint8_t i = 1; i < s_time.count; i++)
+    {
+        if (s_time.delay_us[i] < s_time.delay_us[best]) best = i;
+    }
+    int64_t offset = s_time.offset_us[best];
+
+    portENTER_CRITICAL(&s_link_mux);
+    s_link.clock_offset_us = offset;
+    s_link.clock_delay_us  = s_time.delay_us[best];
+    s_link.clock_synced    = true;
+    s_link.owd_tx_hist[rdt_owd_bucket(t2 - offset - t1)]++;
+    s_link.owd_rx_hist[rdt_owd_bucket(t4 + offset - t3)]++;
+    portEXIT_CRITICAL(&s_link_mux);
+}
+
+/**
+ * @brief Задержка кадра от пира по его метке отправки и смещению часов
+ */
+static void rdt_owd_rx_sample(const rdt_packet_t *pkt, int64_t rx_time)
+{
+    // Ответ времени уже учтён в rdt_time_sample
+    if (pkt->service_code == RDT_MSG_TIME_RESP || !s_time.period_ms) return;
+
+    portENTER_CRITICAL(&s_link_mux);
+    if (s_link.clock_synced)
+    {
+        // Время приёма по часам пира; разность по младшим 32 битам верна до ~35 минут
+        uint32_t peer_rx = (uint32_t)(rx_time + s_link.clock_offset_us);
+        int32_t  owd     = (int32_t)(peer_rx - pkt->tx_time);
+        s_link.owd_rx_hist[rdt_owd_bucket(owd)]++;
+    }
+    portEXIT_CRITICAL(&s_link_mux);
+}
+
+/**
+ * @brief Периодический запрос времени (из задачи RDT)
+ */
+static void rdt_time_poll(void)
+{
+    if (!s_time.period_ms || !s_channels[0].rx_queue) return;
+    if (memcmp(s_peer_macaddr, s_broadcast_mac, ESP_NOW_ETH_ALEN) == 0) return;
+
+    int64_t now = esp_timer_get_time();
+    if (now < s_time.next_req) return;
+    s_time.next_req   = now + (int64_t)s_time.period_ms * 1000;
+    s_time.pending_t1 = now;
+    uint8_t buffer[sizeof(int64_t)];
+    memcpy(buffer, &now, sizeof(now));
+    rdt_send_one_packet(0, 0, RDT_MSG_TIME_REQ, buffer, sizeof(buffer));
+}
+
+// Сбросить приём канала: недособранный, прерванный и удержанный блоки пира отбрасываются
+static void rdt_rx_reset(rdt_channel_rx_t *rx)
+{
+    rdt_rx_buf_free(rx->rx_buffer);
+    free(rx->packet_received_map);
+    rx->rx_buffer           = NULL;
+    rx->packet_received_map = NULL;
+    rx->receiving           = false;
+    rx->held                = false;
+    rx->packets_received    = 0;
+    rx->done_valid          = false;
+    rdt_rx_parked_free(&rx->parked);
+}
+
+static void rdt_check_peer_epoch(const rdt_packet_t *pkt)
+{
+    if (pkt->epoch == s_peer_epoch) return;
+
+    if (s_peer_epoch == 0)
+    {
+        // Первый кадр пира после нашего старта или привязки
+        s_peer_epoch = pkt->epoch;
+        return;
+    }
+    s_peer_epoch = pkt->epoch;
+
+    // Пир перезапустился: его приём и передача начались с нуля. Недособранные блоки пира
+    // он не повторит, а наш текущий блок отправляем сразу, не дожидаясь таймаута ASK
+    logI("peer restarted (epoch %08" PRIx32 "), channel state reset", pkt->epoch);
+    portENTER_CRITICAL(&s_link_mux);
+    s_link.peer_restarts++;
+    portEXIT_CRITICAL(&s_link_mux);
+    // Часы пира тоже начались с нуля
+    rdt_time_reset();
+    for (uint8_t i = 0; i < RDT_MAX_CHANNELS; i++)
+    {
+        rdt_channel_t    *ch = &s_channels[i];
+        rdt_channel_tx_t *tx = &ch->tx_ctrl;
+
+        rdt_rx_reset(&ch->rx_ctrl);
+        // Отложенных блоков у пира больше нет
+        memset(tx->failed, 0, sizeof(tx->failed));
+
         if (tx->sending)
         {
+            tx->retry_count = 0;
+            tx->acked_max   = 0;
+            rdt_restart_tx_block(i);
+        }
+    }
+}
+
+static void rdt_process_received_packet(uint8_t channel_idx, const rdt_packet_t *pkt, size_t payload_len,
+                                        const uint8_t *src_mac, int64_t rx_time)
+{
+    if (channel_idx >= RDT_MAX_CHANNELS) return;
+    if (s_channels[channel_idx].tx_queue == NULL || s_channels[channel_idx].tx_queue_length == 0 || s_channels[channel_idx].rx_queue == NULL) return;
+    
+    // Проверяем CRC
+    uint32_t calc_crc = rdt_calc_crc(pkt, payload_len);
+    if (calc_crc != pkt->crc)
+    {
+        // CRC не совпал — игнорируем
+        return;
+    }
+
+    rdt_check_peer_epoch(pkt);
+    rdt_owd_rx_sample(pkt, rx_time);
+
+    rdt_channel_t    *ch  = &s_channels[channel_idx];
+    rdt_channel_rx_t *rx  = &ch->rx_ctrl;
+    rdt_channel_tx_t *tx  = &ch->tx_ctrl; // Для некоторых типов пакетов (nack, ask) нужна передача
+    
+    switch (pkt->service_code)
+    {
+    case RDT_MSG_HELLO:
+    {
+        // Пир не знает наш текущий сеанс - отвечаем своим
+        uint32_t known = ((uint32_t)pkt->payload[0]) | ((uint32_t)pkt->payload[1] << 8) |
+                         ((uint32_t)pkt->payload[2] << 16) | ((uint32_t)pkt->payload[3] << 24);
+        if (known != s_epoch)
+        {
+            rdt_send_hello();
+        }
+        break;
+    }
+
+    case RDT_MSG_BEGIN:
+    case RDT_MSG_DATA:
+    case RDT_MSG_END:
+    {
+        // Кадр уже собранного блока: отправитель не получил ASK и повторяет блок
+        if (rx->done_valid && pkt->block_id == rx->done_block_id)
+        {
+            if (pkt->service_code == RDT_MSG_END && !rx->receiving)
+            {
+                rdt_send_one_packet(channel_idx, 0, RDT_MSG_ASK, NULL, 0);
+            }
+            return;
+        }
+
+        if (pkt->chunk_len < RDT_TUNE_CHUNK_MIN || pkt->chunk_len > RDT_PACKET_PAYLOAD_LEN)
+        {
+            return;
+        }
+        // Приём начинается с любого кадра блока: потеря BEGIN стоит только его повтора по NACK
+        if (!rx->receiving || pkt->block_id != rx->block_id || pkt->block_hash != rx->block_hash ||
+            pkt->chunk_len != rx->chunk_len)
+        {
+            if (!rdt_rx_start(ch, pkt)) return;
+        }
+        if (pkt->seq_num >= rx->total_packets)
+        {
+            // seq_num выходит за рамки
+            return;
+        }
+        if (pkt->service_code == RDT_MSG_DATA && pkt->seq_num > 0)
+        {
+            // Кадр DATA обязан нести свою долю блока целиком (последний - остаток)
+            size_t offset = (size_t)(pkt->seq_num - 1) * rx->chunk_len;
+            size_t need   = offset < rx->total_size ? rx->total_size - offset : 0;
+            if (payload_len < (need < rx->chunk_len ? need : rx->chunk_len)) return;
+        }
+        if (!rx->packet_received_map[pkt->seq_num])
+        {
+            rx->packet_received_map[pkt->seq_num] = true;
+            rx->packets_received++;
+            if (pkt->service_code == RDT_MSG_DATA)
+            {
+                // Копируем payload
+                size_t offset = (pkt->seq_num - 1) * rx->chunk_len; 
+                // seq_num - 1, т.к. 0 — это BEGIN, а начиная с 1 идут data
+                size_t copy_len = rx->chunk_len;
+                if (offset + copy_len > rx->total_size)
+                {
+                    copy_len = rx->total_size - offset;
+                }
+                if (offset < rx->total_size)
+                {
+                    memcpy(rx->rx_buffer + offset, pkt->payload, copy_len);
+                }
+            }
+        }
+        rx->last_packet_time = esp_timer_get_time();
+
+        // Отправитель ждёт карту: сообщаем, что уже есть (пустая карта - ничего), он пропустит эти пакеты
+        if (pkt->service_code == RDT_MSG_BEGIN && (pkt->payload[0] & RDT_BEGIN_RESUME_ASK) &&
+            rx->total_packets > RDT_RESUME_MIN_PACKETS)
+        {
+            rdt_send_resume(channel_idx);
+        }
+
+        // NACK/ASK - только по END: до него остальные кадры блока ещё в пути
+        if (pkt->service_code != RDT_MSG_END) break;
+        rx->end_round = ((uint16_t)pkt->payload[0]) | ((uint16_t)pkt->payload[1] << 8);
+        if (pkt->seq_num != rx->total_packets - 1)
+        {
+            // seq не совпадает с последним
+            return;
+        }
+        // Проверяем, все ли пакеты
+        bool all_ok = (rx->packets_received == rx->total_packets);
+        if (!all_ok)
+        {
+            // Отправляем NACK
+            rdt_send_nack_for_missing(channel_idx, src_mac);
+        }
+        else
+        {
+            // Всё собрано: блок в rx-очередь и ASK
+            rdt_rx_deliver(channel_idx);
+        }
+        break;
+    }
+
+    case RDT_MSG_ASK:
+    {
+        // Приёмник подтверждает, что все пакеты получены (ASK на предыдущий блок игнорируется)
+        if (tx->sending && pkt->block_id == tx->block_id)
+        {
+            // Завершаем передачу блока, освобождаем буферы
+            //logI("Channel %d: block transmitted successfully", channel_idx);
+            logD("ask wait for %" PRId64" ms", (esp_timer_get_time() - tx->last_send_time) / 1000);
+            rdt_finish_tx_block(channel_idx, true);
+        }
+        break;
+    }
+
+    case RDT_MSG_NACK:
+    {
+        // В payload могут быть номера seq для повторной отправки
+        if (tx->sending && pkt->block_id == tx->block_id)
+        {
+            // Пакет, отправленный уже после END, на который отвечает этот NACK, мог ещё не дойти:
+            // повторять его рано. Если END неизвестен - повтор не чаще раза за RTO
+            int64_t  now   = esp_timer_get_time();
+            uint16_t round = pkt->seq_num;
+            int64_t  nack_ref;
+            if (round != 0 && (uint16_t)(tx->end_round - round) < RDT_END_HISTORY)
+            {
+                nack_ref = tx->end_time[round % RDT_END_HISTORY];
+            }
+            else
+            {
+                nack_ref = now - rdt_rto_us(tx);
+            }
+
             // Пробежимся по списку seq
             // Для простоты считаем, что первые N байт payload — это список seq (по 2 байта).
             int count = (RDT_PACKET_PAYLOAD_LEN / 2);
@@ -533,19 +1391,20 @@ static void rdt_process_received_packet(uint8_t channel_idx, const rdt_packet_t
                 {
                     break;
                 }
+                if (missing_seq < tx->total_packets && tx->packet_tx_time && tx->packet_tx_time[missing_seq] > nack_ref)
+                {
+                    tx->resends_suppressed++;
+                    continue;
+                }
                 // Переотправляем
                 if (missing_seq < tx->total_packets)
                 {
                     rssi.total_packets_resent++;
+                    tx->packets_resent++;
                     if (missing_seq == 0)
                     {
                         // begin
-                        uint8_t size_arr[4];
-                        size_arr[0] = (uint8_t)((tx->current_size >> 0) & 0xFF);
-                        size_arr[1] = (uint8_t)((tx->current_size >> 8) & 0xFF);
-                        size_arr[2] = (uint8_t)((tx->current_size >> 16) & 0xFF);
-                        size_arr[3] = (uint8_t)((tx->current_size >> 24) & 0xFF);
-                        rdt_send_one_packet(channel_idx, 0, RDT_MSG_BEGIN, size_arr, 4);
+                        rdt_send_one_packet(channel_idx, 0, RDT_MSG_BEGIN, NULL, 0);
                     }
                     else if (missing_seq == (tx->total_packets - 1))
                     {
@@ -555,8 +1414,8 @@ static void rdt_process_received_packet(uint8_t channel_idx, const rdt_packet_t
                     else
                     {
                         // data
-                        size_t offset = (missing_seq - 1) * RDT_PACKET_PAYLOAD_LEN;
-                        size_t chunk_len = RDT_PACKET_PAYLOAD_LEN;
+                        size_t offset = (missing_seq - 1) * tx->tune.chunk_len;
+                        size_t chunk_len = tx->tune.chunk_len;
                         if (offset + chunk_len > tx->current_size)
                         {
                             chunk_len = tx->current_size - offset;
@@ -569,6 +1428,72 @@ static void rdt_process_received_packet(uint8_t channel_idx, const rdt_packet_t
         break;
     }
 
+    case RDT_MSG_TIME_REQ:
+    {
+        // payload: t1; ответ: t1, t2, t3
+        uint8_t buffer[3 * sizeof(int64_t)];
+        int64_t t3;
+        memcpy(&buffer[0], &pkt->payload[0], sizeof(int64_t));
+        memcpy(&buffer[sizeof(int64_t)], &rx_time, sizeof(int64_t));
+        t3 = esp_timer_get_time();
+        memcpy(&buffer[2 * sizeof(int64_t)], &t3, sizeof(int64_t));
+        rdt_send_one_packet(channel_idx, 0, RDT_MSG_TIME_RESP, buffer, sizeof(buffer));
+        break;
+    }
+
+    case RDT_MSG_TIME_RESP:
+    {
+        int64_t t1, t2, t3, t4 = rx_time;
+        memcpy(&t1, &pkt->payload[0], sizeof(int64_t));
+        memcpy(&t2, &pkt->payload[sizeof(int64_t)], sizeof(int64_t));
+        memcpy(&t3, &pkt->payload[2 * sizeof(int64_t)], sizeof(int64_t));
+        // Только ответ на последний запрос: опоздавший ответ дал бы завышенную задержку
+        if (t1 != s_time.pending_t1 || t4 < t1) break;
+        s_time.pending_t1 = 0;
+        rdt_time_sample(t1, t2, t3, t4);
+        break;
+    }
+
+    case RDT_MSG_WAIT:
+    {
+        // Приёмник собрал блок, но его очередь полна: ждём, не расходуя повторы
+        if (tx->sending && pkt->block_id == tx->block_id)
+        {
+            if (!tx->peer_holding) logD("Channel %d: block %u held by peer", channel_idx, (unsigned)tx->block_id);
+            tx->peer_holding   = true;
+            tx->peer_held      = true;
+            tx->retry_count    = 0;
+            tx->last_send_time = esp_timer_get_time();
+        }
+        break;
+    }
+
+    case RDT_MSG_RESUME:
+    {
+        // Карта приёмника: принятые пакеты не отправляем (пришедшая во время отправки - тоже)
+        if (tx->sending && pkt->block_id == tx->block_id)
+        {
+            uint16_t base = ((uint16_t)pkt->payload[0]) | ((uint16_t)pkt->payload[1] << 8);
+            uint16_t have = 0;
+            for (uint16_t i = 0; i < RDT_RESUME_BITS && base + i < tx->total_packets; i++)
+            {
+                if (pkt->payload[2 + i / 8] & (1 << (i % 8)))
+                {
+                    tx->packet_sent_map[base + i] = true;
+                    have++;
+                }
+            }
+            // Приёмник продвигается - повторы блока не исчерпываются на медленной линии
+            if (have > tx->acked_max)
+            {
+                tx->acked_max   = have;
+                tx->retry_count = 0;
+            }
+            tx->resume_wait_until = 0;
+        }
+        break;
+    }
+
     default:
         break;
     }
@@ -599,21 +1524,29 @@ static void rdt_process_tx_channel(uint8_t channel_idx)
                 tx->retry_count  = 0;
                 tx->current_size = block_item.data_size;
                 tx->tx_buffer    = block_item.data_ptr; // Передаём владение
-                tx->total_packets = (tx->current_size + RDT_PACKET_PAYLOAD_LEN - 1) / RDT_PACKET_PAYLOAD_LEN + 2; // +2: BEGIN, END
+                tx->user_ctx     = block_item.user_ctx;
+                // Настройки меняются только между блоками
+                tx->tune         = s_tuning.channel[channel_idx];
+                tx->total_packets = (tx->current_size + tx->tune.chunk_len - 1) / tx->tune.chunk_len + 2; // +2: BEGIN, END
                 tx->packet_sent_map = (bool*)calloc(tx->total_packets, sizeof(bool));
+                tx->packet_tx_time  = (int64_t*)calloc(tx->total_packets, sizeof(int64_t));
+                tx->end_round       = 0;
+                tx->resends_suppressed = 0;
+                tx->peer_holding    = false;
+                tx->peer_held       = false;
                 tx->next_seq_to_send = 0;
                 tx->last_send_time   = esp_timer_get_time();
+                tx->start_time       = tx->last_send_time;
+                tx->packets_resent   = 0;
+                tx->block_hash       = w_crc32_le(0, tx->tx_buffer, tx->current_size);
+                tx->acked_max        = 0;
 
-                // Отправим begin
-                uint8_t size_arr[4];
-                size_arr[0] = (uint8_t)((tx->current_size >> 0) & 0xFF);
-                size_arr[1] = (uint8_t)((tx->current_size >> 8) & 0xFF);
-                size_arr[2] = (uint8_t)((tx->current_size >> 16) & 0xFF);
-                size_arr[3] = (uint8_t)((tx->current_size >> 24) & 0xFF);
+                // Содержимое недоставленного блока отправляется снова с его ID: приёмник продолжит
+                // с отложенной карты. Новому блоку карта не нужна - пакеты идут сразу
+                bool resend = rdt_tx_failed_take(tx, &tx->block_id);
+                if (!resend) tx->block_id = tx->next_block_id++;
 
-                rdt_send_one_packet(channel_idx, 0, RDT_MSG_BEGIN, size_arr, 4);
-                tx->packet_sent_map[0] = true;
-                tx->next_seq_to_send   = 1;
+                rdt_send_begin(channel_idx, resend);
 
                 // statistics
                 rssi.total_packets_sent += tx->total_packets;
@@ -624,20 +1557,27 @@ static void rdt_process_tx_channel(uint8_t channel_idx)
     {
         // Проверяем таймаут на получение ASK
         int64_t now = esp_timer_get_time();
-        if ((now - tx->last_send_time) > (RDT_ACK_TIMEOUT_MS * 1000))
+        int64_t ack_timeout = (int64_t)tx->tune.ack_timeout_ms * 1000;
+        if ((now - tx->last_send_time) > ack_timeout && tx->peer_holding)
+        {
+            // Приёмник удерживает блок: повтор END - ответ ASK, когда очередь освободится, или снова WAIT.
+            // Без ответа следующий таймаут - обычный повтор блока
+            tx->peer_holding   = false;
+            rdt_send_one_packet(channel_idx, tx->total_packets - 1, RDT_MSG_END, NULL, 0);
+            tx->last_send_time = now;
+            return;
+        }
+        if ((now - tx->last_send_time) > ack_timeout)
         {
             // Не получили ASK: переотправляем весь блок
             tx->retry_count++;
             rssi.total_packets_resent += tx->total_packets;
-            if (tx->retry_count >= RDT_MAX_RETRY_COUNT)
+            tx->packets_resent += tx->total_packets;
+            if (tx->retry_count >= tx->tune.max_retry)
             {
                 // Сдаёмся — сбрасываем передачу
                 logD("Channel %d: block send failed after max retries", channel_idx);
-                free(tx->packet_sent_map);
-                tx->packet_sent_map = NULL;
-                free(tx->tx_buffer);
-                tx->tx_buffer = NULL;
-                tx->sending   = false;
+                rdt_finish_tx_block(channel_idx, false);
             }
             else
             {
@@ -646,6 +1586,13 @@ static void rdt_process_tx_channel(uint8_t channel_idx)
             return;
         }
 
+        // Длинный блок: ждём карту приёмника, чтобы не отправлять уже принятое
+        if (tx->resume_wait_until && now < tx->resume_wait_until)
+        {
+            return;
+        }
+        tx->resume_wait_until = 0;
+
         // Если ещё остались неотправленные пакеты, отправляем
         while (tx->next_seq_to_send < tx->total_packets)
         {
@@ -660,8 +1607,8 @@ static void rdt_process_tx_channel(uint8_t channel_idx)
                 else
                 {
                     // DATA
-                    size_t offset = (tx->next_seq_to_send - 1) * RDT_PACKET_PAYLOAD_LEN;
-                    size_t chunk_len = RDT_PACKET_PAYLOAD_LEN;
+                    size_t offset = (tx->next_seq_to_send - 1) * tx->tune.chunk_len;
+                    size_t chunk_len = tx->tune.chunk_len;
                     if (offset + chunk_len > tx->current_size)
                     {
                         chunk_len = tx->current_size - offset;
@@ -676,23 +1623,153 @@ static void rdt_process_tx_channel(uint8_t channel_idx)
     }
 }
 
-static void rdt_restart_tx_block(uint8_t channel_idx)
+/**
+ * @brief Запомнить недоставленный блок (вытесняется самая старая запись)
+ */
+static void rdt_tx_failed_add(rdt_channel_tx_t *tx)
+{
+    rdt_tx_failed_t *slot = NULL;
+    for (int i = 0; i < RDT_RESUME_FAILED; i++)
+    {
+        rdt_tx_failed_t *f = &tx->failed[i];
+        if (f->valid && f->block_hash == tx->block_hash && f->size == tx->current_size)
+        {
+            slot = f;   // тот же блок не доставлен снова
+            break;
+        }
+        if (!slot || (slot->valid && (!f->valid || f->failed_time < slot->failed_time))) slot = f;
+    }
+    slot->valid       = true;
+    slot->block_id    = tx->block_id;
+    slot->block_hash  = tx->block_hash;
+    slot->size        = tx->current_size;
+    slot->chunk_len   = tx->tune.chunk_len;
+    slot->failed_time = esp_timer_get_time();
+}
+
+/**
+ * @brief Найти недоставленный блок с тем же содержимым (не старше RDT_RESUME_GRACE_MS) и забрать его ID
+ * @return true - блок найден, block_id задан
+ */
+static bool rdt_tx_failed_take(rdt_channel_tx_t *tx, uint16_t *block_id)
+{
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < RDT_RESUME_FAILED; i++)
+    {
+        rdt_tx_failed_t *f = &tx->failed[i];
+        if (f->valid && now - f->failed_time > (int64_t)RDT_RESUME_GRACE_MS * 1000) f->valid = false;
+        if (f->valid && f->block_hash == tx->block_hash && f->size == tx->current_size &&
+            f->chunk_len == tx->tune.chunk_len)
+        {
+            f->valid  = false;
+            *block_id = f->block_id;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Отправить BEGIN блока; с ask_resume длинный блок ждёт карту приёмника до RDT_RESUME_WAIT_MS
+ */
+static void rdt_send_begin(uint8_t channel_idx, bool ask_resume)
 {
     rdt_channel_tx_t *tx = &s_channels[channel_idx].tx_ctrl;
-    logD("Channel %d: re-send entire block", channel_idx);
-    memset(tx->packet_sent_map, 0, tx->total_packets * sizeof(bool));
-    tx->next_seq_to_send = 0;
-    // Отправим begin
-    uint8_t size_arr[4];
-    size_arr[0] = (uint8_t)((tx->current_size >> 0) & 0xFF);
-    size_arr[1] = (uint8_t)((tx->current_size >> 8) & 0xFF);
-    size_arr[2] = (uint8_t)((tx->current_size >> 16) & 0xFF);
-    size_arr[3] = (uint8_t)((tx->current_size >> 24) & 0xFF);
-
-    rdt_send_one_packet(channel_idx, 0, RDT_MSG_BEGIN, size_arr, 4);
+    uint8_t flags = 0;
+
+    ask_resume = ask_resume && tx->total_packets > RDT_RESUME_MIN_PACKETS;
+    if (ask_resume) flags |= RDT_BEGIN_RESUME_ASK;
+    rdt_send_one_packet(channel_idx, 0, RDT_MSG_BEGIN, &flags, 1);
     tx->packet_sent_map[0] = true;
     tx->next_seq_to_send   = 1;
     tx->last_send_time     = esp_timer_get_time();
+    tx->resume_wait_until  = ask_resume ? tx->last_send_time + RDT_RESUME_WAIT_MS * 1000 : 0;
+}
+
+static void rdt_restart_tx_block(uint8_t channel_idx)
+{
+    rdt_channel_tx_t *tx = &s_channels[channel_idx].tx_ctrl;
+    logD("Channel %d: re-send entire block", channel_idx);
+    memset(tx->packet_sent_map, 0, tx->total_packets * sizeof(bool));
+    // Приёмник часть блока уже собрал - спрашиваем его карту
+    rdt_send_begin(channel_idx, true);
+}
+
+/**
+ * @brief Учесть завершённый блок в оценках линии
+ *
+ * RTT берётся только у блоков без повторов всего блока (алгоритм Карна),
+ * доля потерь - по всем блокам; обе оценки - экспоненциальное сглаживание с весом 1/8.
+ */
+static void rdt_link_update(const rdt_channel_tx_t *tx, bool delivered)
+{
+    int64_t  now       = esp_timer_get_time();
+    uint32_t sent      = (uint32_t)tx->total_packets + tx->packets_resent;
+    uint32_t loss_pm   = delivered ? (sent ? (uint32_t)tx->packets_resent * 1000 / sent : 0) : 1000;
+
+    portENTER_CRITICAL(&s_link_mux);
+    if (delivered && tx->retry_count == 0 && !tx->peer_held)
+    {
+        uint32_t rtt = (uint32_t)(now - tx->start_time);
+        if (s_link.srtt_us == 0)
+        {
+            s_link.srtt_us   = rtt;
+            s_link.rttvar_us = rtt / 2;
+        }
+        else
+        {
+            uint32_t err     = rtt > s_link.srtt_us ? rtt - s_link.srtt_us : s_link.srtt_us - rtt;
+            s_link.rttvar_us = (3 * s_link.rttvar_us + err) / 4;
+            s_link.srtt_us   = (7 * s_link.srtt_us + rtt) / 8;
+        }
+    }
+    s_link.loss_permille = (uint16_t)((7 * (uint32_t)s_link.loss_permille + loss_pm) / 8);
+    if (delivered)
+        s_link.blocks_ok++;
+    else
+        s_link.blocks_failed++;
+    s_link.resends_suppressed += tx->resends_suppressed;
+    portEXIT_CRITICAL(&s_link_mux);
+}
+
+/**
+ * @brief RTO по сглаженному RTT блока: srtt + 4 * rttvar в пределах [RDT_RTO_MIN_MS, ожидание ASK канала]
+ */
+static int64_t rdt_rto_us(const rdt_channel_tx_t *tx)
+{
+    int64_t max_rto = (int64_t)tx->tune.ack_timeout_ms * 1000;
+    portENTER_CRITICAL(&s_link_mux);
+    int64_t rto = s_link.srtt_us ? (int64_t)s_link.srtt_us + 4 * (int64_t)s_link.rttvar_us : max_rto;
+    portEXIT_CRITICAL(&s_link_mux);
+    if (rto < RDT_RTO_MIN_MS * 1000) rto = RDT_RTO_MIN_MS * 1000;
+    if (rto > max_rto) rto = max_rto;
+    return rto;
+}
+
+static void rdt_finish_tx_block(uint8_t channel_idx, bool delivered)
+{
+    rdt_channel_t    *ch = &s_channels[channel_idx];
+    rdt_channel_tx_t *tx = &ch->tx_ctrl;
+
+    rdt_link_update(tx, delivered);
+
+    // Приёмник отложит недособранный длинный блок: его повторная отправка пойдёт с тем же ID
+    if (!delivered && tx->total_packets > RDT_RESUME_MIN_PACKETS) rdt_tx_failed_add(tx);
+
+    free(tx->packet_sent_map);
+    tx->packet_sent_map = NULL;
+    free(tx->packet_tx_time);
+    tx->packet_tx_time = NULL;
+    free(tx->tx_buffer);
+    tx->tx_buffer = NULL;
+    tx->sending   = false;
+
+    void *user_ctx = tx->user_ctx;
+    tx->user_ctx   = NULL;
+    if (ch->tx_done_cb)
+    {
+        ch->tx_done_cb(channel_idx, user_ctx, delivered);
+    }
 }
 
 static void rdt_send_nack_for_missing(uint8_t channel_idx, const uint8_t *dst_mac)
@@ -727,7 +1804,8 @@ static void rdt_send_nack_for_missing(uint8_t channel_idx, const uint8_t *dst_ma
         buffer[idx]   = 0xFF;
         buffer[idx+1] = 0xFF;
     }
-    rdt_send_one_packet(channel_idx, 0, RDT_MSG_NACK, buffer, RDT_PACKET_PAYLOAD_LEN);
+    // В seq - номер END, на который отвечает NACK
+    rdt_send_one_packet(channel_idx, rx->end_round, RDT_MSG_NACK, buffer, RDT_PACKET_PAYLOAD_LEN);
 }
 
 static void check_connection_status(void)
@@ -792,13 +1870,25 @@ int Wireless_Init(void)
 
     // Здесь оставляем ту логику, что была, или меняем под себя
 
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_start());
-    ESP_ERROR_CHECK(esp_wifi_set_channel(1, WIFI_SECOND_CHAN_NONE));
-    ESP_ERROR_CHECK(esp_wifi_set_protocol(ESP_IF_WIFI_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N | WIFI_PROTOCOL_LR));
+    bool espnow = (s_transport == &s_espnow_transport);
+    if (espnow)
+    {
+        wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+        ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+        ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+        ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+        ESP_ERROR_CHECK(esp_wifi_start());
+        ESP_ERROR_CHECK(esp_wifi_set_channel(1, WIFI_SECOND_CHAN_NONE));
+        ESP_ERROR_CHECK(esp_wifi_set_protocol(ESP_IF_WIFI_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N | WIFI_PROTOCOL_LR));
+    }
+
+    // Новый сеанс при каждом старте: пир по нему узнаёт о перезапуске
+    while (s_epoch == 0)
+    {
+        s_epoch = esp_random();
+    }
+
+    rdt_tuning_load();
 
     // Инициализация очередей и мьютекса для RDT
     if (!s_rdt_mutex)
@@ -807,20 +1897,24 @@ int Wireless_Init(void)
     }
     if (!s_rdt_event_queue)
     {
-        s_rdt_event_queue = xQueueCreate(30, sizeof(rdt_event_msg_t));
+        s_rdt_event_queue = xQueueCreate(s_tuning.event_queue_len, sizeof(rdt_event_msg_t));
     }
     // Запуск задачи RDT
     if (!s_rdt_task_handle)
     {
-        xTaskCreate(rdt_task, "rdt_task", 4096, NULL, 5, &s_rdt_task_handle);
+        xTaskCreate(rdt_task, "rdt_task", 4096, NULL, s_tuning.task_priority, &s_rdt_task_handle);
     }
 
-    ESP_ERROR_CHECK(esp_now_init());
-    ESP_ERROR_CHECK(esp_now_register_send_cb(rdt_send_cb));
-    ESP_ERROR_CHECK(esp_now_register_recv_cb(rdt_recv_cb));
-    // Установим PMK (пароль для шифрования, при необходимости)
-    uint8_t pmk[16] = {0}; // или реальный ключ
-    ESP_ERROR_CHECK(esp_now_set_pmk(pmk));
+    if (espnow)
+    {
+        ESP_ERROR_CHECK(esp_now_init());
+        ESP_ERROR_CHECK(esp_now_register_send_cb(rdt_send_cb));
+        ESP_ERROR_CHECK(esp_now_register_recv_cb(rdt_recv_cb));
+        // PMK ESP-NOW не используется: пиры добавляются без шифрования кадров,
+        // блоки зашифрованных каналов шифрует w_crypt (w_crypt_init до Wireless_Init)
+        uint8_t pmk[16] = {0};
+        ESP_ERROR_CHECK(esp_now_set_pmk(pmk));
+    }
 
     // Добавление широковещательного пира
     Rdt_AddPeer(s_broadcast_mac);
@@ -837,10 +1931,122 @@ int Wireless_Init(void)
         Rdt_AddPeer(s_peer_macaddr);
     }
 
-    logI("ESP-NOW и RDT инициализированы");
+    logI("%s и RDT инициализированы", espnow ? "ESP-NOW" : "Транспорт");
     return ESP_OK;
 }
 
+/**
+ * @brief Заменить транспорт кадров (вызывается до Wireless_Init)
+ * @param[in] transport Транспорт, хранится по указателю (NULL - ESP-NOW)
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_SetTransport(const rdt_transport_t *transport)
+{
+    if (s_rdt_task_handle) return 1;
+    if (transport && !transport->send) return 1;
+    s_transport = transport ? transport : &s_espnow_transport;
+    return 0;
+}
+
+// Сообщение очереди событий для принятого кадра; false - кадр не для RDT
+static bool rdt_input_msg(const uint8_t *src_mac, const uint8_t *frame, size_t len, int rssi_dbm,
+                          TickType_t now, rdt_event_msg_t *msg)
+{
+    if (!src_mac || !frame || len < RDT_PACKET_MIN_LEN || len > sizeof(rdt_packet_t) || !s_rdt_event_queue)
+    {
+        return false;
+    }
+
+    // проверка мака пира
+    if (memcmp(src_mac, s_peer_macaddr, ESP_NOW_ETH_ALEN) != 0)
+    {
+        return false;
+    }
+
+    rssi.last_rssi_update = now;
+    if (rssi_dbm != 0) rssi.rssi = rssi_dbm;
+
+    // Кадр короче rdt_packet_t: payload за принятой частью остаётся нулевым, CRC переносится в поле crc.
+    // Создаём сообщение для обработки в основной задаче.
+    size_t payload_len = len - RDT_PACKET_MIN_LEN;
+    memset(msg, 0, sizeof(*msg));
+    msg->event_type = RDT_EVENT_RECV_PKT;
+    memcpy(msg->src_mac, src_mac, ESP_NOW_ETH_ALEN);
+    msg->rx_time = esp_timer_get_time();
+    memcpy(&msg->packet, frame, RDT_PACKET_HDR_LEN + payload_len);
+    memcpy(&msg->packet.crc, frame + RDT_PACKET_HDR_LEN + payload_len, sizeof(msg->packet.crc));
+    msg->payload_len = (uint8_t)payload_len;
+    return true;
+}
+
+/**
+ * @brief Передать в RDT принятый транспортом кадр (из задачи)
+ * @param[in] src_mac MAC отправителя
+ * @param[in] frame   Кадр
+ * @param[in] len     Размер кадра
+ * @param[in] rssi_dbm Уровень сигнала, дБм (0 - неизвестен)
+ */
+void Rdt_TransportInput(const uint8_t *src_mac, const uint8_t *frame, size_t len, int rssi_dbm)
+{
+    rdt_event_msg_t msg;
+    if (!rdt_input_msg(src_mac, frame, len, rssi_dbm, xTaskGetTickCount(), &msg)) return;
+
+    // Отправляем сообщение в очередь событий, чтобы обработка происходила в задаче rdt_task
+    if (xQueueSend(s_rdt_event_queue, &msg, 0) != pdTRUE)
+    {
+        // Если очередь переполнена, обработка будет пропущена
+        logW("Event queue full, packet dropped");
+    }
+}
+
+/**
+ * @brief Передать в RDT принятый кадр из обработчика прерывания
+ */
+void Rdt_TransportInputFromISR(const uint8_t *src_mac, const uint8_t *frame, size_t len, int rssi_dbm)
+{
+    rdt_event_msg_t msg;
+    if (!rdt_input_msg(src_mac, frame, len, rssi_dbm, xTaskGetTickCountFromISR(), &msg)) return;
+
+    // Переполнение очереди не логируется: вывод из прерывания недопустим
+    BaseType_t woken = pdFALSE;
+    xQueueSendFromISR(s_rdt_event_queue, &msg, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+/**
+ * @brief Сколько кадров ещё поместится в очередь событий RDT
+ * @return Свободное место; 0 - RDT не запущен или очередь заполнена
+ */
+size_t Rdt_TransportRxSpace(void)
+{
+    return s_rdt_event_queue ? (size_t)uxQueueSpacesAvailable(s_rdt_event_queue) : 0;
+}
+
+/**
+ * @brief Сообщить итог отправки кадра
+ * @param[in] ok true - кадр доставлен
+ */
+void Rdt_TransportSendDone(bool ok)
+{
+    if (!s_rdt_event_queue) return;
+    rdt_event_msg_t msg = {0};
+    msg.event_type = ok ? RDT_EVENT_SEND_OK : RDT_EVENT_SEND_FAIL;
+    xQueueSend(s_rdt_event_queue, &msg, 0);
+}
+
+/**
+ * @brief Сообщить итог отправки кадра из обработчика прерывания
+ */
+void Rdt_TransportSendDoneFromISR(bool ok)
+{
+    if (!s_rdt_event_queue) return;
+    rdt_event_msg_t msg = {0};
+    msg.event_type = ok ? RDT_EVENT_SEND_OK : RDT_EVENT_SEND_FAIL;
+    BaseType_t woken = pdFALSE;
+    xQueueSendFromISR(s_rdt_event_queue, &msg, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
 /**
  * @brief Регистрация/создание очередей для одного логического канала
  * @param[in] channel Номер канала (0..RDT_MAX_CHANNELS-1)
@@ -865,6 +2071,8 @@ int Rdt_ChannelInit(uint8_t channel, uint8_t rx_queue_len, uint8_t tx_queue_len,
         ch->tx_queue_length = tx_queue_len;
     }
     ch->max_block_size = max_block_size;
+    // Случайное начало: после перезагрузки первый блок не совпадёт с последним собранным у пира
+    ch->tx_ctrl.next_block_id = (uint16_t)esp_random();
     return 0;
 }
 
@@ -897,16 +2105,212 @@ int Rdt_SendBlock(uint8_t channel, const uint8_t *data_ptr, size_t size, void *u
     item.data_size = size;
     item.user_ctx  = user_ctx;
 
+    // Зашифрованный канал: блок шифруется целиком здесь, в задаче отправителя,
+    // в новый буфер с местом под хвост. Исходный буфер освобождается только после
+    // постановки в очередь: при ошибке его по-прежнему освобождает вызывающий.
+    // Флаг читается один раз и без мьютекса: отправитель не ждёт проход задачи RDT
+    bool encrypted = ch->encrypted;
+    if (encrypted)
+    {
+        uint8_t *sealed = (uint8_t *)malloc(size + W_CRYPT_OVERHEAD);
+        if (!sealed) return 1;
+        memcpy(sealed, data_ptr, size);
+        if (w_crypt_seal(channel, sealed, size) != 0)
+        {
+            logE("channel %d: encryption failed", channel);
+            free(sealed);
+            return 1;
+        }
+        item.data_ptr  = sealed;
+        item.data_size = size + W_CRYPT_OVERHEAD;
+    }
+
     if (xQueueSend(ch->tx_queue, &item, 1000) != pdTRUE)
     {
         // Очередь заполнена
         logE("queue full");
+        if (item.data_ptr != data_ptr) free(item.data_ptr);
         return 1;
     }
+    if (item.data_ptr != data_ptr) free((void *)data_ptr);
+    // Канал свободен - блок уходит сразу, не по периодическому обходу.
+    // Занятый канал возьмёт его после ASK текущего блока
+    if (!ch->tx_ctrl.sending && s_rdt_event_queue)
+    {
+        rdt_event_msg_t msg = {0};
+        msg.event_type = RDT_EVENT_TX_READY;
+        xQueueSend(s_rdt_event_queue, &msg, 0);
+    }
    // logI("block %p enqueued", item.data_ptr);
     return 0;
 }
 
+/**
+ * @brief Установить коллбек завершения передачи блоков канала
+ * @param[in] channel Номер канала
+ * @param[in] cb      Коллбек (NULL - отключить)
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_ChannelSetTxDoneCallback(uint8_t channel, rdt_tx_done_cb_t cb)
+{
+    if (channel >= RDT_MAX_CHANNELS) return 1;
+    if (s_rdt_mutex) xSemaphoreTake(s_rdt_mutex, portMAX_DELAY);
+    s_channels[channel].tx_done_cb = cb;
+    if (s_rdt_mutex) xSemaphoreGive(s_rdt_mutex);
+    return 0;
+}
+
+/**
+ * @brief Умеренность уведомлений получателя канала
+ * @param[in] channel      Номер канала
+ * @param[in] max_blocks   Уведомлять раз на столько блоков (0, 1 - на каждый блок)
+ * @param[in] max_delay_us Не позже, чем через столько мкс после первого неуведомлённого блока
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_ChannelSetNotify(uint8_t channel, uint8_t max_blocks, uint32_t max_delay_us)
+{
+    if (channel >= RDT_MAX_CHANNELS) return 1;
+    if (s_rdt_mutex) xSemaphoreTake(s_rdt_mutex, portMAX_DELAY);
+    s_channels[channel].notify_blocks = max_blocks;
+    s_channels[channel].notify_us     = max_delay_us;
+    if (s_rdt_mutex) xSemaphoreGive(s_rdt_mutex);
+    return 0;
+}
+
+/**
+ * @brief Включить обмен времени с пиром и измерение односторонних задержек
+ * @param[in] period_ms Период обмена, мс (0 - выключить)
+ */
+void Rdt_TimeSyncEnable(uint32_t period_ms)
+{
+    if (s_rdt_mutex) xSemaphoreTake(s_rdt_mutex, portMAX_DELAY);
+    s_time.period_ms = period_ms;
+    s_time.next_req  = 0;
+    if (!period_ms) rdt_time_reset();
+    if (s_rdt_mutex) xSemaphoreGive(s_rdt_mutex);
+}
+
+/**
+ * @brief Получить текущие настройки RDT
+ * @param[out] out Настройки
+ */
+void Rdt_TuningGet(rdt_tuning_t *out)
+{
+    if (!out) return;
+    if (s_rdt_mutex) xSemaphoreTake(s_rdt_mutex, portMAX_DELAY);
+    // До Wireless_Init NVS может быть ещё не инициализировано: сохранённые настройки
+    // прочитает Wireless_Init, а пока - значения по умолчанию
+    if (s_tuning_ready) *out = s_tuning;
+    else                rdt_tuning_defaults(out);
+    if (s_rdt_mutex) xSemaphoreGive(s_rdt_mutex);
+}
+
+/**
+ * @brief Изменить настройки RDT
+ * @param[in] tuning Настройки
+ * @return 0 - OK, 1 - значение вне границ
+ */
+int Rdt_TuningSet(const rdt_tuning_t *tuning)
+{
+    if (!tuning || !rdt_tuning_valid(tuning)) return 1;
+    if (s_rdt_mutex) xSemaphoreTake(s_rdt_mutex, portMAX_DELAY);
+    // Задача читает настройки канала под мьютексом только в начале блока
+    s_tuning       = *tuning;
+    s_tuning_ready = true;
+    if (s_rdt_task_handle) vTaskPrioritySet(s_rdt_task_handle, tuning->task_priority);
+    if (s_rdt_mutex) xSemaphoreGive(s_rdt_mutex);
+    logI("RDT tuning updated");
+    return 0;
+}
+
+/**
+ * @brief Сохранить текущие настройки в NVS
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_TuningSave(void)
+{
+    rdt_tuning_t t;
+    Rdt_TuningGet(&t);
+
+    nvs_handle_t h;
+    if (nvs_open(RDT_TUNING_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) return 1;
+    esp_err_t err = nvs_set_blob(h, RDT_TUNING_NVS_KEY, &t, sizeof(t));
+    if (err == ESP_OK) err = nvs_commit(h);
+    nvs_close(h);
+    return err == ESP_OK ? 0 : 1;
+}
+
+/**
+ * @brief Чтение настроек для w_param
+ */
+int Rdt_TuningParamRead(uint8_t *out_data, size_t *out_size)
+{
+    if (!out_data || !out_size || *out_size < sizeof(rdt_tuning_t)) return 1;
+    rdt_tuning_t t;
+    Rdt_TuningGet(&t);
+    memcpy(out_data, &t, sizeof(t));
+    *out_size = sizeof(t);
+    return 0;
+}
+
+/**
+ * @brief Запись настроек через w_param: применение и сохранение в NVS
+ */
+int Rdt_TuningParamWrite(const uint8_t *in_data, size_t in_size)
+{
+    if (!in_data || in_size != sizeof(rdt_tuning_t)) return 1;
+    rdt_tuning_t t;
+    memcpy(&t, in_data, sizeof(t));
+    if (Rdt_TuningSet(&t) != 0)
+    {
+        logW("RDT tuning rejected: out of range");
+        return 1;
+    }
+    if (Rdt_TuningSave() != 0)
+    {
+        logW("RDT tuning applied but not saved");
+    }
+    return 0;
+}
+
+/**
+ * @brief Установить политику переполнения rx-очереди канала
+ * @param[in] channel Номер канала
+ * @param[in] policy  Политика
+ * @param[in] key_fn  Ключ сообщения для RDT_RX_CONFLATE (NULL - первый байт блока)
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_ChannelSetRxPolicy(uint8_t channel, rdt_rx_policy_t policy, rdt_rx_key_fn_t key_fn)
+{
+    if (channel >= RDT_MAX_CHANNELS || policy > RDT_RX_CONFLATE) return 1;
+    if (s_rdt_mutex) xSemaphoreTake(s_rdt_mutex, portMAX_DELAY);
+    s_channels[channel].rx_policy = policy;
+    s_channels[channel].rx_key_fn = key_fn;
+    if (s_rdt_mutex) xSemaphoreGive(s_rdt_mutex);
+    return 0;
+}
+
+/**
+ * @brief Получить оценки состояния линии
+ * @param[out] out Оценки; глубина очередей - на момент вызова
+ */
+void Rdt_LinkStatsGet(rdt_link_stats_t *out)
+{
+    if (!out) return;
+
+    portENTER_CRITICAL(&s_link_mux);
+    *out = s_link;
+    portEXIT_CRITICAL(&s_link_mux);
+
+    for (uint8_t i = 0; i < RDT_MAX_CHANNELS; i++)
+    {
+        rdt_channel_t *ch = &s_channels[i];
+        UBaseType_t depth = ch->tx_queue ? uxQueueMessagesWaiting(ch->tx_queue) : 0;
+        if (ch->tx_ctrl.sending) depth++;
+        out->tx_queue_depth[i] = (uint8_t)(depth > UINT8_MAX ? UINT8_MAX : depth);
+    }
+}
+
 /**
  * @brief Получить готовый принятый блок из rx-очереди (если есть)
  * @param[in]  channel Номер канала
@@ -920,15 +2324,41 @@ bool Rdt_ReceiveBlock(uint8_t channel, rdt_block_item_t *block_item, TickType_t
     if (!block_item) return false;
 
     rdt_channel_t *ch = &s_channels[channel];
-    if (xQueueReceive(ch->rx_queue, block_item, wait_ticks) == pdTRUE)
+    if (xQueueReceive(ch->rx_queue, block_item, wait_ticks) != pdTRUE)
     {
-        return true;
+        return false;
     }
-    return false;
+    // Место в очереди освободилось - удерживаемый блок отдаётся сразу, не по периодическому обходу
+    if (ch->rx_ctrl.held && s_rdt_event_queue)
+    {
+        rdt_event_msg_t msg = {0};
+        msg.event_type = RDT_EVENT_RX_SPACE;
+        xQueueSend(s_rdt_event_queue, &msg, 0);
+    }
+
+    // Расшифровка в задаче получателя; поддельный или повторный блок отбрасывается
+    if (ch->encrypted && w_crypt_open(channel, block_item->data_ptr, &block_item->data_size) != 0)
+    {
+        Rdt_FreeReceivedBlock(block_item);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Добавить владельца принятого блока
+ * @param[in] block_item Блок, полученный через Rdt_ReceiveBlock
+ */
+void Rdt_RetainBlock(const rdt_block_item_t *block_item)
+{
+    if (!block_item || !block_item->data_ptr) return;
+    portENTER_CRITICAL(&s_block_ref_mux);
+    RDT_BLOCK_REF(block_item->data_ptr)->refs++;
+    portEXIT_CRITICAL(&s_block_ref_mux);
 }
 
 /**
- * @brief Освободить принятый блок, если библиотека выделяла память
+ * @brief Освободить принятый блок (снять одну ссылку; память освобождается последней)
  * @param[in] block_item Блок, полученный через Rdt_ReceiveBlock
  */
 void Rdt_FreeReceivedBlock(rdt_block_item_t *block_item)
@@ -937,7 +2367,13 @@ void Rdt_FreeReceivedBlock(rdt_block_item_t *block_item)
     if (!block_item) return;
     if (block_item->data_ptr)
     {
-        free(block_item->data_ptr);
+        portENTER_CRITICAL(&s_block_ref_mux);
+        uint32_t refs = --RDT_BLOCK_REF(block_item->data_ptr)->refs;
+        portEXIT_CRITICAL(&s_block_ref_mux);
+        if (refs == 0)
+        {
+            rdt_rx_buf_free(block_item->data_ptr);
+        }
     }
     block_item->data_ptr  = NULL;
     block_item->data_size = 0;
@@ -951,13 +2387,117 @@ void Rdt_FreeReceivedBlock(rdt_block_item_t *block_item)
 void Rdt_AddPeer(const uint8_t *peer_mac)
 {
     if (!peer_mac) return;
-    esp_now_peer_info_t peer = {0};
-    peer.channel = 1; // или другой канал
-    peer.ifidx   = ESP_IF_WIFI_STA;
-    peer.encrypt = false;
-    memcpy(peer.peer_addr, peer_mac, ESP_NOW_ETH_ALEN);
-    esp_now_add_peer(&peer);
+    if (s_transport->add_peer)
+    {
+        s_transport->add_peer(s_transport->ctx, peer_mac);
+    }
+    // Новый пир - его сеанс неизвестен
+    if (memcmp(s_peer_macaddr, peer_mac, ESP_NOW_ETH_ALEN) != 0)
+    {
+        s_peer_epoch = 0;
+    }
     memcpy(s_peer_macaddr, peer_mac, ESP_NOW_ETH_ALEN);
+    // Объявляем свой сеанс сразу: пир сбросит устаревшее состояние за одно RTT
+    rdt_send_hello();
+    rdt_transport_flush();
+
+    // Шифрование ESP-NOW не используется: ключ пира для блоков выводится w_crypt
+    w_crypt_set_peer(peer_mac);
+}
+
+/**
+ * @brief Текущий peer
+ * @param[out] peer_mac Буфер под MAC (6 байт)
+ */
+void Rdt_GetPeer(uint8_t *peer_mac)
+{
+    if (!peer_mac) return;
+    memcpy(peer_mac, s_peer_macaddr, ESP_NOW_ETH_ALEN);
+}
+
+// Передача всех каналов завершена: очереди пусты, текущих блоков нет
+static bool rdt_tx_idle(void)
+{
+    bool idle = true;
+    xSemaphoreTake(s_rdt_mutex, portMAX_DELAY);
+    for (uint8_t i = 0; i < RDT_MAX_CHANNELS && idle; i++)
+    {
+        rdt_channel_t *ch = &s_channels[i];
+        if (ch->tx_ctrl.sending || (ch->tx_queue && uxQueueMessagesWaiting(ch->tx_queue))) idle = false;
+    }
+    xSemaphoreGive(s_rdt_mutex);
+    return idle;
+}
+
+/**
+ * @brief Сменить пира с отдельным сеансом
+ * @param[in] peer_mac   MAC нового пира
+ * @param[in] timeout_ms Сколько ждать завершения передачи прежнему пиру, мс
+ * @return 0 - OK, 1 - передача не завершилась за timeout_ms (пир всё равно сменён), 2 - ошибка
+ */
+int Rdt_SwitchPeer(const uint8_t *peer_mac, uint32_t timeout_ms)
+{
+    if (!peer_mac || !s_rdt_mutex) return 2;
+    if (memcmp(s_peer_macaddr, peer_mac, ESP_NOW_ETH_ALEN) == 0) return 0;
+
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    bool idle;
+    while (!(idle = rdt_tx_idle()) && esp_timer_get_time() < deadline)
+    {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    if (!idle) logW("peer switch: tx not drained in %u ms, dropping", (unsigned)timeout_ms);
+
+    uint8_t prev[ESP_NOW_ETH_ALEN];
+    xSemaphoreTake(s_rdt_mutex, portMAX_DELAY);
+    for (uint8_t i = 0; i < RDT_MAX_CHANNELS; i++)
+    {
+        rdt_channel_t *ch = &s_channels[i];
+        if (!ch->tx_queue) continue;
+
+        if (ch->tx_ctrl.sending) rdt_finish_tx_block(i, false);
+        memset(ch->tx_ctrl.failed, 0, sizeof(ch->tx_ctrl.failed));   // блок прежнему пиру новому не продолжить
+        rdt_block_item_t item;
+        while (xQueueReceive(ch->tx_queue, &item, 0) == pdTRUE)
+        {
+            free(item.data_ptr);
+            if (ch->tx_done_cb) ch->tx_done_cb(i, item.user_ctx, false);
+        }
+        rdt_rx_reset(&ch->rx_ctrl);
+    }
+    rdt_time_reset();
+    // Новый сеанс: пир, с которым связь уже была, сбросит её остатки по первому кадру
+    uint32_t epoch = s_epoch;
+    while (s_epoch == 0 || s_epoch == epoch)
+    {
+        s_epoch = esp_random();
+    }
+    memcpy(prev, s_peer_macaddr, ESP_NOW_ETH_ALEN);
+    xSemaphoreGive(s_rdt_mutex);
+
+    w_snapshot_peer_reset();
+    w_dedup_peer_reset();
+    if (s_transport->del_peer && memcmp(prev, s_broadcast_mac, ESP_NOW_ETH_ALEN) != 0)
+    {
+        s_transport->del_peer(s_transport->ctx, prev);
+    }
+    Rdt_AddPeer(peer_mac);
+    return idle ? 0 : 1;
+}
+
+/**
+ * @brief Включить/выключить шифрование блоков канала (w_crypt.h)
+ * @param[in] channel Номер канала
+ * @param[in] enable  true - блоки шифруются AES-GCM ключом пира
+ * @return 0 - OK, 1 - ошибка
+ */
+int Rdt_ChannelSetEncrypted(uint8_t channel, bool enable)
+{
+    if (channel >= RDT_MAX_CHANNELS) return 1;
+    if (s_rdt_mutex) xSemaphoreTake(s_rdt_mutex, portMAX_DELAY);
+    s_channels[channel].encrypted = enable;
+    if (s_rdt_mutex) xSemaphoreGive(s_rdt_mutex);
+    return 0;
 }
 
 /**
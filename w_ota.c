@@ -0,0 +1,514 @@
+/**
+ * @file w_ota.c
+ * @brief Обновление прошивки по линии RDT (канал W_CHAN_OTA, поверх w_rpc)
+ *
+ * @author Pavel
+ * @date 2025-03-12
+ */
+
+#include "w_ota.h"
+#include "w_rpc.h"
+#include "w_main.h"
+#include "w_user.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "nvs.h"
+#endif
+
+#define TAG "w_ota"
+#include "log.h"
+
+#define W_OTA_CALL_TIMEOUT      pdMS_TO_TICKS(3000)
+#define W_OTA_BEGIN_TIMEOUT     pdMS_TO_TICKS(30000)    ///< Стирание раздела
+#define W_OTA_FINISH_TIMEOUT    pdMS_TO_TICKS(15000)    ///< Чтение образа и SHA-256
+#define W_OTA_READ_BUF          1024
+#define W_OTA_SWITCH_TIMEOUT_MS 3000                    ///< Ожидание передачи прежнему пиру при смене узла
+
+static bool g_initialized = false;
+static w_rpc_t s_rpc;
+
+// Приёмник
+static const w_ota_flash_ops_t *s_flash = NULL;
+static w_ota_progress_t s_rx            = {0};
+static bool     s_rx_active             = false;
+static uint32_t s_rx_saved              = 0;    ///< Смещение последнего сохранения прогресса
+
+static uint8_t w_ota_m_begin(const uint8_t *req, size_t req_len, uint8_t *resp, size_t *resp_len, void *ctx);
+static uint8_t w_ota_m_write(const uint8_t *req, size_t req_len, uint8_t *resp, size_t *resp_len, void *ctx);
+static uint8_t w_ota_m_finish(const uint8_t *req, size_t req_len, uint8_t *resp, size_t *resp_len, void *ctx);
+
+// Все методы работают с флешем - в задаче w_rpc, а не в обработчике событий
+static const w_rpc_method_t s_methods[] = {
+    { .method = W_OTA_M_BEGIN,  .handler = w_ota_m_begin,  .max_resp = sizeof(w_ota_resp_t), .flags = W_RPC_METHOD_WORKER },
+    { .method = W_OTA_M_WRITE,  .handler = w_ota_m_write,  .max_resp = sizeof(w_ota_resp_t), .flags = W_RPC_METHOD_WORKER },
+    { .method = W_OTA_M_FINISH, .handler = w_ota_m_finish, .max_resp = sizeof(w_ota_resp_t), .flags = W_RPC_METHOD_WORKER },
+};
+
+/* ----------------------------------------------------------------
+ * Локальные функции
+ * ---------------------------------------------------------------- */
+
+// SHA-256 образа, читаемого частями (раздел приёмника или источник отправителя)
+static int w_ota_hash(int (*read)(void *, size_t, uint8_t *, size_t), void *ctx, size_t size, uint8_t *out)
+{
+    uint8_t *buf = (uint8_t *)malloc(W_OTA_READ_BUF);
+    if (!buf) return 1;
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    int ret = 0;
+    for (size_t off = 0; off < size; off += W_OTA_READ_BUF)
+    {
+        size_t len = size - off < W_OTA_READ_BUF ? size - off : W_OTA_READ_BUF;
+        if (read(ctx, off, buf, len) != 0)
+        {
+            ret = 1;
+            break;
+        }
+        mbedtls_sha256_update(&sha, buf, len);
+    }
+    if (!ret) mbedtls_sha256_finish(&sha, out);
+    mbedtls_sha256_free(&sha);
+    free(buf);
+    return ret;
+}
+
+static void w_ota_resp_set(uint8_t *resp, size_t *resp_len, uint32_t offset)
+{
+    w_ota_resp_t r = { .offset = offset };
+    memcpy(resp, &r, sizeof(r));
+    *resp_len = sizeof(r);
+}
+
+static void w_ota_progress_store(void)
+{
+    if (!s_flash->progress_save) return;
+    if (s_flash->progress_save(s_flash->ctx, &s_rx) != 0)
+    {
+        logW("прогресс не сохранён");
+        return;
+    }
+    s_rx_saved = s_rx.offset;
+}
+
+static bool w_ota_same_image(const w_ota_progress_t *p, const w_ota_begin_req_t *b)
+{
+    return p->image_size == b->image_size && memcmp(p->sha256, b->sha256, W_OTA_HASH_LEN) == 0;
+}
+
+/* ----------------------------------------------------------------
+ * Методы приёмника
+ * ---------------------------------------------------------------- */
+
+static uint8_t w_ota_m_begin(const uint8_t *req, size_t req_len, uint8_t *resp, size_t *resp_len, void *ctx)
+{
+    if (!s_flash) return W_OTA_ERR_NO_RX;
+    if (req_len < sizeof(w_ota_begin_req_t)) return W_OTA_ERR_STATE;
+    w_ota_begin_req_t b;
+    memcpy(&b, req, sizeof(b));
+
+    // Та же загрузка: продолжается в RAM или сохранена до перезагрузки
+    if (!(s_rx_active && w_ota_same_image(&s_rx, &b)))
+    {
+        w_ota_progress_t saved;
+        if (s_flash->progress_load && s_flash->progress_load(s_flash->ctx, &saved) == 0 &&
+            w_ota_same_image(&saved, &b) && saved.offset <= saved.image_size)
+        {
+            // Записанное после сохранения повторится теми же данными: флеш допускает перезапись
+            // теми же битами, стирать раздел не нужно
+            s_rx        = saved;
+            s_rx_saved  = saved.offset;
+            s_rx_active = true;
+            logI("загрузка продолжается с %u из %u", (unsigned)s_rx.offset, (unsigned)s_rx.image_size);
+        }
+        else
+        {
+            s_rx_active = false;
+            if (s_flash->begin(s_flash->ctx, b.image_size) != 0)
+            {
+                logE("раздел не подготовлен под образ %u байт", (unsigned)b.image_size);
+                return W_OTA_ERR_FLASH;
+            }
+            memset(&s_rx, 0, sizeof(s_rx));
+            s_rx.image_size = b.image_size;
+            memcpy(s_rx.sha256, b.sha256, W_OTA_HASH_LEN);
+            s_rx_active = true;
+            w_ota_progress_store();
+            logI("загрузка образа %u байт", (unsigned)b.image_size);
+        }
+    }
+    w_ota_resp_set(resp, resp_len, s_rx.offset);
+    return W_OTA_OK;
+}
+
+static uint8_t w_ota_m_write(const uint8_t *req, size_t req_len, uint8_t *resp, size_t *resp_len, void *ctx)
+{
+    if (!s_flash) return W_OTA_ERR_NO_RX;
+    if (!s_rx_active || req_len < sizeof(w_ota_write_req_t)) return W_OTA_ERR_STATE;
+
+    const w_ota_write_req_t *w = (const w_ota_write_req_t *)req;
+    uint32_t offset;
+    memcpy(&offset, &w->offset, sizeof(offset));
+    size_t len = req_len - sizeof(w_ota_write_req_t);
+
+    // Повтор уже записанной части (ответ был потерян) - только подтверждение
+    if (offset < s_rx.offset)
+    {
+        w_ota_resp_set(resp, resp_len, s_rx.offset);
+        return W_OTA_OK;
+    }
+    if (offset != s_rx.offset || len == 0 || len > s_rx.image_size - offset)
+    {
+        w_ota_resp_set(resp, resp_len, s_rx.offset);
+        return W_OTA_ERR_OFFSET;
+    }
+    if (s_flash->write(s_flash->ctx, offset, w->data, len) != 0)
+    {
+        logE("ошибка записи по смещению %u", (unsigned)offset);
+        return W_OTA_ERR_FLASH;
+    }
+    s_rx.offset += len;
+    if (s_rx.offset - s_rx_saved >= W_OTA_SAVE_EVERY)
+    {
+        w_ota_progress_store();
+    }
+    w_ota_resp_set(resp, resp_len, s_rx.offset);
+    return W_OTA_OK;
+}
+
+static uint8_t w_ota_m_finish(const uint8_t *req, size_t req_len, uint8_t *resp, size_t *resp_len, void *ctx)
+{
+    if (!s_flash) return W_OTA_ERR_NO_RX;
+    if (!s_rx_active || s_rx.offset != s_rx.image_size) return W_OTA_ERR_STATE;
+
+    uint8_t hash[W_OTA_HASH_LEN];
+    uint8_t status = W_OTA_OK;
+    if (w_ota_hash(s_flash->read, s_flash->ctx, s_rx.image_size, hash) != 0)
+    {
+        status = W_OTA_ERR_FLASH;
+    }
+    else if (memcmp(hash, s_rx.sha256, W_OTA_HASH_LEN) != 0)
+    {
+        logE("SHA-256 образа не совпал, загрузка сброшена");
+        status = W_OTA_ERR_HASH;
+    }
+    else if (s_flash->activate(s_flash->ctx, s_rx.image_size) != 0)
+    {
+        logE("раздел не стал загрузочным");
+        status = W_OTA_ERR_FLASH;
+    }
+
+    // Завершённая или испорченная загрузка не продолжается; ошибку раздела можно повторить
+    if (status != W_OTA_ERR_FLASH)
+    {
+        s_rx_active = false;
+        memset(&s_rx, 0, sizeof(s_rx));
+        w_ota_progress_store();
+    }
+    if (status == W_OTA_OK)
+    {
+        logI("образ проверен, раздел загрузочный");
+    }
+    *resp_len = 0;
+    return status;
+}
+
+/* ----------------------------------------------------------------
+ * Отправитель
+ * ---------------------------------------------------------------- */
+
+/**
+ * @brief Вызов с повтором при истечении срока (методы идемпотентны по смещению)
+ */
+static int w_ota_call(uint8_t method, const uint8_t *req, size_t req_len, w_ota_resp_t *resp, TickType_t timeout)
+{
+    int ret = W_RPC_ERR_TIMEOUT;
+    for (int attempt = 0; attempt < W_OTA_RETRIES; attempt++)
+    {
+        uint8_t status   = 0;
+        size_t  resp_len = sizeof(*resp);
+        int r = w_rpc_call(&s_rpc, method, req, req_len, (uint8_t *)resp, &resp_len, timeout, &status);
+        if (r == 0)
+        {
+            if (method != W_OTA_M_FINISH && (status == W_OTA_OK || status == W_OTA_ERR_OFFSET) &&
+                resp_len < sizeof(*resp))
+            {
+                return W_OTA_ERR_STATE;
+            }
+            return status;
+        }
+        ret = (r == -3) ? W_RPC_ERR_TIMEOUT : (r == -2) ? W_RPC_ERR_BUSY : W_RPC_ERR_SEND;
+        logW("метод %d: попытка %d не удалась (%d)", method, attempt + 1, r);
+        if (r != -3) vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    return ret;
+}
+
+/* ----------------------------------------------------------------
+ * Файл вместо раздела
+ * ---------------------------------------------------------------- */
+
+static int w_ota_file_begin(void *ctx, size_t image_size)
+{
+    w_ota_flash_file_t *f = (w_ota_flash_file_t *)ctx;
+    FILE *fp = fopen(f->path, "wb");
+    if (!fp) return 1;
+    fclose(fp);
+    f->activated = false;
+    return 0;
+}
+
+static int w_ota_file_write(void *ctx, size_t offset, const uint8_t *data, size_t len)
+{
+    w_ota_flash_file_t *f = (w_ota_flash_file_t *)ctx;
+    FILE *fp = fopen(f->path, "r+b");
+    if (!fp) return 1;
+    int ret = (fseek(fp, (long)offset, SEEK_SET) != 0 || fwrite(data, 1, len, fp) != len);
+    fclose(fp);
+    return ret;
+}
+
+static int w_ota_file_read(void *ctx, size_t offset, uint8_t *data, size_t len)
+{
+    w_ota_flash_file_t *f = (w_ota_flash_file_t *)ctx;
+    FILE *fp = fopen(f->path, "rb");
+    if (!fp) return 1;
+    int ret = (fseek(fp, (long)offset, SEEK_SET) != 0 || fread(data, 1, len, fp) != len);
+    fclose(fp);
+    return ret;
+}
+
+static int w_ota_file_activate(void *ctx, size_t image_size)
+{
+    ((w_ota_flash_file_t *)ctx)->activated = true;
+    return 0;
+}
+
+static int w_ota_file_progress(void *ctx, w_ota_progress_t *p, bool save)
+{
+    w_ota_flash_file_t *f = (w_ota_flash_file_t *)ctx;
+    char path[sizeof(f->path) + 16];
+    snprintf(path, sizeof(path), "%s.progress", f->path);
+    FILE *fp = fopen(path, save ? "wb" : "rb");
+    if (!fp) return 1;
+    size_t n = save ? fwrite(p, sizeof(*p), 1, fp) : fread(p, sizeof(*p), 1, fp);
+    fclose(fp);
+    return n != 1;
+}
+
+static int w_ota_file_progress_save(void *ctx, const w_ota_progress_t *p)
+{
+    w_ota_progress_t copy = *p;
+    return w_ota_file_progress(ctx, &copy, true);
+}
+
+static int w_ota_file_progress_load(void *ctx, w_ota_progress_t *p)
+{
+    return w_ota_file_progress(ctx, p, false);
+}
+
+/* ----------------------------------------------------------------
+ * Раздел OTA ESP32
+ * ---------------------------------------------------------------- */
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+
+#define W_OTA_NVS_NAMESPACE     "w_ota"
+#define W_OTA_NVS_KEY           "progress"
+#define W_OTA_ERASE_ALIGN       4096
+
+static const esp_partition_t *w_ota_esp_part(void)
+{
+    static const esp_partition_t *part = NULL;
+    if (!part) part = esp_ota_get_next_update_partition(NULL);
+    return part;
+}
+
+static int w_ota_esp_begin(void *ctx, size_t image_size)
+{
+    const esp_partition_t *part = w_ota_esp_part();
+    if (!part || image_size > part->size) return 1;
+    size_t erase = (image_size + W_OTA_ERASE_ALIGN - 1) & ~(size_t)(W_OTA_ERASE_ALIGN - 1);
+    return esp_partition_erase_range(part, 0, erase) != ESP_OK;
+}
+
+static int w_ota_esp_write(void *ctx, size_t offset, const uint8_t *data, size_t len)
+{
+    const esp_partition_t *part = w_ota_esp_part();
+    return !part || esp_partition_write(part, offset, data, len) != ESP_OK;
+}
+
+static int w_ota_esp_read(void *ctx, size_t offset, uint8_t *data, size_t len)
+{
+    const esp_partition_t *part = w_ota_esp_part();
+    return !part || esp_partition_read(part, offset, data, len) != ESP_OK;
+}
+
+static int w_ota_esp_activate(void *ctx, size_t image_size)
+{
+    // esp_ota_set_boot_partition проверяет заголовок и контрольную сумму образа
+    const esp_partition_t *part = w_ota_esp_part();
+    return !part || esp_ota_set_boot_partition(part) != ESP_OK;
+}
+
+static int w_ota_esp_progress_save(void *ctx, const w_ota_progress_t *p)
+{
+    nvs_handle_t h;
+    if (nvs_open(W_OTA_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) return 1;
+    esp_err_t err = nvs_set_blob(h, W_OTA_NVS_KEY, p, sizeof(*p));
+    if (err == ESP_OK) err = nvs_commit(h);
+    nvs_close(h);
+    return err != ESP_OK;
+}
+
+static int w_ota_esp_progress_load(void *ctx, w_ota_progress_t *p)
+{
+    nvs_handle_t h;
+    if (nvs_open(W_OTA_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK) return 1;
+    size_t len = sizeof(*p);
+    esp_err_t err = nvs_get_blob(h, W_OTA_NVS_KEY, p, &len);
+    nvs_close(h);
+    return err != ESP_OK || len != sizeof(*p);
+}
+
+const w_ota_flash_ops_t w_ota_flash_esp_ops = {
+    .begin         = w_ota_esp_begin,
+    .write         = w_ota_esp_write,
+    .read          = w_ota_esp_read,
+    .activate      = w_ota_esp_activate,
+    .progress_save = w_ota_esp_progress_save,
+    .progress_load = w_ota_esp_progress_load,
+    .ctx           = NULL,
+};
+
+#endif // CONFIG_IDF_TARGET_LINUX
+
+/* ----------------------------------------------------------------
+ * Публичные функции
+ * ---------------------------------------------------------------- */
+
+int w_ota_init(const w_ota_flash_ops_t *flash)
+{
+    if (g_initialized) return 0;
+    if (flash && (!flash->begin || !flash->write || !flash->read || !flash->activate)) return 1;
+
+    s_flash = flash;
+    // Методы регистрируются и без раздела: узел ответит W_OTA_ERR_NO_RX, а не молчанием
+    if (w_rpc_init(&s_rpc, W_CHAN_OTA, s_methods, sizeof(s_methods) / sizeof(s_methods[0])) != 0)
+    {
+        logE("w_rpc_init failed");
+        return 1;
+    }
+    g_initialized = true;
+    return 0;
+}
+
+int w_ota_push(const w_ota_source_t *src, uint32_t image_size, const uint8_t *sha256,
+               w_ota_progress_cb_t cb, void *ctx)
+{
+    if (!g_initialized || !src || !src->read || image_size == 0) return W_RPC_ERR_ARG;
+
+    w_ota_begin_req_t b = { .image_size = image_size };
+    if (sha256)
+    {
+        memcpy(b.sha256, sha256, W_OTA_HASH_LEN);
+    }
+    else if (w_ota_hash(src->read, src->ctx, image_size, b.sha256) != 0)
+    {
+        logE("источник образа не читается");
+        return W_RPC_ERR_ARG;
+    }
+
+    w_ota_resp_t r;
+    int st = w_ota_call(W_OTA_M_BEGIN, (const uint8_t *)&b, sizeof(b), &r, W_OTA_BEGIN_TIMEOUT);
+    if (st != W_OTA_OK) return st;
+    if (r.offset) logI("передача продолжается с %u", (unsigned)r.offset);
+
+    w_ota_write_req_t *w = (w_ota_write_req_t *)malloc(sizeof(w_ota_write_req_t) + W_OTA_CHUNK);
+    if (!w) return W_RPC_ERR_ARG;
+
+    uint32_t offset = r.offset;
+    int stalls = 0;
+    while (offset < image_size)
+    {
+        size_t len = image_size - offset < W_OTA_CHUNK ? image_size - offset : W_OTA_CHUNK;
+        if (src->read(src->ctx, offset, w->data, len) != 0)
+        {
+            logE("источник образа не читается по смещению %u", (unsigned)offset);
+            st = W_RPC_ERR_ARG;
+            break;
+        }
+        memcpy(&w->offset, &offset, sizeof(offset));
+        st = w_ota_call(W_OTA_M_WRITE, (const uint8_t *)w, sizeof(*w) + len, &r, W_OTA_CALL_TIMEOUT);
+        if (st != W_OTA_OK && st != W_OTA_ERR_OFFSET) break;
+
+        // Приёмник сообщает своё подтверждённое смещение; без продвижения - не бесконечно
+        if (r.offset <= offset || r.offset > image_size)
+        {
+            if (++stalls >= W_OTA_RETRIES)
+            {
+                st = W_OTA_ERR_OFFSET;
+                break;
+            }
+        }
+        else
+        {
+            stalls = 0;
+        }
+        if (r.offset <= image_size) offset = r.offset;
+        st = W_OTA_OK;
+        if (cb) cb(offset, image_size, ctx);
+    }
+    free(w);
+    if (st != W_OTA_OK) return st;
+
+    return w_ota_call(W_OTA_M_FINISH, NULL, 0, &r, W_OTA_FINISH_TIMEOUT);
+}
+
+size_t w_ota_push_nodes(const uint8_t (*macs)[6], size_t count,
+                        const w_ota_source_t *src, uint32_t image_size, const uint8_t *sha256,
+                        w_ota_progress_cb_t cb, void *ctx, int *results)
+{
+    if (!macs) return 0;
+
+    uint8_t prev_peer[6];
+    Rdt_GetPeer(prev_peer);
+
+    size_t ok = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        // Свой сеанс RDT на каждый узел: состояние каналов прежнего узла ему не достаётся
+        Rdt_SwitchPeer(macs[i], W_OTA_SWITCH_TIMEOUT_MS);
+        int st = w_ota_push(src, image_size, sha256, cb, ctx);
+        if (results) results[i] = st;
+        if (st == W_OTA_OK) ok++;
+        logI("узел %02x:%02x:%02x:%02x:%02x:%02x: %d", macs[i][0], macs[i][1], macs[i][2],
+             macs[i][3], macs[i][4], macs[i][5], st);
+    }
+
+    Rdt_SwitchPeer(prev_peer, W_OTA_SWITCH_TIMEOUT_MS);
+    return ok;
+}
+
+void w_ota_flash_file_init(w_ota_flash_file_t *f, const char *path, w_ota_flash_ops_t *ops)
+{
+    if (!f || !path || !ops) return;
+    memset(f, 0, sizeof(*f));
+    strncpy(f->path, path, sizeof(f->path) - 1);
+    ops->begin         = w_ota_file_begin;
+    ops->write         = w_ota_file_write;
+    ops->read          = w_ota_file_read;
+    ops->activate      = w_ota_file_activate;
+    ops->progress_save = w_ota_file_progress_save;
+    ops->progress_load = w_ota_file_progress_load;
+    ops->ctx           = f;
+}
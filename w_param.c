@@ -13,9 +13,12 @@
 #include "w_param.h"
 #include "wireless_port.h"   
 #include "w_main.h"
+#include "w_crc.h"
 #include "w_user.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -31,6 +34,10 @@
 // Таблица параметров
 static const w_param_descriptor_t *g_param_table = NULL;
 static size_t                      g_param_count = 0;
+
+// Прямой индекс: message_type -> позиция в таблице (W_PARAM_NO_INDEX, если параметра нет)
+#define W_PARAM_NO_INDEX 0xFF
+static uint8_t                     g_param_index[256];
 static bool                        g_initialized = false;
 
 // Для блокирующего запроса/ответа:
@@ -51,33 +58,96 @@ static uint8_t  *g_resp_user_buf  = NULL;
 static size_t   *g_resp_user_size = NULL;
 
 /**
- * Код возврата из ответа
+ * ID текущего запроса и счётчик для следующих
+ */
+static uint16_t  g_req_request_id  = 0;
+static uint16_t  g_next_request_id = 1;
+
+/**
+ * Код возврата и флаги из ответа
  */
 static uint8_t   g_resp_return_code = 255;
+static uint8_t   g_resp_flags       = 0;
 
 /**
  * Фактическая длина данных в ответе
  */
 static size_t    g_resp_data_len = 0;
 
+/**
+ * Хеджирование GET-запросов (клиент) и подавление дубликатов (сервер)
+ */
+static w_hedge_t g_hedge = {0};
+static w_dedup_t g_dedup = {0};
+
+/**
+ * Запрос без ответа (клиент) и последний выполненный SET с его кодом (сервер)
+ */
+static w_retry_t g_retry         = {0};
+static uint16_t  g_set_done_id   = 0;
+static uint8_t   g_set_done_code = 0;
+
+/**
+ * @brief Активный запрос доставлен (ASK от сервера): дубликат не встанет в очередь за ним
+ */
+static volatile bool g_req_delivered = false;
+
+/**
+ * Объединение одновременных одинаковых GET (ключ - message_type)
+ */
+static w_sflight_t g_sflight = {0};
+static uint32_t    g_req_flight = 0;   ///< Лидер single-flight текущего запроса (0 - нет)
+
 /* ----------------------------------------------------------------
  * Предварительные объявления
  * ---------------------------------------------------------------- */
 
 static void w_param_process_packet(const uint8_t *packet_data, size_t packet_size);
+static void w_param_tx_done(uint8_t channel, void *user_ctx, bool delivered);
+static int  w_param_send_packet(uint8_t message_type,
+                                uint8_t set_or_get,
+                                uint16_t request_id,
+                                uint8_t flags,
+                                const uint8_t *value,
+                                size_t value_len,
+                                void *user_ctx);
 static void w_param_receive_cb(void *handler_arg,
                                esp_event_base_t base,
                                int32_t id,
                                void *event_data);
+static void w_param_send_code(const w_header_param_t *hdr_in, uint8_t return_code);
 
 static const w_param_descriptor_t* find_param_descriptor(uint8_t message_type)
 {
-    for (size_t i = 0; i < g_param_count; i++)
+    uint8_t idx = g_param_index[message_type];
+    if (idx == W_PARAM_NO_INDEX || idx >= g_param_count)
+        return NULL;
+    return &g_param_table[idx];
+}
+
+static uint16_t w_param_next_request_id(void)
+{
+    uint16_t id = g_next_request_id++;
+    if (g_next_request_id == 0)
     {
-        if (g_param_table[i].message_type == message_type)
-            return &g_param_table[i];
+        g_next_request_id = 1;
     }
-    return NULL;
+    return id;
+}
+
+/**
+ * @brief CRC-32 запроса без request_id и флагов: одинаковые запросы дают одинаковый блок
+ */
+static uint32_t w_param_request_hash(uint8_t message_type, uint8_t set_or_get,
+                                     const uint8_t *value, size_t value_len)
+{
+    uint8_t  head[2] = { message_type, set_or_get };
+    uint32_t crc     = w_crc32_le(0, head, sizeof(head));
+    if (value && value_len > 0)
+    {
+        crc = w_crc32_le(crc, value, value_len);
+    }
+    return crc;
 }
 
 /* ----------------------------------------------------------------
@@ -86,8 +156,25 @@ static const w_param_descriptor_t* find_param_descriptor(uint8_t message_type)
 
 void w_param_init(const w_param_descriptor_t *table, size_t table_count)
 {
+    if (table_count >= W_PARAM_NO_INDEX)
+    {
+        logE("слишком много параметров: %d", (int)table_count);
+        table_count = W_PARAM_NO_INDEX - 1;
+    }
     g_param_table = table;
     g_param_count = table_count;
+
+    // Строим прямой индекс по message_type
+    memset(g_param_index, W_PARAM_NO_INDEX, sizeof(g_param_index));
+    for (size_t i = 0; i < table_count; i++)
+    {
+        if (g_param_index[table[i].message_type] != W_PARAM_NO_INDEX)
+        {
+            logW("повтор message_type=%d в таблице параметров", table[i].message_type);
+            continue;
+        }
+        g_param_index[table[i].message_type] = (uint8_t)i;
+    }
     g_initialized = true;
 
     // Создание семафора для ожидания ответа
@@ -96,6 +183,16 @@ void w_param_init(const w_param_descriptor_t *table, size_t table_count)
         g_response_sem = xSemaphoreCreateBinary();
     }
     g_request_mutex = xSemaphoreCreateMutex();
+    w_sflight_init(&g_sflight);
+    Rdt_ChannelSetTxDoneCallback(W_CHAN_PARAMS, w_param_tx_done);
+
+    // Случайное начало нумерации, чтобы после перезагрузки сервер не принял
+    // новые запросы за дубликаты старых
+    g_next_request_id = (uint16_t)esp_random();
+    if (g_next_request_id == 0)
+    {
+        g_next_request_id = 1;
+    }
 }
 
 void w_param_deinit(void)
@@ -103,6 +200,7 @@ void w_param_deinit(void)
     g_param_table = NULL;
     g_param_count = 0;
     g_initialized = false;
+    memset(g_param_index, W_PARAM_NO_INDEX, sizeof(g_param_index));
     // Опционально: удаление семафора
     // vSemaphoreDelete(g_response_sem);
     // g_response_sem = NULL;
@@ -123,6 +221,31 @@ int w_param_send_request_async(uint8_t message_type,
                                uint8_t set_or_get,
                                const uint8_t *value,
                                size_t value_len)
+{
+    return w_param_send_packet(message_type, set_or_get, w_param_next_request_id(), 0, value, value_len, NULL);
+}
+
+void w_param_hedge_enable(bool enable)
+{
+    g_hedge.enabled = enable;
+}
+
+void w_param_hedge_stats_get(w_hedge_stats_t *out)
+{
+    w_hedge_stats_get(&g_hedge, out);
+    if (out) out->coalesced = g_sflight.coalesced;
+}
+
+/**
+ * @brief Формирование и отправка пакета запроса
+ */
+static int w_param_send_packet(uint8_t message_type,
+                               uint8_t set_or_get,
+                               uint16_t request_id,
+                               uint8_t flags,
+                               const uint8_t *value,
+                               size_t value_len,
+                               void *user_ctx)
 {
     // Выделяем память для исходящего пакета
     size_t full_size = sizeof(w_header_param_t) + value_len;
@@ -135,6 +258,8 @@ int w_param_send_request_async(uint8_t message_type,
     hdr->message_type = message_type;
     hdr->set_or_get   = set_or_get; // W_PARAM_GET или W_PARAM_SET
     hdr->return_code  = 0;
+    hdr->request_id   = request_id;
+    hdr->flags        = flags;
 
     if (value && value_len > 0)
     {
@@ -142,7 +267,7 @@ int w_param_send_request_async(uint8_t message_type,
     }
 
     // Отправляем пакет
-    int ret = Rdt_SendBlock(W_CHAN_PARAMS, (const uint8_t *)hdr, full_size, NULL);
+    int ret = Rdt_SendBlock(W_CHAN_PARAMS, (const uint8_t *)hdr, full_size, user_ctx);
     if (ret == 1)
     {
         // Если ошибка отправки (1), освобождаем память
@@ -168,8 +293,23 @@ int w_param_request_blocking(uint8_t message_type,
         return -1;
     }
 
+    // Такой же GET уже в полёте - ждём его ответ вместо отправки своего.
+    // Иначе этот GET сразу становится лидером: попутчики присоединяются и пока он ждёт мьютекс
+    uint32_t sf_flight = 0;
+    if (set_or_get == W_PARAM_GET)
+    {
+        int sf_result;
+        if (w_sflight_join(&g_sflight, &message_type, sizeof(message_type),
+                           resp_data, resp_size, wait_ticks, return_code, &sf_result, &sf_flight))
+        {
+            logI("Param request msg_type=%d coalesced, result=%d", message_type, sf_result);
+            return sf_result;
+        }
+    }
+
     if(xSemaphoreTake(g_request_mutex, W_PARAM_DEFAULT_TIMEOUT ) != pdTRUE)
     {
+        w_sflight_complete(&g_sflight, sf_flight, -2, 0xFE, NULL, 0);
         if (return_code) { *return_code = 0xFE; }
         logE("mutex take failed!");
         return -2;
@@ -177,42 +317,91 @@ int w_param_request_blocking(uint8_t message_type,
 
     if (g_request_in_progress)
     {
+        w_sflight_complete(&g_sflight, sf_flight, -2, 0xFE, NULL, 0);
         if (return_code) { *return_code = 0xFE; }
         logE("уже выполняется другой запрос!");
         xSemaphoreGive(g_request_mutex);
         return -2;
     }
 
+    // Повтор запроса, на который не дождались ответа, идёт с прежним request_id: RDT продолжит
+    // недоставленный блок, а сервер узнает дубликат (SET не выполнится второй раз)
+    uint32_t retry_hash = w_param_request_hash(message_type, set_or_get, value, value_len);
+    size_t   retry_size = sizeof(w_header_param_t) + value_len;
+
     // Подготовка к выполнению нового запроса
     g_request_in_progress = true;
     g_req_msg_type        = message_type;
+    g_req_request_id      = w_retry_take(&g_retry, retry_hash, retry_size);
+    if (g_req_request_id == 0)
+    {
+        g_req_request_id = w_param_next_request_id();
+    }
     g_resp_return_code    = 0xFF;
+    g_resp_flags          = 0;
     g_resp_data_len       = 0;
     g_resp_user_buf       = resp_data;
     g_resp_user_size      = resp_size;
+    g_req_delivered       = false;
+    g_req_flight          = sf_flight;
 
     // Очистка семафора
     xSemaphoreTake(g_response_sem, 0);
 
     // Отправка запроса
-    int ret_send = w_param_send_request_async(message_type, set_or_get, value, value_len);
+    int64_t t_start = esp_timer_get_time();
+    int ret_send = w_param_send_packet(message_type, set_or_get, g_req_request_id, 0, value, value_len,
+                                       (void *)(uintptr_t)g_req_request_id);
     if (ret_send != 0)
     {
         // Ошибка отправки
         g_request_in_progress = false;
+        w_sflight_complete(&g_sflight, sf_flight, ret_send, 0xFD, NULL, 0);
         if (return_code) { *return_code = 0xFD; }
         logW("ошибка при отправке запроса");
         xSemaphoreGive(g_request_mutex);
         return ret_send; 
     }
 
-    // Ожидание ответа или таймаута
-    if (xSemaphoreTake(g_response_sem, wait_ticks) == pdTRUE)
+    // Ожидание ответа или таймаута. GET идемпотентен, поэтому при включённом
+    // хеджировании сначала ждём только адаптивный p95, затем шлём дубликат.
+    // Пока сам запрос не доставлен, его повторяет RDT, а дубликат встал бы в очередь
+    // канала за ним - дубликат уходит только после ASK запроса (потерян или задержан ответ)
+    TickType_t first_wait = (set_or_get == W_PARAM_GET) ? w_hedge_delay_ticks(&g_hedge, wait_ticks) : wait_ticks;
+    TickType_t waited     = first_wait;
+    bool       hedged     = false;
+    bool got_response = (xSemaphoreTake(g_response_sem, first_wait) == pdTRUE);
+    while (!got_response && first_wait < wait_ticks && waited < wait_ticks)
+    {
+        if (g_req_delivered)
+        {
+            if (w_param_send_packet(message_type, set_or_get, g_req_request_id, W_PARAM_FLAG_HEDGE,
+                                    value, value_len, NULL) == 0)
+            {
+                g_hedge.stats.hedges_sent++;
+                hedged = true;
+                logD("hedge msg_type=%d after %d ticks", message_type, (int)waited);
+            }
+            break;
+        }
+        TickType_t step = (wait_ticks - waited < first_wait) ? wait_ticks - waited : first_wait;
+        got_response = (xSemaphoreTake(g_response_sem, step) == pdTRUE);
+        waited += step;
+    }
+    if (!got_response && waited < wait_ticks)
+    {
+        got_response = (xSemaphoreTake(g_response_sem, wait_ticks - waited) == pdTRUE);
+    }
+
+    if (got_response)
     {
         // Ответ получен
         if (return_code)
             *return_code = g_resp_return_code;
 
+        w_hedge_record(&g_hedge, (uint32_t)(esp_timer_get_time() - t_start),
+                       hedged, (g_resp_flags & W_PARAM_FLAG_HEDGE) != 0);
+
         g_request_in_progress = false;
         logI("Done param request msg_type=%d, %s, value_len=%d", message_type, set_or_get?"SET":"GET", value_len);
         xSemaphoreGive(g_request_mutex);
@@ -222,6 +411,9 @@ int w_param_request_blocking(uint8_t message_type,
     {
         // Таймаут ожидания ответа
         g_request_in_progress = false;
+        w_sflight_complete(&g_sflight, sf_flight, -3, 0xFC, NULL, 0);
+        g_hedge.stats.timeouts++;
+        w_retry_failed(&g_retry, g_req_request_id, retry_hash, retry_size);
         if (return_code) { *return_code = 0xFC; }
         logW("превышено время ожидания ответа");
         xSemaphoreGive(g_request_mutex);
@@ -263,6 +455,20 @@ int w_param_set(uint8_t message_type,
  * Реализация локальных функций
  * ---------------------------------------------------------------- */
 
+/**
+ * @brief Завершение передачи блока канала W_CHAN_PARAMS (задача RDT, под её мьютексом)
+ *
+ * user_ctx - request_id активного запроса; ответы сервера отправляются с NULL.
+ */
+static void w_param_tx_done(uint8_t channel, void *user_ctx, bool delivered)
+{
+    (void)channel;
+    if (delivered && user_ctx && (uint16_t)(uintptr_t)user_ctx == g_req_request_id)
+    {
+        g_req_delivered = true;
+    }
+}
+
 /**
  * @brief Callback-функция, вызываемая при получении блока данных в канале W_CHAN_PARAMS
  */
@@ -295,6 +501,25 @@ static void w_param_receive_cb(void *handler_arg,
     Rdt_FreeReceivedBlock(&block_item);
 }
 
+/**
+ * @brief Ответ на запрос без данных, только с кодом возврата
+ */
+static void w_param_send_code(const w_header_param_t *hdr_in, uint8_t return_code)
+{
+    size_t resp_len = sizeof(w_header_param_t);
+    w_header_param_t *resp_pkt = (w_header_param_t *)malloc(resp_len);
+    if (!resp_pkt) return;
+
+    resp_pkt->message_type = hdr_in->message_type;
+    resp_pkt->set_or_get   = W_PARAM_RESP; // это ответ
+    resp_pkt->return_code  = return_code;
+    resp_pkt->request_id   = hdr_in->request_id;
+    resp_pkt->flags        = hdr_in->flags;
+
+    int ret = Rdt_SendBlock(W_CHAN_PARAMS, (uint8_t*)resp_pkt, resp_len, NULL);
+    if (ret == 1) free(resp_pkt);
+}
+
 /**
  * @brief Обработка входящего пакета (запроса или ответа)
  */
@@ -321,28 +546,35 @@ static void w_param_process_packet(const uint8_t *packet_data, size_t packet_siz
        ----------------------------------------------------- */
     if (set_or_get == W_PARAM_GET || set_or_get == W_PARAM_SET)
     {
+        // Дубликат уже обработанного запроса (хедж или повтор клиента). Ответ на первый экземпляр
+        // мог потеряться, поэтому GET выполняется и отвечается заново; SET не повторяется,
+        // на повтор последнего SET отвечаем его прежним кодом
+        if (w_dedup_check_and_add(&g_dedup, hdr_in->request_id) && set_or_get == W_PARAM_SET)
+        {
+            if (hdr_in->request_id == g_set_done_id)
+            {
+                w_param_send_code(hdr_in, g_set_done_code);
+                return;
+            }
+            logD("дубликат запроса id=%d подавлен", (int)hdr_in->request_id);
+            return;
+        }
+
         // Ищем дескриптор параметра
         const w_param_descriptor_t *desc = find_param_descriptor(message_type);
         if (!desc)
         {
             // Параметр не найден
-            return_code = 1; // код ошибки: "параметр не найден"
-            // Формируем ответ с кодом ошибки
-            size_t resp_len = sizeof(w_header_param_t);
-            w_header_param_t *resp_pkt = (w_header_param_t *)malloc(resp_len);
-            if (!resp_pkt) return;
-
-            resp_pkt->message_type = message_type;
-            resp_pkt->set_or_get   = W_PARAM_RESP; // это ответ
-            resp_pkt->return_code  = return_code;
-            
-            int ret = Rdt_SendBlock(W_CHAN_PARAMS, (uint8_t*)resp_pkt, resp_len, NULL);
-            if (ret == 1) free(resp_pkt);
+            w_param_send_code(hdr_in, 1); // код ошибки: "параметр не найден"
             return;
         }
 
-        // Готовим буфер для ответа (например, до 256 байт)
-        size_t max_resp_data = MAX_PARAM_LENGTH;
+        // Готовим буфер для ответа по подсказке размера из реестра; для SET данных в ответе нет
+        size_t max_resp_data = 0;
+        if (set_or_get == W_PARAM_GET)
+        {
+            max_resp_data = desc->max_size ? desc->max_size : MAX_PARAM_LENGTH;
+        }
         uint8_t *resp_buf = (uint8_t *)malloc(sizeof(w_header_param_t) + max_resp_data);
         if (!resp_buf)
         {
@@ -353,6 +585,8 @@ static void w_param_process_packet(const uint8_t *packet_data, size_t packet_siz
         w_header_param_t *hdr_out = (w_header_param_t *)resp_buf;
         hdr_out->message_type = message_type;
         hdr_out->set_or_get   = W_PARAM_RESP; // отмечаем как ответ
+        hdr_out->request_id   = hdr_in->request_id;
+        hdr_out->flags        = hdr_in->flags;
 
         uint8_t *payload_out = hdr_out->data;
         size_t   payload_out_size = max_resp_data;
@@ -384,6 +618,8 @@ static void w_param_process_packet(const uint8_t *packet_data, size_t packet_siz
                 return_code = 3; // запись не поддерживается
                 payload_out_size = 0;
             }
+            g_set_done_id   = hdr_in->request_id;
+            g_set_done_code = return_code;
         }
 
         hdr_out->return_code = return_code;
@@ -402,9 +638,11 @@ static void w_param_process_packet(const uint8_t *packet_data, size_t packet_siz
        ----------------------------------------------------- */
     else if (set_or_get == W_PARAM_RESP)
     {
-        if (g_request_in_progress && (message_type == g_req_msg_type))
+        if (g_request_in_progress && (message_type == g_req_msg_type) &&
+            (hdr_in->request_id == g_req_request_id))
         {
             g_resp_return_code = hdr_in->return_code;
+            g_resp_flags       = hdr_in->flags;
 
             // Копируем данные ответа в пользовательский буфер, если задан
             if (g_resp_user_buf && g_resp_user_size)
@@ -422,7 +660,8 @@ static void w_param_process_packet(const uint8_t *packet_data, size_t packet_siz
                 g_resp_data_len   = payload_in_size;
             }
 
-            // Освобождаем ожидающий поток
+            // Раздаём ответ попутчикам (если есть) и освобождаем ожидающий поток
+            w_sflight_complete(&g_sflight, g_req_flight, 0, hdr_in->return_code, payload_in, payload_in_size);
             xSemaphoreGive(g_response_sem);
         }
         else
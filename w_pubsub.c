@@ -0,0 +1,288 @@
+/**
+ * @file w_pubsub.c
+ * @brief Публикация/подписка по числовым темам поверх канала RDT
+ *
+ * @author Pavel
+ * @date 2025-03-03
+ */
+
+#include "w_pubsub.h"
+#include "w_main.h"
+#include "w_user.h"
+#include "wireless_port.h" // Wireless_Channel_Receive_Callback_Register
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define TAG "w_pubsub"
+#include "log.h"
+
+#define W_PUBSUB_MASK_BYTES     (W_PUBSUB_MAX_TOPICS / 8)
+
+/**
+ * @brief Подписчик
+ */
+typedef struct
+{
+    w_pubsub_cb_t cb;
+    void         *ctx;
+} w_pubsub_sub_t;
+
+/**
+ * @brief Запись таблицы тем
+ */
+typedef struct
+{
+    w_pubsub_sub_t         subs[W_PUBSUB_MAX_SUBS];
+    uint8_t                sub_count;
+    w_pubsub_topic_stats_t stats;
+} w_pubsub_topic_t;
+
+static bool g_initialized               = false;
+static uint8_t g_channel                = 0;
+static SemaphoreHandle_t g_mutex        = NULL;   // рекурсивный: коллбек может (от)писаться и публиковать
+
+// Таблица тем: индекс - номер темы
+static w_pubsub_topic_t s_topics[W_PUBSUB_MAX_TOPICS];
+
+// Набор тем, на которые подписан пир
+static uint8_t g_remote_mask[W_PUBSUB_MASK_BYTES] = {0};
+static volatile bool g_remote_known     = false;
+
+// Принятый блок, раздаваемый подписчикам (NULL - локальная публикация или вне раздачи)
+static const rdt_block_item_t *s_dispatch_block = NULL;
+
+static void w_pubsub_receive_cb(void *handler_arg, esp_event_base_t base, int32_t id, void *event_data);
+
+/* ----------------------------------------------------------------
+ * Локальные функции
+ * ---------------------------------------------------------------- */
+
+static void w_pubsub_local_mask(uint8_t *mask)
+{
+    memset(mask, 0, W_PUBSUB_MASK_BYTES);
+    xSemaphoreTakeRecursive(g_mutex, portMAX_DELAY);
+    for (uint8_t t = 0; t < W_PUBSUB_MAX_TOPICS; t++)
+    {
+        if (s_topics[t].sub_count) mask[t >> 3] |= (uint8_t)(1 << (t & 7));
+    }
+    xSemaphoreGiveRecursive(g_mutex);
+}
+
+static int w_pubsub_send_control(uint8_t op)
+{
+    size_t msg_size = 2 + (op == W_PUBSUB_OP_SET ? W_PUBSUB_MASK_BYTES : 0);
+    uint8_t *msg = (uint8_t *)malloc(msg_size);
+    if (!msg) return 1;
+
+    msg[0] = W_PUBSUB_TOPIC_CONTROL;
+    msg[1] = op;
+    if (op == W_PUBSUB_OP_SET)
+    {
+        w_pubsub_local_mask(&msg[2]);
+    }
+    if (Rdt_SendBlock(g_channel, msg, msg_size, NULL) != 0)
+    {
+        free(msg);
+        return 1;
+    }
+    return 0;
+}
+
+static void w_pubsub_handle_control(const uint8_t *data, size_t len)
+{
+    if (len < 1) return;
+
+    switch (data[0])
+    {
+    case W_PUBSUB_OP_SET:
+        if (len < 1 + W_PUBSUB_MASK_BYTES) return;
+        memcpy(g_remote_mask, &data[1], W_PUBSUB_MASK_BYTES);
+        g_remote_known = true;
+        logI("получен набор подписок пира");
+        break;
+    case W_PUBSUB_OP_QUERY:
+        w_pubsub_send_control(W_PUBSUB_OP_SET);
+        break;
+    default:
+        break;
+    }
+}
+
+// Раздача подписчикам темы. Мьютекс держится до конца раздачи: после возврата
+// w_pubsub_unsubscribe() из другой задачи коллбек больше не вызывается.
+// Обход идёт по копии: коллбек может сам отписаться, не сдвигая обход
+static void w_pubsub_dispatch(uint8_t topic, const uint8_t *data, size_t len)
+{
+    w_pubsub_sub_t subs[W_PUBSUB_MAX_SUBS];
+
+    xSemaphoreTakeRecursive(g_mutex, portMAX_DELAY);
+    w_pubsub_topic_t *t = &s_topics[topic];
+    uint8_t count = t->sub_count;
+    memcpy(subs, t->subs, count * sizeof(subs[0]));
+    for (uint8_t i = 0; i < count; i++)
+    {
+        subs[i].cb(topic, data, len, subs[i].ctx);
+    }
+    xSemaphoreGiveRecursive(g_mutex);
+}
+
+static void w_pubsub_receive_cb(void *handler_arg, esp_event_base_t base, int32_t id, void *event_data)
+{
+    rdt_block_item_t block_item;
+    if (!Rdt_ReceiveBlock(g_channel, &block_item, 0))
+    {
+        return;
+    }
+
+    if (block_item.data_size >= 1)
+    {
+        uint8_t topic    = block_item.data_ptr[0];
+        const uint8_t *d = block_item.data_ptr + 1;
+        size_t len       = block_item.data_size - 1;
+
+        if (topic == W_PUBSUB_TOPIC_CONTROL)
+        {
+            w_pubsub_handle_control(d, len);
+        }
+        else if (topic < W_PUBSUB_MAX_TOPICS)
+        {
+            s_topics[topic].stats.received++;
+            s_dispatch_block = &block_item;
+            w_pubsub_dispatch(topic, d, len);
+            s_dispatch_block = NULL;
+        }
+        else
+        {
+            logW("тема %d вне диапазона", topic);
+        }
+    }
+
+    Rdt_FreeReceivedBlock(&block_item);
+}
+
+/* ----------------------------------------------------------------
+ * Публичные функции
+ * ---------------------------------------------------------------- */
+
+int w_pubsub_init(uint8_t channel)
+{
+    if (g_initialized) return 0;
+    if (channel >= RDT_MAX_CHANNELS) return 1;
+
+    g_mutex = xSemaphoreCreateRecursiveMutex();
+    if (!g_mutex) return 1;
+
+    g_channel     = channel;
+    g_initialized = true;
+    Wireless_Channel_Receive_Callback_Register(w_pubsub_receive_cb, channel);
+    return 0;
+}
+
+int w_pubsub_subscribe(uint8_t topic, w_pubsub_cb_t cb, void *ctx)
+{
+    if (!g_initialized || !cb || topic >= W_PUBSUB_TOPIC_CONTROL) return 1;
+
+    xSemaphoreTakeRecursive(g_mutex, portMAX_DELAY);
+    w_pubsub_topic_t *t = &s_topics[topic];
+    if (t->sub_count >= W_PUBSUB_MAX_SUBS)
+    {
+        xSemaphoreGiveRecursive(g_mutex);
+        logE("нет места для подписчика темы %d", topic);
+        return 1;
+    }
+    t->subs[t->sub_count].cb  = cb;
+    t->subs[t->sub_count].ctx = ctx;
+    t->sub_count++;
+    bool first = (t->sub_count == 1);
+    xSemaphoreGiveRecursive(g_mutex);
+
+    // Набор тем изменился - сообщаем пиру
+    if (first) w_pubsub_send_control(W_PUBSUB_OP_SET);
+    return 0;
+}
+
+int w_pubsub_unsubscribe(uint8_t topic, w_pubsub_cb_t cb, void *ctx)
+{
+    if (!g_initialized || topic >= W_PUBSUB_TOPIC_CONTROL) return 1;
+
+    xSemaphoreTakeRecursive(g_mutex, portMAX_DELAY);
+    w_pubsub_topic_t *t = &s_topics[topic];
+    for (uint8_t i = 0; i < t->sub_count; i++)
+    {
+        if (t->subs[i].cb == cb && t->subs[i].ctx == ctx)
+        {
+            t->subs[i] = t->subs[t->sub_count - 1];
+            t->sub_count--;
+            bool last = (t->sub_count == 0);
+            xSemaphoreGiveRecursive(g_mutex);
+            if (last) w_pubsub_send_control(W_PUBSUB_OP_SET);
+            return 0;
+        }
+    }
+    xSemaphoreGiveRecursive(g_mutex);
+    return 1;
+}
+
+int w_pubsub_retain(rdt_block_item_t *out)
+{
+    if (!out || !s_dispatch_block) return 1;
+    Rdt_RetainBlock(s_dispatch_block);
+    *out = *s_dispatch_block;
+    return 0;
+}
+
+bool w_pubsub_remote_subscribed(uint8_t topic)
+{
+    if (topic >= W_PUBSUB_MAX_TOPICS) return false;
+    if (!g_remote_known) return true;
+    return (g_remote_mask[topic >> 3] >> (topic & 7)) & 1;
+}
+
+int w_pubsub_publish(uint8_t topic, const uint8_t *data, size_t len)
+{
+    if (!g_initialized || topic >= W_PUBSUB_TOPIC_CONTROL || (!data && len)) return 1;
+
+    w_pubsub_topic_t *t = &s_topics[topic];
+    t->stats.published++;
+
+    w_pubsub_dispatch(topic, data, len);
+
+    if (!w_pubsub_remote_subscribed(topic))
+    {
+        t->stats.suppressed++;
+        return 0;
+    }
+
+    uint8_t *msg = (uint8_t *)malloc(1 + len);
+    if (!msg) return 1;
+    msg[0] = topic;
+    if (len) memcpy(&msg[1], data, len);
+    if (Rdt_SendBlock(g_channel, msg, 1 + len, NULL) != 0)
+    {
+        free(msg);
+        return 1;
+    }
+    t->stats.sent++;
+    return 0;
+}
+
+int w_pubsub_resync(void)
+{
+    if (!g_initialized) return 1;
+    int ret = w_pubsub_send_control(W_PUBSUB_OP_SET);
+    ret |= w_pubsub_send_control(W_PUBSUB_OP_QUERY);
+    return ret;
+}
+
+void w_pubsub_topic_stats_get(uint8_t topic, w_pubsub_topic_stats_t *out)
+{
+    if (!out) return;
+    if (topic >= W_PUBSUB_MAX_TOPICS)
+    {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    *out = s_topics[topic].stats;
+}
@@ -0,0 +1,685 @@
+/**
+ * @file w_rpc.c
+ * @brief Универсальный запрос/ответ (RPC) поверх канала RDT
+ *
+ * @author Pavel
+ * @date 2025-03-05
+ */
+
+#include "w_rpc.h"
+#include "w_main.h"
+#include "w_crc.h"
+#include "w_user.h"
+#include "wireless_port.h" // Wireless_Channel_Receive_Callback_Register
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define TAG "w_rpc"
+#include "log.h"
+
+#define W_RPC_NO_INDEX 0xFF
+
+/**
+ * @brief Запрос к задаче модуля: принятый блок целиком (освобождается задачей)
+ */
+typedef struct
+{
+    rdt_block_item_t block;
+    TickType_t       rx_tick;   ///< Момент приёма (для проверки срока)
+} w_rpc_job_t;
+
+/**
+ * @brief Истёкший асинхронный вызов (коллбек вызывается вне блокировки)
+ */
+typedef struct
+{
+    w_rpc_done_cb_t cb;
+    void           *ctx;
+} w_rpc_expired_t;
+
+// Состояние RPC по номеру канала (обработчик событий получает только номер канала)
+static w_rpc_t *s_rpc_by_channel[RDT_MAX_CHANNELS] = {0};
+
+static void w_rpc_receive_cb(void *handler_arg, esp_event_base_t base, int32_t id, void *event_data);
+static void w_rpc_tx_done(uint8_t channel, void *user_ctx, bool delivered);
+static void w_rpc_task(void *arg);
+
+/* ----------------------------------------------------------------
+ * Локальные функции
+ * ---------------------------------------------------------------- */
+
+static uint16_t w_rpc_next_request_id(w_rpc_t *rpc)
+{
+    uint16_t id = rpc->next_request_id++;
+    if (rpc->next_request_id == 0)
+    {
+        rpc->next_request_id = 1;
+    }
+    return id;
+}
+
+static uint16_t w_rpc_budget_ms(TickType_t ticks)
+{
+    uint32_t ms = pdTICKS_TO_MS(ticks);
+    return (uint16_t)(ms > UINT16_MAX ? UINT16_MAX : ms);
+}
+
+/**
+ * @brief Формирование и отправка пакета
+ * @param[in] user_ctx Контекст блока для w_rpc_tx_done (request_id запроса клиента, иначе NULL)
+ */
+static int w_rpc_send(w_rpc_t *rpc, uint8_t kind, uint8_t method, uint16_t request_id,
+                      uint8_t status, uint8_t flags, uint16_t budget_ms,
+                      const uint8_t *data, size_t len, void *user_ctx)
+{
+    size_t full_size = sizeof(w_header_rpc_t) + len;
+    w_header_rpc_t *hdr = (w_header_rpc_t *)malloc(full_size);
+    if (!hdr) return 1;
+
+    hdr->kind       = kind;
+    hdr->method     = method;
+    hdr->request_id = request_id;
+    hdr->status     = status;
+    hdr->flags      = flags;
+    hdr->budget_ms  = budget_ms;
+    if (data && len) memcpy(hdr->data, data, len);
+
+    if (Rdt_SendBlock(rpc->channel, (const uint8_t *)hdr, full_size, user_ctx) != 0)
+    {
+        free(hdr);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Сохранить ответ для повтора на дубликат запроса (под rpc->lock)
+ */
+static void w_rpc_replay_store(w_rpc_t *rpc, const w_header_rpc_t *resp, size_t len)
+{
+    if (len > W_RPC_REPLAY_MAX_LEN) return;
+    uint8_t *copy = NULL;
+    if (len)
+    {
+        copy = (uint8_t *)malloc(len);
+        if (!copy) return;
+        memcpy(copy, resp->data, len);
+    }
+    w_rpc_replay_t *r = &rpc->replay[rpc->replay_head];
+    free(r->data);
+    r->request_id = resp->request_id;
+    r->method     = resp->method;
+    r->status     = resp->status;
+    r->len        = (uint16_t)len;
+    r->data       = copy;
+    r->peer_gen   = rpc->dedup.peer_gen;
+    rpc->replay_head = (rpc->replay_head + 1) % W_RPC_REPLAY_DEPTH;
+}
+
+/**
+ * @brief Повторить сохранённый ответ на дубликат запроса
+ * @return true - ответ найден и отправлен
+ */
+static bool w_rpc_replay_send(w_rpc_t *rpc, const w_header_rpc_t *hdr)
+{
+    w_header_rpc_t *resp = NULL;
+    size_t len = 0;
+
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    for (int i = 0; i < W_RPC_REPLAY_DEPTH; i++)
+    {
+        const w_rpc_replay_t *r = &rpc->replay[i];
+        if (r->request_id != hdr->request_id || r->method != hdr->method) continue;
+        if (r->peer_gen != rpc->dedup.peer_gen) continue;   // ответ прежнему пиру
+        resp = (w_header_rpc_t *)malloc(sizeof(w_header_rpc_t) + r->len);
+        if (resp)
+        {
+            len = r->len;
+            resp->status = r->status;
+            if (len) memcpy(resp->data, r->data, len);
+        }
+        break;
+    }
+    xSemaphoreGive(rpc->lock);
+    if (!resp) return false;
+
+    resp->kind       = W_RPC_KIND_RESP;
+    resp->method     = hdr->method;
+    resp->request_id = hdr->request_id;
+    resp->flags      = hdr->flags;
+    resp->budget_ms  = 0;
+    if (Rdt_SendBlock(rpc->channel, (const uint8_t *)resp, sizeof(w_header_rpc_t) + len, NULL) != 0)
+    {
+        free(resp);
+        return false;
+    }
+    return true;
+}
+
+static const w_rpc_method_t *w_rpc_find_method(const w_rpc_t *rpc, uint8_t method)
+{
+    uint8_t idx = rpc->index[method];
+    if (idx == W_RPC_NO_INDEX || idx >= rpc->method_count) return NULL;
+    return &rpc->methods[idx];
+}
+
+/**
+ * @brief Выполнение запроса и отправка ответа (в обработчике событий или в задаче модуля)
+ */
+static void w_rpc_serve(w_rpc_t *rpc, const w_header_rpc_t *hdr, size_t size, TickType_t rx_tick)
+{
+    // Клиент уже перестал ждать - не тратим время на выполнение
+    if (hdr->budget_ms && xTaskGetTickCount() - rx_tick >= pdMS_TO_TICKS(hdr->budget_ms))
+    {
+        xSemaphoreTake(rpc->lock, portMAX_DELAY);
+        rpc->stats.expired++;
+        xSemaphoreGive(rpc->lock);
+        logD("запрос id=%d метод %d отброшен по сроку", (int)hdr->request_id, hdr->method);
+        return;
+    }
+
+    bool reply = !(hdr->flags & W_RPC_FLAG_NO_REPLY);
+    const w_rpc_method_t *m = w_rpc_find_method(rpc, hdr->method);
+    if (!m)
+    {
+        logW("метод %d не зарегистрирован", hdr->method);
+        if (reply)
+            w_rpc_send(rpc, W_RPC_KIND_RESP, hdr->method, hdr->request_id, W_RPC_ERR_NO_METHOD, hdr->flags, 0, NULL, 0, NULL);
+        return;
+    }
+
+    // Ответ формируется сразу в буфере пакета, который заберёт Rdt_SendBlock
+    w_header_rpc_t *resp = (w_header_rpc_t *)malloc(sizeof(w_header_rpc_t) + m->max_resp);
+    if (!resp)
+    {
+        logE("недостаточно памяти для ответа");
+        if (reply)
+            w_rpc_send(rpc, W_RPC_KIND_RESP, hdr->method, hdr->request_id, W_RPC_ERR_NO_MEM, hdr->flags, 0, NULL, 0, NULL);
+        return;
+    }
+
+    size_t resp_len = m->max_resp;
+    uint8_t status = m->handler(hdr->data, size - sizeof(w_header_rpc_t), resp->data, &resp_len, m->ctx);
+    if (resp_len > m->max_resp) resp_len = m->max_resp;
+
+    resp->kind       = W_RPC_KIND_RESP;
+    resp->method     = hdr->method;
+    resp->request_id = hdr->request_id;
+    resp->status     = status;
+    resp->flags      = hdr->flags;
+    resp->budget_ms  = 0;
+
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    rpc->stats.served++;
+    if (reply) w_rpc_replay_store(rpc, resp, resp_len);
+    xSemaphoreGive(rpc->lock);
+
+    if (!reply)
+    {
+        free(resp);
+        return;
+    }
+    if (Rdt_SendBlock(rpc->channel, (const uint8_t *)resp, sizeof(w_header_rpc_t) + resp_len, NULL) != 0)
+    {
+        free(resp);
+    }
+}
+
+/**
+ * @brief Сопоставление ответа с незавершённым вызовом
+ */
+static void w_rpc_handle_response(w_rpc_t *rpc, const w_header_rpc_t *hdr, size_t size)
+{
+    const uint8_t *data = hdr->data;
+    size_t len = size - sizeof(w_header_rpc_t);
+    w_rpc_done_cb_t cb = NULL;
+    void *ctx = NULL;
+    bool found = false;
+
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    for (int i = 0; i < W_RPC_MAX_PENDING; i++)
+    {
+        w_rpc_pending_t *p = &rpc->pending[i];
+        if (!p->used || p->done || p->request_id != hdr->request_id || p->method != hdr->method)
+            continue;
+
+        found = true;
+        if (p->cb)
+        {
+            // Асинхронный вызов: слот освобождается, коллбек - вне блокировки
+            cb  = p->cb;
+            ctx = p->ctx;
+            p->used = false;
+        }
+        else
+        {
+            // Блокирующий вызов: данные копируются, пока вызывающий не может освободить слот
+            if (p->buf && p->size)
+            {
+                size_t to_copy = (len <= *p->size) ? len : *p->size;
+                memcpy(p->buf, data, to_copy);
+                *p->size = to_copy;
+            }
+            else if (p->size)
+            {
+                *p->size = len;
+            }
+            p->status = hdr->status;
+            p->flags  = hdr->flags;
+            p->done   = true;
+            xSemaphoreGive(p->sem);
+        }
+        break;
+    }
+    if (found)
+        rpc->stats.completed++;
+    else
+        rpc->stats.late++;
+    xSemaphoreGive(rpc->lock);
+
+    if (cb)
+    {
+        cb(hdr->status, data, len, ctx);
+    }
+}
+
+/**
+ * @brief Завершение асинхронных вызовов с истёкшим сроком
+ */
+static void w_rpc_sweep(w_rpc_t *rpc)
+{
+    w_rpc_expired_t expired[W_RPC_MAX_PENDING];
+    int count = 0;
+    TickType_t now = xTaskGetTickCount();
+
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    for (int i = 0; i < W_RPC_MAX_PENDING; i++)
+    {
+        w_rpc_pending_t *p = &rpc->pending[i];
+        if (p->used && p->cb && (int32_t)(now - p->deadline) >= 0)
+        {
+            expired[count].cb  = p->cb;
+            expired[count].ctx = p->ctx;
+            count++;
+            p->used = false;
+            rpc->stats.timeouts++;
+        }
+    }
+    xSemaphoreGive(rpc->lock);
+
+    for (int i = 0; i < count; i++)
+    {
+        expired[i].cb(W_RPC_ERR_TIMEOUT, NULL, 0, expired[i].ctx);
+    }
+}
+
+/**
+ * @brief Занять слот вызова
+ * @param[in] request_id ID вызова (0 - новый)
+ * @return Слот или NULL, если все заняты
+ */
+static w_rpc_pending_t *w_rpc_slot_alloc(w_rpc_t *rpc, uint8_t method, uint16_t request_id,
+                                         TickType_t timeout, w_rpc_done_cb_t cb, void *ctx)
+{
+    w_rpc_pending_t *slot = NULL;
+
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    for (int i = 0; i < W_RPC_MAX_PENDING; i++)
+    {
+        if (!rpc->pending[i].used)
+        {
+            slot = &rpc->pending[i];
+            break;
+        }
+    }
+    if (slot)
+    {
+        slot->used       = true;
+        slot->done       = false;
+        slot->method     = method;
+        slot->request_id = request_id ? request_id : w_rpc_next_request_id(rpc);
+        slot->deadline   = xTaskGetTickCount() + timeout;
+        slot->cb         = cb;
+        slot->ctx        = ctx;
+        slot->buf        = NULL;
+        slot->size       = NULL;
+        slot->status     = W_RPC_ERR_TIMEOUT;
+        slot->flags      = 0;
+        slot->delivered  = false;
+        // Пробуждение от ответа, опоздавшего к предыдущему владельцу слота
+        xSemaphoreTake(slot->sem, 0);
+        rpc->stats.calls++;
+    }
+    xSemaphoreGive(rpc->lock);
+    return slot;
+}
+
+static void w_rpc_slot_free(w_rpc_t *rpc, w_rpc_pending_t *slot)
+{
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    slot->used = false;
+    xSemaphoreGive(rpc->lock);
+}
+
+static void w_rpc_receive_cb(void *handler_arg, esp_event_base_t base, int32_t id, void *event_data)
+{
+    if (id < 0 || id >= RDT_MAX_CHANNELS || !s_rpc_by_channel[id]) return;
+    w_rpc_t *rpc = s_rpc_by_channel[id];
+
+    rdt_block_item_t block_item;
+    if (!Rdt_ReceiveBlock(rpc->channel, &block_item, 0))
+    {
+        return;
+    }
+
+    const w_header_rpc_t *hdr = (const w_header_rpc_t *)block_item.data_ptr;
+    if (!block_item.data_ptr || block_item.data_size < sizeof(w_header_rpc_t))
+    {
+        logE("некорректный блок данных");
+    }
+    else if (hdr->kind == W_RPC_KIND_RESP)
+    {
+        w_rpc_handle_response(rpc, hdr, block_item.data_size);
+    }
+    else if (hdr->kind == W_RPC_KIND_REQ)
+    {
+        // Дубликат уже принятого запроса (хедж или повтор клиента): метод повторно не выполняется.
+        // Ответ на первый экземпляр мог потеряться - повторяем сохранённый; если его ещё нет,
+        // запрос выполняется и ответ уйдёт сам
+        if (w_dedup_check_and_add(&rpc->dedup, hdr->request_id))
+        {
+            bool replayed = !(hdr->flags & W_RPC_FLAG_NO_REPLY) && w_rpc_replay_send(rpc, hdr);
+            xSemaphoreTake(rpc->lock, portMAX_DELAY);
+            if (replayed)
+                rpc->stats.replayed++;
+            else
+                rpc->stats.duplicates++;
+            xSemaphoreGive(rpc->lock);
+        }
+        else
+        {
+            const w_rpc_method_t *m = w_rpc_find_method(rpc, hdr->method);
+            if (m && (m->flags & W_RPC_METHOD_WORKER))
+            {
+                // Блок передаётся задаче модуля без копирования, она его и освободит
+                w_rpc_job_t job = { .block = block_item, .rx_tick = xTaskGetTickCount() };
+                if (xQueueSend(rpc->jobs, &job, 0) == pdTRUE)
+                {
+                    return;
+                }
+                logW("очередь задачи заполнена, метод %d", hdr->method);
+                if (!(hdr->flags & W_RPC_FLAG_NO_REPLY))
+                    w_rpc_send(rpc, W_RPC_KIND_RESP, hdr->method, hdr->request_id,
+                               W_RPC_ERR_SERVER_BUSY, hdr->flags, 0, NULL, 0, NULL);
+            }
+            else
+            {
+                w_rpc_serve(rpc, hdr, block_item.data_size, xTaskGetTickCount());
+            }
+        }
+    }
+    else
+    {
+        logW("неизвестный вид пакета %d", hdr->kind);
+    }
+
+    Rdt_FreeReceivedBlock(&block_item);
+}
+
+/**
+ * @brief Завершение передачи блока канала (задача RDT): отметка доставки запроса клиента
+ */
+static void w_rpc_tx_done(uint8_t channel, void *user_ctx, bool delivered)
+{
+    if (!delivered || !user_ctx || channel >= RDT_MAX_CHANNELS || !s_rpc_by_channel[channel]) return;
+    w_rpc_t *rpc = s_rpc_by_channel[channel];
+    uint16_t request_id = (uint16_t)(uintptr_t)user_ctx;
+
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    for (int i = 0; i < W_RPC_MAX_PENDING; i++)
+    {
+        w_rpc_pending_t *p = &rpc->pending[i];
+        if (p->used && p->request_id == request_id)
+        {
+            p->delivered = true;
+            break;
+        }
+    }
+    xSemaphoreGive(rpc->lock);
+}
+
+/**
+ * @brief Задача модуля: долгие обработчики сервера и сроки асинхронных вызовов
+ */
+static void w_rpc_task(void *arg)
+{
+    w_rpc_t *rpc = (w_rpc_t *)arg;
+    w_rpc_job_t job;
+
+    while (1)
+    {
+        if (xQueueReceive(rpc->jobs, &job, pdMS_TO_TICKS(W_RPC_SWEEP_MS)) == pdTRUE)
+        {
+            w_rpc_serve(rpc, (const w_header_rpc_t *)job.block.data_ptr, job.block.data_size, job.rx_tick);
+            Rdt_FreeReceivedBlock(&job.block);
+        }
+        w_rpc_sweep(rpc);
+    }
+}
+
+/* ----------------------------------------------------------------
+ * Публичные функции
+ * ---------------------------------------------------------------- */
+
+int w_rpc_init(w_rpc_t *rpc, uint8_t channel, const w_rpc_method_t *methods, size_t method_count)
+{
+    if (!rpc || channel >= RDT_MAX_CHANNELS || s_rpc_by_channel[channel]) return 1;
+    if (method_count >= W_RPC_NO_INDEX)
+    {
+        logE("слишком много методов: %d", (int)method_count);
+        return 1;
+    }
+
+    memset(rpc, 0, sizeof(*rpc));
+    rpc->channel      = channel;
+    rpc->methods      = methods;
+    rpc->method_count = methods ? method_count : 0;
+
+    // Прямой индекс по номеру метода
+    memset(rpc->index, W_RPC_NO_INDEX, sizeof(rpc->index));
+    for (size_t i = 0; i < rpc->method_count; i++)
+    {
+        if (rpc->index[methods[i].method] != W_RPC_NO_INDEX || !methods[i].handler)
+        {
+            logW("метод %d пропущен (повтор или нет обработчика)", methods[i].method);
+            continue;
+        }
+        rpc->index[methods[i].method] = (uint8_t)i;
+    }
+
+    rpc->lock = xSemaphoreCreateMutex();
+    rpc->jobs = xQueueCreate(W_RPC_WORKER_QUEUE, sizeof(w_rpc_job_t));
+    if (!rpc->lock || !rpc->jobs) return 1;
+    for (int i = 0; i < W_RPC_MAX_PENDING; i++)
+    {
+        rpc->pending[i].sem = xSemaphoreCreateBinary();
+        if (!rpc->pending[i].sem) return 1;
+    }
+
+    // Случайное начало нумерации: после перезагрузки сервер не примет новые вызовы за дубликаты
+    rpc->next_request_id = (uint16_t)esp_random();
+    if (rpc->next_request_id == 0)
+    {
+        rpc->next_request_id = 1;
+    }
+
+    if (xTaskCreate(w_rpc_task, "w_rpc_task", 4096, rpc, 4, NULL) != pdPASS) return 1;
+
+    s_rpc_by_channel[channel] = rpc;
+    Wireless_Channel_Receive_Callback_Register(w_rpc_receive_cb, channel);
+    Rdt_ChannelSetTxDoneCallback(channel, w_rpc_tx_done);
+    return 0;
+}
+
+int w_rpc_call(w_rpc_t *rpc, uint8_t method, const uint8_t *req, size_t req_len,
+               uint8_t *resp, size_t *resp_size, TickType_t timeout, uint8_t *status)
+{
+    if (status) *status = W_RPC_ERR_ARG;
+    if (!rpc || !rpc->lock || (!req && req_len)) return -1;
+
+    // Повтор вызова, на который не дождались ответа, идёт с прежним request_id: RDT продолжит
+    // недоставленный блок, а сервер ответит сохранённым ответом вместо повторного выполнения
+    uint16_t budget_ms = w_rpc_budget_ms(timeout);
+    uint8_t  head[3]   = { method, (uint8_t)budget_ms, (uint8_t)(budget_ms >> 8) };
+    uint32_t retry_hash = w_crc32_le(w_crc32_le(0, head, sizeof(head)), req, req_len);
+    size_t   retry_size = sizeof(w_header_rpc_t) + req_len;
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    uint16_t retry_id = w_retry_take(&rpc->retry, retry_hash, retry_size);
+    xSemaphoreGive(rpc->lock);
+
+    w_rpc_pending_t *slot = w_rpc_slot_alloc(rpc, method, retry_id, timeout, NULL, NULL);
+    if (!slot)
+    {
+        if (status) *status = W_RPC_ERR_BUSY;
+        logW("нет свободного слота вызова, метод %d", method);
+        return -2;
+    }
+    slot->buf  = resp;
+    slot->size = resp_size;
+    uint16_t request_id = slot->request_id;
+
+    int64_t t_start = esp_timer_get_time();
+    if (w_rpc_send(rpc, W_RPC_KIND_REQ, method, request_id, 0, 0, budget_ms, req, req_len,
+                   (void *)(uintptr_t)request_id) != 0)
+    {
+        w_rpc_slot_free(rpc, slot);
+        if (status) *status = W_RPC_ERR_SEND;
+        logW("ошибка при отправке запроса, метод %d", method);
+        return -1;
+    }
+
+    // Идемпотентный метод: сначала ждём только адаптивный p95, затем шлём дубликат.
+    // Недоставленный запрос повторяет RDT, и дубликат встал бы в очередь канала за ним,
+    // поэтому дубликат уходит только после ASK запроса
+    bool idempotent = (rpc->idempotent[method >> 3] >> (method & 7)) & 1;
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    TickType_t first_wait = idempotent ? w_hedge_delay_ticks(&rpc->hedge, timeout) : timeout;
+    xSemaphoreGive(rpc->lock);
+    TickType_t waited = first_wait;
+    bool hedged = false;
+    xSemaphoreTake(slot->sem, first_wait);
+    while (!slot->done && first_wait < timeout && waited < timeout)
+    {
+        if (slot->delivered)
+        {
+            TickType_t left = timeout - waited;
+            if (w_rpc_send(rpc, W_RPC_KIND_REQ, method, request_id, 0, W_RPC_FLAG_HEDGE,
+                           w_rpc_budget_ms(left), req, req_len, NULL) == 0)
+            {
+                xSemaphoreTake(rpc->lock, portMAX_DELAY);
+                rpc->hedge.stats.hedges_sent++;
+                hedged = true;
+                xSemaphoreGive(rpc->lock);
+                logD("hedge метод %d после %d тиков", method, (int)waited);
+            }
+            break;
+        }
+        TickType_t step = (timeout - waited < first_wait) ? timeout - waited : first_wait;
+        xSemaphoreTake(slot->sem, step);
+        waited += step;
+    }
+    if (!slot->done && waited < timeout)
+    {
+        xSemaphoreTake(slot->sem, timeout - waited);
+    }
+
+    // Ответ мог прийти между таймаутом и освобождением слота - проверяем под блокировкой
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    bool done = slot->done;
+    uint8_t resp_status = slot->status;
+    uint8_t resp_flags = slot->flags;
+    slot->used = false;
+    if (done)
+    {
+        w_hedge_record(&rpc->hedge, (uint32_t)(esp_timer_get_time() - t_start),
+                       hedged, (resp_flags & W_RPC_FLAG_HEDGE) != 0);
+    }
+    else
+    {
+        rpc->stats.timeouts++;
+        rpc->hedge.stats.timeouts++;
+        w_retry_failed(&rpc->retry, request_id, retry_hash, retry_size);
+    }
+    xSemaphoreGive(rpc->lock);
+
+    if (status) *status = resp_status;
+    if (!done)
+    {
+        logW("превышено время ожидания ответа, метод %d", method);
+        return -3;
+    }
+    return 0;
+}
+
+int w_rpc_call_async(w_rpc_t *rpc, uint8_t method, const uint8_t *req, size_t req_len,
+                     TickType_t timeout, w_rpc_done_cb_t cb, void *ctx)
+{
+    if (!rpc || !rpc->lock || (!req && req_len)) return 1;
+
+    // Без коллбека - запрос без ответа, слот не нужен
+    if (!cb)
+    {
+        xSemaphoreTake(rpc->lock, portMAX_DELAY);
+        uint16_t request_id = w_rpc_next_request_id(rpc);
+        rpc->stats.calls++;
+        xSemaphoreGive(rpc->lock);
+        return w_rpc_send(rpc, W_RPC_KIND_REQ, method, request_id, 0,
+                          W_RPC_FLAG_NO_REPLY, w_rpc_budget_ms(timeout), req, req_len, NULL);
+    }
+
+    w_rpc_pending_t *slot = w_rpc_slot_alloc(rpc, method, 0, timeout, cb, ctx);
+    if (!slot)
+    {
+        logW("нет свободного слота вызова, метод %d", method);
+        return 1;
+    }
+
+    if (w_rpc_send(rpc, W_RPC_KIND_REQ, method, slot->request_id, 0, 0, w_rpc_budget_ms(timeout), req, req_len,
+                   (void *)(uintptr_t)slot->request_id) != 0)
+    {
+        w_rpc_slot_free(rpc, slot);
+        logW("ошибка при отправке запроса, метод %d", method);
+        return 1;
+    }
+    return 0;
+}
+
+void w_rpc_set_idempotent(w_rpc_t *rpc, uint8_t method, bool idempotent)
+{
+    if (!rpc) return;
+    if (idempotent)
+        rpc->idempotent[method >> 3] |= (uint8_t)(1 << (method & 7));
+    else
+        rpc->idempotent[method >> 3] &= (uint8_t)~(1 << (method & 7));
+}
+
+void w_rpc_hedge_enable(w_rpc_t *rpc, bool enable)
+{
+    if (!rpc || !rpc->lock) return;
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    rpc->hedge.enabled = enable;
+    xSemaphoreGive(rpc->lock);
+}
+
+void w_rpc_stats_get(w_rpc_t *rpc, w_rpc_stats_t *out, w_hedge_stats_t *hedge_out)
+{
+    if (!rpc || !rpc->lock) return;
+    xSemaphoreTake(rpc->lock, portMAX_DELAY);
+    if (out) *out = rpc->stats;
+    if (hedge_out) w_hedge_stats_get(&rpc->hedge, hedge_out);
+    xSemaphoreGive(rpc->lock);
+}
@@ -0,0 +1,147 @@
+/**
+ * @file w_sflight.c
+ * @brief Объединение одинаковых одновременных запросов (single-flight)
+ *
+ * @author Pavel
+ * @date 2025-02-12
+ */
+
+#include "w_sflight.h"
+#include <string.h>
+
+void w_sflight_init(w_sflight_t *sf)
+{
+    if (!sf || sf->lock) return;
+
+    sf->lock = xSemaphoreCreateMutex();
+    for (int i = 0; i < W_SFLIGHT_MAX_WAITERS; i++)
+    {
+        sf->waiters[i].sem = xSemaphoreCreateBinary();
+    }
+}
+
+// Открыть лидера с ключом (под sf->lock); 0 - все слоты заняты
+static uint32_t w_sflight_lead(w_sflight_t *sf, const void *key, size_t key_len)
+{
+    for (int i = 0; i < W_SFLIGHT_MAX_FLIGHTS; i++)
+    {
+        w_sflight_flight_t *f = &sf->flights[i];
+        if (f->id) continue;
+        if (++sf->next_id == 0) sf->next_id = 1;
+        f->id = sf->next_id;
+        memcpy(f->key, key, key_len);
+        f->key_len = key_len;
+        return f->id;
+    }
+    return 0;
+}
+
+bool w_sflight_join(w_sflight_t *sf, const void *key, size_t key_len,
+                    uint8_t *buf, size_t *size, TickType_t wait_ticks,
+                    uint8_t *return_code, int *result, uint32_t *flight)
+{
+    if (flight) *flight = 0;
+    if (!sf || !sf->lock || key_len > W_SFLIGHT_KEY_MAX) return false;
+
+    xSemaphoreTake(sf->lock, portMAX_DELAY);
+    const w_sflight_flight_t *f = NULL;
+    for (int i = 0; i < W_SFLIGHT_MAX_FLIGHTS; i++)
+    {
+        if (sf->flights[i].id && sf->flights[i].key_len == key_len &&
+            memcmp(sf->flights[i].key, key, key_len) == 0)
+        {
+            f = &sf->flights[i];
+            break;
+        }
+    }
+
+    w_sflight_waiter_t *w = NULL;
+    for (int i = 0; i < W_SFLIGHT_MAX_WAITERS; i++)
+    {
+        if (!sf->waiters[i].used)
+        {
+            w = &sf->waiters[i];
+            break;
+        }
+    }
+    if (!f || !w)
+    {
+        // Идентичного запроса нет (или все слоты попутчиков заняты) - выполняем свой.
+        // Лидер открывается сразу, до ожидания мьютекса запросов модуля
+        if (!f && flight) *flight = w_sflight_lead(sf, key, key_len);
+        xSemaphoreGive(sf->lock);
+        return false;
+    }
+
+    w->used        = true;
+    w->done        = false;
+    w->flight      = f->id;
+    w->result      = -1;
+    w->return_code = 0xFF;
+    w->buf         = buf;
+    w->size        = size;
+    xSemaphoreTake(w->sem, 0);
+    sf->coalesced++;
+    xSemaphoreGive(sf->lock);
+
+    xSemaphoreTake(w->sem, wait_ticks);
+
+    // Результат проверяем под мьютексом: лидер мог завершиться сразу после таймаута
+    xSemaphoreTake(sf->lock, portMAX_DELAY);
+    bool done = w->done;
+    int  res  = w->result;
+    uint8_t rc = w->return_code;
+    w->used = false;
+    w->buf  = NULL;
+    w->size = NULL;
+    xSemaphoreGive(sf->lock);
+
+    if (!done)
+    {
+        res = -3;
+        rc  = 0xFC;
+    }
+    if (return_code) *return_code = rc;
+    if (result) *result = res;
+    return true;
+}
+
+void w_sflight_complete(w_sflight_t *sf, uint32_t flight, int result, uint8_t return_code,
+                        const uint8_t *data, size_t data_len)
+{
+    if (!sf || !sf->lock || flight == 0) return;
+
+    xSemaphoreTake(sf->lock, portMAX_DELAY);
+    w_sflight_flight_t *f = NULL;
+    for (int i = 0; i < W_SFLIGHT_MAX_FLIGHTS; i++)
+    {
+        if (sf->flights[i].id == flight) f = &sf->flights[i];
+    }
+    if (!f)
+    {
+        xSemaphoreGive(sf->lock);
+        return;
+    }
+    f->id = 0;
+
+    for (int i = 0; i < W_SFLIGHT_MAX_WAITERS; i++)
+    {
+        w_sflight_waiter_t *w = &sf->waiters[i];
+        if (!w->used || w->done || w->flight != flight) continue;
+
+        if (result == 0 && w->size)
+        {
+            size_t to_copy = (data_len <= *w->size) ? data_len : *w->size;
+            if (w->buf && data && to_copy > 0)
+            {
+                memcpy(w->buf, data, to_copy);
+            }
+            *w->size = w->buf ? to_copy : data_len;
+        }
+        w->result      = result;
+        w->return_code = return_code;
+        w->done        = true;
+        xSemaphoreGive(w->sem);
+    }
+    xSemaphoreGive(sf->lock);
+}
@@ -0,0 +1,389 @@
+/**
+ * @file w_snapshot.c
+ * @brief Передача снимков сенсоров разностью относительно последнего подтверждённого снимка
+ *
+ * @author Pavel
+ * @date 2025-02-17
+ */
+
+#include "w_snapshot.h"
+#include "w_main.h"
+#include "w_user.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define TAG "w_snapshot"
+#include "log.h"
+
+/**
+ * Зарегистрированные передатчики: по ним проверяется user_ctx в коллбеке канала
+ */
+static w_snapshot_tx_t *s_tx_list[W_SNAPSHOT_MAX_STREAMS] = {0};
+
+/**
+ * Защита in_flight и обмена baseline/pending между задачей отправителя и задачей RDT
+ */
+static portMUX_TYPE s_snapshot_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Номер смены пира: приёмник сбрасывает снимок в своей задаче, увидев новый номер
+ */
+static volatile uint32_t s_peer_gen = 0;
+
+/* ----------------------------------------------------------------
+ * Локальные функции
+ * ---------------------------------------------------------------- */
+
+static bool w_snapshot_tx_registered(const void *ctx)
+{
+    if (!ctx) return false;
+    for (int i = 0; i < W_SNAPSHOT_MAX_STREAMS; i++)
+    {
+        if (s_tx_list[i] == ctx) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Коллбек завершения передачи блока канала (вызывается из задачи RDT)
+ */
+static void w_snapshot_tx_done(uint8_t channel, void *user_ctx, bool delivered)
+{
+    (void)channel;
+    if (!w_snapshot_tx_registered(user_ctx)) return;
+
+    w_snapshot_tx_t *tx = (w_snapshot_tx_t *)user_ctx;
+
+    portENTER_CRITICAL(&s_snapshot_mux);
+    if (delivered)
+    {
+        // Снимок в полёте становится базовым - меняем буферы местами
+        uint8_t *tmp      = tx->baseline;
+        tx->baseline      = tx->pending;
+        tx->pending       = tmp;
+        tx->baseline_seq  = tx->pending_seq;
+        tx->has_baseline  = true;
+    }
+    else
+    {
+        // Неизвестно, что есть у приёмника - начинаем с ключевого кадра
+        tx->force_keyframe = true;
+        tx->stats.failed++;
+    }
+    tx->in_flight = false;
+    portEXIT_CRITICAL(&s_snapshot_mux);
+
+    // Отложенные за время полёта изменения можно отправлять
+    if (tx->policy.notify_task)
+    {
+        xTaskNotifyGive(tx->policy.notify_task);
+    }
+}
+
+static int w_snapshot_send_keyframe_req(uint8_t channel, uint8_t stream)
+{
+    w_header_sensors_t *req = (w_header_sensors_t *)malloc(sizeof(w_header_sensors_t) + 1);
+    if (!req) return 1;
+
+    req->message_type = W_MSG_TYPE_SENSORS_KEYFRAME_REQ;
+    req->data[0]      = stream;
+    if (Rdt_SendBlock(channel, (uint8_t *)req, sizeof(w_header_sensors_t) + 1, NULL) != 0)
+    {
+        free(req);
+        return 1;
+    }
+    return 0;
+}
+
+/* ----------------------------------------------------------------
+ * Передатчик
+ * ---------------------------------------------------------------- */
+
+int w_snapshot_tx_init(w_snapshot_tx_t *tx, uint8_t channel, uint8_t stream,
+                       size_t record_size, uint8_t record_count, uint32_t keyframe_interval_ms)
+{
+    if (!tx || record_size == 0 || record_size > UINT16_MAX || record_count == 0) return 1;
+
+    memset(tx, 0, sizeof(*tx));
+    tx->channel           = channel;
+    tx->stream            = stream;
+    tx->record_size       = (uint16_t)record_size;
+    tx->record_count      = record_count;
+    tx->keyframe_interval_ms = keyframe_interval_ms;
+    tx->baseline          = (uint8_t *)calloc(record_count, record_size);
+    tx->pending           = (uint8_t *)calloc(record_count, record_size);
+    if (!tx->baseline || !tx->pending)
+    {
+        free(tx->baseline);
+        free(tx->pending);
+        tx->baseline = tx->pending = NULL;
+        logE("нет памяти для потока %d", stream);
+        return 1;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < W_SNAPSHOT_MAX_STREAMS; i++)
+    {
+        if (s_tx_list[i] == tx) { slot = i; break; }
+        if (slot < 0 && s_tx_list[i] == NULL) slot = i;
+    }
+    if (slot < 0)
+    {
+        logE("превышено количество потоков снимков");
+        return 1;
+    }
+    s_tx_list[slot] = tx;
+
+    return Rdt_ChannelSetTxDoneCallback(channel, w_snapshot_tx_done);
+}
+
+void w_snapshot_tx_set_policy(w_snapshot_tx_t *tx, const w_snapshot_policy_t *policy)
+{
+    if (!tx) return;
+    if (policy)
+        tx->policy = *policy;
+    else
+        memset(&tx->policy, 0, sizeof(tx->policy));
+}
+
+void w_snapshot_tx_set_keyframe_interval(w_snapshot_tx_t *tx, uint32_t keyframe_interval_ms)
+{
+    if (!tx) return;
+    tx->keyframe_interval_ms = keyframe_interval_ms;
+}
+
+int w_snapshot_tx_send(w_snapshot_tx_t *tx, const void *records)
+{
+    if (!tx || !tx->baseline || !records) return W_SNAPSHOT_ERROR;
+
+    const size_t   rs    = tx->record_size;
+    const size_t   full  = rs * tx->record_count;
+    const uint8_t *cur   = (const uint8_t *)records;
+
+    portENTER_CRITICAL(&s_snapshot_mux);
+    bool busy = tx->in_flight;
+    portEXIT_CRITICAL(&s_snapshot_mux);
+    if (busy)
+    {
+        // Изменения не теряются: следующий вызов сравнит с тем же базовым снимком
+        tx->stats.busy++;
+        return W_SNAPSHOT_BUSY;
+    }
+
+    const int64_t now = esp_timer_get_time();
+    const w_snapshot_policy_t *pol = &tx->policy;
+
+    bool keyframe = !tx->has_baseline || tx->force_keyframe ||
+                    (tx->keyframe_interval_ms &&
+                     now - tx->last_keyframe_us >= (int64_t)tx->keyframe_interval_ms * 1000);
+
+    size_t changed = 0;
+    if (!keyframe)
+    {
+        size_t significant = 0;
+        for (size_t i = 0; i < tx->record_count; i++)
+        {
+            const uint8_t *old_rec = tx->baseline + i * rs;
+            const uint8_t *new_rec = cur + i * rs;
+            if (memcmp(new_rec, old_rec, rs) == 0) continue;
+            changed++;
+            if (!pol->significant || pol->significant(old_rec, new_rec)) significant++;
+        }
+        if (changed == 0)
+        {
+            tx->stats.unchanged++;
+            return W_SNAPSHOT_UNCHANGED;
+        }
+        // Только незначимые изменения - ждём heartbeat
+        if (significant == 0 &&
+            !(pol->heartbeat_ms && now - tx->last_send_us >= (int64_t)pol->heartbeat_ms * 1000))
+        {
+            tx->stats.deferred++;
+            return W_SNAPSHOT_DEFERRED;
+        }
+        // Разница не выгоднее полного снимка
+        if (changed * (1 + rs) >= full) keyframe = true;
+    }
+
+    // Ограничение частоты: изменения не теряются, уйдут следующим вызовом
+    if (pol->min_interval_ms && tx->last_send_us &&
+        now - tx->last_send_us < (int64_t)pol->min_interval_ms * 1000)
+    {
+        tx->stats.deferred++;
+        return W_SNAPSHOT_DEFERRED;
+    }
+
+    size_t payload  = keyframe ? full : changed * (1 + rs);
+    size_t msg_size = sizeof(w_header_sensors_t) + sizeof(w_snapshot_hdr_t) + payload;
+    w_header_sensors_t *msg = (w_header_sensors_t *)malloc(msg_size);
+    if (!msg)
+    {
+        logE("нет памяти для снимка");
+        return W_SNAPSHOT_ERROR;
+    }
+
+    msg->message_type     = W_MSG_TYPE_SENSORS_DELTA;
+    w_snapshot_hdr_t *hdr = (w_snapshot_hdr_t *)msg->data;
+    hdr->stream           = tx->stream;
+    hdr->flags            = keyframe ? W_SNAPSHOT_FLAG_KEYFRAME : 0;
+    hdr->seq              = tx->next_seq;
+    hdr->base_seq         = tx->baseline_seq;
+    hdr->record_size      = tx->record_size;
+    hdr->record_count     = tx->record_count;
+
+    if (keyframe)
+    {
+        hdr->entries = tx->record_count;
+        memcpy(hdr->data, cur, full);
+    }
+    else
+    {
+        uint8_t *p = hdr->data;
+        for (size_t i = 0; i < tx->record_count; i++)
+        {
+            if (memcmp(cur + i * rs, tx->baseline + i * rs, rs) == 0) continue;
+            *p++ = (uint8_t)i;
+            memcpy(p, cur + i * rs, rs);
+            p += rs;
+        }
+        hdr->entries = (uint8_t)changed;
+    }
+
+    // pending и in_flight выставляем до отправки: подтверждение может прийти сразу
+    memcpy(tx->pending, cur, full);
+    tx->pending_seq = tx->next_seq;
+    tx->in_flight   = true;
+
+    if (Rdt_SendBlock(tx->channel, (uint8_t *)msg, msg_size, tx) != 0)
+    {
+        free(msg);
+        tx->in_flight = false;
+        return W_SNAPSHOT_ERROR;
+    }
+
+    tx->next_seq++;
+    tx->last_send_us = now;
+    tx->stats.bytes_sent += msg_size;
+    tx->stats.bytes_full += sizeof(w_header_sensors_t) + sizeof(w_snapshot_hdr_t) + full;
+    if (keyframe)
+    {
+        tx->force_keyframe   = false;
+        tx->last_keyframe_us = now;
+        tx->stats.keyframes++;
+    }
+    else
+    {
+        tx->stats.diffs++;
+    }
+    return W_SNAPSHOT_OK;
+}
+
+void w_snapshot_tx_handle_keyframe_req(const uint8_t *data, size_t len)
+{
+    if (!data || len < 1) return;
+
+    for (int i = 0; i < W_SNAPSHOT_MAX_STREAMS; i++)
+    {
+        if (s_tx_list[i] && s_tx_list[i]->stream == data[0])
+        {
+            logI("запрошен ключевой кадр потока %d", data[0]);
+            s_tx_list[i]->force_keyframe = true;
+        }
+    }
+}
+
+void w_snapshot_peer_reset(void)
+{
+    portENTER_CRITICAL(&s_snapshot_mux);
+    for (int i = 0; i < W_SNAPSHOT_MAX_STREAMS; i++)
+    {
+        w_snapshot_tx_t *tx = s_tx_list[i];
+        if (!tx) continue;
+        tx->has_baseline   = false;
+        tx->force_keyframe = true;
+    }
+    s_peer_gen++;
+    portEXIT_CRITICAL(&s_snapshot_mux);
+}
+
+/* ----------------------------------------------------------------
+ * Приёмник
+ * ---------------------------------------------------------------- */
+
+int w_snapshot_rx_init(w_snapshot_rx_t *rx, uint8_t channel, uint8_t stream,
+                       size_t record_size, uint8_t record_count)
+{
+    if (!rx || record_size == 0 || record_size > UINT16_MAX || record_count == 0) return 1;
+
+    memset(rx, 0, sizeof(*rx));
+    rx->channel      = channel;
+    rx->stream       = stream;
+    rx->record_size  = (uint16_t)record_size;
+    rx->record_count = record_count;
+    rx->peer_gen     = s_peer_gen;
+    rx->snapshot     = (uint8_t *)calloc(record_count, record_size);
+    return rx->snapshot ? 0 : 1;
+}
+
+uint8_t w_snapshot_stream_get(const uint8_t *data, size_t len)
+{
+    if (!data || len < sizeof(w_snapshot_hdr_t)) return 0;
+    return ((const w_snapshot_hdr_t *)data)->stream;
+}
+
+int w_snapshot_rx_apply(w_snapshot_rx_t *rx, const uint8_t *data, size_t len)
+{
+    if (!rx || !rx->snapshot || !data || len < sizeof(w_snapshot_hdr_t)) return W_SNAPSHOT_ERROR;
+
+    const w_snapshot_hdr_t *hdr = (const w_snapshot_hdr_t *)data;
+    const size_t rs      = rx->record_size;
+    const size_t payload = len - sizeof(w_snapshot_hdr_t);
+
+    if (hdr->stream != rx->stream || hdr->record_size != rx->record_size ||
+        hdr->record_count != rx->record_count)
+    {
+        logE("снимок не соответствует потоку %d", rx->stream);
+        return W_SNAPSHOT_ERROR;
+    }
+
+    uint32_t gen = s_peer_gen;
+    if (rx->peer_gen != gen)
+    {
+        rx->peer_gen = gen;
+        rx->valid    = false;
+    }
+
+    if (hdr->flags & W_SNAPSHOT_FLAG_KEYFRAME)
+    {
+        if (payload < rs * rx->record_count) return W_SNAPSHOT_ERROR;
+        memcpy(rx->snapshot, hdr->data, rs * rx->record_count);
+        rx->seq   = hdr->seq;
+        rx->valid = true;
+        return W_SNAPSHOT_OK;
+    }
+
+    if (!rx->valid || hdr->base_seq != rx->seq)
+    {
+        // Разница построена не к нашему снимку (например, предыдущий блок отброшен при переполнении очереди)
+        rx->gaps++;
+        w_snapshot_send_keyframe_req(rx->channel, rx->stream);
+        return W_SNAPSHOT_NEED_KEYFRAME;
+    }
+
+    if (payload < (size_t)hdr->entries * (1 + rs)) return W_SNAPSHOT_ERROR;
+
+    const uint8_t *p = hdr->data;
+    for (uint8_t e = 0; e < hdr->entries; e++)
+    {
+        uint8_t idx = *p++;
+        if (idx < rx->record_count)
+        {
+            memcpy(rx->snapshot + idx * rs, p, rs);
+        }
+        p += rs;
+    }
+    rx->seq = hdr->seq;
+    return W_SNAPSHOT_OK;
+}
@@ -0,0 +1,266 @@
+/**
+ * @file w_tsc.c
+ * @brief Потоковое сжатие временных рядов сенсоров (в духе Gorilla)
+ *
+ * @author Pavel
+ * @date 2025-02-24
+ */
+
+#include "w_tsc.h"
+#include <string.h>
+
+/**
+ * @brief Запись битового потока (старший бит байта - первый)
+ */
+typedef struct
+{
+    uint8_t *buf;
+    size_t   cap;       ///< Размер буфера, байт
+    size_t   pos;       ///< Позиция, бит
+    bool     overflow;  ///< Буфер переполнен
+} w_bitwriter_t;
+
+/* ----------------------------------------------------------------
+ * Битовый поток
+ * ---------------------------------------------------------------- */
+
+static void w_bits_put(w_bitwriter_t *bw, uint32_t value, uint8_t nbits)
+{
+    if (bw->pos + nbits > bw->cap * 8)
+    {
+        bw->overflow = true;
+        return;
+    }
+    while (nbits--)
+    {
+        size_t byte = bw->pos >> 3;
+        uint8_t mask = (uint8_t)(0x80 >> (bw->pos & 7));
+        if ((value >> nbits) & 1)
+            bw->buf[byte] |= mask;
+        else
+            bw->buf[byte] &= (uint8_t)~mask;
+        bw->pos++;
+    }
+}
+
+static uint32_t w_bits_get(w_bitreader_t *br, uint8_t nbits)
+{
+    if (br->pos + nbits > br->len * 8)
+    {
+        br->error = true;
+        return 0;
+    }
+    uint32_t v = 0;
+    while (nbits--)
+    {
+        v = (v << 1) | ((br->buf[br->pos >> 3] >> (7 - (br->pos & 7))) & 1);
+        br->pos++;
+    }
+    return v;
+}
+
+// Количество единиц префикса до нуля (не более max)
+static uint8_t w_bits_prefix(w_bitreader_t *br, uint8_t max)
+{
+    uint8_t n = 0;
+    while (n < max && w_bits_get(br, 1)) n++;
+    return n;
+}
+
+static inline uint32_t w_zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t w_unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// Знаковое значение из младших nbits бит
+static inline int32_t w_sign_extend(uint32_t v, uint8_t nbits)
+{
+    uint32_t m = 1u << (nbits - 1);
+    return (int32_t)((v ^ m) - m);
+}
+
+/* ----------------------------------------------------------------
+ * Поля отсчёта
+ * ---------------------------------------------------------------- */
+
+static void w_tsc_put_dod(w_bitwriter_t *bw, int32_t dod)
+{
+    if (dod == 0)
+    {
+        w_bits_put(bw, 0x0, 1);
+    }
+    else if (dod >= -64 && dod <= 63)
+    {
+        w_bits_put(bw, 0x2, 2);
+        w_bits_put(bw, (uint32_t)dod & 0x7F, 7);
+    }
+    else if (dod >= -256 && dod <= 255)
+    {
+        w_bits_put(bw, 0x6, 3);
+        w_bits_put(bw, (uint32_t)dod & 0x1FF, 9);
+    }
+    else if (dod >= -2048 && dod <= 2047)
+    {
+        w_bits_put(bw, 0xE, 4);
+        w_bits_put(bw, (uint32_t)dod & 0xFFF, 12);
+    }
+    else
+    {
+        w_bits_put(bw, 0xF, 4);
+        w_bits_put(bw, (uint32_t)dod, 32);
+    }
+}
+
+static int32_t w_tsc_get_dod(w_bitreader_t *br)
+{
+    switch (w_bits_prefix(br, 4))
+    {
+    case 0:  return 0;
+    case 1:  return w_sign_extend(w_bits_get(br, 7), 7);
+    case 2:  return w_sign_extend(w_bits_get(br, 9), 9);
+    case 3:  return w_sign_extend(w_bits_get(br, 12), 12);
+    default: return (int32_t)w_bits_get(br, 32);
+    }
+}
+
+static void w_tsc_put_value(w_bitwriter_t *bw, int32_t delta)
+{
+    uint32_t zz = w_zigzag(delta);
+    if (zz == 0)
+    {
+        w_bits_put(bw, 0x0, 1);
+    }
+    else if (zz < 16)
+    {
+        w_bits_put(bw, 0x2, 2);
+        w_bits_put(bw, zz, 4);
+    }
+    else if (zz < 256)
+    {
+        w_bits_put(bw, 0x6, 3);
+        w_bits_put(bw, zz, 8);
+    }
+    else
+    {
+        w_bits_put(bw, 0x7, 3);
+        w_bits_put(bw, zz, 17);
+    }
+}
+
+static int32_t w_tsc_get_value(w_bitreader_t *br)
+{
+    switch (w_bits_prefix(br, 3))
+    {
+    case 0:  return 0;
+    case 1:  return w_unzigzag(w_bits_get(br, 4));
+    case 2:  return w_unzigzag(w_bits_get(br, 8));
+    default: return w_unzigzag(w_bits_get(br, 17));
+    }
+}
+
+/* ----------------------------------------------------------------
+ * Кодер
+ * ---------------------------------------------------------------- */
+
+size_t w_tsc_encode(const w_history_sample_t *in, size_t count, uint8_t *out, size_t out_cap)
+{
+    if (!in || !out || count == 0 || count > UINT16_MAX) return 0;
+
+    w_bitwriter_t bw = { .buf = out, .cap = out_cap, .pos = 0, .overflow = false };
+    uint8_t done[256 / 8] = {0};    // Серии, уже записанные в поток
+
+    for (size_t first = 0; first < count && !bw.overflow; first++)
+    {
+        uint8_t series = in[first].series;
+        if (done[series >> 3] & (1 << (series & 7))) continue;
+        done[series >> 3] |= (uint8_t)(1 << (series & 7));
+
+        uint16_t n = 0;
+        for (size_t i = first; i < count; i++)
+        {
+            if (in[i].series == series) n++;
+        }
+        w_bits_put(&bw, series, 8);
+        w_bits_put(&bw, n, 16);
+
+        w_tsc_series_t st = {0};
+        bool head = true;
+        for (size_t i = first; i < count && !bw.overflow; i++)
+        {
+            if (in[i].series != series) continue;
+
+            if (head)
+            {
+                w_bits_put(&bw, in[i].ts, 32);
+                w_bits_put(&bw, (uint16_t)in[i].value, 16);
+                head = false;
+            }
+            else
+            {
+                int32_t delta = (int32_t)(in[i].ts - st.ts);
+                w_tsc_put_dod(&bw, delta - st.delta);
+                w_tsc_put_value(&bw, (int32_t)in[i].value - st.value);
+                st.delta = delta;
+            }
+            st.ts    = in[i].ts;
+            st.value = in[i].value;
+        }
+    }
+
+    return bw.overflow ? 0 : (bw.pos + 7) / 8;
+}
+
+/* ----------------------------------------------------------------
+ * Декодер
+ * ---------------------------------------------------------------- */
+
+void w_tsc_decoder_init(w_tsc_decoder_t *dec, const uint8_t *data, size_t len, size_t count)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->br.buf = data;
+    dec->br.len = data ? len : 0;
+    dec->left   = count;
+}
+
+bool w_tsc_decoder_next(w_tsc_decoder_t *dec, w_history_sample_t *out)
+{
+    if (dec->left == 0 || dec->br.error) return false;
+
+    if (dec->group_left == 0)
+    {
+        dec->series     = (uint8_t)w_bits_get(&dec->br, 8);
+        dec->group_left = (uint16_t)w_bits_get(&dec->br, 16);
+        dec->group_pos  = 0;
+        memset(&dec->st, 0, sizeof(dec->st));
+        if (dec->group_left == 0 || dec->group_left > dec->left) dec->br.error = true;
+        if (dec->br.error) return false;
+    }
+
+    if (dec->group_pos == 0)
+    {
+        dec->st.ts    = w_bits_get(&dec->br, 32);
+        dec->st.value = (int16_t)w_bits_get(&dec->br, 16);
+    }
+    else
+    {
+        dec->st.delta += w_tsc_get_dod(&dec->br);
+        dec->st.ts    += (uint32_t)dec->st.delta;
+        dec->st.value  = (int16_t)(dec->st.value + w_tsc_get_value(&dec->br));
+    }
+    if (dec->br.error) return false;
+
+    out->ts       = dec->st.ts;
+    out->series   = dec->series;
+    out->reserved = 0;
+    out->value    = dec->st.value;
+
+    dec->group_pos++;
+    dec->group_left--;
+    dec->left--;
+    return true;
+}
@@ -0,0 +1,396 @@
+/**
+ * @file w_udp.c
+ * @brief Транспорт кадров RDT по UDP для хоста (recvmmsg/sendmmsg, UDP GSO)
+ *
+ * @author Pavel
+ * @date 2025-03-17
+ */
+
+#define _GNU_SOURCE    // recvmmsg, sendmmsg
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+
+#include "w_udp.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#define TAG "w_udp"
+#include "log.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT             103     ///< linux/udp.h, ядро 4.18+
+#endif
+
+#define W_UDP_HDR_LEN           6       ///< MAC отправителя
+#define W_UDP_DGRAM_MAX         (W_UDP_HDR_LEN + RDT_FRAME_MAX_LEN)
+
+/**
+ * @brief Узел: MAC и адрес UDP
+ */
+typedef struct
+{
+    bool               used;
+    uint8_t            mac[6];
+    struct sockaddr_in addr;
+} w_udp_node_t;
+
+/**
+ * @brief Кадр пачки передачи (заголовок и кадр подряд - одна iovec на сегмент GSO)
+ */
+typedef struct
+{
+    uint8_t  buf[W_UDP_DGRAM_MAX];
+    uint16_t len;
+    int16_t  node;
+} w_udp_slot_t;
+
+static int               s_fd = -1;
+static uint8_t           s_self_mac[6];
+static bool              s_gso = false;
+static bool              s_learn = false;
+static w_udp_input_fn_t  s_input = NULL;     ///< Получатель кадров (NULL - Rdt_TransportInput)
+static SemaphoreHandle_t s_lock = NULL;
+static w_udp_node_t      s_nodes[W_UDP_MAX_NODES];
+static w_udp_stats_t     s_stats = {0};
+
+// Буферы выделены один раз: ни приём, ни передача не выделяют память на кадр
+static w_udp_slot_t       s_tx[W_UDP_BATCH];
+static size_t             s_tx_count = 0;
+static uint8_t            s_rx_buf[W_UDP_BATCH][W_UDP_DGRAM_MAX];
+static struct iovec       s_rx_iov[W_UDP_BATCH];
+static struct sockaddr_in s_rx_addr[W_UDP_BATCH];
+static struct mmsghdr     s_rx_msgs[W_UDP_BATCH];
+
+static int  w_udp_send(void *ctx, const uint8_t *dst_mac, const uint8_t *frame, size_t len);
+static void w_udp_flush(void *ctx);
+
+static const rdt_transport_t s_transport = {
+    .send     = w_udp_send,
+    .add_peer = NULL,
+    .flush    = w_udp_flush,
+    .ctx      = NULL,
+};
+
+/* ----------------------------------------------------------------
+ * Локальные функции
+ * ---------------------------------------------------------------- */
+
+static int w_udp_node_find(const uint8_t *mac)
+{
+    for (int i = 0; i < W_UDP_MAX_NODES; i++)
+    {
+        if (s_nodes[i].used && memcmp(s_nodes[i].mac, mac, 6) == 0) return i;
+    }
+    return -1;
+}
+
+static bool w_udp_addr_equal(const struct sockaddr_in *a, const struct sockaddr_in *b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+/**
+ * @brief Проверить отправителя датаграммы (под s_lock)
+ *
+ * Адрес узла не меняется датаграммами: MAC в датаграмме не проверяется, поэтому
+ * иначе любой хост перехватил бы трафик узла, назвавшись его MAC. Неизвестный MAC
+ * запоминается, только если включено обучение (w_udp_learn_enable).
+ * @return true - датаграмма от известного узла с его адреса
+ */
+static bool w_udp_node_accept(const uint8_t *mac, const struct sockaddr_in *addr)
+{
+    int idx = w_udp_node_find(mac);
+    if (idx >= 0) return w_udp_addr_equal(&s_nodes[idx].addr, addr);
+    if (!s_learn) return false;
+
+    for (idx = 0; idx < W_UDP_MAX_NODES && s_nodes[idx].used; idx++) {}
+    if (idx == W_UDP_MAX_NODES) return false;
+    s_nodes[idx].used = true;
+    memcpy(s_nodes[idx].mac, mac, 6);
+    s_nodes[idx].addr = *addr;
+    return true;
+}
+
+// Вызывается под s_lock
+static int w_udp_node_set(const uint8_t *mac, const struct sockaddr_in *addr)
+{
+    int idx = w_udp_node_find(mac);
+    if (idx < 0)
+    {
+        for (idx = 0; idx < W_UDP_MAX_NODES && s_nodes[idx].used; idx++) {}
+        if (idx == W_UDP_MAX_NODES) return -1;
+        s_nodes[idx].used = true;
+        memcpy(s_nodes[idx].mac, mac, 6);
+    }
+    s_nodes[idx].addr = *addr;
+    return idx;
+}
+
+// Вызывается под s_lock
+static void w_udp_flush_locked(void)
+{
+    struct mmsghdr msgs[W_UDP_BATCH];
+    struct iovec   iov[W_UDP_BATCH];
+    uint8_t        segs[W_UDP_BATCH];
+    union
+    {
+        char           buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } ctrl[W_UDP_BATCH];
+    size_t nmsg = 0;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (size_t i = 0; i < s_tx_count; )
+    {
+        const w_udp_slot_t *first = &s_tx[i];
+
+        // Подряд идущие кадры одного размера одному узлу - одна датаграмма GSO
+        size_t seg = 1;
+        while (s_gso && i + seg < s_tx_count && seg < W_UDP_GSO_SEGMENTS &&
+               s_tx[i + seg].node == first->node && s_tx[i + seg].len == first->len)
+        {
+            seg++;
+        }
+        for (size_t k = 0; k < seg; k++)
+        {
+            iov[i + k].iov_base = s_tx[i + k].buf;
+            iov[i + k].iov_len  = s_tx[i + k].len;
+        }
+
+        struct msghdr *h = &msgs[nmsg].msg_hdr;
+        h->msg_name    = &s_nodes[first->node].addr;
+        h->msg_namelen = sizeof(struct sockaddr_in);
+        h->msg_iov     = &iov[i];
+        h->msg_iovlen  = seg;
+        if (seg > 1)
+        {
+            h->msg_control    = ctrl[nmsg].buf;
+            h->msg_controllen = sizeof(ctrl[nmsg].buf);
+            struct cmsghdr *cm = CMSG_FIRSTHDR(h);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type  = UDP_SEGMENT;
+            cm->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+            uint16_t gso_size = first->len;
+            memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+        }
+        segs[nmsg++] = (uint8_t)seg;
+        i += seg;
+    }
+
+    size_t sent = 0;
+    while (sent < nmsg)
+    {
+        int r = sendmmsg(s_fd, &msgs[sent], nmsg - sent, MSG_DONTWAIT);
+        s_stats.tx_calls++;
+        if (r > 0)
+        {
+            for (int k = 0; k < r; k++) s_stats.tx_frames += segs[sent + k];
+            sent += (size_t)r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR) continue;
+        // Буфер сокета заполнен или ошибка датаграммы: кадр теряется, RDT повторит его сам
+        s_stats.tx_dropped += segs[sent];
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            for (size_t k = sent + 1; k < nmsg; k++) s_stats.tx_dropped += segs[k];
+            break;
+        }
+        sent++;
+    }
+    s_tx_count = 0;
+}
+
+static int w_udp_send(void *ctx, const uint8_t *dst_mac, const uint8_t *frame, size_t len)
+{
+    if (s_fd < 0 || len > RDT_FRAME_MAX_LEN) return 1;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int node = w_udp_node_find(dst_mac);
+    if (node < 0)
+    {
+        s_stats.tx_dropped++;
+        xSemaphoreGive(s_lock);
+        return 1;
+    }
+    w_udp_slot_t *slot = &s_tx[s_tx_count++];
+    memcpy(slot->buf, s_self_mac, W_UDP_HDR_LEN);
+    memcpy(slot->buf + W_UDP_HDR_LEN, frame, len);
+    slot->len  = (uint16_t)(W_UDP_HDR_LEN + len);
+    slot->node = (int16_t)node;
+    if (s_tx_count == W_UDP_BATCH)
+    {
+        w_udp_flush_locked();
+    }
+    xSemaphoreGive(s_lock);
+    return 0;
+}
+
+static void w_udp_flush(void *ctx)
+{
+    if (s_fd < 0) return;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_tx_count) w_udp_flush_locked();
+    xSemaphoreGive(s_lock);
+}
+
+/* ----------------------------------------------------------------
+ * Публичные функции
+ * ---------------------------------------------------------------- */
+
+int w_udp_init(const char *bind_addr, uint16_t port, const uint8_t *self_mac)
+{
+    if (s_fd >= 0) return 0;
+    if (!self_mac) return 1;
+
+    if (!s_lock)
+    {
+        s_lock = xSemaphoreCreateMutex();
+        if (!s_lock) return 1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        logE("socket: %d", errno);
+        return 1;
+    }
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons(port) };
+    a.sin_addr.s_addr = htonl(INADDR_ANY);
+    if ((bind_addr && inet_pton(AF_INET, bind_addr, &a.sin_addr) != 1) ||
+        bind(fd, (struct sockaddr *)&a, sizeof(a)) != 0)
+    {
+        logE("bind %s:%u: %d", bind_addr ? bind_addr : "*", port, errno);
+        close(fd);
+        return 1;
+    }
+
+    // Очереди сокета - под несколько пачек, пока задачи заняты
+    int sz = W_UDP_BATCH * W_UDP_DGRAM_MAX * 16;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+
+    // Проверка UDP_SEGMENT: ядро без GSO отклонит опцию; сама опция сокета не нужна -
+    // размер сегмента задаётся в каждой датаграмме
+    int gso = W_UDP_DGRAM_MAX;
+    s_gso = setsockopt(fd, SOL_UDP, UDP_SEGMENT, &gso, sizeof(gso)) == 0;
+    if (s_gso)
+    {
+        gso = 0;
+        setsockopt(fd, SOL_UDP, UDP_SEGMENT, &gso, sizeof(gso));
+    }
+    s_stats.gso = s_gso;
+
+    for (int i = 0; i < W_UDP_BATCH; i++)
+    {
+        s_rx_iov[i].iov_base = s_rx_buf[i];
+        s_rx_iov[i].iov_len  = sizeof(s_rx_buf[i]);
+        s_rx_msgs[i].msg_hdr.msg_iov    = &s_rx_iov[i];
+        s_rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        s_rx_msgs[i].msg_hdr.msg_name   = &s_rx_addr[i];
+    }
+    memcpy(s_self_mac, self_mac, 6);
+    s_fd = fd;
+    logI("UDP :%u, GSO %s", port, s_gso ? "да" : "нет");
+    return 0;
+}
+
+int w_udp_add_node(const uint8_t *mac, const char *ip, uint16_t port)
+{
+    if (!mac || !ip || !s_lock) return 1;
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons(port) };
+    if (inet_pton(AF_INET, ip, &a.sin_addr) != 1) return 1;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int idx = w_udp_node_set(mac, &a);
+    xSemaphoreGive(s_lock);
+    return idx < 0;
+}
+
+void w_udp_set_input(w_udp_input_fn_t input)
+{
+    s_input = input;
+}
+
+void w_udp_learn_enable(bool enable)
+{
+    s_learn = enable;
+}
+
+const rdt_transport_t *w_udp_transport(void)
+{
+    return &s_transport;
+}
+
+int w_udp_fd(void)
+{
+    return s_fd;
+}
+
+size_t w_udp_poll(void)
+{
+    if (s_fd < 0) return 0;
+
+    size_t total = 0;
+    for (;;)
+    {
+        // Не больше, чем поместится в очередь событий RDT: остальное ждёт в сокете,
+        // а не теряется при переполнении очереди
+        size_t vlen = s_input ? W_UDP_BATCH : Rdt_TransportRxSpace();
+        if (vlen == 0) break;
+        if (vlen > W_UDP_BATCH) vlen = W_UDP_BATCH;
+
+        for (size_t i = 0; i < vlen; i++)
+        {
+            s_rx_msgs[i].msg_hdr.msg_namelen = sizeof(s_rx_addr[i]);
+        }
+        int n = recvmmsg(s_fd, s_rx_msgs, (unsigned)vlen, MSG_DONTWAIT, NULL);
+        if (n <= 0) break;
+        s_stats.rx_calls++;
+
+        // Отправители проверяются раз на пачку, кадры уходят в RDT без блокировки
+        bool ok[W_UDP_BATCH];
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (int i = 0; i < n; i++)
+        {
+            ok[i] = s_rx_msgs[i].msg_len > W_UDP_HDR_LEN && s_rx_msgs[i].msg_hdr.msg_namelen == sizeof(s_rx_addr[i]) &&
+                    w_udp_node_accept(s_rx_buf[i], &s_rx_addr[i]);
+        }
+        xSemaphoreGive(s_lock);
+
+        for (int i = 0; i < n; i++)
+        {
+            if (!ok[i])
+            {
+                s_stats.rx_dropped++;
+                continue;
+            }
+            unsigned len = s_rx_msgs[i].msg_len;
+            if (s_input)
+                s_input(s_rx_buf[i], s_rx_buf[i] + W_UDP_HDR_LEN, len - W_UDP_HDR_LEN, 0);
+            else
+                Rdt_TransportInput(s_rx_buf[i], s_rx_buf[i] + W_UDP_HDR_LEN, len - W_UDP_HDR_LEN, 0);
+            s_stats.rx_frames++;
+        }
+        total += (size_t)n;
+        if ((size_t)n < vlen) break;
+    }
+    return total;
+}
+
+void w_udp_stats_get(w_udp_stats_t *out)
+{
+    if (out) *out = s_stats;
+}
+
+#endif // CONFIG_IDF_TARGET_LINUX